@@ -0,0 +1,128 @@
+#ifndef DYNAMIC_MATRIX_H
+#define DYNAMIC_MATRIX_H
+
+#include <type_traits>
+#include <vector>
+
+#include "matrix.h"
+
+/**
+ * Non-owning view of a row-major matrix whose shape is only known at run time:
+ * rows x cols elements, consecutive rows stride elements apart. T may be const.
+ */
+template<class T>
+struct MatrixView
+{
+    MatrixView()
+        : data(nullptr)
+        , rows(0)
+        , cols(0)
+        , stride(0)
+    {}
+
+    MatrixView(T *data, size_t rows, size_t cols, size_t stride)
+        : data(data)
+        , rows(rows)
+        , cols(cols)
+        , stride(stride)
+    {}
+
+    template<class U, typename std::enable_if<std::is_same<const U, T>::value, int>::type = 0>
+    MatrixView(const MatrixView<U> &other)
+        : data(other.data)
+        , rows(other.rows)
+        , cols(other.cols)
+        , stride(other.stride)
+    {}
+
+    T &operator()(size_t i, size_t j) const { return data[i * stride + j]; }
+
+    T *row(size_t i) const { return data + i * stride; }
+
+    /**
+     * Sub-matrix of blockRows x blockCols elements starting at (i, j).
+     */
+    MatrixView block(size_t i, size_t j, size_t blockRows, size_t blockCols) const
+    {
+        return MatrixView(data + i * stride + j, blockRows, blockCols, stride);
+    }
+
+    T *data;
+    size_t rows;
+    size_t cols;
+    size_t stride;
+};
+
+/**
+ * View of a compile-time Matrix. Note that Matrix<T, cols, rows> holds cols
+ * rows of rows elements each.
+ */
+template<class T, size_t cols, size_t rows>
+MatrixView<T> makeMatrixView(Matrix<T, cols, rows> &matrix)
+{
+    return MatrixView<T>(matrix.data[0], cols, rows, matrix.stride);
+}
+
+template<class T, size_t cols, size_t rows>
+MatrixView<const T> makeMatrixView(const Matrix<T, cols, rows> &matrix)
+{
+    return MatrixView<const T>(matrix.data[0], cols, rows, matrix.stride);
+}
+
+/**
+ * Heap-backed matrix with a run-time shape, laid out like Matrix: aligned to
+ * MATRIX_ALIGNMENT with rows padded to matrixStride<T>(cols).
+ */
+template<class T>
+class DynamicMatrix
+{
+public:
+    DynamicMatrix()
+        : DynamicMatrix(0, 0)
+    {}
+
+    DynamicMatrix(size_t rows, size_t cols, int sequence = 0)
+        : sequence(sequence)
+        , timestamp(0)
+    {
+        resize(rows, cols);
+    }
+
+    /**
+     * Changes the shape; the contents are zeroed.
+     */
+    void resize(size_t rows, size_t cols)
+    {
+        _rows = rows;
+        _cols = cols;
+        _stride = matrixStride<T>(cols);
+        _data.assign(_rows * _stride, T());
+    }
+
+    size_t rows() const { return _rows; }
+    size_t cols() const { return _cols; }
+    size_t stride() const { return _stride; }
+
+    T *data() { return _data.data(); }
+    const T *data() const { return _data.data(); }
+
+    T &operator()(size_t i, size_t j) { return _data[i * _stride + j]; }
+    const T &operator()(size_t i, size_t j) const { return _data[i * _stride + j]; }
+
+    MatrixView<T> view() { return MatrixView<T>(_data.data(), _rows, _cols, _stride); }
+    MatrixView<const T> view() const
+    {
+        return MatrixView<const T>(_data.data(), _rows, _cols, _stride);
+    }
+
+    int sequence;
+    long long timestamp;
+
+private:
+    size_t _rows;
+    size_t _cols;
+    size_t _stride;
+    std::vector<T, AlignedAllocator<T, matrixAlignment<T>()>> _data;
+};
+
+#endif // DYNAMIC_MATRIX_H
@@ -0,0 +1,346 @@
+#ifndef DYNAMIC_MATRIX_MULTIPLIER_H
+#define DYNAMIC_MATRIX_MULTIPLIER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "dynamic_matrix.h"
+#include "matrix_epilogue.h"
+#include "task_runtime.h"
+
+/**
+ * Constant right-hand operand B prepacked by a multiplier (see
+ * DynamicMatrixMultiplier::prepack()), opaque to callers. It owns a copy of
+ * B, which any multiplier can use, and at most one backend layout of it
+ * (the backend's packed panels), which multipliers that understand it use
+ * instead of packing B on every product. Immutable once prepack() returns,
+ * so one handle may serve concurrent callers.
+ */
+template<class T>
+class PackedMatrix
+{
+public:
+    explicit PackedMatrix(const MatrixView<const T> &B)
+        : _plain(B.rows, B.cols)
+        , _id(nextId())
+    {
+        for (size_t i = 0; i < B.rows; i++) {
+            std::copy(B.row(i), B.row(i) + B.cols, &_plain(i, 0));
+        }
+    }
+
+    size_t rows() const { return _plain.rows(); }
+    size_t cols() const { return _plain.cols(); }
+
+    /**
+     * B as given to prepack().
+     */
+    const DynamicMatrix<T> &plain() const { return _plain; }
+
+    /**
+     * Unique for the life of the process, unlike the address of plain(), for
+     * backends that cache their own packing keyed by operand.
+     */
+    uint64_t id() const { return _id; }
+
+    /**
+     * The backend layout if it is a Layout, nullptr otherwise.
+     */
+    template<class Layout>
+    const Layout *layout() const
+    {
+        return _layoutType == layoutType<Layout>() ? static_cast<const Layout *>(_layout.get())
+                                                   : nullptr;
+    }
+
+    template<class Layout>
+    void setLayout(std::shared_ptr<const Layout> layout)
+    {
+        _layoutType = layout ? layoutType<Layout>() : nullptr;
+        _layout = std::move(layout);
+    }
+
+    /**
+     * Takes over the backend layout of other, a prepacked copy of the same B.
+     */
+    void shareLayout(const PackedMatrix &other)
+    {
+        _layoutType = other._layoutType;
+        _layout = other._layout;
+    }
+
+private:
+    template<class Layout>
+    static const void *layoutType()
+    {
+        static const char type = 0;
+        return &type;
+    }
+
+    static uint64_t nextId()
+    {
+        static std::atomic<uint64_t> counter{0};
+        return ++counter;
+    }
+
+    DynamicMatrix<T> _plain;
+    uint64_t _id;
+    const void *_layoutType = nullptr;
+    std::shared_ptr<const void> _layout;
+};
+
+/**
+ * Multiplier for shapes only known at run time: C (m x n) = A (m x k) * B (k x n).
+ * Views may have any stride not smaller than their row length; C must not
+ * alias A or B. Backends implement compute(), which only sees non-empty,
+ * consistent shapes.
+ */
+template<class T>
+class DynamicMatrixMultiplier
+{
+public:
+    /**
+     * Returns false, leaving C untouched, when the shapes do not match.
+     */
+    bool multiply(const MatrixView<const T> &A, const MatrixView<const T> &B, const MatrixView<T> &C)
+    {
+        if (!shapesMatch(A, B, C)) {
+            return false;
+        }
+        if (C.rows == 0 || C.cols == 0) {
+            return true;
+        }
+        if (A.cols == 0) {
+            computeEmpty(C);
+            return true;
+        }
+        compute(A, B, C);
+        return true;
+    }
+
+    /**
+     * C = epilogue(A * B), see GemmEpilogue. Backends that fuse the epilogue
+     * into their output write override computeFused(); the others make one
+     * pass over C after the product.
+     */
+    bool multiply(const MatrixView<const T> &A,
+                  const MatrixView<const T> &B,
+                  const MatrixView<T> &C,
+                  const GemmEpilogue<T> &epilogue)
+    {
+        if (epilogue.empty()) {
+            return multiply(A, B, C);
+        }
+        if (!shapesMatch(A, B, C)) {
+            return false;
+        }
+        if (C.rows == 0 || C.cols == 0) {
+            return true;
+        }
+        if (A.cols == 0) {
+            computeEmpty(C);
+            epilogue.apply(C.data, C.stride, 0, 0, C.rows, C.cols);
+            return true;
+        }
+        computeFused(A, B, C, epilogue);
+        return true;
+    }
+
+    bool multiply(const DynamicMatrix<T> &A, const DynamicMatrix<T> &B, DynamicMatrix<T> &C)
+    {
+        return multiply(A, B, C, GemmEpilogue<T>());
+    }
+
+    bool multiply(const DynamicMatrix<T> &A,
+                  const DynamicMatrix<T> &B,
+                  DynamicMatrix<T> &C,
+                  const GemmEpilogue<T> &epilogue)
+    {
+        if (!multiply(A.view(), B.view(), C.view(), epilogue)) {
+            return false;
+        }
+        C.sequence = A.sequence;
+        C.timestamp = A.timestamp;
+        return true;
+    }
+
+    /**
+     * Prepacks B, a right-hand operand reused across products (weights), in
+     * the layout this backend multiplies fastest; see PackedMatrix. Backends
+     * without a layout of their own keep B as is.
+     */
+    std::shared_ptr<const PackedMatrix<T>> prepack(const MatrixView<const T> &B)
+    {
+        std::shared_ptr<PackedMatrix<T>> packed = std::make_shared<PackedMatrix<T>>(B);
+        packOperand(*packed);
+        return packed;
+    }
+
+    std::shared_ptr<const PackedMatrix<T>> prepack(const DynamicMatrix<T> &B)
+    {
+        return prepack(B.view());
+    }
+
+    /**
+     * C = epilogue(A * B) for a prepacked B. Any multiplier takes any B:
+     * one that cannot use B's layout (another backend's, or its blocking
+     * changed since) multiplies B's copy the usual way. Returns false,
+     * leaving C untouched, when the shapes do not match.
+     */
+    bool multiply(const MatrixView<const T> &A,
+                  const PackedMatrix<T> &B,
+                  const MatrixView<T> &C,
+                  const GemmEpilogue<T> &epilogue = GemmEpilogue<T>())
+    {
+        if (A.cols != B.rows() || C.rows != A.rows || C.cols != B.cols()) {
+            return false;
+        }
+        if (C.rows == 0 || C.cols == 0) {
+            return true;
+        }
+        if (A.cols == 0) {
+            computeEmpty(C);
+            if (!epilogue.empty()) {
+                epilogue.apply(C.data, C.stride, 0, 0, C.rows, C.cols);
+            }
+            return true;
+        }
+        computePrepacked(A, B, C, epilogue);
+        return true;
+    }
+
+    bool multiply(const DynamicMatrix<T> &A,
+                  const PackedMatrix<T> &B,
+                  DynamicMatrix<T> &C,
+                  const GemmEpilogue<T> &epilogue = GemmEpilogue<T>())
+    {
+        if (!multiply(A.view(), B, C.view(), epilogue)) {
+            return false;
+        }
+        C.sequence = A.sequence;
+        C.timestamp = A.timestamp;
+        return true;
+    }
+
+    /**
+     * C[i] = A[i] * B[i] for n independent products. Returns false, leaving
+     * every C untouched, when one of the shapes does not match. Backends that
+     * can run products concurrently override computeBatch() to spread the
+     * batch across cores; the default multiplies them one after the other.
+     */
+    bool multiplyBatch(const MatrixView<const T> *A,
+                       const MatrixView<const T> *B,
+                       const MatrixView<T> *C,
+                       size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            if (!shapesMatch(A[i], B[i], C[i])) {
+                return false;
+            }
+        }
+        computeBatch(A, B, C, n);
+        return true;
+    }
+
+    static bool shapesMatch(const MatrixView<const T> &A,
+                            const MatrixView<const T> &B,
+                            const MatrixView<T> &C)
+    {
+        return A.cols == B.rows && C.rows == A.rows && C.cols == B.cols;
+    }
+
+    /**
+     * Tuning knobs, used by MatrixAutotuner. setNumThreads caps the threads
+     * one product may use, setBlocking sets the cache blocking (see
+     * GemmBlocking) of packed backends. Both return false when the backend
+     * has no such knob. setNumThreads may be called while other threads
+     * multiply (ThreadBudget::rebalance()), their next product takes the new
+     * count; setBlocking must be called before the multiplier is shared.
+     */
+    virtual bool setNumThreads(size_t /*threads*/) { return false; }
+    virtual bool setBlocking(size_t /*mc*/, size_t /*kc*/, size_t /*nc*/) { return false; }
+
+    virtual ~DynamicMatrixMultiplier() {}
+
+protected:
+    virtual void compute(const MatrixView<const T> &A,
+                         const MatrixView<const T> &B,
+                         const MatrixView<T> &C) = 0;
+
+    /**
+     * compute() followed by a non-empty epilogue.
+     */
+    virtual void computeFused(const MatrixView<const T> &A,
+                              const MatrixView<const T> &B,
+                              const MatrixView<T> &C,
+                              const GemmEpilogue<T> &epilogue)
+    {
+        compute(A, B, C);
+        epilogue.apply(C.data, C.stride, 0, 0, C.rows, C.cols);
+    }
+
+    /**
+     * The products of multiplyBatch(), shapes checked.
+     */
+    virtual void computeBatch(const MatrixView<const T> *A,
+                              const MatrixView<const T> *B,
+                              const MatrixView<T> *C,
+                              size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            multiply(A[i], B[i], C[i]);
+        }
+    }
+
+    /**
+     * computeBatch() for backends whose products may run concurrently on one
+     * instance: the batch is spread over the shared TaskRuntime.
+     */
+    void computeBatchOnRuntime(const MatrixView<const T> *A,
+                               const MatrixView<const T> *B,
+                               const MatrixView<T> *C,
+                               size_t n)
+    {
+        TaskRuntime::instance().parallelFor(n, 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                multiply(A[i], B[i], C[i]);
+            }
+        });
+    }
+
+    /**
+     * Adds the backend's layout to a freshly copied B; the default adds none.
+     */
+    virtual void packOperand(PackedMatrix<T> & /*B*/) {}
+
+    /**
+     * Product with a prepacked B (possibly empty epilogue); the default
+     * multiplies B's copy.
+     */
+    virtual void computePrepacked(const MatrixView<const T> &A,
+                                  const PackedMatrix<T> &B,
+                                  const MatrixView<T> &C,
+                                  const GemmEpilogue<T> &epilogue)
+    {
+        if (epilogue.empty()) {
+            compute(A, B.plain().view(), C);
+        } else {
+            computeFused(A, B.plain().view(), C, epilogue);
+        }
+    }
+
+    /**
+     * Product with an empty inner dimension: zero, unless the backend's
+     * element type represents zero otherwise (quantized zero points).
+     */
+    virtual void computeEmpty(const MatrixView<T> &C)
+    {
+        for (size_t i = 0; i < C.rows; i++) {
+            std::fill(C.row(i), C.row(i) + C.cols, T());
+        }
+    }
+};
+
+#endif // DYNAMIC_MATRIX_MULTIPLIER_H
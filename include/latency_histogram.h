@@ -0,0 +1,167 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+/**
+ * Nanoseconds on the steady clock, the time base of matrix timestamps. Unlike
+ * system_clock it never goes backwards under NTP adjustments.
+ */
+inline long long steadyClockNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/**
+ * Percentiles of a LatencyHistogram, in nanoseconds.
+ */
+struct LatencySummary
+{
+    size_t count = 0;
+    double mean = 0;
+    long long p50 = 0;
+    long long p90 = 0;
+    long long p99 = 0;
+    long long p999 = 0;
+    long long max = 0;
+
+    /**
+     * "n=1000 mean=12.3us p50=11.9us p90=... max=..." in microseconds.
+     */
+    std::string describe() const
+    {
+        char text[160];
+        std::snprintf(text,
+                      sizeof(text),
+                      "n=%zu mean=%.1fus p50=%.1fus p90=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus",
+                      count,
+                      mean / 1e3,
+                      p50 / 1e3,
+                      p90 / 1e3,
+                      p99 / 1e3,
+                      p999 / 1e3,
+                      max / 1e3);
+        return text;
+    }
+};
+
+/**
+ * HDR-style latency histogram: values below 2^SUB_BUCKET_BITS ns get a bucket
+ * each, above that every power of two is split into 2^SUB_BUCKET_BITS linear
+ * buckets, so a reported percentile is within 1% of the recorded value.
+ * record() is wait-free (relaxed atomic increments) and may be called from any
+ * number of threads; values beyond 2^MAX_VALUE_BITS ns land in the last bucket.
+ */
+class LatencyHistogram
+{
+public:
+    static constexpr int SUB_BUCKET_BITS = 7;
+    static constexpr int MAX_VALUE_BITS = 40;
+    static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BUCKET_BITS;
+    static constexpr size_t BUCKETS = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    LatencyHistogram() { reset(); }
+
+    void record(long long nanos)
+    {
+        uint64_t value = nanos > 0 ? static_cast<uint64_t>(nanos) : 0;
+        _buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+        _count.fetch_add(1, std::memory_order_relaxed);
+        _sum.fetch_add(value, std::memory_order_relaxed);
+        uint64_t max = _max.load(std::memory_order_relaxed);
+        while (value > max && !_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    size_t count() const { return _count.load(std::memory_order_relaxed); }
+
+    /**
+     * Smallest recorded value v such that percent % of the values are <= v,
+     * as the upper bound of its bucket, capped at the exact maximum.
+     */
+    long long percentile(double percent) const
+    {
+        size_t total = count();
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(percent / 100.0 * total + 0.5);
+        rank = std::min<uint64_t>(std::max<uint64_t>(rank, 1), total);
+        uint64_t seen = 0;
+        uint64_t max = _max.load(std::memory_order_relaxed);
+        for (size_t bucket = 0; bucket < BUCKETS; bucket++) {
+            seen += _buckets[bucket].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                return static_cast<long long>(std::min(highestValueOf(bucket), max));
+            }
+        }
+        return static_cast<long long>(max);
+    }
+
+    LatencySummary summarize() const
+    {
+        LatencySummary summary;
+        summary.count = count();
+        if (summary.count == 0) {
+            return summary;
+        }
+        summary.mean = double(_sum.load(std::memory_order_relaxed)) / summary.count;
+        summary.p50 = percentile(50);
+        summary.p90 = percentile(90);
+        summary.p99 = percentile(99);
+        summary.p999 = percentile(99.9);
+        summary.max = static_cast<long long>(_max.load(std::memory_order_relaxed));
+        return summary;
+    }
+
+    /**
+     * Not safe against concurrent record() calls.
+     */
+    void reset()
+    {
+        for (auto &bucket : _buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        _count.store(0);
+        _sum.store(0);
+        _max.store(0);
+    }
+
+private:
+    static size_t bucketOf(uint64_t value)
+    {
+        if (value < SUB_BUCKETS) {
+            return static_cast<size_t>(value);
+        }
+        int magnitude = 63 - __builtin_clzll(value);
+        if (magnitude >= MAX_VALUE_BITS) {
+            return BUCKETS - 1;
+        }
+        int shift = magnitude - SUB_BUCKET_BITS;
+        return (shift + 1) * SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS);
+    }
+
+    static uint64_t highestValueOf(size_t bucket)
+    {
+        if (bucket < SUB_BUCKETS) {
+            return bucket;
+        }
+        int shift = static_cast<int>(bucket / SUB_BUCKETS) - 1;
+        uint64_t subBucket = bucket % SUB_BUCKETS + SUB_BUCKETS;
+        return ((subBucket + 1) << shift) - 1;
+    }
+
+    std::atomic<uint64_t> _buckets[BUCKETS];
+    std::atomic<uint64_t> _count;
+    std::atomic<uint64_t> _sum;
+    std::atomic<uint64_t> _max;
+};
+
+#endif // LATENCY_HISTOGRAM_H
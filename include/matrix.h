@@ -3,20 +3,114 @@
 
 #include <chrono>
 #include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#ifndef MATRIX_ALIGNMENT
+#define MATRIX_ALIGNMENT 64
+#endif
+
+#ifndef MATRIX_ROW_PADDING
+#define MATRIX_ROW_PADDING 1
+#endif
+
+/**
+ * Byte alignment of matrix data: MATRIX_ALIGNMENT, or alignof(T) if larger.
+ */
+template<class T>
+constexpr size_t matrixAlignment()
+{
+    return MATRIX_ALIGNMENT < alignof(T) ? alignof(T) : MATRIX_ALIGNMENT;
+}
+
+/**
+ * Leading dimension (stride, in elements, between the starts of two rows) for
+ * rows of the given length.
+ *
+ * By default rows are padded to whole cache lines so every row starts aligned,
+ * and a pitch that is a multiple of 4 KiB gets one extra line so walking down a
+ * column does not keep landing in the same L1 sets.
+ */
+template<class T>
+constexpr size_t matrixStride(size_t rowLength)
+{
+    const size_t lineElements = matrixAlignment<T>() >= sizeof(T)
+                                    ? matrixAlignment<T>() / sizeof(T)
+                                    : 1;
+    const size_t padded = (rowLength + lineElements - 1) / lineElements * lineElements;
+    return !MATRIX_ROW_PADDING ? rowLength
+           : (padded * sizeof(T)) % 4096 == 0 ? padded + lineElements
+                                              : padded;
+}
+
+/**
+ * Storage policy of Matrix<T, cols, rows>: byte alignment of the data and its
+ * leading dimension. Specialise it for a row length to choose another leading
+ * dimension; backends only rely on stride.
+ */
+template<class T, size_t rows>
+struct MatrixStorage
+{
+    static constexpr size_t alignment = matrixAlignment<T>();
+    static constexpr size_t stride = matrixStride<T>(rows);
+};
+
+/**
+ * Minimal aligned allocator for scratch buffers (e.g. GEMM packing panels).
+ */
+template<class T, size_t alignment = MATRIX_ALIGNMENT>
+struct AlignedAllocator
+{
+    typedef T value_type;
+
+    template<class U>
+    struct rebind
+    {
+        typedef AlignedAllocator<U, alignment> other;
+    };
+
+    AlignedAllocator() {}
+
+    template<class U>
+    AlignedAllocator(const AlignedAllocator<U, alignment> &)
+    {}
+
+    T *allocate(size_t n)
+    {
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(alignment)));
+    }
+
+    void deallocate(T *pointer, size_t) { ::operator delete(pointer, std::align_val_t(alignment)); }
+
+    template<class U>
+    bool operator==(const AlignedAllocator<U, alignment> &) const
+    {
+        return true;
+    }
+
+    template<class U>
+    bool operator!=(const AlignedAllocator<U, alignment> &) const
+    {
+        return false;
+    }
+};
 
 template<class T, size_t cols, size_t rows>
 class Matrix
 {
 public:
+    static constexpr size_t stride = MatrixStorage<T, rows>::stride;
+
     Matrix()
         : sequence(0)
     {}
 
     Matrix(int sequence)
         : sequence(sequence)
-        , timestamp(std::chrono::duration_cast<std::chrono::microseconds>(
-                        std::chrono::system_clock::now().time_since_epoch())
+        , timestamp(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch())
                         .count())
+        , stageTimestamp(timestamp)
     {}
 
     void row(int row, T *rowData)
@@ -27,8 +121,11 @@ public:
     }
 
     int sequence;
+    // Steady clock nanoseconds: when the input was produced (copied through
+    // every product) and when the last pipeline stage handed the matrix on.
     long long timestamp;
-    T data[cols][rows];
+    long long stageTimestamp;
+    alignas(MatrixStorage<T, rows>::alignment) T data[cols][stride];
 };
 
 
@@ -0,0 +1,350 @@
+#ifndef MATRIX_ARENA_H
+#define MATRIX_ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Pages backing a MatrixArena:
+ * - default: the system's base pages.
+ * - transparent: huge-page aligned memory advised with MADV_HUGEPAGE, so the
+ *   kernel backs it with transparent huge pages when it can.
+ * - explicit: MAP_HUGETLB pages from the reserved pool (vm.nr_hugepages);
+ *   falls back to transparent when the pool cannot serve the mapping.
+ */
+enum PagePolicy { PAGES_DEFAULT = 0, PAGES_TRANSPARENT, PAGES_EXPLICIT };
+
+inline const char *pagePolicyName(PagePolicy pages)
+{
+    return pages == PAGES_TRANSPARENT ? "transparent" : pages == PAGES_EXPLICIT ? "explicit"
+                                                                                : "default";
+}
+
+inline bool parsePagePolicy(const std::string &name, PagePolicy &pages)
+{
+    for (PagePolicy candidate : {PAGES_DEFAULT, PAGES_TRANSPARENT, PAGES_EXPLICIT}) {
+        if (name == pagePolicyName(candidate)) {
+            pages = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Page faults of the whole process so far (getrusage), zero where it is not
+ * available.
+ */
+struct PageFaults
+{
+    long minor = 0;
+    long major = 0;
+
+    static PageFaults process()
+    {
+        PageFaults faults;
+#ifdef __linux__
+        rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0) {
+            faults.minor = usage.ru_minflt;
+            faults.major = usage.ru_majflt;
+        }
+#endif
+        return faults;
+    }
+
+    PageFaults operator-(const PageFaults &earlier) const
+    {
+        PageFaults faults;
+        faults.minor = minor - earlier.minor;
+        faults.major = major - earlier.major;
+        return faults;
+    }
+};
+
+/**
+ * Bump allocator for matrix storage, mapped in chunks of at least chunkBytes
+ * on the pages of its PagePolicy. Memory is only returned when the arena is
+ * destroyed, which suits the fixed slots of pools and input rings.
+ *
+ * Chunks are mapped but not touched: a page lands on the NUMA node of the
+ * thread that first writes it, so storage handed out lazily (see SlotPool)
+ * ends up next to the stage that uses it. With huge pages that decision is
+ * taken for a whole huge page at a time.
+ */
+class MatrixArena
+{
+public:
+    static constexpr size_t DEFAULT_CHUNK_BYTES = size_t(8) << 20;
+
+    explicit MatrixArena(PagePolicy pages = PAGES_DEFAULT,
+                         size_t chunkBytes = DEFAULT_CHUNK_BYTES)
+        : _pages(pages)
+        , _chunkBytes(chunkBytes)
+        , _used(0)
+        , _hugeFallbacks(0)
+    {}
+
+    ~MatrixArena()
+    {
+        for (const Chunk &chunk : _chunks) {
+#ifdef __linux__
+            munmap(chunk.data, chunk.bytes);
+#else
+            ::operator delete(chunk.data, std::align_val_t(basePageSize()));
+#endif
+        }
+    }
+
+    MatrixArena(const MatrixArena &) = delete;
+    MatrixArena &operator=(const MatrixArena &) = delete;
+
+    /**
+     * bytes of storage aligned to alignment (at most a base page). Throws
+     * std::bad_alloc, like operator new, when no memory can be mapped.
+     */
+    void *allocate(size_t bytes, size_t alignment)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        size_t offset = roundUp(_used, alignment);
+        if (_chunks.empty() || offset + bytes > _chunks.back().bytes) {
+            mapChunk(std::max(bytes, _chunkBytes));
+            offset = 0;
+        }
+        _used = offset + bytes;
+        return _chunks.back().data + offset;
+    }
+
+    /**
+     * count default-constructed objects in a row. They are never destroyed,
+     * hence the restriction to trivially destructible types such as Matrix.
+     */
+    template<class M>
+    M *create(size_t count = 1)
+    {
+        static_assert(std::is_trivially_destructible<M>::value,
+                      "arena objects are released without their destructor");
+        M *objects = static_cast<M *>(allocate(sizeof(M) * count, alignof(M)));
+        for (size_t i = 0; i < count; i++) {
+            new (objects + i) M();
+        }
+        return objects;
+    }
+
+    PagePolicy pages() const { return _pages; }
+
+    size_t mappedBytes() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        size_t bytes = 0;
+        for (const Chunk &chunk : _chunks) {
+            bytes += chunk.bytes;
+        }
+        return bytes;
+    }
+
+    size_t chunkCount() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _chunks.size();
+    }
+
+    /**
+     * Chunks that explicit pages could not be had for (mapped with
+     * transparent huge pages instead).
+     */
+    size_t hugeFallbacks() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _hugeFallbacks;
+    }
+
+    /**
+     * Bytes the kernel currently backs with huge pages in the mappings that
+     * hold the arena's chunks, from /proc/self/smaps (AnonHugePages, or the
+     * resident size for explicit pages); 0 where that file is not available.
+     */
+    size_t hugePageBytes() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::ifstream smaps("/proc/self/smaps");
+        std::string line;
+        size_t bytes = 0;
+        const Chunk *current = nullptr;
+        while (std::getline(smaps, line)) {
+            uintptr_t start, end;
+            char dash;
+            std::istringstream fields(line);
+            if (line.find(':') == std::string::npos || line.find('-') < line.find(':')) {
+                if (fields >> std::hex >> start >> dash >> end && dash == '-') {
+                    current = nullptr;
+                    for (const Chunk &chunk : _chunks) {
+                        uintptr_t data = reinterpret_cast<uintptr_t>(chunk.data);
+                        if (start <= data && data < end) {
+                            current = &chunk;
+                        }
+                    }
+                    continue;
+                }
+            }
+            std::string key;
+            size_t kilobytes;
+            if (current != nullptr && fields >> key >> kilobytes) {
+                if ((key == "AnonHugePages:" && !current->explicitPages) ||
+                    (key == "Rss:" && current->explicitPages)) {
+                    bytes += kilobytes * 1024;
+                }
+            }
+        }
+        return bytes;
+    }
+
+    /**
+     * "transparent pages, 6 MiB mapped in 1 chunk, 4 MiB on huge pages".
+     */
+    std::string describe() const
+    {
+        const size_t mapped = mappedBytes();
+        const size_t chunks = chunkCount();
+        std::ostringstream text;
+        text << pagePolicyName(_pages) << " pages, " << mebibytes(mapped) << " MiB mapped in "
+             << chunks << (chunks == 1 ? " chunk" : " chunks");
+        if (_pages != PAGES_DEFAULT) {
+            text << ", " << mebibytes(hugePageBytes()) << " MiB on huge pages";
+            const size_t fallbacks = hugeFallbacks();
+            if (fallbacks > 0) {
+                text << ", " << fallbacks << " without explicit pages";
+            }
+            if (!transparentHugePagesEnabled()) {
+                text << " (transparent huge pages disabled)";
+            }
+        }
+        return text.str();
+    }
+
+    static size_t hugePageSize()
+    {
+        std::ifstream meminfo("/proc/meminfo");
+        std::string key;
+        while (meminfo >> key) {
+            size_t kilobytes;
+            if (key == "Hugepagesize:" && meminfo >> kilobytes) {
+                return kilobytes * 1024;
+            }
+            meminfo.ignore(256, '\n');
+        }
+        return size_t(2) << 20;
+    }
+
+    /**
+     * False when the kernel's transparent huge page mode is "never".
+     */
+    static bool transparentHugePagesEnabled()
+    {
+        std::ifstream mode("/sys/kernel/mm/transparent_hugepage/enabled");
+        std::string modes;
+        return std::getline(mode, modes) && modes.find("[never]") == std::string::npos;
+    }
+
+private:
+    struct Chunk
+    {
+        char *data;
+        size_t bytes;
+        bool explicitPages;
+    };
+
+    static size_t roundUp(size_t value, size_t multiple)
+    {
+        return (value + multiple - 1) / multiple * multiple;
+    }
+
+    static double mebibytes(size_t bytes) { return double(bytes) / (1 << 20); }
+
+    static size_t basePageSize()
+    {
+#ifdef __linux__
+        return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#else
+        return 4096;
+#endif
+    }
+
+    void mapChunk(size_t bytes)
+    {
+#ifdef __linux__
+        const size_t huge = hugePageSize();
+        if (_pages == PAGES_EXPLICIT) {
+            const size_t length = roundUp(bytes, huge);
+            void *data = mmap(nullptr,
+                              length,
+                              PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                              -1,
+                              0);
+            if (data != MAP_FAILED) {
+                _chunks.push_back({static_cast<char *>(data), length, true});
+                return;
+            }
+            _hugeFallbacks++;
+        }
+        if (_pages == PAGES_DEFAULT) {
+            const size_t length = roundUp(bytes, basePageSize());
+            void *data = mmap(
+                nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (data == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            _chunks.push_back({static_cast<char *>(data), length, false});
+            return;
+        }
+        // Over-map by one huge page and trim, so the chunk starts on a huge
+        // page boundary and every whole huge page of it can be promoted.
+        const size_t length = roundUp(bytes, huge);
+        void *mapped = mmap(
+            nullptr, length + huge, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapped == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        char *start = static_cast<char *>(mapped);
+        char *data = reinterpret_cast<char *>(roundUp(reinterpret_cast<uintptr_t>(start), huge));
+        if (data > start) {
+            munmap(start, data - start);
+        }
+        if (start + length + huge > data + length) {
+            munmap(data + length, start + length + huge - (data + length));
+        }
+        madvise(data, length, MADV_HUGEPAGE);
+        _chunks.push_back({data, length, false});
+#else
+        const size_t length = roundUp(bytes, basePageSize());
+        _chunks.push_back({static_cast<char *>(
+                               ::operator new(length, std::align_val_t(basePageSize()))),
+                           length,
+                           false});
+#endif
+    }
+
+    PagePolicy _pages;
+    size_t _chunkBytes;
+    size_t _used;
+    size_t _hugeFallbacks;
+    std::vector<Chunk> _chunks;
+    mutable std::mutex _mutex;
+};
+
+#endif // MATRIX_ARENA_H
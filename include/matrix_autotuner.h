@@ -0,0 +1,598 @@
+#ifndef MATRIX_AUTOTUNER_H
+#define MATRIX_AUTOTUNER_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "dynamic_matrix_multiplier.h"
+#include "matrix_backend_registry.h"
+#include "matrix_microbenchmark.h"
+#include "matrix_shape_sweep.h"
+#include "matrix_verification.h"
+#include "thread_budget.h"
+#include "thread_placement.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Host CPU as the tuning cache knows it: the board model when the kernel
+ * reports one (Raspberry Pi), else the processor model name, else the CPU
+ * implementer and part, followed by the number of CPUs.
+ */
+inline std::string cpuModelName()
+{
+    std::string board;
+    std::string model;
+    std::string implementer;
+    std::string part;
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string key = line.substr(0, colon);
+        key.erase(key.find_last_not_of(" \t") + 1);
+        std::string value = line.substr(colon + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+        std::string *field = key == "Model"             ? &board
+                             : key == "model name"      ? &model
+                             : key == "CPU implementer" ? &implementer
+                             : key == "CPU part"        ? &part
+                                                        : nullptr;
+        if (field != nullptr && field->empty()) {
+            *field = value;
+        }
+    }
+    std::string name = !board.empty()   ? board
+                       : !model.empty() ? model
+                       : !part.empty()  ? "CPU " + implementer + "/" + part
+                                        : std::string("unknown CPU");
+    return name + " x" + std::to_string(std::max(1u, std::thread::hardware_concurrency()));
+}
+
+/**
+ * Backend and knob values picked for one configuration. A knob left at 0 keeps
+ * the backend default.
+ */
+struct MatrixTuning
+{
+    std::string backend;
+    size_t threads = 0;
+    size_t mc = 0;
+    size_t kc = 0;
+    size_t nc = 0;
+    // Median time per product when it was tuned.
+    double medianNanos = 0;
+
+    /**
+     * "packed (task runtime), 2 threads, blocking 96x256x256".
+     */
+    std::string describe() const
+    {
+        std::string text = backend;
+        if (threads > 0) {
+            text += ", " + std::to_string(threads) + " threads";
+        }
+        if (mc > 0) {
+            text += ", blocking " + std::to_string(mc) + "x" + std::to_string(kc) + "x" +
+                    std::to_string(nc);
+        }
+        return text;
+    }
+
+    /**
+     * The backend with the knobs applied, nullptr when it is not compiled in or
+     * refuses a knob (a cache written by another build).
+     */
+    template<class T>
+    std::unique_ptr<DynamicMatrixMultiplier<T>> create() const
+    {
+        std::unique_ptr<DynamicMatrixMultiplier<T>> multiplier =
+            MatrixBackendRegistry<T>::instance().create(backend);
+        if (multiplier && threads > 0 && !multiplier->setNumThreads(threads)) {
+            return nullptr;
+        }
+        if (multiplier && mc > 0 && !multiplier->setBlocking(mc, kc, nc)) {
+            return nullptr;
+        }
+        return multiplier;
+    }
+};
+
+/**
+ * Tuning results by CPU model, element type, shape and number of concurrent
+ * callers, kept in a tab separated file (KPSR_TUNING_CACHE, by default
+ * kpsr_matrix_tuning.tsv in the working directory). Each line holds the key
+ * fields, then backend, threads, mc, kc, nc and the median time in ns. Entries
+ * of other CPUs are kept, so one file can serve several machines.
+ */
+class MatrixTuningCache
+{
+public:
+    explicit MatrixTuningCache(const std::string &path)
+        : _path(path)
+        , _cpu(cpuModelName())
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        load(_entries);
+    }
+
+    /**
+     * The cache of this process, at the default path.
+     */
+    static MatrixTuningCache &instance()
+    {
+        static MatrixTuningCache cache(defaultPath());
+        return cache;
+    }
+
+    static std::string defaultPath()
+    {
+        const char *path = std::getenv("KPSR_TUNING_CACHE");
+        return path != nullptr && *path != '\0' ? path : "kpsr_matrix_tuning.tsv";
+    }
+
+    bool find(const std::string &type,
+              const MatrixShape &shape,
+              size_t callers,
+              MatrixTuning &tuning) const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto entry = _entries.find(key(_cpu, type, shape, callers));
+        if (entry == _entries.end()) {
+            return false;
+        }
+        tuning = entry->second;
+        return true;
+    }
+
+    /**
+     * Records tuning and rewrites the file, merging what other processes
+     * stored meanwhile. The read-merge-write holds an flock on path.lock, and
+     * the new contents are written to a temporary file renamed over the cache,
+     * so readers never see a partial file. Returns false when the file cannot
+     * be written; the entry is still used by this process.
+     */
+    bool store(const std::string &type,
+               const MatrixShape &shape,
+               size_t callers,
+               const MatrixTuning &tuning)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _entries[key(_cpu, type, shape, callers)] = tuning;
+#ifdef __linux__
+        const int lockFile = open((_path + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (lockFile >= 0) {
+            flock(lockFile, LOCK_EX);
+        }
+        const std::string temporary = _path + ".tmp." + std::to_string(getpid());
+#else
+        const std::string temporary = _path + ".tmp";
+#endif
+        std::map<std::string, MatrixTuning> onDisk;
+        load(onDisk);
+        for (auto &entry : onDisk) {
+            _entries.insert(entry);
+        }
+        std::ofstream out(temporary);
+        out.precision(10);
+        for (const auto &entry : _entries) {
+            const MatrixTuning &value = entry.second;
+            out << entry.first << '\t' << value.backend << '\t' << value.threads << '\t'
+                << value.mc << '\t' << value.kc << '\t' << value.nc << '\t'
+                << value.medianNanos << '\n';
+        }
+        out.close();
+        const bool stored = bool(out) && std::rename(temporary.c_str(), _path.c_str()) == 0;
+        if (!stored) {
+            std::remove(temporary.c_str());
+        }
+#ifdef __linux__
+        if (lockFile >= 0) {
+            // Closing releases the lock.
+            close(lockFile);
+        }
+#endif
+        return stored;
+    }
+
+    const std::string &path() const { return _path; }
+    const std::string &cpu() const { return _cpu; }
+
+private:
+    static std::string key(const std::string &cpu,
+                           const std::string &type,
+                           const MatrixShape &shape,
+                           size_t callers)
+    {
+        return cpu + '\t' + type + '\t' + shape.describe() + '\t' + std::to_string(callers);
+    }
+
+    void load(std::map<std::string, MatrixTuning> &entries) const
+    {
+        std::ifstream in(_path);
+        std::string line;
+        while (std::getline(in, line)) {
+            std::vector<std::string> fields;
+            std::stringstream stream(line);
+            std::string field;
+            while (std::getline(stream, field, '\t')) {
+                fields.push_back(field);
+            }
+            if (fields.size() != 10) {
+                continue;
+            }
+            std::vector<MatrixShape> shape = parseMatrixShapes(fields[2]);
+            if (shape.size() != 1) {
+                continue;
+            }
+            MatrixTuning tuning;
+            tuning.backend = fields[4];
+            tuning.threads = std::strtoul(fields[5].c_str(), nullptr, 10);
+            tuning.mc = std::strtoul(fields[6].c_str(), nullptr, 10);
+            tuning.kc = std::strtoul(fields[7].c_str(), nullptr, 10);
+            tuning.nc = std::strtoul(fields[8].c_str(), nullptr, 10);
+            tuning.medianNanos = std::atof(fields[9].c_str());
+            size_t callers = std::strtoul(fields[3].c_str(), nullptr, 10);
+            entries[key(fields[0], fields[1], shape[0], callers)] = tuning;
+        }
+    }
+
+    std::string _path;
+    std::string _cpu;
+    mutable std::mutex _mutex;
+    std::map<std::string, MatrixTuning> _entries;
+};
+
+/**
+ * Startup autotuner. For one configuration (element type T, shape, callers
+ * threads multiplying concurrently) it times every selected backend that
+ * passes verifyDynamicMultiplier() at its defaults, then refines the fastest:
+ * first its intra-op threads (1, 2, 4, ... up to the cores), then, for packed
+ * backends, a grid of cache blockings. Timing uses runMicrobenchmark() with
+ * short settings, so a configuration tunes in about a second.
+ */
+template<class T>
+class MatrixAutotuner
+{
+public:
+    explicit MatrixAutotuner(MatrixTuningCache &cache = MatrixTuningCache::instance(),
+                             const std::vector<std::string> &backendFilters = {})
+        : _cache(cache)
+        , _backendFilters(backendFilters)
+    {
+        _settings.warmup = std::chrono::milliseconds(2);
+        _settings.minSample = std::chrono::microseconds(20);
+        _settings.maxTime = std::chrono::milliseconds(20);
+        _settings.minRepetitions = 5;
+        _settings.maxRepetitions = 200;
+        _settings.targetError = 0.02;
+    }
+
+    MicrobenchmarkSettings &settings() { return _settings; }
+
+    /**
+     * The cached tuning of the configuration, tuned and stored first when
+     * there is none.
+     */
+    MatrixTuning tuned(const MatrixShape &shape, size_t callers)
+    {
+        MatrixTuning tuning;
+        if (_cache.find(matrixTypeName<T>(), shape, callers, tuning)) {
+            return tuning;
+        }
+        return retune(shape, callers);
+    }
+
+    /**
+     * Tunes the configuration and stores the winner in the cache. Every
+     * candidate timed is appended to candidates when given.
+     */
+    MatrixTuning retune(const MatrixShape &shape,
+                        size_t callers,
+                        std::vector<MatrixTuning> *candidates = nullptr)
+    {
+        callers = std::max<size_t>(callers, 1);
+        MatrixTuning best;
+        MatrixBackendRegistry<T> &registry = MatrixBackendRegistry<T>::instance();
+        for (const std::string &name : registry.select(_backendFilters)) {
+            // Backends added on request ("auto") would tune themselves.
+            if (!registry.onRequest(name) && verified(name)) {
+                MatrixTuning candidate;
+                candidate.backend = name;
+                consider(candidate, shape, callers, best, candidates);
+            }
+        }
+        if (best.backend.empty()) {
+            return best;
+        }
+
+        MatrixTuning base = best;
+        std::unique_ptr<DynamicMatrixMultiplier<T>> probe = base.create<T>();
+        if (probe->setNumThreads(1)) {
+            size_t cores = std::max(1u, std::thread::hardware_concurrency());
+            for (size_t threads = 1; threads < 2 * cores; threads *= 2) {
+                MatrixTuning candidate = base;
+                candidate.threads = std::min(threads, cores);
+                consider(candidate, shape, callers, best, candidates);
+            }
+        }
+
+        base = best;
+        probe = base.create<T>();
+        if (probe->setBlocking(96, 256, 256)) {
+            for (size_t mc : {48, 96, 192}) {
+                for (size_t kc : {128, 256, 512}) {
+                    for (size_t nc : {256, 1024}) {
+                        MatrixTuning candidate = base;
+                        candidate.mc = mc;
+                        candidate.kc = kc;
+                        candidate.nc = nc;
+                        consider(candidate, shape, callers, best, candidates);
+                    }
+                }
+            }
+        }
+        _cache.store(matrixTypeName<T>(), shape, callers, best);
+        return best;
+    }
+
+private:
+    // Times candidate and keeps it in best when faster.
+    void consider(MatrixTuning &candidate,
+                  const MatrixShape &shape,
+                  size_t callers,
+                  MatrixTuning &best,
+                  std::vector<MatrixTuning> *candidates)
+    {
+        std::unique_ptr<DynamicMatrixMultiplier<T>> multiplier = candidate.create<T>();
+        if (!multiplier) {
+            return;
+        }
+        MicrobenchmarkResult result = runMicrobenchmark<T>(
+            *multiplier, candidate.backend, shape, callers, ThreadPlacement(), _settings);
+        candidate.medianNanos = result.time.median;
+        if (candidates != nullptr) {
+            candidates->push_back(candidate);
+        }
+        if (best.backend.empty() || candidate.medianNanos < best.medianNanos) {
+            best = candidate;
+        }
+    }
+
+    // Backends are verified once per process and element type.
+    static bool verified(const std::string &name)
+    {
+        static std::mutex mutex;
+        static std::map<std::string, bool> results;
+        std::lock_guard<std::mutex> lock(mutex);
+        auto result = results.find(name);
+        if (result == results.end()) {
+            std::unique_ptr<DynamicMatrixMultiplier<T>> multiplier =
+                MatrixBackendRegistry<T>::instance().create(name);
+            bool passed = multiplier && verifyDynamicMultiplier<T>(*multiplier).passed();
+            result = results.emplace(name, passed).first;
+        }
+        return result->second;
+    }
+
+    MatrixTuningCache &_cache;
+    std::vector<std::string> _backendFilters;
+    MicrobenchmarkSettings _settings;
+};
+
+/**
+ * Multiplier dispatching each product to the backend and knobs tuned for its
+ * shape: read from the tuning cache, or tuned (MatrixAutotuner) the first
+ * time a shape is seen and stored there, so later runs do not tune again.
+ * callers, the number of threads expected to multiply concurrently, is part of
+ * the cache key: set by the driver (setCallers()) or, left at 0, the stages
+ * registered with ThreadBudget. prepare() tunes ahead of time; otherwise the
+ * first product of a new shape pays for the tuning.
+ *
+ * Products too small to gain from tuning (an empty dimension, fewer than
+ * MIN_TUNED_FLOPS) and every product while tuning is disabled (verification,
+ * see MatrixTuningPause) run on the default backend, the first of the build,
+ * and leave the cache alone.
+ */
+template<class T>
+class MatrixAutoMultiplier : public DynamicMatrixMultiplier<T>
+{
+public:
+    explicit MatrixAutoMultiplier(size_t callers = 0,
+                                  MatrixTuningCache &cache = MatrixTuningCache::instance())
+        : _callers(callers)
+        , _tuner(cache)
+    {}
+
+    static constexpr double MIN_TUNED_FLOPS = 2.0 * 32 * 32 * 32;
+
+    MatrixTuning prepare(const MatrixShape &shape)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return dispatch(shape).first;
+    }
+
+    // 0 follows ThreadBudget::stages().
+    void setCallers(size_t callers)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _callers = callers;
+    }
+
+    bool tuningEnabled() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _tuningEnabled;
+    }
+
+    void setTuningEnabled(bool enabled)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _tuningEnabled = enabled;
+    }
+
+    virtual ~MatrixAutoMultiplier() {}
+
+protected:
+    void compute(const MatrixView<const T> &A,
+                 const MatrixView<const T> &B,
+                 const MatrixView<T> &C) override
+    {
+        computeFused(A, B, C, GemmEpilogue<T>());
+    }
+
+    void computeFused(const MatrixView<const T> &A,
+                      const MatrixView<const T> &B,
+                      const MatrixView<T> &C,
+                      const GemmEpilogue<T> &epilogue) override
+    {
+        DynamicMatrixMultiplier<T> *multiplier;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            multiplier = dispatch({C.rows, C.cols, A.cols}).second.get();
+        }
+        multiplier->multiply(A, B, C, epilogue);
+    }
+
+    // The height of A is only known at the product: B is packed for the
+    // backend tuned for a square k x n x k product. Products dispatched to
+    // another backend multiply B's copy.
+    void packOperand(PackedMatrix<T> &B) override
+    {
+        DynamicMatrixMultiplier<T> *multiplier;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            multiplier = dispatch({B.rows(), B.cols(), B.rows()}).second.get();
+        }
+        B.shareLayout(*multiplier->prepack(B.plain()));
+    }
+
+    void computePrepacked(const MatrixView<const T> &A,
+                          const PackedMatrix<T> &B,
+                          const MatrixView<T> &C,
+                          const GemmEpilogue<T> &epilogue) override
+    {
+        DynamicMatrixMultiplier<T> *multiplier;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            multiplier = dispatch({C.rows, C.cols, A.cols}).second.get();
+        }
+        multiplier->multiply(A, B, C, epilogue);
+    }
+
+private:
+    typedef std::pair<MatrixTuning, std::unique_ptr<DynamicMatrixMultiplier<T>>> Dispatch;
+
+    // Called with _mutex held; entries are never removed, so the multiplier
+    // can be used after the lock is released.
+    Dispatch &dispatch(const MatrixShape &shape)
+    {
+        // Also catches an empty dimension, whose flops() is 0.
+        if (!_tuningEnabled || shape.flops() < MIN_TUNED_FLOPS) {
+            return fallback();
+        }
+        const size_t callers =
+            _callers > 0 ? _callers : std::max<size_t>(ThreadBudget::instance().stages(), 1);
+        auto key = std::make_tuple(shape.m, shape.n, shape.k, callers);
+        auto entry = _dispatch.find(key);
+        if (entry != _dispatch.end()) {
+            return entry->second;
+        }
+        MatrixTuning tuning = _tuner.tuned(shape, callers);
+        std::unique_ptr<DynamicMatrixMultiplier<T>> multiplier = tuning.template create<T>();
+        if (!multiplier) {
+            tuning = _tuner.retune(shape, callers);
+            multiplier = tuning.template create<T>();
+        }
+        if (!multiplier) {
+            // Nothing passed verification.
+            return fallback();
+        }
+        return _dispatch.emplace(key, Dispatch(tuning, std::move(multiplier))).first->second;
+    }
+
+    // The default backend, created on first use; called with _mutex held.
+    Dispatch &fallback()
+    {
+        if (!_fallback.second) {
+            _fallback.first.backend = MatrixBackendRegistry<T>::instance().select({}).front();
+            _fallback.second = _fallback.first.template create<T>();
+        }
+        return _fallback;
+    }
+
+    size_t _callers;
+    MatrixAutotuner<T> _tuner;
+    bool _tuningEnabled = true;
+    mutable std::mutex _mutex;
+    std::map<std::tuple<size_t, size_t, size_t, size_t>, Dispatch> _dispatch;
+    Dispatch _fallback;
+};
+
+/**
+ * Sets the callers of multiplier, when it is a MatrixAutoMultiplier, to the
+ * threads a driver is about to run on it; other backends ignore it.
+ */
+template<class T>
+void setExpectedCallers(DynamicMatrixMultiplier<T> &multiplier, size_t callers)
+{
+    if (auto *automatic = dynamic_cast<MatrixAutoMultiplier<T> *>(&multiplier)) {
+        automatic->setCallers(callers);
+    }
+}
+
+/**
+ * Disables tuning of multiplier, when it is a MatrixAutoMultiplier, for the
+ * pause's lifetime. Verification multiplies odd and degenerate shapes that
+ * are neither worth tuning nor storing in the cache.
+ */
+template<class T>
+class MatrixTuningPause
+{
+public:
+    explicit MatrixTuningPause(DynamicMatrixMultiplier<T> &multiplier)
+        : _automatic(dynamic_cast<MatrixAutoMultiplier<T> *>(&multiplier))
+        , _wasEnabled(_automatic != nullptr && _automatic->tuningEnabled())
+    {
+        if (_wasEnabled) {
+            _automatic->setTuningEnabled(false);
+        }
+    }
+
+    ~MatrixTuningPause()
+    {
+        if (_wasEnabled) {
+            _automatic->setTuningEnabled(true);
+        }
+    }
+
+    MatrixTuningPause(const MatrixTuningPause &) = delete;
+    MatrixTuningPause &operator=(const MatrixTuningPause &) = delete;
+
+private:
+    MatrixAutoMultiplier<T> *_automatic;
+    bool _wasEnabled;
+};
+
+inline const bool autoBackendRegistered =
+    registerOnRequestMatrixBackend<MatrixAutoMultiplier>("auto", 1000);
+
+#endif // MATRIX_AUTOTUNER_H
@@ -0,0 +1,312 @@
+#ifndef MATRIX_BACKEND_REGISTRY_H
+#define MATRIX_BACKEND_REGISTRY_H
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dynamic_matrix.h"
+#include "dynamic_matrix_multiplier.h"
+#include "matrix_multiplier.h"
+
+template<class T>
+using NamedDynamicMultipliers =
+    std::vector<std::pair<std::string, std::unique_ptr<DynamicMatrixMultiplier<T>>>>;
+
+/**
+ * Run-time sized backends for element type T, by name. Backend headers add
+ * their backends when included (registerMatrixBackend), so a binary offers the
+ * backends whose headers it includes; matrix_backends.h includes all the ones
+ * the build found. Names are listed by rank, the order reports use. Backends
+ * added on request (the autotuned "auto") are only selected by their name.
+ */
+template<class T>
+class MatrixBackendRegistry
+{
+public:
+    typedef std::function<std::unique_ptr<DynamicMatrixMultiplier<T>>()> Factory;
+
+    static MatrixBackendRegistry &instance()
+    {
+        static MatrixBackendRegistry registry;
+        return registry;
+    }
+
+    /**
+     * Returns false, keeping the first registration, when name is taken.
+     */
+    bool add(const std::string &name, int rank, Factory factory, bool onRequest = false)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (const Entry &entry : _entries) {
+            if (entry.name == name) {
+                return false;
+            }
+        }
+        auto position = std::upper_bound(_entries.begin(),
+                                         _entries.end(),
+                                         rank,
+                                         [](int r, const Entry &entry) { return r < entry.rank; });
+        _entries.insert(position, Entry{name, rank, onRequest, std::move(factory)});
+        return true;
+    }
+
+    std::vector<std::string> names() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::vector<std::string> result;
+        for (const Entry &entry : _entries) {
+            result.push_back(entry.name);
+        }
+        return result;
+    }
+
+    bool onRequest(const std::string &name) const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (const Entry &entry : _entries) {
+            if (entry.name == name) {
+                return entry.onRequest;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * New instance of backend name, nullptr if no such backend is compiled in.
+     */
+    std::unique_ptr<DynamicMatrixMultiplier<T>> create(const std::string &name) const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (const Entry &entry : _entries) {
+            if (entry.name == name) {
+                return entry.factory();
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * Names picked by filters, in rank order: a filter equal to a name picks
+     * that backend only, any other filter every backend whose name contains it
+     * ("packed" picks "packed" only, "task" every task runtime variant). No
+     * filters pick every backend not added on request.
+     */
+    std::vector<std::string> select(const std::vector<std::string> &filters) const
+    {
+        std::vector<std::string> all;
+        std::vector<bool> onRequest;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (const Entry &entry : _entries) {
+                all.push_back(entry.name);
+                onRequest.push_back(entry.onRequest);
+            }
+        }
+        std::vector<std::string> picked;
+        for (size_t i = 0; i < all.size(); i++) {
+            const std::string &name = all[i];
+            bool match = filters.empty() && !onRequest[i];
+            for (const std::string &filter : filters) {
+                bool exact = std::find(all.begin(), all.end(), filter) != all.end();
+                match = match || (exact ? name == filter
+                                        : !onRequest[i] && name.find(filter) != std::string::npos);
+            }
+            if (match) {
+                picked.push_back(name);
+            }
+        }
+        return picked;
+    }
+
+    NamedDynamicMultipliers<T> createSelected(const std::vector<std::string> &filters) const
+    {
+        NamedDynamicMultipliers<T> backends;
+        for (const std::string &name : select(filters)) {
+            backends.emplace_back(name, create(name));
+        }
+        return backends;
+    }
+
+private:
+    struct Entry
+    {
+        std::string name;
+        int rank;
+        bool onRequest;
+        Factory factory;
+    };
+
+    MatrixBackendRegistry() = default;
+
+    mutable std::mutex _mutex;
+    std::vector<Entry> _entries;
+};
+
+template<template<class> class Multiplier, class... Args>
+bool registerMatrixBackendFor(bool onRequest, const std::string &name, int rank, Args... args)
+{
+    MatrixBackendRegistry<float>::instance().add(
+        name, rank, [=]() { return std::make_unique<Multiplier<float>>(args...); }, onRequest);
+    MatrixBackendRegistry<double>::instance().add(
+        name, rank, [=]() { return std::make_unique<Multiplier<double>>(args...); }, onRequest);
+    MatrixBackendRegistry<int>::instance().add(
+        name, rank, [=]() { return std::make_unique<Multiplier<int>>(args...); }, onRequest);
+    return true;
+}
+
+/**
+ * Registers Multiplier<T>(args...) as name for float, double and int. Backend
+ * headers call it from an inline variable, e.g.
+ *   inline const bool seqBackendRegistered =
+ *       registerMatrixBackend<DynamicMatrixSeqMultiplier>("normal", 100);
+ * Lower ranks are listed first.
+ */
+template<template<class> class Multiplier, class... Args>
+bool registerMatrixBackend(const std::string &name, int rank, Args... args)
+{
+    return registerMatrixBackendFor<Multiplier>(false, name, rank, args...);
+}
+
+/**
+ * As registerMatrixBackend, for a backend only run when asked for by name.
+ */
+template<template<class> class Multiplier, class... Args>
+bool registerOnRequestMatrixBackend(const std::string &name, int rank, Args... args)
+{
+    return registerMatrixBackendFor<Multiplier>(true, name, rank, args...);
+}
+
+/**
+ * Every registered backend for T whose name passes filters (see
+ * MatrixBackendRegistry::select), in rank order.
+ */
+template<class T>
+NamedDynamicMultipliers<T> dynamicMultipliers(const std::vector<std::string> &filters = {})
+{
+    return MatrixBackendRegistry<T>::instance().createSelected(filters);
+}
+
+/**
+ * Splits a "simd,packed" style backend list.
+ */
+inline std::vector<std::string> parseBackendList(const std::string &list)
+{
+    std::vector<std::string> names;
+    std::stringstream stream(list);
+    std::string name;
+    while (std::getline(stream, name, ',')) {
+        name.erase(0, name.find_first_not_of(' '));
+        name.erase(name.find_last_not_of(' ') + 1);
+        if (!name.empty()) {
+            names.push_back(name);
+        }
+    }
+    return names;
+}
+
+/**
+ * Fixed-size MatrixMultiplier running a registered backend on views of the
+ * matrices, for drivers built around compile-time shapes (the event pipeline,
+ * kpsr_matrix_mult_benchmark).
+ */
+template<class T, size_t colsLeft, size_t rowsLeft, size_t rowsRight>
+class RegisteredMatrixMultiplier : public MatrixMultiplier<T, colsLeft, rowsLeft, rowsRight>
+{
+public:
+    explicit RegisteredMatrixMultiplier(std::unique_ptr<DynamicMatrixMultiplier<T>> backend)
+        : _backend(std::move(backend))
+    {}
+
+    void multiply(const Matrix<T, colsLeft, rowsLeft> &A,
+                  const Matrix<T, rowsLeft, rowsRight> &B,
+                  Matrix<T, colsLeft, rowsRight> &C) override
+    {
+        C.sequence = A.sequence;
+        C.timestamp = A.timestamp;
+        _backend->multiply(makeMatrixView(A), makeMatrixView(B), makeMatrixView(C));
+    }
+
+    void multiply(const Matrix<T, colsLeft, rowsLeft> &A,
+                  const Matrix<T, rowsLeft, rowsRight> &B,
+                  Matrix<T, colsLeft, rowsRight> &C,
+                  const GemmEpilogue<T> &epilogue) override
+    {
+        C.sequence = A.sequence;
+        C.timestamp = A.timestamp;
+        _backend->multiply(makeMatrixView(A), makeMatrixView(B), makeMatrixView(C), epilogue);
+    }
+
+    // Views of the batch in thread local buffers, reused across batches, so
+    // the backend's native batched path (computeBatch()) sees every product.
+    void multiplyBatch(const Matrix<T, colsLeft, rowsLeft> *A,
+                       const Matrix<T, rowsLeft, rowsRight> *B,
+                       Matrix<T, colsLeft, rowsRight> *C,
+                       size_t n) override
+    {
+        static thread_local std::vector<MatrixView<const T>> leftViews, rightViews;
+        static thread_local std::vector<MatrixView<T>> resultViews;
+        leftViews.clear();
+        rightViews.clear();
+        resultViews.clear();
+        for (size_t i = 0; i < n; i++) {
+            C[i].sequence = A[i].sequence;
+            C[i].timestamp = A[i].timestamp;
+            leftViews.push_back(makeMatrixView(A[i]));
+            rightViews.push_back(makeMatrixView(B[i]));
+            resultViews.push_back(makeMatrixView(C[i]));
+        }
+        _backend->multiplyBatch(leftViews.data(), rightViews.data(), resultViews.data(), n);
+    }
+
+    /**
+     * Prepacks B, the right-hand operand of every product (see
+     * DynamicMatrixMultiplier::prepack()), for multiply() with a PackedMatrix.
+     */
+    std::shared_ptr<const PackedMatrix<T>> prepack(const Matrix<T, rowsLeft, rowsRight> &B)
+    {
+        return _backend->prepack(makeMatrixView(B));
+    }
+
+    void multiply(const Matrix<T, colsLeft, rowsLeft> &A,
+                  const PackedMatrix<T> &B,
+                  Matrix<T, colsLeft, rowsRight> &C,
+                  const GemmEpilogue<T> &epilogue = GemmEpilogue<T>())
+    {
+        C.sequence = A.sequence;
+        C.timestamp = A.timestamp;
+        _backend->multiply(makeMatrixView(A), B, makeMatrixView(C), epilogue);
+    }
+
+    bool setNumThreads(size_t threads) override { return _backend->setNumThreads(threads); }
+
+    DynamicMatrixMultiplier<T> &backend() { return *_backend; }
+
+    virtual ~RegisteredMatrixMultiplier() {}
+
+private:
+    std::unique_ptr<DynamicMatrixMultiplier<T>> _backend;
+};
+
+/**
+ * Backend name at a compile-time shape, nullptr if it is not compiled in.
+ */
+template<class T, size_t colsLeft, size_t rowsLeft, size_t rowsRight>
+std::unique_ptr<MatrixMultiplier<T, colsLeft, rowsLeft, rowsRight>> createRegisteredMultiplier(
+    const std::string &name)
+{
+    std::unique_ptr<DynamicMatrixMultiplier<T>> backend =
+        MatrixBackendRegistry<T>::instance().create(name);
+    if (!backend) {
+        return nullptr;
+    }
+    return std::make_unique<RegisteredMatrixMultiplier<T, colsLeft, rowsLeft, rowsRight>>(
+        std::move(backend));
+}
+
+#endif // MATRIX_BACKEND_REGISTRY_H
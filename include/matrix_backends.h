@@ -0,0 +1,50 @@
+#ifndef MATRIX_BACKENDS_H
+#define MATRIX_BACKENDS_H
+
+#include <type_traits>
+
+// Every backend of this build: including a backend header registers it in
+// MatrixBackendRegistry. The optional ones are enabled by CMake when their
+// library is found.
+#include "matrix_backend_registry.h"
+#include "matrix_packed_multiplier.h"
+#include "matrix_quantized_multiplier.h"
+#include "matrix_seq_multiplier.h"
+#include "matrix_simd_multiplier.h"
+#include "matrix_strassen_multiplier.h"
+#include "matrix_widened_multiplier.h"
+#ifdef openmp_enabled
+#include "matrix_openmp_multiplier.h"
+#endif
+#ifdef eigen_enabled
+#include "matrix_eigen_multiplier.h"
+#endif
+#ifdef blas_enabled
+#include <klepsydra/matrix_mult_benchmark/matrix_blas_multipler.h>
+#endif
+#ifdef ruy_enabled
+#include <klepsydra/matrix_mult_benchmark/matrix_ruy_multiplier.h>
+#endif
+// "auto", on request only: dispatches to the backends above as tuned.
+#include "matrix_autotuner.h"
+
+/**
+ * The correctness check for any registered backend of T:
+ * verifyDynamicMultiplier(), with the requantization checks of the quantized
+ * backends and the recursion checks of the Strassen ones. "auto" is checked
+ * without tuning the verification shapes (MatrixTuningPause).
+ */
+template<class T>
+VerificationReport verifyBackend(DynamicMatrixMultiplier<T> &multiplier)
+{
+    MatrixTuningPause<T> pause(multiplier);
+    if constexpr (VerificationTraits<T>::saturating) {
+        return verifyQuantizedMultiplier<T>(multiplier);
+    } else if constexpr (std::is_floating_point<T>::value) {
+        return verifyStrassenMultiplier<T>(multiplier);
+    } else {
+        return verifyDynamicMultiplier<T>(multiplier);
+    }
+}
+
+#endif // MATRIX_BACKENDS_H
@@ -5,7 +5,11 @@ extern "C" {
 #include <cblas.h>
 }
 
+#include <klepsydra/matrix_mult_benchmark/dynamic_matrix_multiplier.h>
+#include <klepsydra/matrix_mult_benchmark/matrix_backend_registry.h>
 #include <klepsydra/matrix_mult_benchmark/matrix_multiplier.h>
+#include <klepsydra/matrix_mult_benchmark/matrix_packed_gemm.h>
+#include <klepsydra/matrix_mult_benchmark/task_runtime.h>
 
 namespace kpsr {
 namespace matrix_mult_benchmark {
@@ -14,6 +18,14 @@ template<class T, size_t colsLeft, size_t rowsLeft, size_t rowsRight>
 class MatrixBlasMultiplier : public MatrixMultiplier<T, colsLeft, rowsLeft, rowsRight>
 {
 public:
+    /**
+     * BLAS has no integer gemm, so other element types go through the packed
+     * kernel instead.
+     */
+    MatrixBlasMultiplier()
+        : _fallback({4, 8, &packedMicroKernel<T, 4, 8>}, {64, 256, 256})
+    {}
+
     void multiply(const Matrix<T, colsLeft, rowsLeft> &A,
                   const Matrix<T, rowsLeft, rowsRight> &B,
                   Matrix<T, colsLeft, rowsRight> &C) override
@@ -21,33 +33,58 @@ public:
         C.sequence = A.sequence;
         C.timestamp = A.timestamp;
 
-        multiplyHelper(A.data[0], B.data[0], C.data[0]);
+        multiplyHelper(A.data[0], A.stride, B.data[0], B.stride, C.data[0], C.stride);
+    }
+
+    void multiplyBatch(const Matrix<T, colsLeft, rowsLeft> *A,
+                       const Matrix<T, rowsLeft, rowsRight> *B,
+                       Matrix<T, colsLeft, rowsRight> *C,
+                       size_t n) override
+    {
+        TaskRuntime::instance().parallelFor(n, 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                C[i].sequence = A[i].sequence;
+                C[i].timestamp = A[i].timestamp;
+                multiplyHelper(
+                    A[i].data[0], A[i].stride, B[i].data[0], B[i].stride, C[i].data[0], C[i].stride);
+            }
+        });
     }
 
     virtual ~MatrixBlasMultiplier() {}
 
 private:
-    void multiplyHelper(const double *A_data, const double *B_data, double *C_data)
+    void multiplyHelper(const double *A_data,
+                        size_t lda,
+                        const double *B_data,
+                        size_t ldb,
+                        double *C_data,
+                        size_t ldc)
     {
-        double alpha = 1.0f;
-        double beta = 0.0f;
+        double alpha = 1.0;
+        double beta = 0.0;
         cblas_dgemm(CblasRowMajor,
                     CblasNoTrans,
                     CblasNoTrans,
                     colsLeft,
-                    rowsLeft,
                     rowsRight,
+                    rowsLeft,
                     alpha,
                     A_data,
-                    colsLeft,
+                    lda,
                     B_data,
-                    rowsLeft,
+                    ldb,
                     beta,
                     C_data,
-                    rowsRight);
+                    ldc);
     }
 
-    void multiplyHelper(const float *A_data, const float *B_data, float *C_data)
+    void multiplyHelper(const float *A_data,
+                        size_t lda,
+                        const float *B_data,
+                        size_t ldb,
+                        float *C_data,
+                        size_t ldc)
     {
         float alpha = 1.0f;
         float beta = 0.0f;
@@ -59,34 +96,131 @@ private:
                     rowsLeft,
                     alpha,
                     A_data,
-                    colsLeft,
+                    lda,
                     B_data,
-                    rowsRight,
+                    ldb,
                     beta,
                     C_data,
-                    rowsRight);
+                    ldc);
     }
 
-    void multiplyHelper(const int *A_data, const int *B_data, int *C_data)
+    template<class U>
+    void multiplyHelper(const U *A_data,
+                        size_t lda,
+                        const U *B_data,
+                        size_t ldb,
+                        U *C_data,
+                        size_t ldc)
+    {
+        _fallback.multiply(colsLeft, rowsRight, rowsLeft, A_data, lda, B_data, ldb, C_data, ldc);
+    }
+
+    PackedGemm<T> _fallback;
+};
+
+/**
+ * BLAS gemm on run-time shapes. BLAS has no integer gemm, so other element
+ * types go through the packed kernel instead.
+ */
+template<class T>
+class DynamicMatrixBlasMultiplier : public DynamicMatrixMultiplier<T>
+{
+public:
+    DynamicMatrixBlasMultiplier()
+        : _fallback({4, 8, &packedMicroKernel<T, 4, 8>}, {64, 256, 256})
+    {}
+
+    virtual ~DynamicMatrixBlasMultiplier() {}
+
+protected:
+    void compute(const MatrixView<const T> &A,
+                 const MatrixView<const T> &B,
+                 const MatrixView<T> &C) override
+    {
+        gemm(C.rows, C.cols, A.cols, A.data, A.stride, B.data, B.stride, C.data, C.stride);
+    }
+
+    // The products of a batch run as runtime tasks, each a single BLAS call.
+    void computeBatch(const MatrixView<const T> *A,
+                      const MatrixView<const T> *B,
+                      const MatrixView<T> *C,
+                      size_t n) override
+    {
+        this->computeBatchOnRuntime(A, B, C, n);
+    }
+
+private:
+    void gemm(size_t m,
+              size_t n,
+              size_t k,
+              const double *A_data,
+              size_t lda,
+              const double *B_data,
+              size_t ldb,
+              double *C_data,
+              size_t ldc)
+    {
+        cblas_dgemm(CblasRowMajor,
+                    CblasNoTrans,
+                    CblasNoTrans,
+                    m,
+                    n,
+                    k,
+                    1.0,
+                    A_data,
+                    lda,
+                    B_data,
+                    ldb,
+                    0.0,
+                    C_data,
+                    ldc);
+    }
+
+    void gemm(size_t m,
+              size_t n,
+              size_t k,
+              const float *A_data,
+              size_t lda,
+              const float *B_data,
+              size_t ldb,
+              float *C_data,
+              size_t ldc)
     {
-        float alpha = 1.0f;
-        float beta = 0.0f;
         cblas_sgemm(CblasRowMajor,
                     CblasNoTrans,
                     CblasNoTrans,
-                    colsLeft,
-                    rowsLeft,
-                    rowsRight,
-                    alpha,
-                    (float *) A_data,
-                    colsLeft,
-                    (float *) B_data,
-                    rowsLeft,
-                    beta,
-                    (float *) C_data,
-                    rowsRight);
+                    m,
+                    n,
+                    k,
+                    1.0f,
+                    A_data,
+                    lda,
+                    B_data,
+                    ldb,
+                    0.0f,
+                    C_data,
+                    ldc);
+    }
+
+    template<class U>
+    void gemm(size_t m,
+              size_t n,
+              size_t k,
+              const U *A_data,
+              size_t lda,
+              const U *B_data,
+              size_t ldb,
+              U *C_data,
+              size_t ldc)
+    {
+        _fallback.multiply(m, n, k, A_data, lda, B_data, ldb, C_data, ldc);
     }
+
+    PackedGemm<T> _fallback;
 };
+
+inline const bool blasBackendRegistered =
+    registerMatrixBackend<DynamicMatrixBlasMultiplier>("blas", 30);
 } // namespace matrix_mult_benchmark
 } // namespace kpsr
 
@@ -0,0 +1,136 @@
+#ifndef MATRIX_CHAIN_EXECUTOR_H
+#define MATRIX_CHAIN_EXECUTOR_H
+
+#include <memory>
+
+#include <klepsydra/matrix_mult_benchmark/matrix_multiplier.h>
+
+namespace kpsr {
+namespace matrix_mult_benchmark {
+
+/**
+ * Runs a whole multiplication chain on one thread over a fixed set of
+ * buffers allocated once, so the working set stays in L1/L2 from one step
+ * and one event to the next instead of moving through pipeline slots.
+ *
+ * By default it runs the chain of the sequential StreamAssembler mode,
+ * steps times X <- X * X (that is input^(2^steps)). With setPower(p) it
+ * computes input^p by exponentiation by squaring: floor(log2 p) squarings plus
+ * one product per further set bit of p, instead of the p - 1 products of a
+ * naive chain.
+ *
+ * Operand packing is left to the multiplier: the packed and SIMD backends
+ * pack each operand once per step.
+ */
+template<class T, size_t rows>
+class MatrixChainExecutor
+{
+public:
+    MatrixChainExecutor(MatrixMultiplier<T, rows, rows, rows> *multiplier, int steps)
+        : _multiplier(multiplier)
+        , _steps(steps)
+        , _power(0)
+        , _multiplications(0)
+    {
+        for (auto &buffer : _buffers) {
+            buffer.reset(new Matrix<T, rows, rows>());
+        }
+    }
+
+    /**
+     * Switches to input^exponent by squaring; 0 goes back to the squaring chain.
+     */
+    void setPower(unsigned exponent) { _power = exponent; }
+
+    unsigned power() const { return _power; }
+
+    /**
+     * Result of the chain on input. It lives in the executor's buffers (or is
+     * input itself for an empty chain) and stays valid until the next run().
+     */
+    const Matrix<T, rows, rows> &run(const Matrix<T, rows, rows> &input)
+    {
+        Matrix<T, rows, rows> *result = _power > 0 ? raise(input, _power)
+                                                   : squareChain(input, _steps);
+        if (result == nullptr) {
+            return input;
+        }
+        result->sequence = input.sequence;
+        result->timestamp = input.timestamp;
+        return *result;
+    }
+
+    /**
+     * Number of products run so far.
+     */
+    size_t multiplications() const { return _multiplications; }
+
+private:
+    // Both return the buffer holding the result, nullptr when it is the input.
+    Matrix<T, rows, rows> *squareChain(const Matrix<T, rows, rows> &input, int steps)
+    {
+        const Matrix<T, rows, rows> *current = &input;
+        Matrix<T, rows, rows> *result = nullptr;
+        for (int i = 0; i < steps; i++) {
+            result = _buffers[i % 2].get();
+            multiply(*current, *current, *result);
+            current = result;
+        }
+        return result;
+    }
+
+    Matrix<T, rows, rows> *raise(const Matrix<T, rows, rows> &input, unsigned exponent)
+    {
+        // Base squares ping-pong through buffers 0/1, the running product
+        // through buffers 2/3; the base starts out as the input itself.
+        const Matrix<T, rows, rows> *base = &input;
+        Matrix<T, rows, rows> *result = nullptr;
+        bool haveResult = false;
+        int nextBase = 0;
+        int nextResult = 2;
+        while (true) {
+            if (exponent & 1) {
+                if (!haveResult && base != &input) {
+                    // The running product takes the base buffer over, the
+                    // next squarings get the spare product buffer instead.
+                    _buffers[nextResult].swap(_buffers[1 - nextBase]);
+                    result = _buffers[nextResult].get();
+                    nextResult = 5 - nextResult;
+                } else if (haveResult) {
+                    Matrix<T, rows, rows> *product = _buffers[nextResult].get();
+                    multiply(result != nullptr ? *result : input, *base, *product);
+                    result = product;
+                    nextResult = 5 - nextResult;
+                }
+                haveResult = true;
+            }
+            exponent >>= 1;
+            if (exponent == 0) {
+                break;
+            }
+            Matrix<T, rows, rows> *square = _buffers[nextBase].get();
+            multiply(*base, *base, *square);
+            base = square;
+            nextBase = 1 - nextBase;
+        }
+        return result;
+    }
+
+    void multiply(const Matrix<T, rows, rows> &A,
+                  const Matrix<T, rows, rows> &B,
+                  Matrix<T, rows, rows> &C)
+    {
+        _multiplier->multiply(A, B, C);
+        _multiplications++;
+    }
+
+    MatrixMultiplier<T, rows, rows, rows> *_multiplier;
+    int _steps;
+    unsigned _power;
+    size_t _multiplications;
+    std::unique_ptr<Matrix<T, rows, rows>> _buffers[4];
+};
+} // namespace matrix_mult_benchmark
+} // namespace kpsr
+
+#endif // MATRIX_CHAIN_EXECUTOR_H
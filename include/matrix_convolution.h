@@ -0,0 +1,779 @@
+#ifndef MATRIX_CONVOLUTION_H
+#define MATRIX_CONVOLUTION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "dynamic_matrix.h"
+#include "dynamic_matrix_multiplier.h"
+#include "matrix_epilogue.h"
+#include "matrix_packed_gemm.h"
+#include "matrix_shape_sweep.h"
+#include "matrix_simd_kernels.h"
+#include "matrix_verification.h"
+#include "philox_random.h"
+#include "task_runtime.h"
+
+/**
+ * Memory layout of an activation (one image, batch size 1) held in a
+ * DynamicMatrix: CONV_NCHW is channels x (height * width), one row per
+ * channel; CONV_NHWC is (height * width) x channels, one row per pixel.
+ */
+enum ConvolutionLayout { CONV_NCHW = 0, CONV_NHWC };
+
+/**
+ * How a convolution is lowered to GEMM:
+ * - CONV_IM2COL builds the patch matrix (kernel^2 * channels values per
+ *   output pixel) and multiplies it with any DynamicMatrixMultiplier.
+ * - CONV_IMPLICIT_GEMM never stores the patch matrix: the packed gemm packs
+ *   its panels straight from the input (PackedGemm::multiplyPacked()).
+ */
+enum ConvolutionLowering { CONV_IM2COL = 0, CONV_IMPLICIT_GEMM };
+
+inline const char *convolutionLayoutName(ConvolutionLayout layout)
+{
+    return layout == CONV_NHWC ? "nhwc" : "nchw";
+}
+
+inline const char *convolutionLoweringName(ConvolutionLowering lowering)
+{
+    return lowering == CONV_IMPLICIT_GEMM ? "implicit" : "im2col";
+}
+
+inline bool parseConvolutionLayout(const std::string &name, ConvolutionLayout &layout)
+{
+    if (name != "nchw" && name != "nhwc") {
+        return false;
+    }
+    layout = name == "nhwc" ? CONV_NHWC : CONV_NCHW;
+    return true;
+}
+
+inline bool parseConvolutionLowering(const std::string &name, ConvolutionLowering &lowering)
+{
+    if (name != "im2col" && name != "implicit") {
+        return false;
+    }
+    lowering = name == "implicit" ? CONV_IMPLICIT_GEMM : CONV_IM2COL;
+    return true;
+}
+
+/**
+ * One convolution layer: filters kernel x kernel filters over a channels x
+ * height x width input, with the given stride and zero padding on every side.
+ */
+struct ConvolutionShape
+{
+    size_t channels;
+    size_t height;
+    size_t width;
+    size_t filters;
+    size_t kernel;
+    size_t stride;
+    size_t padding;
+
+    bool valid() const
+    {
+        return channels > 0 && filters > 0 && kernel > 0 && stride > 0 &&
+               height + 2 * padding >= kernel && width + 2 * padding >= kernel;
+    }
+
+    size_t outputHeight() const { return (height + 2 * padding - kernel) / stride + 1; }
+    size_t outputWidth() const { return (width + 2 * padding - kernel) / stride + 1; }
+    size_t outputPixels() const { return outputHeight() * outputWidth(); }
+
+    // Inner dimension of the lowered product: the values of one patch.
+    size_t depth() const { return channels * kernel * kernel; }
+
+    /**
+     * The GEMM the layer lowers to: filters x pixels (weights times patches)
+     * in NCHW, pixels x filters (patches times weights) in NHWC.
+     */
+    MatrixShape gemmShape(ConvolutionLayout layout) const
+    {
+        return layout == CONV_NHWC ? MatrixShape{outputPixels(), filters, depth()}
+                                   : MatrixShape{filters, outputPixels(), depth()};
+    }
+
+    double flops() const { return 2.0 * filters * outputPixels() * depth(); }
+
+    /**
+     * "3x64x64 -> 16x64x64 k3 s1 p1".
+     */
+    std::string describe() const
+    {
+        std::ostringstream text;
+        text << channels << "x" << height << "x" << width << " -> " << filters << "x"
+             << outputHeight() << "x" << outputWidth() << " k" << kernel << " s" << stride
+             << " p" << padding;
+        return text.str();
+    }
+};
+
+/**
+ * Rows and columns of the DynamicMatrix holding a channels x height x width
+ * activation in layout.
+ */
+inline size_t activationRows(ConvolutionLayout layout, size_t channels, size_t pixels)
+{
+    return layout == CONV_NHWC ? pixels : channels;
+}
+
+inline size_t activationCols(ConvolutionLayout layout, size_t channels, size_t pixels)
+{
+    return layout == CONV_NHWC ? channels : pixels;
+}
+
+/**
+ * Parses a layer chain such as "3x64x64,16:3:1:1,32:3:2:1": the input
+ * channels x height x width, then one filters:kernel:stride:padding entry per
+ * layer (stride and padding default to 1 and 0), each layer taking the output
+ * of the one before. Returns an empty chain when an entry is malformed or a
+ * layer does not fit its input.
+ */
+inline std::vector<ConvolutionShape> parseConvolutionChain(const std::string &spec)
+{
+    std::vector<std::string> items;
+    std::string list = spec;
+    std::replace(list.begin(), list.end(), ',', ' ');
+    std::stringstream stream(list);
+    std::string item;
+    while (stream >> item) {
+        items.push_back(item);
+    }
+    std::vector<size_t> input;
+    auto parseSizes = [](const std::string &text, char separator, std::vector<size_t> &sizes) {
+        std::stringstream fields(text);
+        std::string field;
+        while (std::getline(fields, field, separator)) {
+            size_t used = 0;
+            unsigned long value = 0;
+            try {
+                value = std::stoul(field, &used);
+            } catch (const std::exception &) {
+                return false;
+            }
+            if (used != field.size()) {
+                return false;
+            }
+            sizes.push_back(value);
+        }
+        return true;
+    };
+    if (items.size() < 2 || !parseSizes(items[0], 'x', input) || input.size() != 3) {
+        return {};
+    }
+
+    std::vector<ConvolutionShape> chain;
+    size_t channels = input[0];
+    size_t height = input[1];
+    size_t width = input[2];
+    for (size_t i = 1; i < items.size(); i++) {
+        std::vector<size_t> layer;
+        if (!parseSizes(items[i], ':', layer) || layer.size() < 2 || layer.size() > 4) {
+            return {};
+        }
+        ConvolutionShape shape{channels,
+                               height,
+                               width,
+                               layer[0],
+                               layer[1],
+                               layer.size() > 2 ? layer[2] : 1,
+                               layer.size() > 3 ? layer[3] : 0};
+        if (!shape.valid()) {
+            return {};
+        }
+        chain.push_back(shape);
+        channels = shape.filters;
+        height = shape.outputHeight();
+        width = shape.outputWidth();
+    }
+    return chain;
+}
+
+/**
+ * Convolution layer lowered to GEMM (see ConvolutionLowering). Activations are
+ * DynamicMatrix in the layer's layout (activationRows() x activationCols()),
+ * so the output of one layer is the input of the next. The im2col patch
+ * matrix is allocated once, at construction; a layer is meant for one thread
+ * at a time.
+ *
+ * The im2col lowering runs on multiplier, which must outlive the layer; the
+ * implicit one packs for the host's SIMD micro-kernel, on the shared
+ * TaskRuntime when parallel is set. In NHWC the weights are the B operand
+ * and are prepacked whenever the filters are set; NCHW weights are the A
+ * operand, packed with every product.
+ */
+template<class T>
+class ConvolutionLayer
+{
+public:
+    ConvolutionLayer(const ConvolutionShape &shape,
+                     ConvolutionLayout layout,
+                     ConvolutionLowering lowering,
+                     DynamicMatrixMultiplier<T> *multiplier = nullptr,
+                     bool parallel = false)
+        : _shape(shape)
+        , _layout(layout)
+        , _lowering(lowering)
+        , _multiplier(multiplier)
+        , _gemm(SimdMicroKernels<T>::select(activeSimdIsa()),
+                {96, 256, 256},
+                parallel ? &TaskRuntime::instance() : nullptr)
+        , _activation(EPILOGUE_IDENTITY)
+    {
+        const size_t depth = shape.depth();
+        if (layout == CONV_NHWC) {
+            _weights.resize(depth, shape.filters);
+        } else {
+            _weights.resize(shape.filters, depth);
+        }
+        if (lowering == CONV_IM2COL) {
+            if (layout == CONV_NHWC) {
+                _patches.resize(shape.outputPixels(), depth);
+            } else {
+                _patches.resize(depth, shape.outputPixels());
+            }
+        }
+        prepackWeights();
+    }
+
+    const ConvolutionShape &shape() const { return _shape; }
+    ConvolutionLayout layout() const { return _layout; }
+    ConvolutionLowering lowering() const { return _lowering; }
+    EpilogueActivation activation() const { return _activation; }
+
+    /**
+     * Per filter bias, empty when the layer has none.
+     */
+    const std::vector<T> &bias() const { return _bias; }
+
+    size_t inputRows() const
+    {
+        return activationRows(_layout, _shape.channels, _shape.height * _shape.width);
+    }
+    size_t inputCols() const
+    {
+        return activationCols(_layout, _shape.channels, _shape.height * _shape.width);
+    }
+    size_t outputRows() const
+    {
+        return activationRows(_layout, _shape.filters, _shape.outputPixels());
+    }
+    size_t outputCols() const
+    {
+        return activationCols(_layout, _shape.filters, _shape.outputPixels());
+    }
+
+    /**
+     * Sets the weights from filters x channels x kernel x kernel values
+     * (OIHW order), rearranged for the product.
+     */
+    void setFilters(const T *filters)
+    {
+        const size_t depth = _shape.depth();
+        const size_t kernel2 = _shape.kernel * _shape.kernel;
+        for (size_t f = 0; f < _shape.filters; f++) {
+            for (size_t q = 0; q < depth; q++) {
+                size_t channel, row, col;
+                decodeDepth(q, channel, row, col);
+                T value = filters[(f * _shape.channels + channel) * kernel2 +
+                                  row * _shape.kernel + col];
+                if (_layout == CONV_NHWC) {
+                    _weights(q, f) = value;
+                } else {
+                    _weights(f, q) = value;
+                }
+            }
+        }
+        prepackWeights();
+    }
+
+    /**
+     * Sets one bias per filter, added to the outputs of the filter; null
+     * removes it.
+     */
+    void setBias(const T *bias)
+    {
+        _bias.assign(bias, bias != nullptr ? bias + _shape.filters : bias);
+    }
+
+    /**
+     * Activation applied to the outputs after the bias. Both are fused into
+     * the write of the product (see GemmEpilogue).
+     */
+    void setActivation(EpilogueActivation activation) { _activation = activation; }
+
+    /**
+     * Returns false, leaving output untouched, when an activation does not
+     * have the layer's shape (or im2col has no multiplier). Sequence and
+     * timestamp are copied to the output, like DynamicMatrixMultiplier does.
+     */
+    bool forward(const DynamicMatrix<T> &input, DynamicMatrix<T> &output)
+    {
+        if (input.rows() != inputRows() || input.cols() != inputCols() ||
+            output.rows() != outputRows() || output.cols() != outputCols() ||
+            (_lowering == CONV_IM2COL && _multiplier == nullptr)) {
+            return false;
+        }
+        output.sequence = input.sequence;
+        output.timestamp = input.timestamp;
+        // Filters are the columns of an NHWC product and the rows of an NCHW one.
+        GemmEpilogue<T> epilogue;
+        (_layout == CONV_NHWC ? epilogue.columnBias : epilogue.rowBias) =
+            _bias.empty() ? nullptr : _bias.data();
+        epilogue.activation = _activation;
+        if (_lowering == CONV_IM2COL) {
+            im2col(input.view());
+            const MatrixView<const T> patches = _patches.view();
+            const MatrixView<const T> weights = _weights.view();
+            return _layout == CONV_NHWC
+                       ? _multiplier->multiply(patches, *_packedWeights, output.view(), epilogue)
+                       : _multiplier->multiply(weights, patches, output.view(), epilogue);
+        }
+        implicitGemm(input.view(), output.view(), epilogue);
+        return true;
+    }
+
+private:
+    // Patch value q: channel-major (c, kh, kw) in NCHW, where weight rows are
+    // OIHW filters; pixel-major (kh, kw, c) in NHWC, where a patch is kernel^2
+    // runs of contiguous channels.
+    void decodeDepth(size_t q, size_t &channel, size_t &row, size_t &col) const
+    {
+        const size_t kernel = _shape.kernel;
+        if (_layout == CONV_NHWC) {
+            channel = q % _shape.channels;
+            row = q / _shape.channels / kernel;
+            col = q / _shape.channels % kernel;
+        } else {
+            channel = q / (kernel * kernel);
+            row = q / kernel % kernel;
+            col = q % kernel;
+        }
+    }
+
+    // Copies count input values of row, from column col onwards every stride
+    // columns, to out every outStride values; zero in the padding (and for
+    // the whole run when row is a padding row, nullptr).
+    void copyInputRow(const T *row, long col, size_t count, T *out, size_t outStride) const
+    {
+        const long stride = long(_shape.stride);
+        const long width = long(_shape.width);
+        size_t first = col < 0 ? size_t((-col + stride - 1) / stride) : 0;
+        size_t last = col < width ? size_t((width - col + stride - 1) / stride) : 0;
+        first = std::min(first, count);
+        last = row == nullptr ? first : std::max(first, std::min(last, count));
+        for (size_t x = 0; x < first; x++) {
+            out[x * outStride] = T();
+        }
+        if (stride == 1 && outStride == 1) {
+            std::copy(row + col + long(first), row + col + long(last), out + first);
+        } else {
+            for (size_t x = first; x < last; x++) {
+                out[x * outStride] = row[col + long(x) * stride];
+            }
+        }
+        for (size_t x = last; x < count; x++) {
+            out[x * outStride] = T();
+        }
+    }
+
+    // Input row of channel (NCHW) at image row, nullptr in the padding.
+    const T *channelRow(const MatrixView<const T> &input, size_t channel, long row) const
+    {
+        if (row < 0 || row >= long(_shape.height)) {
+            return nullptr;
+        }
+        return input.row(channel) + size_t(row) * _shape.width;
+    }
+
+    void im2col(const MatrixView<const T> &input)
+    {
+        const ConvolutionShape &s = _shape;
+        const size_t outputWidth = s.outputWidth();
+        if (_layout == CONV_NHWC) {
+            // One row per output pixel: kernel^2 runs of channels copied whole.
+            for (size_t o = 0; o < s.outputPixels(); o++) {
+                const long originRow = long(o / outputWidth * s.stride) - long(s.padding);
+                const long originCol = long(o % outputWidth * s.stride) - long(s.padding);
+                T *patch = _patches.view().row(o);
+                for (size_t kh = 0; kh < s.kernel; kh++) {
+                    for (size_t kw = 0; kw < s.kernel; kw++) {
+                        const long row = originRow + long(kh);
+                        const long col = originCol + long(kw);
+                        T *run = patch + (kh * s.kernel + kw) * s.channels;
+                        if (row < 0 || col < 0 || row >= long(s.height) || col >= long(s.width)) {
+                            std::fill(run, run + s.channels, T());
+                        } else {
+                            const T *pixel = input.row(size_t(row) * s.width + size_t(col));
+                            std::copy(pixel, pixel + s.channels, run);
+                        }
+                    }
+                }
+            }
+            return;
+        }
+        // One row per (channel, kh, kw): a strided copy of each input row.
+        for (size_t q = 0; q < s.depth(); q++) {
+            const size_t channel = q / (s.kernel * s.kernel);
+            const size_t kh = q / s.kernel % s.kernel;
+            const size_t kw = q % s.kernel;
+            T *row = _patches.view().row(q);
+            for (size_t oh = 0; oh < s.outputHeight(); oh++) {
+                const long inputRow = long(oh * s.stride + kh) - long(s.padding);
+                copyInputRow(channelRow(input, channel, inputRow),
+                             long(kw) - long(s.padding),
+                             outputWidth,
+                             row + oh * outputWidth,
+                             1);
+            }
+        }
+    }
+
+    // Packs the rows x depth block at (i, p) of the NHWC patch matrix like
+    // packPanelA(): each patch is kernel^2 runs of contiguous input channels.
+    void packPatchesA(const MatrixView<const T> &input,
+                      size_t i,
+                      size_t p,
+                      size_t rows,
+                      size_t depth,
+                      size_t mr,
+                      T *packed) const
+    {
+        const ConvolutionShape &s = _shape;
+        for (size_t ir = 0; ir < rows; ir += mr, packed += depth * mr) {
+            const size_t panelRows = std::min(mr, rows - ir);
+            for (size_t r = 0; r < mr; r++) {
+                if (r >= panelRows) {
+                    for (size_t q = 0; q < depth; q++) {
+                        packed[q * mr + r] = T();
+                    }
+                    continue;
+                }
+                const size_t o = i + ir + r;
+                const long originRow = long(o / s.outputWidth() * s.stride) - long(s.padding);
+                const long originCol = long(o % s.outputWidth() * s.stride) - long(s.padding);
+                for (size_t q = p; q < p + depth;) {
+                    const size_t cell = q / s.channels;
+                    const size_t channel = q % s.channels;
+                    const size_t run = std::min(s.channels - channel, p + depth - q);
+                    const long row = originRow + long(cell / s.kernel);
+                    const long col = originCol + long(cell % s.kernel);
+                    T *out = packed + (q - p) * mr + r;
+                    if (row < 0 || col < 0 || row >= long(s.height) || col >= long(s.width)) {
+                        for (size_t x = 0; x < run; x++) {
+                            out[x * mr] = T();
+                        }
+                    } else {
+                        const T *in = input.row(size_t(row) * s.width + size_t(col)) + channel;
+                        for (size_t x = 0; x < run; x++) {
+                            out[x * mr] = in[x];
+                        }
+                    }
+                    q += run;
+                }
+            }
+        }
+    }
+
+    // Packs the depth x cols block at (p, j) of the NCHW patch matrix like
+    // packPanelB(): consecutive output pixels of one output row read one
+    // input row every stride columns.
+    void packPatchesB(const MatrixView<const T> &input,
+                      size_t p,
+                      size_t j,
+                      size_t depth,
+                      size_t cols,
+                      size_t nr,
+                      T *packed) const
+    {
+        const ConvolutionShape &s = _shape;
+        const size_t outputWidth = s.outputWidth();
+        for (size_t jr = 0; jr < cols; jr += nr) {
+            const size_t panelCols = std::min(nr, cols - jr);
+            for (size_t q = p; q < p + depth; q++, packed += nr) {
+                size_t channel, kh, kw;
+                decodeDepth(q, channel, kh, kw);
+                for (size_t done = 0; done < panelCols;) {
+                    const size_t o = j + jr + done;
+                    const size_t oh = o / outputWidth;
+                    const size_t ow = o % outputWidth;
+                    const size_t run = std::min(panelCols - done, outputWidth - ow);
+                    copyInputRow(channelRow(input, channel, long(oh * s.stride + kh) -
+                                                                long(s.padding)),
+                                 long(ow * s.stride + kw) - long(s.padding),
+                                 run,
+                                 packed + done,
+                                 1);
+                    done += run;
+                }
+                std::fill(packed + panelCols, packed + nr, T());
+            }
+        }
+    }
+
+    void prepackWeights()
+    {
+        if (_layout != CONV_NHWC) {
+            return;
+        }
+        if (_lowering == CONV_IMPLICIT_GEMM) {
+            const MatrixView<const T> weights = _weights.view();
+            _weightPanels =
+                _gemm.prepackB(weights.rows, weights.cols, weights.data, weights.stride);
+        } else if (_multiplier != nullptr) {
+            _packedWeights = _multiplier->prepack(_weights);
+        }
+    }
+
+    void implicitGemm(const MatrixView<const T> &input,
+                      const MatrixView<T> &output,
+                      const GemmEpilogue<T> &epilogue) const
+    {
+        const MatrixShape product = _shape.gemmShape(_layout);
+        const MatrixView<const T> weights = _weights.view();
+        if (_layout == CONV_NHWC) {
+            // A is the patch matrix: mr output pixels per micro-panel.
+            _gemm.multiplyPrepacked(
+                product.m,
+                [this, &input](
+                    size_t i, size_t p, size_t rows, size_t depth, size_t mr, T *packed) {
+                    packPatchesA(input, i, p, rows, depth, mr, packed);
+                },
+                *_weightPanels,
+                output.data,
+                output.stride,
+                &epilogue);
+            return;
+        }
+        // B is the patch matrix: nr output pixels per micro-panel.
+        _gemm.multiplyPacked(
+            product.m,
+            product.n,
+            product.k,
+            [&weights](size_t i, size_t p, size_t rows, size_t depth, size_t mr, T *packed) {
+                packPanelA(rows, depth, mr, weights.row(i) + p, weights.stride, packed);
+            },
+            [this, &input](size_t p, size_t j, size_t depth, size_t cols, size_t nr, T *packed) {
+                packPatchesB(input, p, j, depth, cols, nr, packed);
+            },
+            output.data,
+            output.stride,
+            &epilogue);
+    }
+
+    ConvolutionShape _shape;
+    ConvolutionLayout _layout;
+    ConvolutionLowering _lowering;
+    DynamicMatrixMultiplier<T> *_multiplier;
+    PackedGemm<T> _gemm;
+    DynamicMatrix<T> _weights;
+    std::shared_ptr<const PackedMatrix<T>> _packedWeights;
+    std::shared_ptr<const typename PackedGemm<T>::PackedB> _weightPanels;
+    DynamicMatrix<T> _patches;
+    std::vector<T> _bias;
+    EpilogueActivation _activation;
+};
+
+/**
+ * Fills a layer input (or any activation) with Philox uniform values: [-1, 1)
+ * for floating point types, -8..8 for integers.
+ */
+template<class T>
+void fillActivation(DynamicMatrix<T> &activation, uint64_t seed, uint64_t stream = 0)
+{
+    const T low = std::is_integral<T>::value ? T(-8) : T(-1);
+    const T high = std::is_integral<T>::value ? T(8) : T(1);
+    Philox4x32 rng(seed);
+    for (size_t i = 0; i < activation.rows(); i++) {
+        rng.fillUniform(&activation(i, 0),
+                        activation.cols(),
+                        low,
+                        high,
+                        i * Philox4x32::blocksFor<T>(activation.cols()),
+                        stream);
+    }
+}
+
+/**
+ * Filters (OIHW) with Philox uniform values scaled so that activations keep
+ * their magnitude from layer to layer: within 1 / sqrt(depth) for floating
+ * point types, -1..1 for integers.
+ */
+template<class T>
+std::vector<T> randomFilters(const ConvolutionShape &shape, uint64_t seed)
+{
+    std::vector<T> filters(shape.filters * shape.depth());
+    Philox4x32 rng(seed);
+    if (std::is_integral<T>::value) {
+        rng.fillUniform(filters.data(), filters.size(), T(-1), T(1), 0);
+    } else {
+        const double bound = 1.0 / std::sqrt(double(shape.depth()));
+        rng.fillUniform(filters.data(), filters.size(), T(-bound), T(bound), 0);
+    }
+    return filters;
+}
+
+/**
+ * One Philox uniform bias per filter, within -1..1 (-1, 0 or 1 for integers).
+ */
+template<class T>
+std::vector<T> randomBias(const ConvolutionShape &shape, uint64_t seed)
+{
+    std::vector<T> bias(shape.filters);
+    Philox4x32(seed).fillUniform(bias.data(), bias.size(), T(-1), T(1), 0, 1);
+    return bias;
+}
+
+/**
+ * Checks layer against a direct convolution of the same input and OIHW
+ * filters, followed by the layer's bias and activation, with the tolerance of
+ * checkProductRows() (the lowered product's inner size is the patch depth).
+ * Returns a failure description, empty when every output matches.
+ */
+template<class T>
+KPSR_PRECISE_MATH std::string checkConvolution(ConvolutionLayer<T> &layer,
+                                               const DynamicMatrix<T> &input,
+                                               const std::vector<T> &filters,
+                                               double &worstErrorRatio)
+{
+    typedef typename VerificationTraits<T>::Accumulator Accumulator;
+    const ConvolutionShape &s = layer.shape();
+    const ConvolutionLayout layout = layer.layout();
+    DynamicMatrix<T> output(layer.outputRows(), layer.outputCols());
+    for (size_t i = 0; i < output.rows(); i++) {
+        std::fill(&output(i, 0), &output(i, 0) + output.cols(), VerificationTraits<T>::poison());
+    }
+    if (!layer.forward(input, output)) {
+        return "activation shapes rejected";
+    }
+    const bool fused = !layer.bias().empty() || layer.activation() != EPILOGUE_IDENTITY;
+    const double scale = (s.depth() + (fused ? 4 : 2)) * VerificationTraits<T>::epsilon() +
+                         (fused ? 2 : 1) * VerificationTraits<T>::roundoff();
+    GemmEpilogue<T> epilogue;
+    epilogue.activation = layer.activation();
+    typename GemmEpilogue<T>::Compute low, high;
+    epilogue.bounds(low, high);
+    for (size_t f = 0; f < s.filters; f++) {
+        const double bias = layer.bias().empty() ? 0.0 : double(layer.bias()[f]);
+        for (size_t o = 0; o < s.outputPixels(); o++) {
+            const long originRow = long(o / s.outputWidth() * s.stride) - long(s.padding);
+            const long originCol = long(o % s.outputWidth() * s.stride) - long(s.padding);
+            Accumulator sum = 0;
+            double magnitude = 0;
+            long long exact = 0;
+            for (size_t c = 0; c < s.channels; c++) {
+                for (size_t kh = 0; kh < s.kernel; kh++) {
+                    for (size_t kw = 0; kw < s.kernel; kw++) {
+                        const long row = originRow + long(kh);
+                        const long col = originCol + long(kw);
+                        if (row < 0 || col < 0 || row >= long(s.height) || col >= long(s.width)) {
+                            continue;
+                        }
+                        const size_t pixel = size_t(row) * s.width + size_t(col);
+                        const T x = layout == CONV_NHWC ? input(pixel, c) : input(c, pixel);
+                        const T w = filters[((f * s.channels + c) * s.kernel + kh) * s.kernel + kw];
+                        if (VerificationTraits<T>::exact) {
+                            exact += static_cast<long long>(x) * static_cast<long long>(w);
+                        } else {
+                            const Accumulator product = Accumulator(x) * Accumulator(w);
+                            sum += product;
+                            magnitude += std::fabs(double(product));
+                        }
+                    }
+                }
+            }
+            const T value = layout == CONV_NHWC ? output(o, f) : output(f, o);
+            bool ok;
+            double expected;
+            if constexpr (VerificationTraits<T>::exact) {
+                auto saturate = [](long long x) {
+                    return VerificationTraits<T>::saturating
+                               ? std::min<long long>(
+                                     std::numeric_limits<T>::max(),
+                                     std::max<long long>(std::numeric_limits<T>::min(), x))
+                               : x;
+                };
+                exact = saturate(exact);
+                if (fused) {
+                    exact += static_cast<long long>(bias);
+                    exact = saturate(std::min<long long>(high, std::max<long long>(low, exact)));
+                }
+                expected = double(exact);
+                ok = static_cast<long long>(value) == exact;
+            } else {
+                expected = std::min(double(high), std::max(double(low), double(sum) + bias));
+                const double tolerance =
+                    scale * (magnitude + std::fabs(bias)) + VerificationTraits<T>::smallest();
+                const double error = std::fabs(double(Accumulator(value)) - expected);
+                ok = error <= tolerance;
+                if (ok) {
+                    worstErrorRatio = std::max(worstErrorRatio, error / tolerance);
+                }
+            }
+            if (!ok) {
+                std::ostringstream failure;
+                failure << "filter " << f << ", pixel " << o << " = " << +value << ", expected "
+                        << expected;
+                return failure.str();
+            }
+        }
+    }
+    return std::string();
+}
+
+/**
+ * Runs both lowerings in both layouts, im2col on multiplier, over layers
+ * covering 1x1 kernels, stride 2, padding wider than the kernel reach and
+ * odd sizes, against a direct convolution. Every other layer has a bias and
+ * the layers cycle through the activations.
+ */
+template<class T>
+VerificationReport verifyConvolutionLayers(DynamicMatrixMultiplier<T> &multiplier)
+{
+    VerificationReport report;
+    const std::vector<ConvolutionShape> shapes = {{1, 1, 1, 1, 1, 1, 0},
+                                                  {3, 9, 7, 5, 3, 1, 1},
+                                                  {4, 11, 13, 7, 3, 2, 1},
+                                                  {16, 8, 8, 8, 1, 1, 0},
+                                                  {5, 6, 5, 3, 5, 1, 2},
+                                                  {2, 4, 4, 3, 3, 3, 2},
+                                                  {17, 15, 14, 33, 3, 1, 1}};
+    const EpilogueActivation activations[] = {EPILOGUE_IDENTITY, EPILOGUE_RELU, EPILOGUE_RELU6};
+    uint64_t seed = 0xc0de;
+    size_t index = 0;
+    for (const ConvolutionShape &shape : shapes) {
+        const std::vector<T> filters = randomFilters<T>(shape, seed++);
+        const std::vector<T> bias = randomBias<T>(shape, seed++);
+        const EpilogueActivation activation = activations[index % 3];
+        for (ConvolutionLayout layout : {CONV_NCHW, CONV_NHWC}) {
+            for (ConvolutionLowering lowering : {CONV_IM2COL, CONV_IMPLICIT_GEMM}) {
+                ConvolutionLayer<T> layer(shape, layout, lowering, &multiplier);
+                layer.setFilters(filters.data());
+                layer.setBias(index % 2 == 1 ? bias.data() : nullptr);
+                layer.setActivation(activation);
+                DynamicMatrix<T> input(layer.inputRows(), layer.inputCols());
+                fillActivation(input, seed++);
+                report.cases++;
+                std::string failure =
+                    checkConvolution(layer, input, filters, report.worstErrorRatio);
+                if (!failure.empty() && report.failedCases++ == 0) {
+                    report.firstFailure = shape.describe() + " " + convolutionLayoutName(layout) +
+                                          " " + convolutionLoweringName(lowering) + " " +
+                                          epilogueActivationName(activation) + ": " + failure;
+                }
+            }
+        }
+        index++;
+    }
+    return report;
+}
+
+#endif // MATRIX_CONVOLUTION_H
@@ -1,62 +1,250 @@
 #ifndef MATRIX_DATA_FACTORY_H
 #define MATRIX_DATA_FACTORY_H
 
-#include <functional>
-#include <klepsydra/matrix_mult_benchmark/matrix.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <klepsydra/matrix_mult_benchmark/latency_histogram.h>
+#include <klepsydra/matrix_mult_benchmark/matrix.h>
+#include <klepsydra/matrix_mult_benchmark/matrix_arena.h>
+#include <klepsydra/matrix_mult_benchmark/philox_random.h>
+#include <klepsydra/matrix_mult_benchmark/task_runtime.h>
 
 namespace kpsr {
 namespace matrix_mult_benchmark {
 
 enum MatrixType { IDENTITY = 0, CONSTANT, RANDOM };
 
+/**
+ * Producer side input: a ring of ringSize distinct matrices generated up front
+ * (RANDOM ones with Philox4x32, in parallel on the TaskRuntime) and handed out
+ * as immutable slots. A slot is only stamped and handed out again once every
+ * consumer has released it, so a slow consumer never sees its input change.
+ *
+ * With backgroundRefill, released RANDOM slots are regenerated with fresh
+ * numbers by a helper thread, off the producer's path, so long runs do not
+ * cycle through the same ringSize matrices.
+ *
+ * The ring lives in a MatrixArena on the pages of the given policy.
+ *
+ * generateMatrix() is meant for a single producer thread.
+ */
 template<class T, size_t cols, size_t rows>
 class MatrixDataFactory
 {
 public:
-    MatrixDataFactory(MatrixType type, const T &value, std::function<T()> randomGenerator)
+    typedef std::shared_ptr<const Matrix<T, cols, rows>> Slot;
+
+    static constexpr size_t DEFAULT_RING_SIZE = 16;
+
+    MatrixDataFactory(MatrixType type,
+                      const T &value,
+                      T randomMin,
+                      T randomMax,
+                      size_t ringSize = DEFAULT_RING_SIZE,
+                      bool backgroundRefill = false,
+                      PagePolicy pages = PAGES_DEFAULT,
+                      uint64_t seed = std::random_device()())
         : _sequence(0)
-        , _type(type)
-        , _matrix(new Matrix<T, cols, rows>(_sequence))
-        , _randomGenerator(randomGenerator)
+        , _cursor(0)
+        , _state(std::make_shared<State>(type,
+                                         randomMin,
+                                         randomMax,
+                                         std::max<size_t>(ringSize, 1),
+                                         backgroundRefill && type == RANDOM,
+                                         pages,
+                                         seed))
     {
+        State &state = *_state;
         for (size_t i = 0; i < cols; i++) {
             for (size_t j = 0; j < rows; j++) {
-                if (type == IDENTITY) {
-                    if (i == j) {
-                        _matrix->data[i][j] = 1;
-                    } else {
-                        _matrix->data[i][j] = 0;
-                    }
-                }
-                if (type == CONSTANT) {
-                    _matrix->data[i][j] = value;
-                }
+                state.pattern.data[i][j] = type == IDENTITY ? T(i == j ? 1 : 0) : value;
+            }
+        }
+        TaskRuntime::instance().parallelFor(state.slots.size(),
+                                            1,
+                                            [&state](size_t begin, size_t end) {
+                                                for (size_t slot = begin; slot < end; slot++) {
+                                                    state.fill(*state.slots[slot], slot);
+                                                }
+                                            });
+        state.generation = state.slots.size();
+        if (state.refill) {
+            _refillThread = std::thread([state = _state]() { state->refillLoop(); });
+        }
+    }
+
+    ~MatrixDataFactory()
+    {
+        if (_refillThread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(_state->mutex);
+                _state->stopping = true;
+            }
+            _state->wakeUp.notify_all();
+            _refillThread.join();
+        }
+    }
+
+    /**
+     * Next ready slot of the ring with a new sequence number and timestamp.
+     * When every slot is still in flight a freshly generated heap matrix is
+     * returned instead and counted in misses().
+     */
+    Slot generateMatrix()
+    {
+        State &state = *_state;
+        const size_t ringSize = state.slots.size();
+        for (size_t tried = 0; tried < ringSize; tried++) {
+            size_t index = _cursor;
+            _cursor = (_cursor + 1) % ringSize;
+            if (state.status[index].load(std::memory_order_acquire) != SLOT_READY) {
+                continue;
             }
+            state.status[index].store(SLOT_IN_USE, std::memory_order_relaxed);
+            Matrix<T, cols, rows> *matrix = state.slots[index];
+            stamp(*matrix);
+            std::shared_ptr<State> owner = _state;
+            return Slot(matrix, [owner, index](const Matrix<T, cols, rows> *) {
+                owner->release(index);
+            });
         }
+        _misses++;
+        auto matrix = std::make_shared<Matrix<T, cols, rows>>();
+        state.fill(*matrix, MISS_STREAMS + _misses);
+        stamp(*matrix);
+        return matrix;
     }
 
-    std::shared_ptr<Matrix<T, cols, rows>> generateMatrix()
+    size_t ringSize() const { return _state->slots.size(); }
+    const MatrixArena &arena() const { return _state->arena; }
+    size_t misses() const { return _misses; }
+    size_t refills() const { return _state->refills.load(); }
+
+private:
+    enum SlotStatus { SLOT_READY = 0, SLOT_IN_USE, SLOT_STALE };
+
+    // Philox streams of the matrices generated on a miss, far above the ones
+    // used by ring fills.
+    static constexpr uint64_t MISS_STREAMS = uint64_t(1) << 63;
+
+    struct State
     {
-        _matrix->sequence = ++_sequence;
-        _matrix->timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
-                                 std::chrono::system_clock::now().time_since_epoch())
-                                 .count();
-        if (_type == RANDOM) {
+        State(MatrixType type,
+              T randomMin,
+              T randomMax,
+              size_t ringSize,
+              bool refill,
+              PagePolicy pages,
+              uint64_t seed)
+            : type(type)
+            , randomMin(randomMin)
+            , randomMax(randomMax)
+            , refill(refill)
+            , rng(seed)
+            , arena(pages, ringSize * sizeof(Matrix<T, cols, rows>))
+            , slots(ringSize)
+            , status(ringSize)
+            , generation(0)
+            , refills(0)
+            , stopping(false)
+        {
+            for (size_t slot = 0; slot < ringSize; slot++) {
+                slots[slot] = arena.create<Matrix<T, cols, rows>>();
+                status[slot].store(SLOT_READY);
+            }
+        }
+
+        /**
+         * Fills a matrix; stream picks the Philox stream so every fill of a
+         * RANDOM matrix draws numbers no other fill used.
+         */
+        void fill(Matrix<T, cols, rows> &matrix, uint64_t stream)
+        {
+            if (type != RANDOM) {
+                matrix = pattern;
+                return;
+            }
             for (size_t i = 0; i < cols; i++) {
-                for (size_t j = 0; j < rows; j++) {
-                    _matrix->data[i][j] = _randomGenerator();
+                rng.fillUniform(matrix.data[i],
+                                rows,
+                                randomMin,
+                                randomMax,
+                                i * Philox4x32::blocksFor<T>(rows),
+                                stream);
+            }
+        }
+
+        void release(size_t slot)
+        {
+            if (!refill) {
+                status[slot].store(SLOT_READY, std::memory_order_release);
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                status[slot].store(SLOT_STALE, std::memory_order_relaxed);
+            }
+            wakeUp.notify_one();
+        }
+
+        void refillLoop()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!stopping) {
+                bool filled = false;
+                for (size_t slot = 0; slot < slots.size(); slot++) {
+                    if (status[slot].load(std::memory_order_relaxed) != SLOT_STALE) {
+                        continue;
+                    }
+                    uint64_t fillGeneration = generation++;
+                    lock.unlock();
+                    fill(*slots[slot], fillGeneration);
+                    refills++;
+                    lock.lock();
+                    status[slot].store(SLOT_READY, std::memory_order_release);
+                    filled = true;
+                }
+                if (!filled) {
+                    wakeUp.wait(lock);
                 }
             }
         }
-        return _matrix;
+
+        MatrixType type;
+        T randomMin;
+        T randomMax;
+        bool refill;
+        Philox4x32 rng;
+        Matrix<T, cols, rows> pattern;
+        MatrixArena arena;
+        std::vector<Matrix<T, cols, rows> *> slots;
+        std::vector<std::atomic<int>> status;
+        uint64_t generation;
+        std::atomic<size_t> refills;
+        bool stopping;
+        std::mutex mutex;
+        std::condition_variable wakeUp;
+    };
+
+    void stamp(Matrix<T, cols, rows> &matrix)
+    {
+        matrix.sequence = ++_sequence;
+        matrix.timestamp = steadyClockNanos();
+        matrix.stageTimestamp = matrix.timestamp;
     }
 
-private:
     int _sequence;
-    MatrixType _type;
-    std::shared_ptr<Matrix<T, cols, rows>> _matrix;
-    std::function<T()> _randomGenerator;
+    size_t _cursor;
+    size_t _misses = 0;
+    std::shared_ptr<State> _state;
+    std::thread _refillThread;
 };
 } // namespace matrix_mult_benchmark
 } // namespace kpsr
@@ -1,43 +1,134 @@
 #ifndef MATRIX_EIGEN_MULTIPLIER_H
 #define MATRIX_EIGEN_MULTIPLIER_H
 
+#include <dynamic_matrix_multiplier.h>
+#include <matrix_backend_registry.h>
 #include <matrix_multiplier.h>
+#include <task_runtime.h>
 
 #include <eigen3/Eigen/Dense>
 
+#include <algorithm>
 #include <atomic>
 
+/**
+ * Eigen::Map alignment hint matching MatrixStorage<T, rows>.
+ */
+template<class T, size_t rows>
+constexpr int eigenMapAlignment()
+{
+    return MatrixStorage<T, rows>::alignment >= 64   ? Eigen::Aligned64
+           : MatrixStorage<T, rows>::alignment >= 32 ? Eigen::Aligned32
+           : MatrixStorage<T, rows>::alignment >= 16 ? Eigen::Aligned16
+                                                     : Eigen::Unaligned;
+}
+
+/**
+ * Fixed-size Eigen::Map over a Matrix<T, rows, cols> (rows of cols elements):
+ * row-major with the padded row stride. Eigen only accepts column vectors as
+ * column-major, where the stride then separates consecutive elements.
+ */
+template<class T, size_t rows, size_t cols, bool columnVector = (cols == 1 && rows != 1)>
+struct EigenMatrixMap
+{
+    typedef Eigen::Matrix<T, rows, cols, Eigen::RowMajor> Type;
+    typedef Eigen::Map<Type,
+                       eigenMapAlignment<T, cols>(),
+                       Eigen::OuterStride<Matrix<T, rows, cols>::stride>>
+        Map;
+    typedef Eigen::Map<const Type,
+                       eigenMapAlignment<T, cols>(),
+                       Eigen::OuterStride<Matrix<T, rows, cols>::stride>>
+        ConstMap;
+};
+
+template<class T, size_t rows, size_t cols>
+struct EigenMatrixMap<T, rows, cols, true>
+{
+    typedef Eigen::Matrix<T, rows, 1, Eigen::ColMajor> Type;
+    typedef Eigen::Map<Type,
+                       eigenMapAlignment<T, cols>(),
+                       Eigen::InnerStride<Matrix<T, rows, cols>::stride>>
+        Map;
+    typedef Eigen::Map<const Type,
+                       eigenMapAlignment<T, cols>(),
+                       Eigen::InnerStride<Matrix<T, rows, cols>::stride>>
+        ConstMap;
+};
+
 template<class T, size_t colsLeft, size_t rowsLeft, size_t rowsRight>
 class MatrixTemplatedEigenMultiplier : public MatrixMultiplier<T, colsLeft, rowsLeft, rowsRight>
 {
-    typedef Eigen::Matrix<T, colsLeft, rowsRight, Eigen::RowMajor> RowMatrixXT;
+    typedef typename EigenMatrixMap<T, colsLeft, rowsLeft>::ConstMap LeftMap;
+    typedef typename EigenMatrixMap<T, rowsLeft, rowsRight>::ConstMap RightMap;
+    typedef typename EigenMatrixMap<T, colsLeft, rowsRight>::Map ResultMap;
 
 public:
+    /**
+     * With useTaskRuntime set, the rows of C are computed as row-block tasks on
+     * the shared TaskRuntime instead of Eigen's own threading.
+     */
+    explicit MatrixTemplatedEigenMultiplier(bool useTaskRuntime = false)
+        : _useTaskRuntime(useTaskRuntime)
+    {}
+
     void multiply(const Matrix<T, colsLeft, rowsLeft> &A,
                   const Matrix<T, rowsLeft, rowsRight> &B,
                   Matrix<T, colsLeft, rowsRight> &C) override
     {
         C.sequence = A.sequence;
         C.timestamp = A.timestamp;
-        Eigen::Map<const Eigen::Matrix<T, colsLeft, rowsLeft, Eigen::StorageOptions::ColMajor>>
-            A_e(A.data[0], colsLeft, rowsLeft);
-        Eigen::Map<const Eigen::Matrix<T, rowsLeft, rowsRight, Eigen::StorageOptions::RowMajor>>
-            B_e(B.data[0], rowsLeft, rowsRight);
+        LeftMap A_e(A.data[0], colsLeft, rowsLeft);
+        RightMap B_e(B.data[0], rowsLeft, rowsRight);
 
-        Eigen::Map<RowMatrixXT>(&C.data[0][0], colsLeft, rowsRight) = A_e * B_e;
+        if (_useTaskRuntime) {
+            ResultMap C_e(&C.data[0][0], colsLeft, rowsRight);
+            TaskRuntime &runtime = TaskRuntime::instance();
+            runtime.parallelFor(colsLeft,
+                                runtime.grainFor(colsLeft, 8),
+                                [&](size_t begin, size_t end) {
+                                    C_e.middleRows(begin, end - begin).noalias() =
+                                        A_e.middleRows(begin, end - begin) * B_e;
+                                });
+        } else {
+            ResultMap(&C.data[0][0], colsLeft, rowsRight).noalias() = A_e * B_e;
+        }
         numberOfMultiplications++;
     }
 
+    void multiplyBatch(const Matrix<T, colsLeft, rowsLeft> *A,
+                       const Matrix<T, rowsLeft, rowsRight> *B,
+                       Matrix<T, colsLeft, rowsRight> *C,
+                       size_t n) override
+    {
+        // Fixed size maps cost nothing to build; C must not alias A or B.
+        TaskRuntime::instance().parallelFor(n, 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                C[i].sequence = A[i].sequence;
+                C[i].timestamp = A[i].timestamp;
+                LeftMap A_e(A[i].data[0], colsLeft, rowsLeft);
+                RightMap B_e(B[i].data[0], rowsLeft, rowsRight);
+
+                ResultMap(&C[i].data[0][0], colsLeft, rowsRight).noalias() = A_e * B_e;
+            }
+        });
+        numberOfMultiplications += static_cast<int>(n);
+    }
+
     virtual ~MatrixTemplatedEigenMultiplier() {}
 
     static std::atomic<int> numberOfMultiplications;
+
+private:
+    bool _useTaskRuntime;
 };
 
 template<class T, size_t colsLeft, size_t rowsLeft, size_t rowsRight>
 class MatrixDynamicEigenMultiplier : public MatrixMultiplier<T, colsLeft, rowsLeft, rowsRight>
 {
     typedef Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> EigenRowMatrix;
-    typedef Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::ColMajor> EigenColMatrix;
+    typedef Eigen::Map<const EigenRowMatrix, Eigen::Unaligned, Eigen::OuterStride<>> ConstRowMap;
+    typedef Eigen::Map<EigenRowMatrix, Eigen::Unaligned, Eigen::OuterStride<>> RowMap;
 
 public:
     void multiply(const Matrix<T, colsLeft, rowsLeft> &A,
@@ -46,12 +137,11 @@ public:
     {
         C.sequence = A.sequence;
         C.timestamp = A.timestamp;
-        Eigen::Map<const EigenRowMatrix> A_e(A.data[0], colsLeft, rowsLeft);
-        Eigen::Map<const EigenRowMatrix> B_e(B.data[0], rowsLeft, rowsRight);
+        ConstRowMap A_e(A.data[0], colsLeft, rowsLeft, Eigen::OuterStride<>(A.stride));
+        ConstRowMap B_e(B.data[0], rowsLeft, rowsRight, Eigen::OuterStride<>(B.stride));
 
-        Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> C_e;
-        C_e.resize(colsLeft, rowsRight);
-        C_e = A_e * B_e;
+        RowMap C_e(C.data[0], colsLeft, rowsRight, Eigen::OuterStride<>(C.stride));
+        C_e.noalias() = A_e * B_e;
 
         numberOfMultiplications++;
     }
@@ -61,6 +151,105 @@ public:
     static std::atomic<int> numberOfMultiplications;
 };
 
+/**
+ * Eigen product on run-time shapes, mapped in place through the view strides.
+ */
+template<class T>
+class DynamicMatrixEigenMultiplier : public DynamicMatrixMultiplier<T>
+{
+    typedef Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> EigenRowMatrix;
+    typedef Eigen::Map<const EigenRowMatrix, Eigen::Unaligned, Eigen::OuterStride<>> ConstRowMap;
+    typedef Eigen::Map<EigenRowMatrix, Eigen::Unaligned, Eigen::OuterStride<>> RowMap;
+
+public:
+    /**
+     * See MatrixTemplatedEigenMultiplier.
+     */
+    explicit DynamicMatrixEigenMultiplier(bool useTaskRuntime = false)
+        : _useTaskRuntime(useTaskRuntime)
+        , _threads(0)
+    {}
+
+    // Eigen's own threading is process-wide (Eigen::setNbThreads), so only
+    // the task runtime split can be capped per multiplier.
+    bool setNumThreads(size_t threads) override
+    {
+        _threads.store(threads, std::memory_order_relaxed);
+        return _useTaskRuntime;
+    }
+
+    virtual ~DynamicMatrixEigenMultiplier() {}
+
+protected:
+    void compute(const MatrixView<const T> &A,
+                 const MatrixView<const T> &B,
+                 const MatrixView<T> &C) override
+    {
+        ConstRowMap A_e(A.data, A.rows, A.cols, Eigen::OuterStride<>(A.stride));
+        ConstRowMap B_e(B.data, B.rows, B.cols, Eigen::OuterStride<>(B.stride));
+        RowMap C_e(C.data, C.rows, C.cols, Eigen::OuterStride<>(C.stride));
+
+        if (_useTaskRuntime) {
+            const size_t threads = _threads.load(std::memory_order_relaxed);
+            TaskRuntime &runtime = TaskRuntime::instance();
+            runtime.parallelFor(C.rows,
+                                runtime.grainFor(C.rows, 8, threads),
+                                [&](size_t begin, size_t end) {
+                                    C_e.middleRows(begin, end - begin).noalias() =
+                                        A_e.middleRows(begin, end - begin) * B_e;
+                                });
+        } else {
+            C_e.noalias() = A_e * B_e;
+        }
+    }
+
+    // Eigen's product cannot call back per tile, so C is computed in row
+    // panels of about L2 size, each one finished by the epilogue before the
+    // next is multiplied.
+    void computeFused(const MatrixView<const T> &A,
+                      const MatrixView<const T> &B,
+                      const MatrixView<T> &C,
+                      const GemmEpilogue<T> &epilogue) override
+    {
+        ConstRowMap A_e(A.data, A.rows, A.cols, Eigen::OuterStride<>(A.stride));
+        ConstRowMap B_e(B.data, B.rows, B.cols, Eigen::OuterStride<>(B.stride));
+        RowMap C_e(C.data, C.rows, C.cols, Eigen::OuterStride<>(C.stride));
+        const size_t panel = std::max<size_t>(8, EPILOGUE_PANEL_BYTES / (C.cols * sizeof(T)));
+
+        auto multiplyRows = [&](size_t begin, size_t end) {
+            for (size_t first = begin; first < end; first += panel) {
+                const size_t rows = std::min(panel, end - first);
+                C_e.middleRows(first, rows).noalias() = A_e.middleRows(first, rows) * B_e;
+                epilogue.apply(C.row(first), C.stride, first, 0, rows, C.cols);
+            }
+        };
+        if (_useTaskRuntime) {
+            const size_t threads = _threads.load(std::memory_order_relaxed);
+            TaskRuntime &runtime = TaskRuntime::instance();
+            runtime.parallelFor(C.rows, runtime.grainFor(C.rows, 8, threads), multiplyRows);
+        } else {
+            multiplyRows(0, C.rows);
+        }
+    }
+
+    // Maps cost nothing to build, so the products of a batch run as runtime
+    // tasks whatever the variant.
+    void computeBatch(const MatrixView<const T> *A,
+                      const MatrixView<const T> *B,
+                      const MatrixView<T> *C,
+                      size_t n) override
+    {
+        this->computeBatchOnRuntime(A, B, C, n);
+    }
+
+private:
+    static constexpr size_t EPILOGUE_PANEL_BYTES = 128 * 1024;
+
+    bool _useTaskRuntime;
+    // Set by ThreadBudget::rebalance() while other threads multiply.
+    std::atomic<size_t> _threads;
+};
+
 template<class T, size_t colsLeft, size_t rowsLeft, size_t rowsRight>
 std::atomic<int> 
     MatrixTemplatedEigenMultiplier<T, colsLeft, rowsLeft, rowsRight>::numberOfMultiplications(0);
@@ -69,4 +258,8 @@ template<class T, size_t colsLeft, size_t rowsLeft, size_t rowsRight>
 std::atomic<int> 
     MatrixDynamicEigenMultiplier<T, colsLeft, rowsLeft, rowsRight>::numberOfMultiplications(0);
 
+inline const bool eigenBackendRegistered =
+    registerMatrixBackend<DynamicMatrixEigenMultiplier>("eigen", 20) &&
+    registerMatrixBackend<DynamicMatrixEigenMultiplier>("eigen (task runtime)", 21, true);
+
 #endif
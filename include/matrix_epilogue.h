@@ -0,0 +1,175 @@
+#ifndef MATRIX_EPILOGUE_H
+#define MATRIX_EPILOGUE_H
+
+#include <cstddef>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <type_traits>
+
+/**
+ * Activation of a GemmEpilogue: EPILOGUE_CLAMP keeps values in
+ * [clampLow, clampHigh], ReLU6 in [0, 6].
+ */
+enum EpilogueActivation { EPILOGUE_IDENTITY = 0, EPILOGUE_RELU, EPILOGUE_RELU6, EPILOGUE_CLAMP };
+
+inline const char *epilogueActivationName(EpilogueActivation activation)
+{
+    return activation == EPILOGUE_RELU    ? "relu"
+           : activation == EPILOGUE_RELU6 ? "relu6"
+           : activation == EPILOGUE_CLAMP ? "clamp"
+                                          : "none";
+}
+
+inline bool parseEpilogueActivation(const std::string &name, EpilogueActivation &activation)
+{
+    for (EpilogueActivation candidate :
+         {EPILOGUE_IDENTITY, EPILOGUE_RELU, EPILOGUE_RELU6, EPILOGUE_CLAMP}) {
+        if (name == epilogueActivationName(candidate)) {
+            activation = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Arithmetic of the epilogue for elements of type T: float for float and the
+ * 16-bit float types, double for double, 64-bit integers for integer types,
+ * whose result is saturated to the type for int8 and int16 (like the
+ * quantized products) and wraps for int.
+ */
+template<class T>
+struct EpilogueTraits
+{
+    typedef typename std::conditional<
+        std::is_integral<T>::value,
+        long long,
+        typename std::conditional<std::is_same<T, double>::value, double, float>::type>::type
+        Compute;
+
+    static T store(Compute value)
+    {
+        if constexpr (std::is_integral<T>::value && sizeof(T) < sizeof(int)) {
+            value = value < Compute(std::numeric_limits<T>::min())
+                        ? Compute(std::numeric_limits<T>::min())
+                        : value;
+            value = value > Compute(std::numeric_limits<T>::max())
+                        ? Compute(std::numeric_limits<T>::max())
+                        : value;
+        }
+        return T(value);
+    }
+};
+
+/**
+ * Work fused into the write of C = A * B:
+ *
+ *   C(i, j) = activation(scale * (A * B)(i, j) + rowBias[i] + columnBias[j])
+ *
+ * with either bias left out when null. Bias arrays hold one value per row
+ * (per column) of C and must outlive the product. The product is the one
+ * multiply() returns, so for the quantized backends the epilogue applies to
+ * the requantized C.
+ */
+template<class T>
+struct GemmEpilogue
+{
+    typedef typename EpilogueTraits<T>::Compute Compute;
+
+    Compute scale = Compute(1);
+    const T *rowBias = nullptr;
+    const T *columnBias = nullptr;
+    EpilogueActivation activation = EPILOGUE_IDENTITY;
+    Compute clampLow = Compute(0);
+    Compute clampHigh = Compute(0);
+
+    bool empty() const
+    {
+        return scale == Compute(1) && rowBias == nullptr && columnBias == nullptr &&
+               activation == EPILOGUE_IDENTITY;
+    }
+
+    /**
+     * Range the activation keeps values in (the whole range of Compute for
+     * the identity).
+     */
+    void bounds(Compute &low, Compute &high) const
+    {
+        low = std::numeric_limits<Compute>::has_infinity
+                  ? -std::numeric_limits<Compute>::infinity()
+                  : std::numeric_limits<Compute>::lowest();
+        high = std::numeric_limits<Compute>::has_infinity
+                   ? std::numeric_limits<Compute>::infinity()
+                   : std::numeric_limits<Compute>::max();
+        if (activation == EPILOGUE_RELU || activation == EPILOGUE_RELU6) {
+            low = Compute(0);
+        }
+        if (activation == EPILOGUE_RELU6) {
+            high = Compute(6);
+        }
+        if (activation == EPILOGUE_CLAMP) {
+            low = clampLow;
+            high = clampHigh;
+        }
+    }
+
+    /**
+     * Applies the epilogue to the rows x cols tile of C at (row, col), whose
+     * first element is c. Backends call it on each tile right after writing
+     * it, while the tile is still in L1.
+     */
+    void apply(T *c, size_t ldc, size_t row, size_t col, size_t rows, size_t cols) const
+    {
+        Compute low, high;
+        bounds(low, high);
+        for (size_t i = 0; i < rows; i++) {
+            T *out = c + i * ldc;
+            const Compute bias = rowBias != nullptr ? Compute(rowBias[row + i]) : Compute(0);
+            if (columnBias != nullptr) {
+                const T *columns = columnBias + col;
+                for (size_t j = 0; j < cols; j++) {
+                    Compute value = scale * Compute(out[j]) + bias + Compute(columns[j]);
+                    value = value < low ? low : value;
+                    out[j] = EpilogueTraits<T>::store(value > high ? high : value);
+                }
+            } else {
+                for (size_t j = 0; j < cols; j++) {
+                    Compute value = scale * Compute(out[j]) + bias;
+                    value = value < low ? low : value;
+                    out[j] = EpilogueTraits<T>::store(value > high ? high : value);
+                }
+            }
+        }
+    }
+
+    /**
+     * "scale 0.5, row bias, relu"; "none" when empty.
+     */
+    std::string describe() const
+    {
+        std::ostringstream text;
+        const char *separator = "";
+        if (scale != Compute(1)) {
+            text << "scale " << scale;
+            separator = ", ";
+        }
+        if (rowBias != nullptr) {
+            text << separator << "row bias";
+            separator = ", ";
+        }
+        if (columnBias != nullptr) {
+            text << separator << "column bias";
+            separator = ", ";
+        }
+        if (activation != EPILOGUE_IDENTITY || empty()) {
+            text << separator << epilogueActivationName(activation);
+        }
+        if (activation == EPILOGUE_CLAMP) {
+            text << " [" << clampLow << ", " << clampHigh << "]";
+        }
+        return text.str();
+    }
+};
+
+#endif // MATRIX_EPILOGUE_H
@@ -13,14 +13,15 @@ namespace matrix_mult_benchmark {
 template <class T, size_t rows>
 class MatrixGemmEigenMultiplier : public MatrixMultiplier<T, rows> {
     typedef Eigen::Matrix<T, rows, rows, Eigen::RowMajor> RowMatrixXT;
+    typedef Eigen::Map<RowMatrixXT, Eigen::Unaligned, Eigen::OuterStride<>> RowMap;
     
 public:
     void multiply(const Matrix<T, rows> & A, const Matrix<T, rows> & B, Matrix<T, rows> & C) override {
         C.sequence = A.sequence;
         C.timestamp = A.timestamp;
-        Eigen::Map<RowMatrixXT> A_e(&A.data[0][0], rows, rows);
+        RowMap A_e(&A.data[0][0], rows, rows, Eigen::OuterStride<>(A.stride));
 
-        Eigen::Map<RowMatrixXT> C_e(&C.data[0][0], rows, rows);
+        RowMap C_e(&C.data[0][0], rows, rows, Eigen::OuterStride<>(C.stride));
         C_e.noalias() += A_e * A_e;
 
         numberOfMultiplications++;
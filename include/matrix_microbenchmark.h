@@ -0,0 +1,351 @@
+#ifndef MATRIX_MICROBENCHMARK_H
+#define MATRIX_MICROBENCHMARK_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "dynamic_matrix_multiplier.h"
+#include "matrix_backend_registry.h"
+#include "matrix_shape_sweep.h"
+#include "matrix_verification.h"
+#include "philox_random.h"
+#include "reduced_float.h"
+#include "thread_placement.h"
+
+template<class T>
+const char *matrixTypeName()
+{
+    return std::is_same<T, float>::value    ? "float"
+           : std::is_same<T, double>::value ? "double"
+           : std::is_same<T, int>::value    ? "int"
+           : std::is_same<T, int8_t>::value ? "int8"
+           : std::is_same<T, int16_t>::value ? "int16"
+           : std::is_same<T, Half>::value     ? "half"
+           : std::is_same<T, BFloat16>::value ? "bfloat16"
+                                              : "other";
+}
+
+/**
+ * How long and how often a configuration is measured. After warmup, samples
+ * (each at least minSample long, batching products when one is shorter) are
+ * taken until the standard error of their mean is below targetError of the
+ * mean, with at least minRepetitions samples and at most maxRepetitions or
+ * maxTime.
+ */
+struct MicrobenchmarkSettings
+{
+    std::chrono::nanoseconds warmup = std::chrono::milliseconds(50);
+    std::chrono::nanoseconds minSample = std::chrono::microseconds(50);
+    std::chrono::nanoseconds maxTime = std::chrono::seconds(2);
+    size_t minRepetitions = 10;
+    size_t maxRepetitions = 1000;
+    double targetError = 0.01;
+    // Multiply a B prepacked once per thread (DynamicMatrixMultiplier::prepack()).
+    bool prepacked = false;
+};
+
+/**
+ * Time of one product (or one round of concurrent products), in nanoseconds.
+ */
+struct MicrobenchmarkStatistics
+{
+    size_t repetitions = 0;
+    size_t productsPerSample = 0;
+    double median = 0;
+    double min = 0;
+    double mean = 0;
+    double stddev = 0;
+    bool stable = false;
+};
+
+inline MicrobenchmarkStatistics summarizeSamples(std::vector<double> samples,
+                                                 size_t productsPerSample,
+                                                 double targetError)
+{
+    MicrobenchmarkStatistics statistics;
+    statistics.repetitions = samples.size();
+    statistics.productsPerSample = productsPerSample;
+    if (samples.empty()) {
+        return statistics;
+    }
+    std::sort(samples.begin(), samples.end());
+    size_t n = samples.size();
+    statistics.median = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    statistics.min = samples.front();
+    double sum = 0;
+    for (double sample : samples) {
+        sum += sample;
+    }
+    statistics.mean = sum / n;
+    double squares = 0;
+    for (double sample : samples) {
+        squares += (sample - statistics.mean) * (sample - statistics.mean);
+    }
+    statistics.stddev = n > 1 ? std::sqrt(squares / (n - 1)) : 0;
+    statistics.stable = n > 1 && statistics.stddev / std::sqrt(double(n)) <=
+                                     targetError * statistics.mean;
+    return statistics;
+}
+
+/**
+ * Runs a function on threads caller threads at once and times rounds of it.
+ * The threads are started once, pinned with placement and released together
+ * for every round, so a round measures the products only.
+ */
+class ConcurrentRounds
+{
+public:
+    ConcurrentRounds(size_t threads,
+                     const ThreadPlacement &placement,
+                     std::function<void(size_t thread, size_t products)> work)
+        : _work(std::move(work))
+        , _round(0)
+        , _products(0)
+        , _pending(0)
+        , _stopping(false)
+    {
+        for (size_t thread = 0; thread < threads; thread++) {
+            _threads.emplace_back([this, thread, placement]() {
+                placement.pinCurrentThread(thread);
+                threadLoop(thread);
+            });
+        }
+    }
+
+    ~ConcurrentRounds()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _start.notify_all();
+        for (auto &thread : _threads) {
+            thread.join();
+        }
+    }
+
+    /**
+     * Every thread runs products products; returns the wall time of the round.
+     */
+    std::chrono::nanoseconds run(size_t products)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _products = products;
+        _pending = _threads.size();
+        auto begin = std::chrono::steady_clock::now();
+        _round++;
+        _start.notify_all();
+        _done.wait(lock, [this]() { return _pending == 0; });
+        return std::chrono::steady_clock::now() - begin;
+    }
+
+private:
+    void threadLoop(size_t thread)
+    {
+        size_t seen = 0;
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+            _start.wait(lock, [&]() { return _stopping || _round != seen; });
+            if (_stopping) {
+                return;
+            }
+            seen = _round;
+            size_t products = _products;
+            lock.unlock();
+            _work(thread, products);
+            lock.lock();
+            if (--_pending == 0) {
+                _done.notify_one();
+            }
+        }
+    }
+
+    std::function<void(size_t, size_t)> _work;
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _start;
+    std::condition_variable _done;
+    size_t _round;
+    size_t _products;
+    size_t _pending;
+    bool _stopping;
+};
+
+struct MicrobenchmarkResult
+{
+    std::string backend;
+    std::string type;
+    MatrixShape shape;
+    size_t threads;
+    MicrobenchmarkStatistics time;
+
+    // All threads together, from the median round time.
+    double gflops() const
+    {
+        return time.median > 0 ? threads * shape.flops() / time.median : 0.0;
+    }
+
+    double gflopsPerThread() const { return threads > 0 ? gflops() / threads : 0.0; }
+};
+
+/**
+ * Measures multiplier on shape with threads concurrent callers, each
+ * multiplying its own operands (Philox uniform values) into its own result.
+ * With settings.prepacked, B is prepacked before the measurement.
+ */
+template<class T>
+MicrobenchmarkResult runMicrobenchmark(DynamicMatrixMultiplier<T> &multiplier,
+                                       const std::string &backend,
+                                       const MatrixShape &shape,
+                                       size_t threads,
+                                       const ThreadPlacement &placement,
+                                       const MicrobenchmarkSettings &settings)
+{
+    threads = std::max<size_t>(threads, 1);
+    struct Operands
+    {
+        DynamicMatrix<T> A, B, C;
+        std::shared_ptr<const PackedMatrix<T>> packedB;
+    };
+    std::vector<std::unique_ptr<Operands>> operands;
+    Philox4x32 rng(threads * 1000003 + shape.m * 7919 + shape.n * 131 + shape.k);
+    const T low = std::is_integral<T>::value ? T(-8) : T(-1);
+    const T high = std::is_integral<T>::value ? T(8) : T(1);
+    for (size_t thread = 0; thread < threads; thread++) {
+        operands.emplace_back(new Operands{DynamicMatrix<T>(shape.m, shape.k),
+                                           DynamicMatrix<T>(shape.k, shape.n),
+                                           DynamicMatrix<T>(shape.m, shape.n),
+                                           nullptr});
+        Operands &own = *operands.back();
+        for (size_t i = 0; i < shape.m; i++) {
+            rng.fillUniform(&own.A(i, 0), shape.k, low, high, i * Philox4x32::blocksFor<T>(shape.k), 2 * thread);
+        }
+        for (size_t i = 0; i < shape.k; i++) {
+            rng.fillUniform(&own.B(i, 0), shape.n, low, high, i * Philox4x32::blocksFor<T>(shape.n), 2 * thread + 1);
+        }
+        if (settings.prepacked) {
+            own.packedB = multiplier.prepack(own.B);
+        }
+    }
+
+    auto work = [&](size_t thread, size_t products) {
+        Operands &own = *operands[thread];
+        for (size_t p = 0; p < products; p++) {
+            if (own.packedB) {
+                multiplier.multiply(own.A, *own.packedB, own.C);
+            } else {
+                multiplier.multiply(own.A, own.B, own.C);
+            }
+        }
+    };
+    std::unique_ptr<ConcurrentRounds> rounds;
+    if (threads > 1) {
+        rounds.reset(new ConcurrentRounds(threads, placement, work));
+    }
+    auto round = [&](size_t products) -> std::chrono::nanoseconds {
+        if (rounds) {
+            return rounds->run(products);
+        }
+        auto begin = std::chrono::steady_clock::now();
+        work(0, products);
+        return std::chrono::steady_clock::now() - begin;
+    };
+
+    // Warm-up (caches, page faults, lazily started runtimes), which also
+    // sizes the samples.
+    std::chrono::nanoseconds warm(0);
+    size_t warmRounds = 0;
+    while (warmRounds == 0 || warm < settings.warmup) {
+        warm += round(1);
+        warmRounds++;
+    }
+    double roundNanos = std::max(1.0, double(warm.count()) / warmRounds);
+    size_t productsPerSample = std::max<size_t>(
+        1, static_cast<size_t>(std::ceil(settings.minSample.count() / roundNanos)));
+
+    std::vector<double> samples;
+    MicrobenchmarkStatistics statistics;
+    auto begin = std::chrono::steady_clock::now();
+    while (samples.size() < settings.maxRepetitions) {
+        samples.push_back(double(round(productsPerSample).count()) / productsPerSample);
+        if (samples.size() < settings.minRepetitions) {
+            continue;
+        }
+        statistics = summarizeSamples(samples, productsPerSample, settings.targetError);
+        if (statistics.stable || std::chrono::steady_clock::now() - begin >= settings.maxTime) {
+            break;
+        }
+    }
+    statistics = summarizeSamples(samples, productsPerSample, settings.targetError);
+    return {backend, matrixTypeName<T>(), shape, threads, statistics};
+}
+
+/**
+ * Backend left out of a run because it failed verifyDynamicMultiplier().
+ */
+struct RejectedBackend
+{
+    std::string backend;
+    std::string type;
+    std::string reason;
+};
+
+inline void writeMicrobenchmarkCsv(std::ostream &out, const std::vector<MicrobenchmarkResult> &results)
+{
+    std::streamsize precision = out.precision(10);
+    out << "backend,type,m,n,k,threads,repetitions,products_per_sample,median_ns,min_ns,mean_ns,"
+           "stddev_ns,stable,gflops,gflops_per_thread\n";
+    for (const MicrobenchmarkResult &result : results) {
+        out << '"' << result.backend << "\"," << result.type << ',' << result.shape.m << ','
+            << result.shape.n << ',' << result.shape.k << ',' << result.threads << ','
+            << result.time.repetitions << ',' << result.time.productsPerSample << ','
+            << result.time.median << ',' << result.time.min << ',' << result.time.mean << ','
+            << result.time.stddev << ',' << (result.time.stable ? 1 : 0) << ',' << result.gflops()
+            << ',' << result.gflopsPerThread() << '\n';
+    }
+    out.precision(precision);
+}
+
+inline void writeMicrobenchmarkJson(std::ostream &out,
+                                    const std::vector<MicrobenchmarkResult> &results,
+                                    const std::vector<RejectedBackend> &rejected = {})
+{
+    std::streamsize precision = out.precision(10);
+    out << "{\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const MicrobenchmarkResult &result = results[i];
+        out << (i > 0 ? "," : "") << "\n    {\"backend\": \"" << result.backend
+            << "\", \"type\": \"" << result.type << "\", \"m\": " << result.shape.m
+            << ", \"n\": " << result.shape.n << ", \"k\": " << result.shape.k
+            << ", \"threads\": " << result.threads
+            << ", \"repetitions\": " << result.time.repetitions
+            << ", \"products_per_sample\": " << result.time.productsPerSample
+            << ", \"median_ns\": " << result.time.median << ", \"min_ns\": " << result.time.min
+            << ", \"mean_ns\": " << result.time.mean << ", \"stddev_ns\": " << result.time.stddev
+            << ", \"stable\": " << (result.time.stable ? "true" : "false")
+            << ", \"gflops\": " << result.gflops()
+            << ", \"gflops_per_thread\": " << result.gflopsPerThread() << "}";
+    }
+    out << "\n  ],\n  \"rejected\": [";
+    for (size_t i = 0; i < rejected.size(); i++) {
+        out << (i > 0 ? "," : "") << "\n    {\"backend\": \"" << rejected[i].backend
+            << "\", \"type\": \"" << rejected[i].type << "\", \"reason\": \"" << rejected[i].reason
+            << "\"}";
+    }
+    out << "\n  ]\n}\n";
+    out.precision(precision);
+}
+
+#endif // MATRIX_MICROBENCHMARK_H
@@ -2,6 +2,7 @@
 #define MATRIX_MULTIPLIER_H
 
 #include "matrix.h"
+#include "matrix_epilogue.h"
 
 
 template<class T, size_t colsLeft, size_t rowsLeft, size_t rowsRight>
@@ -12,6 +13,41 @@ public:
                           const Matrix<T, rowsLeft, rowsRight> &B,
                           Matrix<T, colsLeft, rowsRight> &C) = 0;
 
+    /**
+     * Computes C[i] = A[i] * B[i] for n independent products of the same shape.
+     * Backends override it to hoist their per-call setup out of the loop and to
+     * spread the batch across cores; the default just calls multiply().
+     */
+    virtual void multiplyBatch(const Matrix<T, colsLeft, rowsLeft> *A,
+                               const Matrix<T, rowsLeft, rowsRight> *B,
+                               Matrix<T, colsLeft, rowsRight> *C,
+                               size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            multiply(A[i], B[i], C[i]);
+        }
+    }
+
+    /**
+     * C = epilogue(A * B), see GemmEpilogue. Backends that fuse the epilogue
+     * into their output write override it; the default makes one pass over C
+     * after multiply().
+     */
+    virtual void multiply(const Matrix<T, colsLeft, rowsLeft> &A,
+                          const Matrix<T, rowsLeft, rowsRight> &B,
+                          Matrix<T, colsLeft, rowsRight> &C,
+                          const GemmEpilogue<T> &epilogue)
+    {
+        multiply(A, B, C);
+        epilogue.apply(C.data[0], C.stride, 0, 0, colsLeft, rowsRight);
+    }
+
+    /**
+     * Caps the threads of one product (see ThreadBudget). Returns false when
+     * the multiplier has no such knob.
+     */
+    virtual bool setNumThreads(size_t /*threads*/) { return false; }
+
     virtual ~MatrixMultiplier() {}
 };
 
@@ -1,6 +1,8 @@
 #ifndef MATRIX_NEON_MULTIPLIER_H
 #define MATRIX_NEON_MULTIPLIER_H
 
+#if defined(__aarch64__) || defined(__ARM_NEON)
+
 #include <arm_neon.h>
 #include <klepsydra/matrix_mult_benchmark/matrix_multiplier.h>
 
@@ -82,4 +84,6 @@ template<class T, size_t colsLeft, size_t rowsRight>
 std::atomic<int> kpsr::matrix_mult_benchmark::MatrixNeonMultiplier<T, colsLeft, rowsRight>::
     numberOfMultiplications(0);
 
+#endif // __aarch64__ || __ARM_NEON
+
 #endif // MATRIX_NEON_MULTIPLIER_H
@@ -1,20 +1,51 @@
 #ifndef MATRIX_OPENMP_MULTIPLIER_H
 #define MATRIX_OPENMP_MULTIPLIER_H
 
+#include <atomic>
+
 #include <omp.h>
 
+#include <dynamic_matrix_multiplier.h>
+#include <matrix_backend_registry.h>
 #include <matrix_multiplier.h>
+#include <task_runtime.h>
 
 template<class T, size_t colsLeft, size_t rowsLeft, size_t rowsRight>
 class MatrixOmpMultiplier : public MatrixMultiplier<T, colsLeft, rowsLeft, rowsRight>
 {
 public:
+    /**
+     * With useTaskRuntime set, the row loop is split into tasks on the shared
+     * TaskRuntime instead of opening an OpenMP parallel region per call, so
+     * concurrent callers do not multiply the number of threads.
+     */
+    explicit MatrixOmpMultiplier(bool useTaskRuntime = false)
+        : _useTaskRuntime(useTaskRuntime)
+    {}
+
     void multiply(const Matrix<T, colsLeft, rowsLeft> &A,
                   const Matrix<T, rowsLeft, rowsRight> &B,
                   Matrix<T, colsLeft, rowsRight> &C) override
     {
         C.sequence = A.sequence;
         C.timestamp = A.timestamp;
+        if (_useTaskRuntime) {
+            TaskRuntime &runtime = TaskRuntime::instance();
+            runtime.parallelFor(colsLeft,
+                                runtime.grainFor(colsLeft, 8),
+                                [&](size_t begin, size_t end) {
+                                    for (size_t i = begin; i < end; i++) {
+                                        for (size_t j = 0; j < rowsRight; j++) {
+                                            C.data[i][j] = 0.0;
+                                            for (size_t k = 0; k < rowsLeft; k++) {
+                                                C.data[i][j] = C.data[i][j] +
+                                                               A.data[i][k] * B.data[k][j];
+                                            }
+                                        }
+                                    }
+                                });
+            return;
+        }
         size_t i;
         size_t j;
         size_t k;
@@ -33,6 +64,9 @@ public:
     }
 
     virtual ~MatrixOmpMultiplier() {}
+
+private:
+    bool _useTaskRuntime;
 };
 
 template<class T, size_t colsLeft, size_t rowsLeft, size_t rowsRight>
@@ -65,4 +99,69 @@ public:
     virtual ~MatrixOmpSimdMultiplier() {}
 };
 
+template<class T>
+class DynamicMatrixOmpMultiplier : public DynamicMatrixMultiplier<T>
+{
+public:
+    /**
+     * See MatrixOmpMultiplier.
+     */
+    explicit DynamicMatrixOmpMultiplier(bool useTaskRuntime = false)
+        : _useTaskRuntime(useTaskRuntime)
+        , _threads(0)
+    {}
+
+    // Size of the OpenMP team (0: the OpenMP default) or task runtime split.
+    bool setNumThreads(size_t threads) override
+    {
+        _threads.store(threads, std::memory_order_relaxed);
+        return true;
+    }
+
+    virtual ~DynamicMatrixOmpMultiplier() {}
+
+protected:
+    void compute(const MatrixView<const T> &A,
+                 const MatrixView<const T> &B,
+                 const MatrixView<T> &C) override
+    {
+        const size_t maxThreads = _threads.load(std::memory_order_relaxed);
+        auto multiplyRow = [&](size_t i) {
+            for (size_t j = 0; j < C.cols; j++) {
+                T sum = 0;
+                for (size_t k = 0; k < A.cols; k++) {
+                    sum = sum + A(i, k) * B(k, j);
+                }
+                C(i, j) = sum;
+            }
+        };
+        if (_useTaskRuntime) {
+            TaskRuntime &runtime = TaskRuntime::instance();
+            runtime.parallelFor(C.rows,
+                                runtime.grainFor(C.rows, 8, maxThreads),
+                                [&](size_t begin, size_t end) {
+                                    for (size_t i = begin; i < end; i++) {
+                                        multiplyRow(i);
+                                    }
+                                });
+            return;
+        }
+        const long rows = static_cast<long>(C.rows);
+        const int threads = maxThreads > 0 ? static_cast<int>(maxThreads) : omp_get_max_threads();
+#pragma omp parallel for num_threads(threads)
+        for (long i = 0; i < rows; i++) {
+            multiplyRow(static_cast<size_t>(i));
+        }
+    }
+
+private:
+    bool _useTaskRuntime;
+    // Set by ThreadBudget::rebalance() while other threads multiply.
+    std::atomic<size_t> _threads;
+};
+
+inline const bool openmpBackendRegistered =
+    registerMatrixBackend<DynamicMatrixOmpMultiplier>("openmp", 10) &&
+    registerMatrixBackend<DynamicMatrixOmpMultiplier>("openmp (task runtime)", 11, true);
+
 #endif // MATRIX_OPENMP_MULTIPLIER_H
@@ -0,0 +1,427 @@
+#ifndef MATRIX_PACKED_GEMM_H
+#define MATRIX_PACKED_GEMM_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "matrix.h"
+#include "matrix_epilogue.h"
+#include "task_runtime.h"
+
+/**
+ * Register-tiled micro-kernel: computes an mr x nr tile of C from a kc deep
+ * micro-panel of A (mr values per k) and of B (nr values per k). Only the
+ * top-left m x n corner of the tile is written back, so edge tiles can reuse
+ * the full-size kernel on zero padded panels.
+ */
+template<class T>
+struct GemmMicroKernel
+{
+    typedef void (*Function)(size_t kc,
+                             const T *a,
+                             const T *b,
+                             T *c,
+                             size_t ldc,
+                             size_t m,
+                             size_t n,
+                             bool accumulate);
+
+    size_t mr;
+    size_t nr;
+    Function run;
+};
+
+/**
+ * Cache blocking of the packed product. The mc x kc block of A is meant to stay
+ * in L2 while a kc x nr micro-panel of B streams through L1, kc x nc is the B
+ * panel shared by all row blocks of A.
+ */
+struct GemmBlocking
+{
+    size_t mc;
+    size_t kc;
+    size_t nc;
+};
+
+template<class T, size_t mr, size_t nr>
+void packedMicroKernel(size_t kc,
+                       const T *a,
+                       const T *b,
+                       T *c,
+                       size_t ldc,
+                       size_t m,
+                       size_t n,
+                       bool accumulate)
+{
+    T acc[mr][nr] = {};
+    for (size_t p = 0; p < kc; p++) {
+        for (size_t i = 0; i < mr; i++) {
+            for (size_t j = 0; j < nr; j++) {
+                acc[i][j] += a[p * mr + i] * b[p * nr + j];
+            }
+        }
+    }
+    for (size_t i = 0; i < m; i++) {
+        for (size_t j = 0; j < n; j++) {
+            if (accumulate) {
+                c[i * ldc + j] += acc[i][j];
+            } else {
+                c[i * ldc + j] = acc[i][j];
+            }
+        }
+    }
+}
+
+/**
+ * Packs an m x k block of row-major A into consecutive micro-panels of mr rows,
+ * k-major inside each panel. Rows past m are zero filled.
+ */
+template<class T>
+void packPanelA(size_t m, size_t k, size_t mr, const T *a, size_t lda, T *packed)
+{
+    for (size_t ir = 0; ir < m; ir += mr) {
+        size_t rows = std::min(mr, m - ir);
+        for (size_t p = 0; p < k; p++) {
+            for (size_t i = 0; i < rows; i++) {
+                packed[i] = a[(ir + i) * lda + p];
+            }
+            for (size_t i = rows; i < mr; i++) {
+                packed[i] = T();
+            }
+            packed += mr;
+        }
+    }
+}
+
+/**
+ * Packs a k x n block of row-major B into consecutive micro-panels of nr
+ * columns, k-major inside each panel. Columns past n are zero filled.
+ */
+template<class T>
+void packPanelB(size_t k, size_t n, size_t nr, const T *b, size_t ldb, T *packed)
+{
+    for (size_t jr = 0; jr < n; jr += nr) {
+        size_t cols = std::min(nr, n - jr);
+        for (size_t p = 0; p < k; p++) {
+            const T *row = b + p * ldb + jr;
+            for (size_t j = 0; j < cols; j++) {
+                packed[j] = row[j];
+            }
+            for (size_t j = cols; j < nr; j++) {
+                packed[j] = T();
+            }
+            packed += nr;
+        }
+    }
+}
+
+/**
+ * Blocked GEMM driver (C = A * B, all row-major with explicit leading
+ * dimensions) around a register-tiled micro-kernel. The packing buffers are
+ * thread local, so one instance can be shared by concurrent callers and the
+ * buffers are reused across calls. With a TaskRuntime the row blocks of A are
+ * packed and multiplied as runtime tasks against a shared packed B panel.
+ */
+template<class T>
+class PackedGemm
+{
+    typedef std::vector<T, AlignedAllocator<T>> PackingBuffer;
+
+public:
+    PackedGemm(const GemmMicroKernel<T> &kernel,
+               const GemmBlocking &blocking,
+               TaskRuntime *runtime = nullptr)
+        : _kernel(kernel)
+        , _blocking(blocking)
+        , _runtime(runtime)
+        , _threads(0)
+    {}
+
+    void multiply(size_t m,
+                  size_t n,
+                  size_t k,
+                  const T *a,
+                  size_t lda,
+                  const T *b,
+                  size_t ldb,
+                  T *c,
+                  size_t ldc,
+                  const GemmEpilogue<T> *epilogue = nullptr) const
+    {
+        multiplyPacked(
+            m,
+            n,
+            k,
+            [a, lda](size_t i, size_t p, size_t rows, size_t depth, size_t mr, T *packed) {
+                packPanelA(rows, depth, mr, a + i * lda + p, lda, packed);
+            },
+            [b, ldb](size_t p, size_t j, size_t depth, size_t cols, size_t nr, T *packed) {
+                packPanelB(depth, cols, nr, b + p * ldb + j, ldb, packed);
+            },
+            c,
+            ldc,
+            epilogue);
+    }
+
+    /**
+     * Product of operands only known through their packing functions, for
+     * operands that are never stored as matrices (implicit GEMM convolution).
+     * packA(i, p, rows, depth, mr, packed) packs the rows x depth block of A at
+     * (i, p) like packPanelA(), packB(p, j, depth, cols, nr, packed) the
+     * depth x cols block of B at (p, j) like packPanelB().
+     *
+     * A non-empty epilogue is applied to each micro-tile of C right after its
+     * last kernel call, while the tile is still in L1.
+     */
+    template<class PackA, class PackB>
+    void multiplyPacked(size_t m,
+                        size_t n,
+                        size_t k,
+                        const PackA &packA,
+                        const PackB &packB,
+                        T *c,
+                        size_t ldc,
+                        const GemmEpilogue<T> *epilogue = nullptr) const
+    {
+        // The packed B panel is read by every row block task, so it is taken out
+        // of the thread local slot: a nested product run by this thread while it
+        // waits for its tasks cannot overwrite it.
+        PackingBuffer packedB;
+        packedB.swap(packingBuffer(1));
+        packedB.resize(roundUp(std::min(_blocking.nc, n), _kernel.nr) *
+                       std::min(_blocking.kc, k));
+        run(m,
+            n,
+            k,
+            packA,
+            [&](size_t p, size_t j, size_t depth, size_t cols) -> const T * {
+                packB(p, j, depth, cols, _kernel.nr, packedB.data());
+                return packedB.data();
+            },
+            c,
+            ldc,
+            epilogue);
+        packedB.swap(packingBuffer(1));
+    }
+
+    /**
+     * Every panel of a constant k x n B, packed once by prepackB() for the
+     * kernel width and blocking of the PackedGemm that packed it.
+     */
+    class PackedB
+    {
+    public:
+        size_t rows() const { return _k; }
+        size_t cols() const { return _n; }
+
+    private:
+        friend class PackedGemm;
+
+        size_t _k;
+        size_t _n;
+        size_t _nr;
+        size_t _kc;
+        size_t _nc;
+        PackingBuffer _panels;
+    };
+
+    /**
+     * Packs B (k x n) the way multiply() packs it, every kc x nc block in
+     * turn, so that multiplyPrepacked() skips packing it.
+     */
+    std::shared_ptr<const PackedB> prepackB(size_t k, size_t n, const T *b, size_t ldb) const
+    {
+        std::shared_ptr<PackedB> packed = std::make_shared<PackedB>();
+        packed->_k = k;
+        packed->_n = n;
+        packed->_nr = _kernel.nr;
+        packed->_kc = _blocking.kc;
+        packed->_nc = _blocking.nc;
+        packed->_panels.resize(roundUp(n, _kernel.nr) * k);
+        T *panels = packed->_panels.data();
+        for (size_t jc = 0; jc < n; jc += _blocking.nc) {
+            size_t nb = std::min(_blocking.nc, n - jc);
+            for (size_t pc = 0; pc < k; pc += _blocking.kc) {
+                size_t kb = std::min(_blocking.kc, k - pc);
+                packPanelB(kb, nb, _kernel.nr, b + pc * ldb + jc, ldb, panels);
+                panels += roundUp(nb, _kernel.nr) * kb;
+            }
+        }
+        return packed;
+    }
+
+    /**
+     * Whether multiplyPrepacked() takes b: it was packed for this kernel width
+     * and blocking (setBlocking() after prepackB() invalidates it).
+     */
+    bool accepts(const PackedB &b) const
+    {
+        return b._nr == _kernel.nr && b._kc == _blocking.kc && b._nc == _blocking.nc;
+    }
+
+    /**
+     * C (m x b.cols()) = A * b for a b that accepts() takes; only A is packed.
+     */
+    void multiplyPrepacked(size_t m,
+                           const T *a,
+                           size_t lda,
+                           const PackedB &b,
+                           T *c,
+                           size_t ldc,
+                           const GemmEpilogue<T> *epilogue = nullptr) const
+    {
+        multiplyPrepacked(
+            m,
+            [a, lda](size_t i, size_t p, size_t rows, size_t depth, size_t mr, T *packed) {
+                packPanelA(rows, depth, mr, a + i * lda + p, lda, packed);
+            },
+            b,
+            c,
+            ldc,
+            epilogue);
+    }
+
+    /**
+     * As above, for an A only known through packA (see multiplyPacked()).
+     */
+    template<class PackA>
+    void multiplyPrepacked(size_t m,
+                           const PackA &packA,
+                           const PackedB &b,
+                           T *c,
+                           size_t ldc,
+                           const GemmEpilogue<T> *epilogue = nullptr) const
+    {
+        // Blocks before jc are full nc wide, each holding its k deep panels.
+        const size_t blockStride = roundUp(_blocking.nc, _kernel.nr) * b._k;
+        run(m,
+            b._n,
+            b._k,
+            packA,
+            [&](size_t p, size_t j, size_t /*depth*/, size_t cols) {
+                return b._panels.data() + j / _blocking.nc * blockStride +
+                       roundUp(cols, _kernel.nr) * p;
+            },
+            c,
+            ldc,
+            epilogue);
+    }
+
+    const GemmMicroKernel<T> &kernel() const { return _kernel; }
+    const GemmBlocking &blocking() const { return _blocking; }
+    bool parallel() const { return _runtime != nullptr; }
+
+    void setBlocking(const GemmBlocking &blocking) { _blocking = blocking; }
+
+    /**
+     * Caps the runtime tasks of one product at threads (0: no cap).
+     */
+    void setThreads(size_t threads) { _threads.store(threads, std::memory_order_relaxed); }
+
+private:
+    /**
+     * The blocked loops: panelB(p, j, depth, cols) returns the packed
+     * depth x cols block of B at (p, j), which stays valid until the next
+     * call.
+     */
+    template<class PackA, class PanelB>
+    void run(size_t m,
+             size_t n,
+             size_t k,
+             const PackA &packA,
+             const PanelB &panelB,
+             T *c,
+             size_t ldc,
+             const GemmEpilogue<T> *epilogue) const
+    {
+        if (epilogue != nullptr && epilogue->empty()) {
+            epilogue = nullptr;
+        }
+        if (k == 0) {
+            for (size_t i = 0; i < m; i++) {
+                std::fill(c + i * ldc, c + i * ldc + n, T());
+            }
+            if (epilogue != nullptr) {
+                epilogue->apply(c, ldc, 0, 0, m, n);
+            }
+            return;
+        }
+
+        const size_t mr = _kernel.mr;
+        const size_t nr = _kernel.nr;
+        const size_t threads = _threads.load(std::memory_order_relaxed);
+        size_t rowBlock = _blocking.mc;
+        if (_runtime != nullptr) {
+            rowBlock = std::min(rowBlock, roundUp(_runtime->grainFor(m, mr, threads), mr));
+        }
+        const size_t rowBlocks = (m + rowBlock - 1) / rowBlock;
+        const size_t blocksPerTask = threads > 0 ? (rowBlocks + threads - 1) / threads : 1;
+
+        for (size_t jc = 0; jc < n; jc += _blocking.nc) {
+            size_t nb = std::min(_blocking.nc, n - jc);
+            for (size_t pc = 0; pc < k; pc += _blocking.kc) {
+                size_t kb = std::min(_blocking.kc, k - pc);
+                const T *packedB = panelB(pc, jc, kb, nb);
+                const bool lastDepthBlock = epilogue != nullptr && pc + kb == k;
+
+                auto multiplyRowBlocks = [&](size_t first, size_t last) {
+                    PackingBuffer &packedA = packingBuffer(0);
+                    packedA.resize(std::max(packedA.size(), roundUp(rowBlock, mr) * kb));
+                    for (size_t block = first; block < last; block++) {
+                        size_t ic = block * rowBlock;
+                        size_t mb = std::min(rowBlock, m - ic);
+                        packA(ic, pc, mb, kb, mr, packedA.data());
+                        for (size_t jr = 0; jr < nb; jr += nr) {
+                            for (size_t ir = 0; ir < mb; ir += mr) {
+                                T *tile = c + (ic + ir) * ldc + jc + jr;
+                                _kernel.run(kb,
+                                            packedA.data() + ir * kb,
+                                            packedB + jr * kb,
+                                            tile,
+                                            ldc,
+                                            std::min(mr, mb - ir),
+                                            std::min(nr, nb - jr),
+                                            pc != 0);
+                                if (lastDepthBlock) {
+                                    epilogue->apply(tile,
+                                                    ldc,
+                                                    ic + ir,
+                                                    jc + jr,
+                                                    std::min(mr, mb - ir),
+                                                    std::min(nr, nb - jr));
+                                }
+                            }
+                        }
+                    }
+                };
+                if (_runtime != nullptr) {
+                    _runtime->parallelFor(rowBlocks, blocksPerTask, multiplyRowBlocks);
+                } else {
+                    multiplyRowBlocks(0, rowBlocks);
+                }
+            }
+        }
+    }
+
+    static size_t roundUp(size_t value, size_t multiple)
+    {
+        return (value + multiple - 1) / multiple * multiple;
+    }
+
+    static PackingBuffer &packingBuffer(int index)
+    {
+        static thread_local PackingBuffer buffers[2];
+        return buffers[index];
+    }
+
+    GemmMicroKernel<T> _kernel;
+    GemmBlocking _blocking;
+    TaskRuntime *_runtime;
+    // Set by ThreadBudget::rebalance() while other threads multiply.
+    std::atomic<size_t> _threads;
+};
+
+#endif // MATRIX_PACKED_GEMM_H
@@ -0,0 +1,195 @@
+#ifndef MATRIX_PACKED_MULTIPLIER_H
+#define MATRIX_PACKED_MULTIPLIER_H
+
+#include "dynamic_matrix_multiplier.h"
+#include "matrix_backend_registry.h"
+#include "matrix_multiplier.h"
+#include "matrix_packed_gemm.h"
+
+/**
+ * Packed, cache-blocked multiplier. mr x nr is the register tile of the
+ * micro-kernel, mc/kc/nc the cache blocking: with the defaults a float
+ * A block (64x256) takes 64 KB and a B panel (256x256) 256 KB, which leaves
+ * room for all four cores of a Raspberry Pi 4 in its 1 MB shared L2.
+ */
+template<class T,
+         size_t colsLeft,
+         size_t rowsLeft,
+         size_t rowsRight,
+         size_t mr = 4,
+         size_t nr = 8,
+         size_t mc = 64,
+         size_t kc = 256,
+         size_t nc = 256>
+class MatrixPackedMultiplier : public MatrixMultiplier<T, colsLeft, rowsLeft, rowsRight>
+{
+public:
+    /**
+     * With parallel set, each product is split into row-block tasks on the
+     * shared TaskRuntime.
+     */
+    explicit MatrixPackedMultiplier(bool parallel = false)
+        : _gemm({mr, nr, &packedMicroKernel<T, mr, nr>},
+                {mc, kc, nc},
+                parallel ? &TaskRuntime::instance() : nullptr)
+    {}
+
+    void multiply(const Matrix<T, colsLeft, rowsLeft> &A,
+                  const Matrix<T, rowsLeft, rowsRight> &B,
+                  Matrix<T, colsLeft, rowsRight> &C) override
+    {
+        multiplyOne(A, B, C);
+    }
+
+    void multiply(const Matrix<T, colsLeft, rowsLeft> &A,
+                  const Matrix<T, rowsLeft, rowsRight> &B,
+                  Matrix<T, colsLeft, rowsRight> &C,
+                  const GemmEpilogue<T> &epilogue) override
+    {
+        multiplyOne(A, B, C, &epilogue);
+    }
+
+    void multiplyBatch(const Matrix<T, colsLeft, rowsLeft> *A,
+                       const Matrix<T, rowsLeft, rowsRight> *B,
+                       Matrix<T, colsLeft, rowsRight> *C,
+                       size_t n) override
+    {
+        // Each runtime thread packs into its own thread local buffers.
+        TaskRuntime::instance().parallelFor(n, 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                multiplyOne(A[i], B[i], C[i]);
+            }
+        });
+    }
+
+    virtual ~MatrixPackedMultiplier() {}
+
+private:
+    void multiplyOne(const Matrix<T, colsLeft, rowsLeft> &A,
+                     const Matrix<T, rowsLeft, rowsRight> &B,
+                     Matrix<T, colsLeft, rowsRight> &C,
+                     const GemmEpilogue<T> *epilogue = nullptr)
+    {
+        C.sequence = A.sequence;
+        C.timestamp = A.timestamp;
+        _gemm.multiply(colsLeft,
+                       rowsRight,
+                       rowsLeft,
+                       A.data[0],
+                       A.stride,
+                       B.data[0],
+                       B.stride,
+                       C.data[0],
+                       C.stride,
+                       epilogue);
+    }
+
+    PackedGemm<T> _gemm;
+};
+
+/**
+ * Run-time shape multiplier on a PackedGemm: fused epilogues, prepacked
+ * right-hand operands and, with parallel set, the task runtime split for any
+ * micro-kernel and blocking. The packed and SIMD backends only differ in the
+ * kernel they hand it.
+ */
+template<class T>
+class DynamicPackedGemmMultiplier : public DynamicMatrixMultiplier<T>
+{
+public:
+    DynamicPackedGemmMultiplier(const GemmMicroKernel<T> &kernel,
+                                const GemmBlocking &blocking,
+                                bool parallel)
+        : _gemm(kernel, blocking, parallel ? &TaskRuntime::instance() : nullptr)
+    {}
+
+    virtual ~DynamicPackedGemmMultiplier() {}
+
+    // Only the task runtime variant runs a product on several threads.
+    bool setNumThreads(size_t threads) override
+    {
+        if (!_gemm.parallel()) {
+            return false;
+        }
+        _gemm.setThreads(threads);
+        return true;
+    }
+
+    bool setBlocking(size_t mc, size_t kc, size_t nc) override
+    {
+        _gemm.setBlocking({mc, kc, nc});
+        return true;
+    }
+
+protected:
+    void compute(const MatrixView<const T> &A,
+                 const MatrixView<const T> &B,
+                 const MatrixView<T> &C) override
+    {
+        _gemm.multiply(C.rows, C.cols, A.cols, A.data, A.stride, B.data, B.stride, C.data, C.stride);
+    }
+
+    void computeFused(const MatrixView<const T> &A,
+                      const MatrixView<const T> &B,
+                      const MatrixView<T> &C,
+                      const GemmEpilogue<T> &epilogue) override
+    {
+        _gemm.multiply(
+            C.rows, C.cols, A.cols, A.data, A.stride, B.data, B.stride, C.data, C.stride, &epilogue);
+    }
+
+    void packOperand(PackedMatrix<T> &B) override
+    {
+        const MatrixView<const T> plain = B.plain().view();
+        B.setLayout(_gemm.prepackB(plain.rows, plain.cols, plain.data, plain.stride));
+    }
+
+    // A B packed before a setBlocking(), or by a backend with another
+    // kernel, no longer matches the blocking and is multiplied from its copy.
+    void computePrepacked(const MatrixView<const T> &A,
+                          const PackedMatrix<T> &B,
+                          const MatrixView<T> &C,
+                          const GemmEpilogue<T> &epilogue) override
+    {
+        const auto *packed = B.template layout<typename PackedGemm<T>::PackedB>();
+        if (packed == nullptr || !_gemm.accepts(*packed)) {
+            DynamicMatrixMultiplier<T>::computePrepacked(A, B, C, epilogue);
+            return;
+        }
+        _gemm.multiplyPrepacked(C.rows, A.data, A.stride, *packed, C.data, C.stride, &epilogue);
+    }
+
+    // Each runtime thread packs into its own thread local buffers.
+    void computeBatch(const MatrixView<const T> *A,
+                      const MatrixView<const T> *B,
+                      const MatrixView<T> *C,
+                      size_t n) override
+    {
+        this->computeBatchOnRuntime(A, B, C, n);
+    }
+
+private:
+    PackedGemm<T> _gemm;
+};
+
+/**
+ * Packed multiplier on run-time shapes, with the default tiling of
+ * MatrixPackedMultiplier.
+ */
+template<class T>
+class DynamicMatrixPackedMultiplier : public DynamicPackedGemmMultiplier<T>
+{
+public:
+    explicit DynamicMatrixPackedMultiplier(bool parallel = false)
+        : DynamicPackedGemmMultiplier<T>(
+              {4, 8, &packedMicroKernel<T, 4, 8>}, {64, 256, 256}, parallel)
+    {}
+
+    virtual ~DynamicMatrixPackedMultiplier() {}
+};
+
+inline const bool packedBackendRegistered =
+    registerMatrixBackend<DynamicMatrixPackedMultiplier>("packed", 60) &&
+    registerMatrixBackend<DynamicMatrixPackedMultiplier>("packed (task runtime)", 61, true);
+
+#endif // MATRIX_PACKED_MULTIPLIER_H
@@ -0,0 +1,153 @@
+#ifndef MATRIX_POOL_H
+#define MATRIX_POOL_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <klepsydra/matrix_mult_benchmark/dynamic_matrix.h>
+#include <klepsydra/matrix_mult_benchmark/matrix.h>
+#include <klepsydra/matrix_mult_benchmark/matrix_arena.h>
+
+namespace kpsr {
+namespace matrix_mult_benchmark {
+
+/**
+ * Read-only, reference counted matrix passed between pipeline stages instead of
+ * the matrix itself.
+ */
+template<class T, size_t rows>
+using MatrixHandle = std::shared_ptr<const Matrix<T, rows, rows>>;
+
+/**
+ * Fixed set of size objects handed out as shared_ptr handles. A slot goes
+ * back to the pool when its last handle is released, so a stage can write its
+ * result into a slot and publish the handle without copying it. Handles may
+ * outlive the pool.
+ *
+ * Slots are made the first time the pool runs out of free ones, on the thread
+ * that acquires them, so their pages are first touched (and placed on the NUMA
+ * node of) the stage that uses them. They come from slotFactory when one is
+ * given, whose storage the pool does not own (e.g. a MatrixArena the factory
+ * keeps alive), otherwise from factory.
+ *
+ * When every slot is in flight acquire() falls back to a heap object made by
+ * the pool's factory instead of blocking the pipeline; fallbacks() counts
+ * those, a non-zero value means the pool is too small for the pipeline depth.
+ */
+template<class Pooled>
+class SlotPool
+{
+public:
+    SlotPool(size_t size,
+             std::function<Pooled *()> factory,
+             std::function<Pooled *()> slotFactory = nullptr)
+        : _state(std::make_shared<State>())
+    {
+        _state->factory = std::move(factory);
+        _state->slotFactory = std::move(slotFactory);
+        _state->size = size;
+        _state->free.reserve(size);
+    }
+
+    std::shared_ptr<Pooled> acquire()
+    {
+        std::shared_ptr<State> state = _state;
+        std::lock_guard<std::mutex> lock(state->mutex);
+        Pooled *object = nullptr;
+        if (!state->free.empty()) {
+            object = state->free.back();
+            state->free.pop_back();
+        } else if (state->created < state->size) {
+            state->created++;
+            if (state->slotFactory) {
+                object = state->slotFactory();
+            } else {
+                state->owned.emplace_back(state->factory());
+                object = state->owned.back().get();
+            }
+        } else {
+            state->fallbacks++;
+            return std::shared_ptr<Pooled>(state->factory());
+        }
+        return std::shared_ptr<Pooled>(object, [state](Pooled *released) {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->free.push_back(released);
+        });
+    }
+
+    size_t size() const { return _state->size; }
+
+    size_t available() const
+    {
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        return _state->free.size() + _state->size - _state->created;
+    }
+
+    size_t fallbacks() const { return _state->fallbacks.load(); }
+
+private:
+    struct State
+    {
+        std::mutex mutex;
+        std::function<Pooled *()> factory;
+        std::function<Pooled *()> slotFactory;
+        size_t size = 0;
+        size_t created = 0;
+        std::vector<std::unique_ptr<Pooled>> owned;
+        std::vector<Pooled *> free;
+        std::atomic<size_t> fallbacks{0};
+    };
+
+    std::shared_ptr<State> _state;
+};
+
+/**
+ * Pool of fixed size matrices (see SlotPool) whose slots live in a
+ * MatrixArena on the pages of the given policy.
+ */
+template<class T, size_t cols, size_t rows>
+class MatrixPool : public SlotPool<Matrix<T, cols, rows>>
+{
+public:
+    typedef Matrix<T, cols, rows> PooledMatrix;
+
+    explicit MatrixPool(size_t size, PagePolicy pages = PAGES_DEFAULT)
+        : MatrixPool(size, std::make_shared<MatrixArena>(pages, size * sizeof(PooledMatrix)))
+    {}
+
+    const MatrixArena &arena() const { return *_arena; }
+
+private:
+    MatrixPool(size_t size, std::shared_ptr<MatrixArena> arena)
+        : SlotPool<PooledMatrix>(
+              size,
+              []() { return new PooledMatrix(); },
+              [arena]() { return arena->create<PooledMatrix>(); })
+        , _arena(arena)
+    {}
+
+    std::shared_ptr<MatrixArena> _arena;
+};
+
+/**
+ * Pool of rows x cols run-time sized matrices (see SlotPool), for pipelines
+ * whose shapes are only known at run time, such as the activations of a
+ * convolution chain.
+ */
+template<class T>
+class DynamicMatrixPool : public SlotPool<DynamicMatrix<T>>
+{
+public:
+    typedef DynamicMatrix<T> PooledMatrix;
+
+    DynamicMatrixPool(size_t size, size_t rows, size_t cols)
+        : SlotPool<PooledMatrix>(size, [rows, cols]() { return new PooledMatrix(rows, cols); })
+    {}
+};
+} // namespace matrix_mult_benchmark
+} // namespace kpsr
+
+#endif // MATRIX_POOL_H
@@ -0,0 +1,474 @@
+#ifndef MATRIX_QUANTIZED_GEMM_H
+#define MATRIX_QUANTIZED_GEMM_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "matrix.h"
+#include "matrix_packed_gemm.h"
+#include "task_runtime.h"
+
+/**
+ * Affine quantization: a quantized value q stands for scale * (q - zeroPoint).
+ */
+struct QuantizationParams
+{
+    float scale = 1.0f;
+    int32_t zeroPoint = 0;
+};
+
+/**
+ * Quantization of a product C = A * B. A and C are quantized per tensor, B per
+ * tensor or, with channelScales set, per output channel (column of B), as
+ * convolution weights usually are; zero points are per tensor. The defaults
+ * (unit scales, zero points 0) make C the exact product saturated to the
+ * element type.
+ */
+struct QuantizedGemmParams
+{
+    QuantizationParams a;
+    QuantizationParams b;
+    QuantizationParams c;
+    std::vector<float> channelScales;
+
+    /**
+     * Factor taking the int32 sum of column j to C's scale.
+     */
+    double multiplier(size_t j) const
+    {
+        double scaleB = channelScales.empty() ? b.scale : channelScales[j];
+        return double(a.scale) * scaleB / c.scale;
+    }
+};
+
+/**
+ * Parameters for operands holding values up to maxA and maxB in magnitude
+ * (zero points 0): C's scale maps the largest possible sum of k products to
+ * the largest Q, so products never saturate.
+ */
+template<class Q>
+QuantizedGemmParams rangeQuantizedParams(size_t k, double maxA, double maxB)
+{
+    QuantizedGemmParams params;
+    params.c.scale = float(std::max(1.0, k * maxA * maxB / std::numeric_limits<Q>::max()));
+    return params;
+}
+
+/**
+ * Rounds half away from zero, as std::llround, without its library call (ten
+ * times the rest of the requantization).
+ */
+inline int64_t roundToNearest(double value)
+{
+    return static_cast<int64_t>(value + (value >= 0 ? 0.5 : -0.5));
+}
+
+/**
+ * Integer micro-kernel: computes an mr x nr int32 tile of C from `groups`
+ * packed groups of A and B. A group holds `group` consecutive k values of each
+ * row of A (and of each column of B), widened to int16 pairs (multiply-add
+ * instructions such as pmaddwd, group 2) or kept as bytes (dot product
+ * instructions, group 4). A values are packed plus aOffset, 128 where the
+ * instruction wants unsigned A; the driver takes that back out. Only the
+ * top-left m x n corner of the tile is written back.
+ */
+struct QuantizedMicroKernel
+{
+    typedef void (*Function)(size_t groups,
+                             const void *a,
+                             const void *b,
+                             int32_t *c,
+                             size_t ldc,
+                             size_t m,
+                             size_t n,
+                             bool accumulate);
+
+    size_t mr;
+    size_t nr;
+    size_t group;
+    int32_t aOffset;
+    bool bytes;
+    Function run;
+    const char *name;
+};
+
+template<size_t mr, size_t nr>
+void quantizedMicroKernel(size_t groups,
+                          const void *a,
+                          const void *b,
+                          int32_t *c,
+                          size_t ldc,
+                          size_t m,
+                          size_t n,
+                          bool accumulate)
+{
+    const int16_t *pa = static_cast<const int16_t *>(a);
+    const int16_t *pb = static_cast<const int16_t *>(b);
+    int32_t acc[mr][nr] = {};
+    for (size_t g = 0; g < groups; g++, pa += 2 * mr, pb += 2 * nr) {
+        for (size_t i = 0; i < mr; i++) {
+            for (size_t j = 0; j < nr; j++) {
+                acc[i][j] += int32_t(pa[2 * i]) * pb[2 * j] +
+                             int32_t(pa[2 * i + 1]) * pb[2 * j + 1];
+            }
+        }
+    }
+    for (size_t i = 0; i < m; i++) {
+        for (size_t j = 0; j < n; j++) {
+            if (accumulate) {
+                c[i * ldc + j] += acc[i][j];
+            } else {
+                c[i * ldc + j] = acc[i][j];
+            }
+        }
+    }
+}
+
+/**
+ * Packs an m x k block of row-major A into micro-panels of mr rows, each a
+ * sequence of groups of `group` k values per row, as P (int16_t, or uint8_t
+ * holding the low byte of value + offset). Rows and k values past the block
+ * are packed as offset; B is zero there. Full groups take the branch-free
+ * path, the group size being a template argument so its loop unrolls.
+ */
+template<size_t group, class Q, class P>
+void packQuantizedGroupsA(
+    size_t m, size_t k, size_t mr, int32_t offset, const Q *a, size_t lda, P *packed)
+{
+    for (size_t ir = 0; ir < m; ir += mr) {
+        const bool fullRows = ir + mr <= m;
+        for (size_t p = 0; p < k; p += group) {
+            if (fullRows && p + group <= k) {
+                for (size_t i = 0; i < mr; i++) {
+                    const Q *row = a + (ir + i) * lda + p;
+                    for (size_t t = 0; t < group; t++) {
+                        packed[t] = static_cast<P>(int32_t(row[t]) + offset);
+                    }
+                    packed += group;
+                }
+                continue;
+            }
+            for (size_t i = 0; i < mr; i++) {
+                for (size_t t = 0; t < group; t++) {
+                    bool inside = ir + i < m && p + t < k;
+                    int32_t value = inside ? int32_t(a[(ir + i) * lda + p + t]) : 0;
+                    *packed++ = static_cast<P>(value + offset);
+                }
+            }
+        }
+    }
+}
+
+template<class Q, class P>
+void packQuantizedA(size_t m,
+                    size_t k,
+                    const QuantizedMicroKernel &kernel,
+                    const Q *a,
+                    size_t lda,
+                    P *packed)
+{
+    if (kernel.group == 4) {
+        packQuantizedGroupsA<4>(m, k, kernel.mr, kernel.aOffset, a, lda, packed);
+    } else {
+        packQuantizedGroupsA<2>(m, k, kernel.mr, kernel.aOffset, a, lda, packed);
+    }
+}
+
+/**
+ * Packs a k x n block of row-major B into micro-panels of nr columns, each a
+ * sequence of groups of `group` k values per column. Padding is zero.
+ */
+template<size_t group, class Q, class P>
+void packQuantizedGroupsB(size_t k, size_t n, size_t nr, const Q *b, size_t ldb, P *packed)
+{
+    for (size_t jr = 0; jr < n; jr += nr) {
+        const bool fullColumns = jr + nr <= n;
+        for (size_t p = 0; p < k; p += group) {
+            if (fullColumns && p + group <= k) {
+                const Q *rows = b + p * ldb + jr;
+                for (size_t j = 0; j < nr; j++) {
+                    for (size_t t = 0; t < group; t++) {
+                        packed[t] = static_cast<P>(rows[t * ldb + j]);
+                    }
+                    packed += group;
+                }
+                continue;
+            }
+            for (size_t j = 0; j < nr; j++) {
+                for (size_t t = 0; t < group; t++) {
+                    *packed++ = jr + j < n && p + t < k ? static_cast<P>(b[(p + t) * ldb + jr + j])
+                                                        : P(0);
+                }
+            }
+        }
+    }
+}
+
+template<class Q, class P>
+void packQuantizedB(size_t k,
+                    size_t n,
+                    const QuantizedMicroKernel &kernel,
+                    const Q *b,
+                    size_t ldb,
+                    P *packed)
+{
+    if (kernel.group == 4) {
+        packQuantizedGroupsB<4>(k, n, kernel.nr, b, ldb, packed);
+    } else {
+        packQuantizedGroupsB<2>(k, n, kernel.nr, b, ldb, packed);
+    }
+}
+
+/**
+ * Quantized GEMM driver for Q = int8_t or int16_t: the raw products are
+ * accumulated in int32 by the micro-kernel, blocked and packed like
+ * PackedGemm, then the zero points are taken out using row sums of A and
+ * column sums of B, and every element is requantized to C's scale, rounded
+ * and saturated.
+ *
+ * int32 accumulation is exact as long as k * max|A - zeroPoint| * max|B -
+ * zeroPoint| stays below 2^31: always for int8 up to k = 2^17, for int16 only
+ * for operands using part of the range (e.g. 12 bits at k = 128).
+ */
+template<class Q>
+class QuantizedGemm
+{
+public:
+    QuantizedGemm(const QuantizedMicroKernel &kernel,
+                  const GemmBlocking &blocking,
+                  TaskRuntime *runtime = nullptr)
+        : _kernel(kernel)
+        , _blocking(blocking)
+        , _runtime(runtime)
+        , _threads(0)
+    {}
+
+    void multiply(size_t m,
+                  size_t n,
+                  size_t k,
+                  const Q *a,
+                  size_t lda,
+                  const Q *b,
+                  size_t ldb,
+                  Q *c,
+                  size_t ldc,
+                  const QuantizedGemmParams &params) const
+    {
+        if (k == 0) {
+            // Every sum is zero, which C represents by its zero point.
+            Q zero = static_cast<Q>(std::min<int64_t>(
+                std::numeric_limits<Q>::max(),
+                std::max<int64_t>(std::numeric_limits<Q>::min(), params.c.zeroPoint)));
+            for (size_t i = 0; i < m; i++) {
+                std::fill(c + i * ldc, c + i * ldc + n, zero);
+            }
+            return;
+        }
+
+        const size_t mr = _kernel.mr;
+        const size_t nr = _kernel.nr;
+        const size_t group = _kernel.group;
+        const size_t elementSize = _kernel.bytes ? 1 : 2;
+        const size_t threads = _threads.load(std::memory_order_relaxed);
+        size_t rowBlock = std::max(mr, _blocking.mc / mr * mr);
+        if (_runtime != nullptr) {
+            rowBlock = std::min(rowBlock, roundUp(_runtime->grainFor(m, mr, threads), mr));
+        }
+        const size_t rowBlocks = (m + rowBlock - 1) / rowBlock;
+        const size_t blocksPerTask = threads > 0 ? (rowBlocks + threads - 1) / threads : 1;
+        const size_t kcBlock = std::max(group, _blocking.kc / group * group);
+        const size_t ncBlock = std::min(_blocking.nc, n);
+
+        // Shared by the row block tasks, so taken out of the thread local
+        // slots (see PackedGemm).
+        Buffer packedB;
+        Buffer accumulators;
+        Buffer sums;
+        packedB.swap(buffer(1));
+        accumulators.swap(buffer(2));
+        sums.swap(buffer(3));
+        packedB.resize(roundUp(ncBlock, nr) * roundUp(std::min(kcBlock, k), group) * elementSize);
+        accumulators.resize(m * ncBlock * sizeof(int32_t));
+        int32_t *acc = reinterpret_cast<int32_t *>(accumulators.data());
+        // Per-column multipliers, then the row sums of A and the column sums
+        // of the current B block.
+        sums.resize(ncBlock * sizeof(double) + (m + ncBlock) * sizeof(int32_t));
+        double *multipliers = reinterpret_cast<double *>(sums.data());
+        int32_t *rowSums = reinterpret_cast<int32_t *>(multipliers + ncBlock);
+        int32_t *columnSums = rowSums + m;
+
+        for (size_t i = 0; i < m; i++) {
+            // Summed in a local: Q = int8_t may alias rowSums.
+            int32_t sum = 0;
+            for (size_t p = 0; p < k; p++) {
+                sum += a[i * lda + p];
+            }
+            rowSums[i] = sum;
+        }
+        for (size_t jc = 0; jc < n; jc += ncBlock) {
+            size_t nb = std::min(ncBlock, n - jc);
+            std::fill(columnSums, columnSums + ncBlock, 0);
+            for (size_t p = 0; p < k; p++) {
+                for (size_t j = 0; j < nb; j++) {
+                    columnSums[j] += b[p * ldb + jc + j];
+                }
+            }
+            for (size_t j = 0; j < nb; j++) {
+                multipliers[j] = params.multiplier(jc + j);
+            }
+
+            for (size_t pc = 0; pc < k; pc += kcBlock) {
+                size_t kb = std::min(kcBlock, k - pc);
+                size_t groups = (kb + group - 1) / group;
+                if (_kernel.bytes) {
+                    packQuantizedB(kb, nb, _kernel, b + pc * ldb + jc, ldb, packedB.data());
+                } else {
+                    packQuantizedB(kb,
+                                   nb,
+                                   _kernel,
+                                   b + pc * ldb + jc,
+                                   ldb,
+                                   reinterpret_cast<int16_t *>(packedB.data()));
+                }
+                const bool last = pc + kb == k;
+
+                auto multiplyRowBlocks = [&](size_t first, size_t lastBlock) {
+                    Buffer &packedA = buffer(0);
+                    size_t panelSize = roundUp(rowBlock, mr) * groups * group * elementSize;
+                    packedA.resize(std::max(packedA.size(), panelSize));
+                    for (size_t block = first; block < lastBlock; block++) {
+                        size_t ic = block * rowBlock;
+                        size_t mb = std::min(rowBlock, m - ic);
+                        if (_kernel.bytes) {
+                            packQuantizedA(mb, kb, _kernel, a + ic * lda + pc, lda, packedA.data());
+                        } else {
+                            packQuantizedA(mb,
+                                           kb,
+                                           _kernel,
+                                           a + ic * lda + pc,
+                                           lda,
+                                           reinterpret_cast<int16_t *>(packedA.data()));
+                        }
+                        for (size_t jr = 0; jr < nb; jr += nr) {
+                            for (size_t ir = 0; ir < mb; ir += mr) {
+                                _kernel.run(groups,
+                                            packedA.data() + ir * groups * group * elementSize,
+                                            packedB.data() + jr * groups * group * elementSize,
+                                            acc + (ic + ir) * ncBlock + jr,
+                                            ncBlock,
+                                            std::min(mr, mb - ir),
+                                            std::min(nr, nb - jr),
+                                            pc != 0);
+                            }
+                        }
+                        if (last) {
+                            requantize(ic,
+                                       mb,
+                                       jc,
+                                       nb,
+                                       k,
+                                       acc,
+                                       ncBlock,
+                                       rowSums,
+                                       columnSums,
+                                       multipliers,
+                                       c,
+                                       ldc,
+                                       params);
+                        }
+                    }
+                };
+                if (_runtime != nullptr) {
+                    _runtime->parallelFor(rowBlocks, blocksPerTask, multiplyRowBlocks);
+                } else {
+                    multiplyRowBlocks(0, rowBlocks);
+                }
+            }
+        }
+        packedB.swap(buffer(1));
+        accumulators.swap(buffer(2));
+        sums.swap(buffer(3));
+    }
+
+    const QuantizedMicroKernel &kernel() const { return _kernel; }
+    const GemmBlocking &blocking() const { return _blocking; }
+    bool parallel() const { return _runtime != nullptr; }
+
+    void setBlocking(const GemmBlocking &blocking) { _blocking = blocking; }
+
+    /**
+     * Caps the runtime tasks of one product at threads (0: no cap).
+     */
+    void setThreads(size_t threads) { _threads.store(threads, std::memory_order_relaxed); }
+
+private:
+    typedef std::vector<uint8_t, AlignedAllocator<uint8_t>> Buffer;
+
+    static size_t roundUp(size_t value, size_t multiple)
+    {
+        return (value + multiple - 1) / multiple * multiple;
+    }
+
+    static Buffer &buffer(int index)
+    {
+        static thread_local Buffer buffers[4];
+        return buffers[index];
+    }
+
+    /**
+     * Rows [ic, ic + mb) of the column block at jc from the raw sums
+     * Σ (a + aOffset) b to C:
+     *   Σ (a - za)(b - zb) = raw - (za + aOffset) Σb - zb Σa + k za zb.
+     * Each row is requantized in place in the int32 accumulators and then
+     * narrowed to C, so neither loop stores through a byte pointer that may
+     * alias its inputs.
+     */
+    void requantize(size_t ic,
+                    size_t mb,
+                    size_t jc,
+                    size_t nb,
+                    size_t k,
+                    int32_t *acc,
+                    size_t ldAcc,
+                    const int32_t *rowSums,
+                    const int32_t *columnSums,
+                    const double *multipliers,
+                    Q *c,
+                    size_t ldc,
+                    const QuantizedGemmParams &params) const
+    {
+        const int64_t za = params.a.zeroPoint;
+        const int64_t zb = params.b.zeroPoint;
+        const int64_t zc = params.c.zeroPoint;
+        const int64_t columnFactor = za + _kernel.aOffset;
+        const int64_t lowest = std::numeric_limits<Q>::min();
+        const int64_t highest = std::numeric_limits<Q>::max();
+        for (size_t i = ic; i < ic + mb; i++) {
+            const int64_t rowTerm = int64_t(k) * za * zb - zb * rowSums[i];
+            int32_t *row = acc + i * ldAcc;
+            for (size_t j = 0; j < nb; j++) {
+                int64_t sum = int64_t(row[j]) - columnFactor * columnSums[j] + rowTerm;
+                int64_t value = roundToNearest(double(sum) * multipliers[j]) + zc;
+                row[j] = int32_t(std::min(highest, std::max(lowest, value)));
+            }
+            Q *out = c + i * ldc + jc;
+            for (size_t j = 0; j < nb; j++) {
+                out[j] = static_cast<Q>(row[j]);
+            }
+        }
+    }
+
+    QuantizedMicroKernel _kernel;
+    GemmBlocking _blocking;
+    TaskRuntime *_runtime;
+    // Set by ThreadBudget::rebalance() while other threads multiply.
+    std::atomic<size_t> _threads;
+};
+
+#endif // MATRIX_QUANTIZED_GEMM_H
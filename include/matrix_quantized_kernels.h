@@ -0,0 +1,289 @@
+#ifndef MATRIX_QUANTIZED_KERNELS_H
+#define MATRIX_QUANTIZED_KERNELS_H
+
+#include <cstdint>
+#include <cstring>
+
+#include "matrix_quantized_gemm.h"
+#include "matrix_simd_kernels.h"
+
+#if defined(MATRIX_SIMD_X86)
+
+__attribute__((target("sse4.2"))) inline void sse42QuantizedMicroKernel(size_t groups,
+                                                                        const void *a,
+                                                                        const void *b,
+                                                                        int32_t *c,
+                                                                        size_t ldc,
+                                                                        size_t m,
+                                                                        size_t n,
+                                                                        bool accumulate)
+{
+    constexpr size_t mr = 4;
+    constexpr size_t nr = 8;
+    const int16_t *pa = static_cast<const int16_t *>(a);
+    const int16_t *pb = static_cast<const int16_t *>(b);
+    __m128i acc[mr][2];
+    for (size_t i = 0; i < mr; i++) {
+        acc[i][0] = _mm_setzero_si128();
+        acc[i][1] = _mm_setzero_si128();
+    }
+    for (size_t g = 0; g < groups; g++, pa += 2 * mr, pb += 2 * nr) {
+        __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pb));
+        __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pb + 8));
+        for (size_t i = 0; i < mr; i++) {
+            int32_t pair;
+            std::memcpy(&pair, pa + 2 * i, sizeof(pair));
+            __m128i ai = _mm_set1_epi32(pair);
+            acc[i][0] = _mm_add_epi32(acc[i][0], _mm_madd_epi16(ai, b0));
+            acc[i][1] = _mm_add_epi32(acc[i][1], _mm_madd_epi16(ai, b1));
+        }
+    }
+    int32_t tile[mr * nr];
+    for (size_t i = 0; i < mr; i++) {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(tile + i * nr), acc[i][0]);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(tile + i * nr + 4), acc[i][1]);
+    }
+    storeMicroTile(tile, nr, c, ldc, m, n, accumulate);
+}
+
+__attribute__((target("avx2"))) inline void avx2QuantizedMicroKernel(size_t groups,
+                                                                     const void *a,
+                                                                     const void *b,
+                                                                     int32_t *c,
+                                                                     size_t ldc,
+                                                                     size_t m,
+                                                                     size_t n,
+                                                                     bool accumulate)
+{
+    constexpr size_t mr = 6;
+    constexpr size_t nr = 16;
+    const int16_t *pa = static_cast<const int16_t *>(a);
+    const int16_t *pb = static_cast<const int16_t *>(b);
+    __m256i acc[mr][2];
+    for (size_t i = 0; i < mr; i++) {
+        acc[i][0] = _mm256_setzero_si256();
+        acc[i][1] = _mm256_setzero_si256();
+    }
+    for (size_t g = 0; g < groups; g++, pa += 2 * mr, pb += 2 * nr) {
+        __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pb));
+        __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pb + 16));
+        for (size_t i = 0; i < mr; i++) {
+            int32_t pair;
+            std::memcpy(&pair, pa + 2 * i, sizeof(pair));
+            __m256i ai = _mm256_set1_epi32(pair);
+            acc[i][0] = _mm256_add_epi32(acc[i][0], _mm256_madd_epi16(ai, b0));
+            acc[i][1] = _mm256_add_epi32(acc[i][1], _mm256_madd_epi16(ai, b1));
+        }
+    }
+    int32_t tile[mr * nr];
+    for (size_t i = 0; i < mr; i++) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(tile + i * nr), acc[i][0]);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(tile + i * nr + 8), acc[i][1]);
+    }
+    storeMicroTile(tile, nr, c, ldc, m, n, accumulate);
+}
+
+__attribute__((target("avx512bw"))) inline void avx512QuantizedMicroKernel(size_t groups,
+                                                                           const void *a,
+                                                                           const void *b,
+                                                                           int32_t *c,
+                                                                           size_t ldc,
+                                                                           size_t m,
+                                                                           size_t n,
+                                                                           bool accumulate)
+{
+    constexpr size_t mr = 6;
+    constexpr size_t nr = 32;
+    const int16_t *pa = static_cast<const int16_t *>(a);
+    const int16_t *pb = static_cast<const int16_t *>(b);
+    __m512i acc[mr][2];
+    for (size_t i = 0; i < mr; i++) {
+        acc[i][0] = _mm512_setzero_si512();
+        acc[i][1] = _mm512_setzero_si512();
+    }
+    for (size_t g = 0; g < groups; g++, pa += 2 * mr, pb += 2 * nr) {
+        __m512i b0 = _mm512_loadu_si512(pb);
+        __m512i b1 = _mm512_loadu_si512(pb + 32);
+        for (size_t i = 0; i < mr; i++) {
+            int32_t pair;
+            std::memcpy(&pair, pa + 2 * i, sizeof(pair));
+            __m512i ai = _mm512_set1_epi32(pair);
+            acc[i][0] = _mm512_add_epi32(acc[i][0], _mm512_madd_epi16(ai, b0));
+            acc[i][1] = _mm512_add_epi32(acc[i][1], _mm512_madd_epi16(ai, b1));
+        }
+    }
+    int32_t tile[mr * nr];
+    for (size_t i = 0; i < mr; i++) {
+        _mm512_storeu_si512(tile + i * nr, acc[i][0]);
+        _mm512_storeu_si512(tile + i * nr + 16, acc[i][1]);
+    }
+    storeMicroTile(tile, nr, c, ldc, m, n, accumulate);
+}
+
+// int8 only: groups of four bytes, A unsigned (packed plus 128), B signed.
+__attribute__((target("avx512bw,avx512vnni"))) inline void avx512VnniQuantizedMicroKernel(
+    size_t groups,
+    const void *a,
+    const void *b,
+    int32_t *c,
+    size_t ldc,
+    size_t m,
+    size_t n,
+    bool accumulate)
+{
+    constexpr size_t mr = 6;
+    constexpr size_t nr = 32;
+    const uint8_t *pa = static_cast<const uint8_t *>(a);
+    const uint8_t *pb = static_cast<const uint8_t *>(b);
+    __m512i acc[mr][2];
+    for (size_t i = 0; i < mr; i++) {
+        acc[i][0] = _mm512_setzero_si512();
+        acc[i][1] = _mm512_setzero_si512();
+    }
+    for (size_t g = 0; g < groups; g++, pa += 4 * mr, pb += 4 * nr) {
+        __m512i b0 = _mm512_loadu_si512(pb);
+        __m512i b1 = _mm512_loadu_si512(pb + 64);
+        for (size_t i = 0; i < mr; i++) {
+            int32_t quad;
+            std::memcpy(&quad, pa + 4 * i, sizeof(quad));
+            __m512i ai = _mm512_set1_epi32(quad);
+            acc[i][0] = _mm512_dpbusd_epi32(acc[i][0], ai, b0);
+            acc[i][1] = _mm512_dpbusd_epi32(acc[i][1], ai, b1);
+        }
+    }
+    int32_t tile[mr * nr];
+    for (size_t i = 0; i < mr; i++) {
+        _mm512_storeu_si512(tile + i * nr, acc[i][0]);
+        _mm512_storeu_si512(tile + i * nr + 16, acc[i][1]);
+    }
+    storeMicroTile(tile, nr, c, ldc, m, n, accumulate);
+}
+
+#endif // MATRIX_SIMD_X86
+
+#if defined(MATRIX_SIMD_NEON)
+
+// Widening multiply-accumulate: vld2q splits each pair group back into the
+// two k values of eight columns.
+inline void neonQuantizedMicroKernel(size_t groups,
+                                     const void *a,
+                                     const void *b,
+                                     int32_t *c,
+                                     size_t ldc,
+                                     size_t m,
+                                     size_t n,
+                                     bool accumulate)
+{
+    constexpr size_t mr = NEON_FLOAT_MR;
+    constexpr size_t nr = 8;
+    const int16_t *pa = static_cast<const int16_t *>(a);
+    const int16_t *pb = static_cast<const int16_t *>(b);
+    int32x4_t acc[mr][2];
+    for (size_t i = 0; i < mr; i++) {
+        acc[i][0] = vdupq_n_s32(0);
+        acc[i][1] = vdupq_n_s32(0);
+    }
+    for (size_t g = 0; g < groups; g++, pa += 2 * mr, pb += 2 * nr) {
+        int16x8x2_t bv = vld2q_s16(pb);
+        for (size_t i = 0; i < mr; i++) {
+            acc[i][0] = vmlal_n_s16(acc[i][0], vget_low_s16(bv.val[0]), pa[2 * i]);
+            acc[i][1] = vmlal_n_s16(acc[i][1], vget_high_s16(bv.val[0]), pa[2 * i]);
+            acc[i][0] = vmlal_n_s16(acc[i][0], vget_low_s16(bv.val[1]), pa[2 * i + 1]);
+            acc[i][1] = vmlal_n_s16(acc[i][1], vget_high_s16(bv.val[1]), pa[2 * i + 1]);
+        }
+    }
+    int32_t tile[mr * nr];
+    for (size_t i = 0; i < mr; i++) {
+        vst1q_s32(tile + i * nr, acc[i][0]);
+        vst1q_s32(tile + i * nr + 4, acc[i][1]);
+    }
+    storeMicroTile(tile, nr, c, ldc, m, n, accumulate);
+}
+
+#if defined(__ARM_FEATURE_DOTPROD)
+// int8 only, ARMv8.2 sdot: groups of four signed bytes.
+inline void neonDotQuantizedMicroKernel(size_t groups,
+                                        const void *a,
+                                        const void *b,
+                                        int32_t *c,
+                                        size_t ldc,
+                                        size_t m,
+                                        size_t n,
+                                        bool accumulate)
+{
+    constexpr size_t mr = NEON_FLOAT_MR;
+    constexpr size_t nr = 8;
+    const uint8_t *pa = static_cast<const uint8_t *>(a);
+    const int8_t *pb = static_cast<const int8_t *>(b);
+    int32x4_t acc[mr][2];
+    for (size_t i = 0; i < mr; i++) {
+        acc[i][0] = vdupq_n_s32(0);
+        acc[i][1] = vdupq_n_s32(0);
+    }
+    for (size_t g = 0; g < groups; g++, pa += 4 * mr, pb += 4 * nr) {
+        int8x16_t b0 = vld1q_s8(pb);
+        int8x16_t b1 = vld1q_s8(pb + 16);
+        for (size_t i = 0; i < mr; i++) {
+            int32_t quad;
+            std::memcpy(&quad, pa + 4 * i, sizeof(quad));
+            int8x16_t ai = vreinterpretq_s8_s32(vdupq_n_s32(quad));
+            acc[i][0] = vdotq_s32(acc[i][0], ai, b0);
+            acc[i][1] = vdotq_s32(acc[i][1], ai, b1);
+        }
+    }
+    int32_t tile[mr * nr];
+    for (size_t i = 0; i < mr; i++) {
+        vst1q_s32(tile + i * nr, acc[i][0]);
+        vst1q_s32(tile + i * nr + 4, acc[i][1]);
+    }
+    storeMicroTile(tile, nr, c, ldc, m, n, accumulate);
+}
+#endif
+
+#endif // MATRIX_SIMD_NEON
+
+/**
+ * Quantized micro-kernel per element type Q (int8_t or int16_t). int8 uses
+ * dot product instructions where there are some: AVX512-VNNI, checked at run
+ * time, and ARMv8.2 sdot when the build targets it (the Raspberry Pi 4's
+ * Cortex-A72 has none). Everything else is widened to int16 pairs and
+ * multiply-added (pmaddwd, NEON vmlal).
+ */
+template<class Q>
+struct QuantizedMicroKernels
+{
+    static QuantizedMicroKernel select(SimdIsa isa)
+    {
+        const bool int8 = sizeof(Q) == 1;
+        switch (isa) {
+#if defined(MATRIX_SIMD_X86)
+        case SIMD_AVX512:
+            if (int8 && __builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512bw")) {
+                return {6, 32, 4, 128, true, &avx512VnniQuantizedMicroKernel, "avx512-vnni"};
+            }
+            if (__builtin_cpu_supports("avx512bw")) {
+                return {6, 32, 2, 0, false, &avx512QuantizedMicroKernel, "avx512bw"};
+            }
+            return {6, 16, 2, 0, false, &avx2QuantizedMicroKernel, "avx2"};
+        case SIMD_AVX2:
+            return {6, 16, 2, 0, false, &avx2QuantizedMicroKernel, "avx2"};
+        case SIMD_SSE42:
+            return {4, 8, 2, 0, false, &sse42QuantizedMicroKernel, "sse4.2"};
+#endif
+#if defined(MATRIX_SIMD_NEON)
+        case SIMD_NEON:
+#if defined(__ARM_FEATURE_DOTPROD)
+            if (int8) {
+                return {NEON_FLOAT_MR, 8, 4, 0, true, &neonDotQuantizedMicroKernel, "neon dotprod"};
+            }
+#endif
+            return {NEON_FLOAT_MR, 8, 2, 0, false, &neonQuantizedMicroKernel, "neon"};
+#endif
+        default:
+            (void)int8;
+            return {4, 8, 2, 0, false, &quantizedMicroKernel<4, 8>, "generic"};
+        }
+    }
+};
+
+#endif // MATRIX_QUANTIZED_KERNELS_H
@@ -0,0 +1,191 @@
+#ifndef MATRIX_QUANTIZED_MULTIPLIER_H
+#define MATRIX_QUANTIZED_MULTIPLIER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "dynamic_matrix_multiplier.h"
+#include "matrix_backend_registry.h"
+#include "matrix_quantized_gemm.h"
+#include "matrix_quantized_kernels.h"
+#include "matrix_verification.h"
+#include "task_runtime.h"
+
+/**
+ * Quantized multiplier on run-time shapes for Q = int8_t or int16_t: int32
+ * accumulation with the SIMD kernel of the host, C requantized with params().
+ * With the default parameters C is the exact product saturated to Q.
+ */
+template<class Q>
+class DynamicMatrixQuantizedMultiplier : public DynamicMatrixMultiplier<Q>
+{
+    static_assert(std::is_same<Q, int8_t>::value || std::is_same<Q, int16_t>::value,
+                  "quantized products are int8_t or int16_t");
+
+public:
+    explicit DynamicMatrixQuantizedMultiplier(bool parallel = false)
+        : _gemm(QuantizedMicroKernels<Q>::select(activeSimdIsa()),
+                {96, 256, 256},
+                parallel ? &TaskRuntime::instance() : nullptr)
+    {}
+
+    virtual ~DynamicMatrixQuantizedMultiplier() {}
+
+    const QuantizedGemmParams &params() const { return _params; }
+
+    /**
+     * channelScales, when set, needs one scale per column of B.
+     */
+    void setParams(const QuantizedGemmParams &params) { _params = params; }
+
+    const char *kernelName() const { return _gemm.kernel().name; }
+
+    // Only the task runtime variant runs a product on several threads.
+    bool setNumThreads(size_t threads) override
+    {
+        if (!_gemm.parallel()) {
+            return false;
+        }
+        _gemm.setThreads(threads);
+        return true;
+    }
+
+    bool setBlocking(size_t mc, size_t kc, size_t nc) override
+    {
+        _gemm.setBlocking({mc, kc, nc});
+        return true;
+    }
+
+protected:
+    void compute(const MatrixView<const Q> &A,
+                 const MatrixView<const Q> &B,
+                 const MatrixView<Q> &C) override
+    {
+        _gemm.multiply(
+            C.rows, C.cols, A.cols, A.data, A.stride, B.data, B.stride, C.data, C.stride, _params);
+    }
+
+    void computeEmpty(const MatrixView<Q> &C) override
+    {
+        _gemm.multiply(C.rows, C.cols, 0, nullptr, 0, nullptr, 0, C.data, C.stride, _params);
+    }
+
+private:
+    QuantizedGemm<Q> _gemm;
+    QuantizedGemmParams _params;
+};
+
+template<class Q>
+bool registerQuantizedBackends()
+{
+    DynamicMatrixQuantizedMultiplier<Q> probe;
+    MatrixBackendRegistry<Q>::instance().add(
+        std::string("quantized (") + probe.kernelName() + ")", 70, []() {
+            return std::make_unique<DynamicMatrixQuantizedMultiplier<Q>>();
+        });
+    MatrixBackendRegistry<Q>::instance().add(
+        "quantized (task runtime)",
+        71,
+        []() { return std::make_unique<DynamicMatrixQuantizedMultiplier<Q>>(true); },
+        true);
+    return true;
+}
+
+// int8 and int16 only have the quantized backends.
+inline const bool quantizedBackendRegistered =
+    registerQuantizedBackends<int8_t>() && registerQuantizedBackends<int16_t>();
+
+/**
+ * verifyDynamicMultiplier() and, for a DynamicMatrixQuantizedMultiplier, the
+ * requantization: nonzero zero points, per-channel scales of B and a C scale
+ * that saturates part of the results, against a reference using the same
+ * double multipliers on exact int64 sums. The multiplier's parameters are
+ * restored afterwards.
+ */
+template<class Q>
+VerificationReport verifyQuantizedMultiplier(DynamicMatrixMultiplier<Q> &multiplier)
+{
+    VerificationReport report = verifyDynamicMultiplier<Q>(multiplier);
+    auto *quantized = dynamic_cast<DynamicMatrixQuantizedMultiplier<Q> *>(&multiplier);
+    if (quantized == nullptr) {
+        return report;
+    }
+    const QuantizedGemmParams saved = quantized->params();
+    const int64_t lowest = std::numeric_limits<Q>::min();
+    const int64_t highest = std::numeric_limits<Q>::max();
+    // int16 operands keep to 11 bits so that k = 1000 sums stay exact in int32.
+    const Q range = sizeof(Q) == 1 ? Q(127) : Q(1000);
+    Philox4x32 rng(0x9a17ULL);
+    uint64_t stream = 0;
+    for (const MatrixShape &shape : verificationShapes()) {
+        QuantizedGemmParams params;
+        params.a = {0.02f, 3};
+        params.b = {0.01f, -2};
+        for (size_t j = 0; j < shape.n; j++) {
+            params.channelScales.push_back(0.01f * float(1 + j % 5));
+        }
+        params.c = {float(0.02 * 0.03 * std::sqrt(double(std::max<size_t>(shape.k, 1))) * range *
+                          range / double(highest)),
+                    -7};
+        quantized->setParams(params);
+
+        DynamicMatrix<Q> A(shape.m + 1, shape.k + 3);
+        DynamicMatrix<Q> B(shape.k + 1, shape.n + 5);
+        DynamicMatrix<Q> C(shape.m + 1, shape.n + 7);
+        MatrixView<Q> a = A.view().block(1, 3, shape.m, shape.k);
+        MatrixView<Q> b = B.view().block(1, 5, shape.k, shape.n);
+        MatrixView<Q> c = C.view().block(1, 7, shape.m, shape.n);
+        for (size_t i = 0; i < a.rows; i++) {
+            rng.fillUniform<Q>(
+                a.row(i), a.cols, Q(-range), range, i * Philox4x32::blocksFor<Q>(a.cols), stream);
+        }
+        stream++;
+        for (size_t i = 0; i < b.rows; i++) {
+            rng.fillUniform<Q>(
+                b.row(i), b.cols, Q(-range), range, i * Philox4x32::blocksFor<Q>(b.cols), stream);
+        }
+        stream++;
+        for (size_t i = 0; i < c.rows; i++) {
+            std::fill(c.row(i), c.row(i) + c.cols, VerificationTraits<Q>::poison());
+        }
+
+        report.cases++;
+        std::string failure;
+        if (!multiplier.multiply(a, b, c)) {
+            failure = "shape rejected";
+        }
+        for (size_t i = 0; i < shape.m && failure.empty(); i++) {
+            for (size_t j = 0; j < shape.n && failure.empty(); j++) {
+                int64_t sum = 0;
+                for (size_t p = 0; p < shape.k; p++) {
+                    sum += (int64_t(a(i, p)) - params.a.zeroPoint) *
+                           (int64_t(b(p, j)) - params.b.zeroPoint);
+                }
+                int64_t expected = std::min(
+                    highest,
+                    std::max(lowest,
+                             roundToNearest(double(sum) * params.multiplier(j)) +
+                                 params.c.zeroPoint));
+                if (int64_t(c(i, j)) != expected) {
+                    std::ostringstream text;
+                    text << "C(" << i << ", " << j << ") = " << int64_t(c(i, j)) << ", expected "
+                         << expected;
+                    failure = text.str();
+                }
+            }
+        }
+        if (!failure.empty() && report.failedCases++ == 0) {
+            report.firstFailure = shape.describe() + " requantized: " + failure;
+        }
+    }
+    quantized->setParams(saved);
+    return report;
+}
+
+#endif // MATRIX_QUANTIZED_MULTIPLIER_H
@@ -1,9 +1,18 @@
 #ifndef MATRIX_RUY_MULTIPLIER_H
 #define MATRIX_RUY_MULTIPLIER_H
 
+#include <klepsydra/matrix_mult_benchmark/dynamic_matrix_multiplier.h>
+#include <klepsydra/matrix_mult_benchmark/matrix_backend_registry.h>
 #include <klepsydra/matrix_mult_benchmark/matrix_multiplier.h>
+#include <klepsydra/matrix_mult_benchmark/task_runtime.h>
 #include <ruy/ruy.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <type_traits>
+
 namespace kpsr {
 namespace matrix_mult_benchmark {
 
@@ -19,24 +28,230 @@ public:
         C.timestamp = A.timestamp;
         ruy::Matrix<T> A_r;
         ruy::MakeSimpleLayout(colsLeft, rowsLeft, ruy::Order::kRowMajor, A_r.mutable_layout());
+        A_r.mutable_layout()->set_stride(A.stride);
         A_r.set_data(A.data[0]);
 
         ruy::Matrix<T> B_r;
         ruy::MakeSimpleLayout(rowsLeft, rowsRight, ruy::Order::kRowMajor, B_r.mutable_layout());
+        B_r.mutable_layout()->set_stride(B.stride);
         B_r.set_data(B.data[0]);
 
         ruy::Matrix<T> C_r;
         ruy::MakeSimpleLayout(colsLeft, rowsRight, ruy::Order::kRowMajor, C_r.mutable_layout());
+        C_r.mutable_layout()->set_stride(C.stride);
         C_r.set_data(C.data[0]);
 
         ruy::MulParams<T, T> mul_params;
+        context.set_max_num_threads(static_cast<int>(_threads.load(std::memory_order_relaxed)));
         ruy::Mul(A_r, B_r, mul_params, &context, &C_r);
     }
 
+    // ruy's max_num_threads of this multiplier's context (one per stage),
+    // applied by the stage's next product.
+    bool setNumThreads(size_t threads) override
+    {
+        _threads.store(std::max<size_t>(threads, 1), std::memory_order_relaxed);
+        return true;
+    }
+
+    void multiplyBatch(const Matrix<T, colsLeft, rowsLeft> *A,
+                       const Matrix<T, rowsLeft, rowsRight> *B,
+                       Matrix<T, colsLeft, rowsRight> *C,
+                       size_t n) override
+    {
+        TaskRuntime::instance().parallelFor(n, 1, [&](size_t begin, size_t end) {
+            // Layouts are shared by the whole chunk, only the data pointers change.
+            ruy::Matrix<T> A_r;
+            ruy::MakeSimpleLayout(colsLeft, rowsLeft, ruy::Order::kRowMajor, A_r.mutable_layout());
+            A_r.mutable_layout()->set_stride(Matrix<T, colsLeft, rowsLeft>::stride);
+            ruy::Matrix<T> B_r;
+            ruy::MakeSimpleLayout(rowsLeft, rowsRight, ruy::Order::kRowMajor, B_r.mutable_layout());
+            B_r.mutable_layout()->set_stride(Matrix<T, rowsLeft, rowsRight>::stride);
+            ruy::Matrix<T> C_r;
+            ruy::MakeSimpleLayout(colsLeft, rowsRight, ruy::Order::kRowMajor, C_r.mutable_layout());
+            C_r.mutable_layout()->set_stride(Matrix<T, colsLeft, rowsRight>::stride);
+            ruy::MulParams<T, T> mul_params;
+            ruy::Context &batchContext = threadContext();
+
+            for (size_t i = begin; i < end; i++) {
+                C[i].sequence = A[i].sequence;
+                C[i].timestamp = A[i].timestamp;
+                A_r.set_data(A[i].data[0]);
+                B_r.set_data(B[i].data[0]);
+                C_r.set_data(C[i].data[0]);
+                ruy::Mul(A_r, B_r, mul_params, &batchContext, &C_r);
+            }
+        });
+    }
+
 private:
+    // ruy::Context is not thread safe, each batch worker keeps its own.
+    static ruy::Context &threadContext()
+    {
+        static thread_local ruy::Context context;
+        return context;
+    }
+
     ruy::Context context;
+    // Set by ThreadBudget::rebalance() while the stage multiplies.
+    std::atomic<size_t> _threads{1};
 };
 
+/**
+ * ruy on run-time shapes. One instance may serve concurrent callers (the
+ * microbenchmark threads, pipeline stages): each thread keeps its own
+ * ruy::Context.
+ */
+template<class T>
+class DynamicMatrixRuyMultiplier : public DynamicMatrixMultiplier<T>
+{
+public:
+    DynamicMatrixRuyMultiplier()
+        : _threads(1)
+    {}
+
+    // ruy's max_num_threads, applied to the calling thread's context.
+    bool setNumThreads(size_t threads) override
+    {
+        _threads.store(std::max<size_t>(threads, 1), std::memory_order_relaxed);
+        return true;
+    }
+
+    virtual ~DynamicMatrixRuyMultiplier() {}
+
+protected:
+    void compute(const MatrixView<const T> &A,
+                 const MatrixView<const T> &B,
+                 const MatrixView<T> &C) override
+    {
+        mul(A, B, C, ruy::MulParams<T, T>());
+    }
+
+    // ruy's float kernels add a per-channel bias and clamp while C is in
+    // registers: an unscaled epilogue with one bias runs there, anything else
+    // (scales, both biases, integer types) takes a pass after the product.
+    void computeFused(const MatrixView<const T> &A,
+                      const MatrixView<const T> &B,
+                      const MatrixView<T> &C,
+                      const GemmEpilogue<T> &epilogue) override
+    {
+        ruy::MulParams<T, T> mul_params;
+        if (fusedParams(epilogue, mul_params)) {
+            mul(A, B, C, mul_params);
+            return;
+        }
+        compute(A, B, C);
+        epilogue.apply(C.data, C.stride, 0, 0, C.rows, C.cols);
+    }
+
+    // B is marked kAlwaysCache: each thread's context packs it once and keeps
+    // it in its prepacked cache, keyed by the address of B's copy. The cache
+    // is cleared when an address comes back holding another operand.
+    void computePrepacked(const MatrixView<const T> &A,
+                          const PackedMatrix<T> &B,
+                          const MatrixView<T> &C,
+                          const GemmEpilogue<T> &epilogue) override
+    {
+        const MatrixView<const T> plain = B.plain().view();
+        std::map<const T *, uint64_t> &cached = cachedOperands();
+        auto entry = cached.find(plain.data);
+        if (entry != cached.end() && entry->second != B.id()) {
+            threadContext().ClearPrepackedCache();
+            cached.clear();
+        }
+        cached[plain.data] = B.id();
+        ruy::MulParams<T, T> mul_params;
+        const bool fused = fusedParams(epilogue, mul_params);
+        mul(A, plain, C, mul_params, ruy::CachePolicy::kAlwaysCache);
+        if (!fused) {
+            epilogue.apply(C.data, C.stride, 0, 0, C.rows, C.cols);
+        }
+    }
+
+    // Each runtime thread multiplies its share of the batch with its own
+    // ruy::Context.
+    void computeBatch(const MatrixView<const T> *A,
+                      const MatrixView<const T> *B,
+                      const MatrixView<T> *C,
+                      size_t n) override
+    {
+        this->computeBatchOnRuntime(A, B, C, n);
+    }
+
+private:
+    // Sets the epilogue up in mul_params if ruy can apply it; an empty one
+    // needs nothing.
+    static bool fusedParams(const GemmEpilogue<T> &epilogue, ruy::MulParams<T, T> &mul_params)
+    {
+        if (epilogue.empty()) {
+            return true;
+        }
+        if constexpr (std::is_floating_point<T>::value) {
+            if (epilogue.scale == T(1) &&
+                (epilogue.rowBias == nullptr || epilogue.columnBias == nullptr)) {
+                T low, high;
+                epilogue.bounds(low, high);
+                if (epilogue.columnBias != nullptr) {
+                    mul_params.set_bias(epilogue.columnBias);
+                    mul_params.set_channel_dimension(ruy::ChannelDimension::kCol);
+                } else if (epilogue.rowBias != nullptr) {
+                    mul_params.set_bias(epilogue.rowBias);
+                }
+                mul_params.set_clamp_min(low);
+                mul_params.set_clamp_max(high);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void mul(const MatrixView<const T> &A,
+             const MatrixView<const T> &B,
+             const MatrixView<T> &C,
+             const ruy::MulParams<T, T> &mul_params,
+             ruy::CachePolicy rhsCachePolicy = ruy::CachePolicy::kNeverCache)
+    {
+        ruy::Matrix<T> A_r;
+        ruy::MakeSimpleLayout(A.rows, A.cols, ruy::Order::kRowMajor, A_r.mutable_layout());
+        A_r.mutable_layout()->set_stride(A.stride);
+        A_r.set_data(A.data);
+
+        ruy::Matrix<T> B_r;
+        ruy::MakeSimpleLayout(B.rows, B.cols, ruy::Order::kRowMajor, B_r.mutable_layout());
+        B_r.mutable_layout()->set_stride(B.stride);
+        B_r.set_data(B.data);
+        B_r.set_cache_policy(rhsCachePolicy);
+
+        ruy::Matrix<T> C_r;
+        ruy::MakeSimpleLayout(C.rows, C.cols, ruy::Order::kRowMajor, C_r.mutable_layout());
+        C_r.mutable_layout()->set_stride(C.stride);
+        C_r.set_data(C.data);
+
+        ruy::Context &context = threadContext();
+        context.set_max_num_threads(static_cast<int>(_threads.load(std::memory_order_relaxed)));
+        ruy::Mul(A_r, B_r, mul_params, &context, &C_r);
+    }
+
+    // Id of the operand whose copy is at each address in this thread's cache.
+    static std::map<const T *, uint64_t> &cachedOperands()
+    {
+        static thread_local std::map<const T *, uint64_t> operands;
+        return operands;
+    }
+
+    static ruy::Context &threadContext()
+    {
+        static thread_local ruy::Context context;
+        return context;
+    }
+
+    // Set by ThreadBudget::rebalance() while other threads multiply.
+    std::atomic<size_t> _threads;
+};
+
+inline const bool ruyBackendRegistered =
+    registerMatrixBackend<DynamicMatrixRuyMultiplier>("ruy", 40);
+
 } // namespace matrix_mult_benchmark
 } // namespace kpsr
 #endif
@@ -1,6 +1,10 @@
 #ifndef MATRIX_SEQ_MULTIPLIER_H
 #define MATRIX_SEQ_MULTIPLIER_H
 
+#include <algorithm>
+
+#include "dynamic_matrix_multiplier.h"
+#include "matrix_backend_registry.h"
 #include "matrix_multiplier.h"
 
 template<class T, size_t colsLeft, size_t rowsLeft, size_t rowsRight>
@@ -14,9 +18,10 @@ public:
         C.sequence = A.sequence;
         C.timestamp = A.timestamp;
         for (size_t i = 0; i < colsLeft; ++i) {
+            // Cleared rather than scaled by zero, which keeps NaN and inf.
+            std::fill(C.data[i], C.data[i] + rowsRight, T());
             for (size_t k = 0; k < rowsLeft; ++k) {
                 for (size_t j = 0; j < rowsRight; ++j) {
-                    C.data[i][j] *= (k != 0);
                     C.data[i][j] += A.data[i][k] * B.data[k][j];
                 }
             }
@@ -26,4 +31,32 @@ public:
     virtual ~MatrixSeqMultiplier() {}
 };
 
+template<class T>
+class DynamicMatrixSeqMultiplier : public DynamicMatrixMultiplier<T>
+{
+public:
+    virtual ~DynamicMatrixSeqMultiplier() {}
+
+protected:
+    void compute(const MatrixView<const T> &A,
+                 const MatrixView<const T> &B,
+                 const MatrixView<T> &C) override
+    {
+        for (size_t i = 0; i < C.rows; ++i) {
+            T *c = C.row(i);
+            std::fill(c, c + C.cols, T());
+            for (size_t k = 0; k < A.cols; ++k) {
+                const T a = A(i, k);
+                const T *b = B.row(k);
+                for (size_t j = 0; j < C.cols; ++j) {
+                    c[j] += a * b[j];
+                }
+            }
+        }
+    }
+};
+
+inline const bool seqBackendRegistered =
+    registerMatrixBackend<DynamicMatrixSeqMultiplier>("normal", 100);
+
 #endif // MATRIX_SEQ_MULTIPLIER_H
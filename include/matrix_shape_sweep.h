@@ -0,0 +1,128 @@
+#ifndef MATRIX_SHAPE_SWEEP_H
+#define MATRIX_SHAPE_SWEEP_H
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "dynamic_matrix_multiplier.h"
+#include "perf_counters.h"
+
+/**
+ * Shape of one product: C (m x n) = A (m x k) * B (k x n).
+ */
+struct MatrixShape
+{
+    size_t m;
+    size_t n;
+    size_t k;
+
+    double flops() const { return 2.0 * m * n * k; }
+
+    std::string describe() const
+    {
+        return std::to_string(m) + "x" + std::to_string(n) + "x" + std::to_string(k);
+    }
+};
+
+/**
+ * Parses a shape list such as "32,64 128x256x64": "MxNxK" entries, or a single
+ * size for a square product, separated by commas or spaces. Malformed entries
+ * are skipped.
+ */
+inline std::vector<MatrixShape> parseMatrixShapes(const std::string &spec)
+{
+    std::vector<MatrixShape> shapes;
+    std::string list = spec;
+    std::replace(list.begin(), list.end(), ',', ' ');
+    std::stringstream stream(list);
+    std::string item;
+    while (stream >> item) {
+        std::vector<size_t> sizes;
+        std::stringstream dims(item);
+        std::string dim;
+        bool valid = true;
+        while (std::getline(dims, dim, 'x')) {
+            try {
+                size_t used = 0;
+                long value = std::stol(dim, &used);
+                valid = valid && used == dim.size() && value > 0;
+                sizes.push_back(static_cast<size_t>(value));
+            } catch (const std::exception &) {
+                valid = false;
+            }
+        }
+        if (valid && sizes.size() == 1) {
+            shapes.push_back({sizes[0], sizes[0], sizes[0]});
+        } else if (valid && sizes.size() == 3) {
+            shapes.push_back({sizes[0], sizes[1], sizes[2]});
+        }
+    }
+    return shapes;
+}
+
+struct ShapeSweepResult
+{
+    MatrixShape shape;
+    size_t iterations;
+    double averageMicros;
+    // Totals over the timed products, when counters were passed.
+    PerfCounterValues counters;
+
+    double gflops() const
+    {
+        return averageMicros > 0 ? shape.flops() / (averageMicros * 1e3) : 0.0;
+    }
+};
+
+/**
+ * Times multiplier on one shape: operands are filled from generator, one
+ * warm-up product is discarded, then products run until both minIterations
+ * and minDuration are reached. counters, if given, count the timed products.
+ */
+template<class T>
+ShapeSweepResult timeMatrixShape(DynamicMatrixMultiplier<T> &multiplier,
+                                 const MatrixShape &shape,
+                                 size_t minIterations,
+                                 std::chrono::microseconds minDuration,
+                                 const std::function<T()> &generator,
+                                 PerfCounters *counters = nullptr)
+{
+    DynamicMatrix<T> A(shape.m, shape.k);
+    DynamicMatrix<T> B(shape.k, shape.n);
+    DynamicMatrix<T> C(shape.m, shape.n);
+    for (size_t i = 0; i < A.rows(); i++) {
+        std::generate(&A(i, 0), &A(i, 0) + A.cols(), generator);
+    }
+    for (size_t i = 0; i < B.rows(); i++) {
+        std::generate(&B(i, 0), &B(i, 0) + B.cols(), generator);
+    }
+
+    multiplier.multiply(A, B, C);
+
+    ShapeSweepResult result = {shape, 0, 0.0, PerfCounterValues()};
+    if (counters != nullptr) {
+        counters->reset();
+        counters->start();
+    }
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::duration elapsed(0);
+    while (result.iterations < minIterations || elapsed < minDuration) {
+        multiplier.multiply(A, B, C);
+        result.iterations++;
+        elapsed = std::chrono::steady_clock::now() - start;
+    }
+    if (counters != nullptr) {
+        counters->stop();
+        result.counters = counters->totals();
+    }
+    result.averageMicros = std::chrono::duration<double, std::micro>(elapsed).count() /
+                           result.iterations;
+    return result;
+}
+
+#endif // MATRIX_SHAPE_SWEEP_H
@@ -0,0 +1,568 @@
+#ifndef MATRIX_SIMD_KERNELS_H
+#define MATRIX_SIMD_KERNELS_H
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "matrix_packed_gemm.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MATRIX_SIMD_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#define MATRIX_SIMD_NEON
+#include <arm_neon.h>
+#if defined(__linux__) && !defined(__aarch64__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+#endif
+
+/**
+ * Instruction sets with a micro-kernel in this file. The kernels are compiled
+ * with per-function target attributes, so the binary only needs the baseline
+ * ISA and the best kernel is picked at run time.
+ */
+enum SimdIsa { SIMD_GENERIC = 0, SIMD_SSE42, SIMD_AVX2, SIMD_AVX512, SIMD_NEON };
+
+inline const char *simdIsaName(SimdIsa isa)
+{
+    switch (isa) {
+    case SIMD_SSE42:
+        return "sse4.2";
+    case SIMD_AVX2:
+        return "avx2+fma";
+    case SIMD_AVX512:
+        return "avx512f";
+    case SIMD_NEON:
+        return "neon";
+    default:
+        return "generic";
+    }
+}
+
+inline SimdIsa detectHostSimdIsa()
+{
+#if defined(MATRIX_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return SIMD_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return SIMD_AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return SIMD_SSE42;
+    }
+#elif defined(MATRIX_SIMD_NEON)
+#if defined(__aarch64__)
+    return SIMD_NEON;
+#elif defined(__linux__)
+    if (getauxval(AT_HWCAP) & HWCAP_NEON) {
+        return SIMD_NEON;
+    }
+#endif
+#endif
+    return SIMD_GENERIC;
+}
+
+/**
+ * True when isa belongs to the instruction set family this binary is built
+ * for; generic always does.
+ */
+inline bool simdIsaInBuild(SimdIsa isa)
+{
+#if defined(MATRIX_SIMD_X86)
+    return isa != SIMD_NEON;
+#elif defined(MATRIX_SIMD_NEON)
+    return isa == SIMD_GENERIC || isa == SIMD_NEON;
+#else
+    return isa == SIMD_GENERIC;
+#endif
+}
+
+/**
+ * ISA used by the SIMD backends, detected once. KPSR_SIMD_ISA can force a
+ * lower level (e.g. "sse4.2" on an AVX-512 host) to compare kernels; a name
+ * of another family (x86 on ARM, NEON on x86), above the host or unknown is
+ * reported on stderr and the detected ISA kept.
+ */
+inline SimdIsa activeSimdIsa()
+{
+    static const SimdIsa isa = []() {
+        SimdIsa detected = detectHostSimdIsa();
+        const char *requested = std::getenv("KPSR_SIMD_ISA");
+        if (requested == nullptr) {
+            return detected;
+        }
+        for (int level = SIMD_GENERIC; level <= SIMD_NEON; level++) {
+            SimdIsa candidate = static_cast<SimdIsa>(level);
+            if (std::strcmp(requested, simdIsaName(candidate)) != 0) {
+                continue;
+            }
+            if (!simdIsaInBuild(candidate)) {
+                std::cerr << "KPSR_SIMD_ISA=" << requested
+                          << " is not an instruction set of this build, using "
+                          << simdIsaName(detected) << std::endl;
+                return detected;
+            }
+            if (candidate > detected) {
+                std::cerr << "KPSR_SIMD_ISA=" << requested
+                          << " is not supported by this host, using " << simdIsaName(detected)
+                          << std::endl;
+                return detected;
+            }
+            return candidate;
+        }
+        std::cerr << "Unknown KPSR_SIMD_ISA=" << requested << ", using " << simdIsaName(detected)
+                  << std::endl;
+        return detected;
+    }();
+    return isa;
+}
+
+/**
+ * Writes the m x n corner of a dense mr x nr tile to C.
+ */
+template<class T>
+inline void storeMicroTile(
+    const T *tile, size_t nr, T *c, size_t ldc, size_t m, size_t n, bool accumulate)
+{
+    for (size_t i = 0; i < m; i++) {
+        for (size_t j = 0; j < n; j++) {
+            if (accumulate) {
+                c[i * ldc + j] += tile[i * nr + j];
+            } else {
+                c[i * ldc + j] = tile[i * nr + j];
+            }
+        }
+    }
+}
+
+#if defined(MATRIX_SIMD_X86)
+
+__attribute__((target("sse4.2"))) inline void sse42MicroKernel(size_t kc,
+                                                               const float *a,
+                                                               const float *b,
+                                                               float *c,
+                                                               size_t ldc,
+                                                               size_t m,
+                                                               size_t n,
+                                                               bool accumulate)
+{
+    constexpr size_t mr = 4;
+    constexpr size_t nr = 8;
+    __m128 acc[mr][2];
+    for (size_t i = 0; i < mr; i++) {
+        acc[i][0] = _mm_setzero_ps();
+        acc[i][1] = _mm_setzero_ps();
+    }
+    for (size_t p = 0; p < kc; p++, a += mr, b += nr) {
+        __m128 b0 = _mm_loadu_ps(b);
+        __m128 b1 = _mm_loadu_ps(b + 4);
+        for (size_t i = 0; i < mr; i++) {
+            __m128 ai = _mm_set1_ps(a[i]);
+            acc[i][0] = _mm_add_ps(acc[i][0], _mm_mul_ps(ai, b0));
+            acc[i][1] = _mm_add_ps(acc[i][1], _mm_mul_ps(ai, b1));
+        }
+    }
+    if (m == mr && n == nr) {
+        for (size_t i = 0; i < mr; i++) {
+            float *row = c + i * ldc;
+            if (accumulate) {
+                acc[i][0] = _mm_add_ps(acc[i][0], _mm_loadu_ps(row));
+                acc[i][1] = _mm_add_ps(acc[i][1], _mm_loadu_ps(row + 4));
+            }
+            _mm_storeu_ps(row, acc[i][0]);
+            _mm_storeu_ps(row + 4, acc[i][1]);
+        }
+        return;
+    }
+    float tile[mr * nr];
+    for (size_t i = 0; i < mr; i++) {
+        _mm_storeu_ps(tile + i * nr, acc[i][0]);
+        _mm_storeu_ps(tile + i * nr + 4, acc[i][1]);
+    }
+    storeMicroTile(tile, nr, c, ldc, m, n, accumulate);
+}
+
+__attribute__((target("sse4.2"))) inline void sse42MicroKernel(size_t kc,
+                                                               const double *a,
+                                                               const double *b,
+                                                               double *c,
+                                                               size_t ldc,
+                                                               size_t m,
+                                                               size_t n,
+                                                               bool accumulate)
+{
+    constexpr size_t mr = 4;
+    constexpr size_t nr = 4;
+    __m128d acc[mr][2];
+    for (size_t i = 0; i < mr; i++) {
+        acc[i][0] = _mm_setzero_pd();
+        acc[i][1] = _mm_setzero_pd();
+    }
+    for (size_t p = 0; p < kc; p++, a += mr, b += nr) {
+        __m128d b0 = _mm_loadu_pd(b);
+        __m128d b1 = _mm_loadu_pd(b + 2);
+        for (size_t i = 0; i < mr; i++) {
+            __m128d ai = _mm_set1_pd(a[i]);
+            acc[i][0] = _mm_add_pd(acc[i][0], _mm_mul_pd(ai, b0));
+            acc[i][1] = _mm_add_pd(acc[i][1], _mm_mul_pd(ai, b1));
+        }
+    }
+    if (m == mr && n == nr) {
+        for (size_t i = 0; i < mr; i++) {
+            double *row = c + i * ldc;
+            if (accumulate) {
+                acc[i][0] = _mm_add_pd(acc[i][0], _mm_loadu_pd(row));
+                acc[i][1] = _mm_add_pd(acc[i][1], _mm_loadu_pd(row + 2));
+            }
+            _mm_storeu_pd(row, acc[i][0]);
+            _mm_storeu_pd(row + 2, acc[i][1]);
+        }
+        return;
+    }
+    double tile[mr * nr];
+    for (size_t i = 0; i < mr; i++) {
+        _mm_storeu_pd(tile + i * nr, acc[i][0]);
+        _mm_storeu_pd(tile + i * nr + 2, acc[i][1]);
+    }
+    storeMicroTile(tile, nr, c, ldc, m, n, accumulate);
+}
+
+__attribute__((target("avx2,fma"))) inline void avx2MicroKernel(size_t kc,
+                                                                const float *a,
+                                                                const float *b,
+                                                                float *c,
+                                                                size_t ldc,
+                                                                size_t m,
+                                                                size_t n,
+                                                                bool accumulate)
+{
+    constexpr size_t mr = 6;
+    constexpr size_t nr = 16;
+    __m256 acc[mr][2];
+    for (size_t i = 0; i < mr; i++) {
+        acc[i][0] = _mm256_setzero_ps();
+        acc[i][1] = _mm256_setzero_ps();
+    }
+    for (size_t p = 0; p < kc; p++, a += mr, b += nr) {
+        __m256 b0 = _mm256_loadu_ps(b);
+        __m256 b1 = _mm256_loadu_ps(b + 8);
+        for (size_t i = 0; i < mr; i++) {
+            __m256 ai = _mm256_broadcast_ss(a + i);
+            acc[i][0] = _mm256_fmadd_ps(ai, b0, acc[i][0]);
+            acc[i][1] = _mm256_fmadd_ps(ai, b1, acc[i][1]);
+        }
+    }
+    if (m == mr && n == nr) {
+        for (size_t i = 0; i < mr; i++) {
+            float *row = c + i * ldc;
+            if (accumulate) {
+                acc[i][0] = _mm256_add_ps(acc[i][0], _mm256_loadu_ps(row));
+                acc[i][1] = _mm256_add_ps(acc[i][1], _mm256_loadu_ps(row + 8));
+            }
+            _mm256_storeu_ps(row, acc[i][0]);
+            _mm256_storeu_ps(row + 8, acc[i][1]);
+        }
+        return;
+    }
+    float tile[mr * nr];
+    for (size_t i = 0; i < mr; i++) {
+        _mm256_storeu_ps(tile + i * nr, acc[i][0]);
+        _mm256_storeu_ps(tile + i * nr + 8, acc[i][1]);
+    }
+    storeMicroTile(tile, nr, c, ldc, m, n, accumulate);
+}
+
+__attribute__((target("avx2,fma"))) inline void avx2MicroKernel(size_t kc,
+                                                                const double *a,
+                                                                const double *b,
+                                                                double *c,
+                                                                size_t ldc,
+                                                                size_t m,
+                                                                size_t n,
+                                                                bool accumulate)
+{
+    constexpr size_t mr = 6;
+    constexpr size_t nr = 8;
+    __m256d acc[mr][2];
+    for (size_t i = 0; i < mr; i++) {
+        acc[i][0] = _mm256_setzero_pd();
+        acc[i][1] = _mm256_setzero_pd();
+    }
+    for (size_t p = 0; p < kc; p++, a += mr, b += nr) {
+        __m256d b0 = _mm256_loadu_pd(b);
+        __m256d b1 = _mm256_loadu_pd(b + 4);
+        for (size_t i = 0; i < mr; i++) {
+            __m256d ai = _mm256_broadcast_sd(a + i);
+            acc[i][0] = _mm256_fmadd_pd(ai, b0, acc[i][0]);
+            acc[i][1] = _mm256_fmadd_pd(ai, b1, acc[i][1]);
+        }
+    }
+    if (m == mr && n == nr) {
+        for (size_t i = 0; i < mr; i++) {
+            double *row = c + i * ldc;
+            if (accumulate) {
+                acc[i][0] = _mm256_add_pd(acc[i][0], _mm256_loadu_pd(row));
+                acc[i][1] = _mm256_add_pd(acc[i][1], _mm256_loadu_pd(row + 4));
+            }
+            _mm256_storeu_pd(row, acc[i][0]);
+            _mm256_storeu_pd(row + 4, acc[i][1]);
+        }
+        return;
+    }
+    double tile[mr * nr];
+    for (size_t i = 0; i < mr; i++) {
+        _mm256_storeu_pd(tile + i * nr, acc[i][0]);
+        _mm256_storeu_pd(tile + i * nr + 4, acc[i][1]);
+    }
+    storeMicroTile(tile, nr, c, ldc, m, n, accumulate);
+}
+
+__attribute__((target("avx512f"))) inline void avx512MicroKernel(size_t kc,
+                                                                 const float *a,
+                                                                 const float *b,
+                                                                 float *c,
+                                                                 size_t ldc,
+                                                                 size_t m,
+                                                                 size_t n,
+                                                                 bool accumulate)
+{
+    constexpr size_t mr = 6;
+    constexpr size_t nr = 32;
+    __m512 acc[mr][2];
+    for (size_t i = 0; i < mr; i++) {
+        acc[i][0] = _mm512_setzero_ps();
+        acc[i][1] = _mm512_setzero_ps();
+    }
+    for (size_t p = 0; p < kc; p++, a += mr, b += nr) {
+        __m512 b0 = _mm512_loadu_ps(b);
+        __m512 b1 = _mm512_loadu_ps(b + 16);
+        for (size_t i = 0; i < mr; i++) {
+            __m512 ai = _mm512_set1_ps(a[i]);
+            acc[i][0] = _mm512_fmadd_ps(ai, b0, acc[i][0]);
+            acc[i][1] = _mm512_fmadd_ps(ai, b1, acc[i][1]);
+        }
+    }
+    if (m == mr && n == nr) {
+        for (size_t i = 0; i < mr; i++) {
+            float *row = c + i * ldc;
+            if (accumulate) {
+                acc[i][0] = _mm512_add_ps(acc[i][0], _mm512_loadu_ps(row));
+                acc[i][1] = _mm512_add_ps(acc[i][1], _mm512_loadu_ps(row + 16));
+            }
+            _mm512_storeu_ps(row, acc[i][0]);
+            _mm512_storeu_ps(row + 16, acc[i][1]);
+        }
+        return;
+    }
+    float tile[mr * nr];
+    for (size_t i = 0; i < mr; i++) {
+        _mm512_storeu_ps(tile + i * nr, acc[i][0]);
+        _mm512_storeu_ps(tile + i * nr + 16, acc[i][1]);
+    }
+    storeMicroTile(tile, nr, c, ldc, m, n, accumulate);
+}
+
+__attribute__((target("avx512f"))) inline void avx512MicroKernel(size_t kc,
+                                                                 const double *a,
+                                                                 const double *b,
+                                                                 double *c,
+                                                                 size_t ldc,
+                                                                 size_t m,
+                                                                 size_t n,
+                                                                 bool accumulate)
+{
+    constexpr size_t mr = 6;
+    constexpr size_t nr = 16;
+    __m512d acc[mr][2];
+    for (size_t i = 0; i < mr; i++) {
+        acc[i][0] = _mm512_setzero_pd();
+        acc[i][1] = _mm512_setzero_pd();
+    }
+    for (size_t p = 0; p < kc; p++, a += mr, b += nr) {
+        __m512d b0 = _mm512_loadu_pd(b);
+        __m512d b1 = _mm512_loadu_pd(b + 8);
+        for (size_t i = 0; i < mr; i++) {
+            __m512d ai = _mm512_set1_pd(a[i]);
+            acc[i][0] = _mm512_fmadd_pd(ai, b0, acc[i][0]);
+            acc[i][1] = _mm512_fmadd_pd(ai, b1, acc[i][1]);
+        }
+    }
+    if (m == mr && n == nr) {
+        for (size_t i = 0; i < mr; i++) {
+            double *row = c + i * ldc;
+            if (accumulate) {
+                acc[i][0] = _mm512_add_pd(acc[i][0], _mm512_loadu_pd(row));
+                acc[i][1] = _mm512_add_pd(acc[i][1], _mm512_loadu_pd(row + 8));
+            }
+            _mm512_storeu_pd(row, acc[i][0]);
+            _mm512_storeu_pd(row + 8, acc[i][1]);
+        }
+        return;
+    }
+    double tile[mr * nr];
+    for (size_t i = 0; i < mr; i++) {
+        _mm512_storeu_pd(tile + i * nr, acc[i][0]);
+        _mm512_storeu_pd(tile + i * nr + 8, acc[i][1]);
+    }
+    storeMicroTile(tile, nr, c, ldc, m, n, accumulate);
+}
+
+#endif // MATRIX_SIMD_X86
+
+#if defined(MATRIX_SIMD_NEON)
+
+#if defined(__aarch64__)
+constexpr size_t NEON_FLOAT_MR = 8;
+#else
+constexpr size_t NEON_FLOAT_MR = 4;
+#endif
+
+inline void neonMicroKernel(size_t kc,
+                            const float *a,
+                            const float *b,
+                            float *c,
+                            size_t ldc,
+                            size_t m,
+                            size_t n,
+                            bool accumulate)
+{
+    constexpr size_t mr = NEON_FLOAT_MR;
+    constexpr size_t nr = 8;
+    float32x4_t acc[mr][2];
+    for (size_t i = 0; i < mr; i++) {
+        acc[i][0] = vdupq_n_f32(0.0f);
+        acc[i][1] = vdupq_n_f32(0.0f);
+    }
+    for (size_t p = 0; p < kc; p++, a += mr, b += nr) {
+        float32x4_t b0 = vld1q_f32(b);
+        float32x4_t b1 = vld1q_f32(b + 4);
+        for (size_t i = 0; i < mr; i++) {
+#if defined(__aarch64__)
+            acc[i][0] = vfmaq_n_f32(acc[i][0], b0, a[i]);
+            acc[i][1] = vfmaq_n_f32(acc[i][1], b1, a[i]);
+#else
+            acc[i][0] = vmlaq_n_f32(acc[i][0], b0, a[i]);
+            acc[i][1] = vmlaq_n_f32(acc[i][1], b1, a[i]);
+#endif
+        }
+    }
+    if (m == mr && n == nr) {
+        for (size_t i = 0; i < mr; i++) {
+            float *row = c + i * ldc;
+            if (accumulate) {
+                acc[i][0] = vaddq_f32(acc[i][0], vld1q_f32(row));
+                acc[i][1] = vaddq_f32(acc[i][1], vld1q_f32(row + 4));
+            }
+            vst1q_f32(row, acc[i][0]);
+            vst1q_f32(row + 4, acc[i][1]);
+        }
+        return;
+    }
+    float tile[mr * nr];
+    for (size_t i = 0; i < mr; i++) {
+        vst1q_f32(tile + i * nr, acc[i][0]);
+        vst1q_f32(tile + i * nr + 4, acc[i][1]);
+    }
+    storeMicroTile(tile, nr, c, ldc, m, n, accumulate);
+}
+
+#if defined(__aarch64__)
+inline void neonMicroKernel(size_t kc,
+                            const double *a,
+                            const double *b,
+                            double *c,
+                            size_t ldc,
+                            size_t m,
+                            size_t n,
+                            bool accumulate)
+{
+    constexpr size_t mr = 8;
+    constexpr size_t nr = 4;
+    float64x2_t acc[mr][2];
+    for (size_t i = 0; i < mr; i++) {
+        acc[i][0] = vdupq_n_f64(0.0);
+        acc[i][1] = vdupq_n_f64(0.0);
+    }
+    for (size_t p = 0; p < kc; p++, a += mr, b += nr) {
+        float64x2_t b0 = vld1q_f64(b);
+        float64x2_t b1 = vld1q_f64(b + 2);
+        for (size_t i = 0; i < mr; i++) {
+            acc[i][0] = vfmaq_n_f64(acc[i][0], b0, a[i]);
+            acc[i][1] = vfmaq_n_f64(acc[i][1], b1, a[i]);
+        }
+    }
+    double tile[mr * nr];
+    for (size_t i = 0; i < mr; i++) {
+        vst1q_f64(tile + i * nr, acc[i][0]);
+        vst1q_f64(tile + i * nr + 2, acc[i][1]);
+    }
+    storeMicroTile(tile, nr, c, ldc, m, n, accumulate);
+}
+#endif
+
+#endif // MATRIX_SIMD_NEON
+
+/**
+ * Micro-kernel table per element type. Types without hand-written kernels
+ * (e.g. int) get the portable register-tiled kernel on every ISA.
+ */
+template<class T>
+struct SimdMicroKernels
+{
+    static GemmMicroKernel<T> select(SimdIsa) { return {4, 8, &packedMicroKernel<T, 4, 8>}; }
+};
+
+template<>
+struct SimdMicroKernels<float>
+{
+    static GemmMicroKernel<float> select(SimdIsa isa)
+    {
+        switch (isa) {
+#if defined(MATRIX_SIMD_X86)
+        case SIMD_AVX512:
+            return {6, 32, &avx512MicroKernel};
+        case SIMD_AVX2:
+            return {6, 16, &avx2MicroKernel};
+        case SIMD_SSE42:
+            return {4, 8, &sse42MicroKernel};
+#endif
+#if defined(MATRIX_SIMD_NEON)
+        case SIMD_NEON:
+            return {NEON_FLOAT_MR, 8, &neonMicroKernel};
+#endif
+        default:
+            return {4, 8, &packedMicroKernel<float, 4, 8>};
+        }
+    }
+};
+
+template<>
+struct SimdMicroKernels<double>
+{
+    static GemmMicroKernel<double> select(SimdIsa isa)
+    {
+        switch (isa) {
+#if defined(MATRIX_SIMD_X86)
+        case SIMD_AVX512:
+            return {6, 16, &avx512MicroKernel};
+        case SIMD_AVX2:
+            return {6, 8, &avx2MicroKernel};
+        case SIMD_SSE42:
+            return {4, 4, &sse42MicroKernel};
+#endif
+#if defined(MATRIX_SIMD_NEON) && defined(__aarch64__)
+        case SIMD_NEON:
+            return {8, 4, &neonMicroKernel};
+#endif
+        default:
+            return {4, 4, &packedMicroKernel<double, 4, 4>};
+        }
+    }
+};
+
+#endif // MATRIX_SIMD_KERNELS_H
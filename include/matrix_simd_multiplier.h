@@ -0,0 +1,109 @@
+#ifndef MATRIX_SIMD_MULTIPLIER_H
+#define MATRIX_SIMD_MULTIPLIER_H
+
+#include "dynamic_matrix_multiplier.h"
+#include "matrix_backend_registry.h"
+#include "matrix_multiplier.h"
+#include "matrix_packed_gemm.h"
+#include "matrix_packed_multiplier.h"
+#include "matrix_simd_kernels.h"
+
+/**
+ * Packed multiplier running the hand-vectorised micro-kernel of the best
+ * instruction set available on the host (see activeSimdIsa()).
+ */
+template<class T, size_t colsLeft, size_t rowsLeft, size_t rowsRight>
+class MatrixSimdMultiplier : public MatrixMultiplier<T, colsLeft, rowsLeft, rowsRight>
+{
+public:
+    /**
+     * With parallel set, each product is split into row-block tasks on the
+     * shared TaskRuntime.
+     */
+    explicit MatrixSimdMultiplier(bool parallel = false)
+        : _isa(activeSimdIsa())
+        , _gemm(SimdMicroKernels<T>::select(_isa),
+                {96, 256, 256},
+                parallel ? &TaskRuntime::instance() : nullptr)
+    {}
+
+    void multiply(const Matrix<T, colsLeft, rowsLeft> &A,
+                  const Matrix<T, rowsLeft, rowsRight> &B,
+                  Matrix<T, colsLeft, rowsRight> &C) override
+    {
+        multiplyOne(A, B, C);
+    }
+
+    void multiply(const Matrix<T, colsLeft, rowsLeft> &A,
+                  const Matrix<T, rowsLeft, rowsRight> &B,
+                  Matrix<T, colsLeft, rowsRight> &C,
+                  const GemmEpilogue<T> &epilogue) override
+    {
+        multiplyOne(A, B, C, &epilogue);
+    }
+
+    void multiplyBatch(const Matrix<T, colsLeft, rowsLeft> *A,
+                       const Matrix<T, rowsLeft, rowsRight> *B,
+                       Matrix<T, colsLeft, rowsRight> *C,
+                       size_t n) override
+    {
+        // Each runtime thread packs into its own thread local buffers.
+        TaskRuntime::instance().parallelFor(n, 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                multiplyOne(A[i], B[i], C[i]);
+            }
+        });
+    }
+
+    SimdIsa isa() const { return _isa; }
+
+    virtual ~MatrixSimdMultiplier() {}
+
+private:
+    void multiplyOne(const Matrix<T, colsLeft, rowsLeft> &A,
+                     const Matrix<T, rowsLeft, rowsRight> &B,
+                     Matrix<T, colsLeft, rowsRight> &C,
+                     const GemmEpilogue<T> *epilogue = nullptr)
+    {
+        C.sequence = A.sequence;
+        C.timestamp = A.timestamp;
+        _gemm.multiply(colsLeft,
+                       rowsRight,
+                       rowsLeft,
+                       A.data[0],
+                       A.stride,
+                       B.data[0],
+                       B.stride,
+                       C.data[0],
+                       C.stride,
+                       epilogue);
+    }
+
+    SimdIsa _isa;
+    PackedGemm<T> _gemm;
+};
+
+template<class T>
+class DynamicMatrixSimdMultiplier : public DynamicPackedGemmMultiplier<T>
+{
+public:
+    explicit DynamicMatrixSimdMultiplier(bool parallel = false)
+        : DynamicPackedGemmMultiplier<T>(
+              SimdMicroKernels<T>::select(activeSimdIsa()), {96, 256, 256}, parallel)
+        , _isa(activeSimdIsa())
+    {}
+
+    SimdIsa isa() const { return _isa; }
+
+    virtual ~DynamicMatrixSimdMultiplier() {}
+
+private:
+    SimdIsa _isa;
+};
+
+inline const bool simdBackendRegistered =
+    registerMatrixBackend<DynamicMatrixSimdMultiplier>(
+        std::string("simd (") + simdIsaName(activeSimdIsa()) + ")", 50) &&
+    registerMatrixBackend<DynamicMatrixSimdMultiplier>("simd (task runtime)", 51, true);
+
+#endif // MATRIX_SIMD_MULTIPLIER_H
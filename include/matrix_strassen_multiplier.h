@@ -0,0 +1,698 @@
+#ifndef MATRIX_STRASSEN_MULTIPLIER_H
+#define MATRIX_STRASSEN_MULTIPLIER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "dynamic_matrix_multiplier.h"
+#include "matrix_backend_registry.h"
+#include "matrix_microbenchmark.h"
+#include "matrix_packed_gemm.h"
+#include "matrix_shape_sweep.h"
+#include "matrix_simd_kernels.h"
+#include "matrix_verification.h"
+#include "task_runtime.h"
+
+/**
+ * Strassen-Winograd multiplier for large run-time shapes: each level splits
+ * A, B and C in quadrants and forms C from 7 products of half the size (and
+ * 15 additions) instead of 8. Products whose smallest dimension is below
+ * cutoff() go to the packed gemm with the host's SIMD kernel. Odd dimensions
+ * are peeled: the recursion runs on the even part and the last row, column or
+ * inner index is added by the gemm or a rank-1 update.
+ *
+ * The temporaries of every level come from one workspace sized before the
+ * recursion starts, kept thread local and reused across calls. The task
+ * runtime variant runs the 7 products of the top level as runtime tasks (their
+ * own recursion and gemm calls run inline), at the cost of keeping all their
+ * operands at once: about 3 n^2 elements for an n x n product, against n^2 for
+ * the sequential one.
+ *
+ * The result is only normwise accurate, see verifyStrassenMultiplier() and
+ * strassenAccuracy().
+ */
+template<class T>
+class DynamicMatrixStrassenMultiplier : public DynamicMatrixMultiplier<T>
+{
+    static_assert(std::is_floating_point<T>::value, "Strassen products are for float and double");
+
+public:
+    explicit DynamicMatrixStrassenMultiplier(bool parallel = false)
+        : _gemm(SimdMicroKernels<T>::select(activeSimdIsa()),
+                {96, 256, 256},
+                parallel ? &TaskRuntime::instance() : nullptr)
+        , _cutoff(0)
+        , _threads(0)
+    {}
+
+    virtual ~DynamicMatrixStrassenMultiplier() {}
+
+    /**
+     * Smallest dimension from which a product recurses. 0 (the default) uses
+     * measuredCutoff(); a cutoff above every dimension gives the classic
+     * product of the gemm.
+     */
+    size_t cutoff() const { return _cutoff; }
+    void setCutoff(size_t cutoff) { _cutoff = cutoff; }
+
+    /**
+     * Recursion levels of an m x n x k product at the current cutoff.
+     */
+    size_t levels(size_t m, size_t n, size_t k) const
+    {
+        const size_t cutoff = effectiveCutoff(m, n, k);
+        size_t count = 0;
+        for (; recurses(m, n, k, cutoff); count++) {
+            m /= 2;
+            n /= 2;
+            k /= 2;
+        }
+        return count;
+    }
+
+    /**
+     * Cutoff of this build and CPU: KPSR_STRASSEN_CUTOFF when set, otherwise
+     * the smallest of 128, 256, 512 and 1024 at which one level beats the gemm
+     * by 3%, timed once per process (and 2048 when none does).
+     */
+    static size_t measuredCutoff(bool parallel)
+    {
+        static const size_t sequential = measureCutoff(false);
+        static const size_t runtime = measureCutoff(true);
+        return parallel ? runtime : sequential;
+    }
+
+    // Only the task runtime variant runs a product on several threads.
+    bool setNumThreads(size_t threads) override
+    {
+        if (!_gemm.parallel()) {
+            return false;
+        }
+        _gemm.setThreads(threads);
+        _threads.store(threads, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool setBlocking(size_t mc, size_t kc, size_t nc) override
+    {
+        _gemm.setBlocking({mc, kc, nc});
+        return true;
+    }
+
+protected:
+    void compute(const MatrixView<const T> &A,
+                 const MatrixView<const T> &B,
+                 const MatrixView<T> &C) override
+    {
+        const size_t cutoff = effectiveCutoff(C.rows, C.cols, A.cols);
+        if (!recurses(C.rows, C.cols, A.cols, cutoff)) {
+            gemm(A, B, C);
+            return;
+        }
+        const bool parallel = _gemm.parallel() && _threads.load(std::memory_order_relaxed) != 1 &&
+                              !TaskRuntime::insideTask();
+
+        // Taken out of the thread local slot for the same reason as the packed
+        // B panel of PackedGemm: this thread may run another product's task
+        // while it waits for its own.
+        Workspace workspace;
+        workspace.swap(workspaceBuffer());
+        const size_t size = parallel ? parallelWorkspaceSize(C.rows, C.cols, A.cols, cutoff)
+                                     : workspaceSize(C.rows, C.cols, A.cols, cutoff);
+        if (workspace.size() < size) {
+            workspace.resize(size);
+        }
+        if (parallel) {
+            multiplyParallel(A, B, C, cutoff, workspace.data());
+        } else {
+            multiplyRecursive(A, B, C, cutoff, workspace.data());
+        }
+        workspace.swap(workspaceBuffer());
+    }
+
+    // Fused into the gemm below the cutoff; a recursive product is only
+    // complete after its final combine, so the epilogue takes a pass there.
+    void computeFused(const MatrixView<const T> &A,
+                      const MatrixView<const T> &B,
+                      const MatrixView<T> &C,
+                      const GemmEpilogue<T> &epilogue) override
+    {
+        if (recurses(C.rows, C.cols, A.cols, effectiveCutoff(C.rows, C.cols, A.cols))) {
+            compute(A, B, C);
+            epilogue.apply(C.data, C.stride, 0, 0, C.rows, C.cols);
+            return;
+        }
+        _gemm.multiply(
+            C.rows, C.cols, A.cols, A.data, A.stride, B.data, B.stride, C.data, C.stride, &epilogue);
+    }
+
+    void packOperand(PackedMatrix<T> &B) override
+    {
+        const MatrixView<const T> plain = B.plain().view();
+        B.setLayout(_gemm.prepackB(plain.rows, plain.cols, plain.data, plain.stride));
+    }
+
+    // The recursion multiplies sums of quadrants of B, so only products below
+    // the cutoff use the packed panels.
+    void computePrepacked(const MatrixView<const T> &A,
+                          const PackedMatrix<T> &B,
+                          const MatrixView<T> &C,
+                          const GemmEpilogue<T> &epilogue) override
+    {
+        const auto *packed = B.template layout<typename PackedGemm<T>::PackedB>();
+        if (packed == nullptr || !_gemm.accepts(*packed) ||
+            recurses(C.rows, C.cols, A.cols, effectiveCutoff(C.rows, C.cols, A.cols))) {
+            DynamicMatrixMultiplier<T>::computePrepacked(A, B, C, epilogue);
+            return;
+        }
+        _gemm.multiplyPrepacked(C.rows, A.data, A.stride, *packed, C.data, C.stride, &epilogue);
+    }
+
+private:
+    typedef std::vector<T, AlignedAllocator<T>> Workspace;
+
+    static constexpr size_t MIN_MEASURED_CUTOFF = 128;
+
+    static bool recurses(size_t m, size_t n, size_t k, size_t cutoff)
+    {
+        return std::min(m, std::min(n, k)) >= std::max<size_t>(cutoff, 2);
+    }
+
+    // Below the smallest measured cutoff nothing recurses, so small products
+    // never pay for the measurement.
+    size_t effectiveCutoff(size_t m, size_t n, size_t k) const
+    {
+        if (_cutoff > 0) {
+            return _cutoff;
+        }
+        if (std::min(m, std::min(n, k)) < MIN_MEASURED_CUTOFF) {
+            return MIN_MEASURED_CUTOFF;
+        }
+        return measuredCutoff(_gemm.parallel());
+    }
+
+    static size_t measureCutoff(bool parallel)
+    {
+        const char *fixed = std::getenv("KPSR_STRASSEN_CUTOFF");
+        if (fixed != nullptr && *fixed != '\0') {
+            return std::max<size_t>(std::strtoul(fixed, nullptr, 10), 2);
+        }
+        MicrobenchmarkSettings settings;
+        settings.warmup = std::chrono::milliseconds(0);
+        settings.minSample = std::chrono::microseconds(20);
+        settings.maxTime = std::chrono::milliseconds(50);
+        settings.minRepetitions = 3;
+        settings.maxRepetitions = 50;
+        settings.targetError = 0.02;
+        DynamicMatrixStrassenMultiplier multiplier(parallel);
+        for (size_t size = MIN_MEASURED_CUTOFF; size <= 1024; size *= 2) {
+            const MatrixShape shape{size, size, size};
+            multiplier.setCutoff(size + 1);
+            const double classic =
+                runMicrobenchmark<T>(multiplier, "", shape, 1, ThreadPlacement(), settings)
+                    .time.median;
+            multiplier.setCutoff(size);
+            const double strassen =
+                runMicrobenchmark<T>(multiplier, "", shape, 1, ThreadPlacement(), settings)
+                    .time.median;
+            if (strassen < 0.97 * classic) {
+                return size;
+            }
+        }
+        return 2048;
+    }
+
+    static Workspace &workspaceBuffer()
+    {
+        static thread_local Workspace buffer;
+        return buffer;
+    }
+
+    // Elements of a rows x cols temporary, kept a multiple of a cache line so
+    // every temporary starts aligned.
+    static size_t blockSize(size_t rows, size_t cols)
+    {
+        const size_t line = std::max<size_t>(1, MATRIX_ALIGNMENT / sizeof(T));
+        return (rows * matrixStride<T>(cols) + line - 1) / line * line;
+    }
+
+    static MatrixView<T> takeBlock(T *&workspace, size_t rows, size_t cols)
+    {
+        MatrixView<T> block(workspace, rows, cols, matrixStride<T>(cols));
+        workspace += blockSize(rows, cols);
+        return block;
+    }
+
+    // X (m/2 x k/2), Y (k/2 x n/2) and Z (m/2 x n/2) per level.
+    static size_t workspaceSize(size_t m, size_t n, size_t k, size_t cutoff)
+    {
+        size_t size = 0;
+        for (; recurses(m, n, k, cutoff); m /= 2, n /= 2, k /= 2) {
+            size += blockSize(m / 2, k / 2) + blockSize(k / 2, n / 2) + blockSize(m / 2, n / 2);
+        }
+        return size;
+    }
+
+    // S1..S4, T1..T4, P5..P7 and a workspace for each of the 7 products.
+    static size_t parallelWorkspaceSize(size_t m, size_t n, size_t k, size_t cutoff)
+    {
+        const size_t m2 = m / 2;
+        const size_t n2 = n / 2;
+        const size_t k2 = k / 2;
+        return 4 * blockSize(m2, k2) + 4 * blockSize(k2, n2) + 3 * blockSize(m2, n2) +
+               7 * workspaceSize(m2, n2, k2, cutoff);
+    }
+
+    void gemm(const MatrixView<const T> &A,
+              const MatrixView<const T> &B,
+              const MatrixView<T> &C) const
+    {
+        _gemm.multiply(
+            C.rows, C.cols, A.cols, A.data, A.stride, B.data, B.stride, C.data, C.stride);
+    }
+
+    // C = A + sign * B, element by element; C may be A or B.
+    static void combine(const MatrixView<const T> &A,
+                        const MatrixView<const T> &B,
+                        T sign,
+                        const MatrixView<T> &C)
+    {
+        for (size_t i = 0; i < C.rows; i++) {
+            const T *a = A.row(i);
+            const T *b = B.row(i);
+            T *c = C.row(i);
+            for (size_t j = 0; j < C.cols; j++) {
+                c[j] = a[j] + sign * b[j];
+            }
+        }
+    }
+
+    /**
+     * The last row, column and inner index of an odd-sized product, around
+     * the even part (top-left me x ne, inner ke) the recursion computed.
+     */
+    void peel(const MatrixView<const T> &A,
+              const MatrixView<const T> &B,
+              const MatrixView<T> &C,
+              size_t me,
+              size_t ne,
+              size_t ke) const
+    {
+        const size_t k = A.cols;
+        if (ke < k) {
+            for (size_t i = 0; i < me; i++) {
+                const T a = A(i, ke);
+                const T *b = B.row(ke);
+                T *c = C.row(i);
+                for (size_t j = 0; j < ne; j++) {
+                    c[j] += a * b[j];
+                }
+            }
+        }
+        if (ne < C.cols) {
+            gemm(A.block(0, 0, me, k), B.block(0, ne, k, 1), C.block(0, ne, me, 1));
+        }
+        if (me < C.rows) {
+            gemm(A.block(me, 0, 1, k), B, C.block(me, 0, 1, C.cols));
+        }
+    }
+
+    /**
+     * Winograd's schedule with three temporaries per level (X, Y, Z), the
+     * products going straight into the quadrants of C:
+     *   S1 = A21 + A22  S2 = S1 - A11  S3 = A11 - A21  S4 = A12 - S2
+     *   T1 = B12 - B11  T2 = B22 - T1  T3 = B22 - B12  T4 = T2 - B21
+     *   P1 = A11 B11  P2 = A12 B21  P3 = S4 B22  P4 = A22 T4
+     *   P5 = S1 T1    P6 = S2 T2    P7 = S3 T3
+     *   C11 = P1 + P2            C12 = P1 + P6 + P5 + P3
+     *   C21 = P1 + P6 + P7 - P4  C22 = P1 + P6 + P7 + P5
+     */
+    void multiplyRecursive(const MatrixView<const T> &A,
+                           const MatrixView<const T> &B,
+                           const MatrixView<T> &C,
+                           size_t cutoff,
+                           T *workspace) const
+    {
+        if (!recurses(C.rows, C.cols, A.cols, cutoff)) {
+            gemm(A, B, C);
+            return;
+        }
+        const size_t m2 = C.rows / 2;
+        const size_t n2 = C.cols / 2;
+        const size_t k2 = A.cols / 2;
+        const MatrixView<const T> A11 = A.block(0, 0, m2, k2), A12 = A.block(0, k2, m2, k2);
+        const MatrixView<const T> A21 = A.block(m2, 0, m2, k2), A22 = A.block(m2, k2, m2, k2);
+        const MatrixView<const T> B11 = B.block(0, 0, k2, n2), B12 = B.block(0, n2, k2, n2);
+        const MatrixView<const T> B21 = B.block(k2, 0, k2, n2), B22 = B.block(k2, n2, k2, n2);
+        const MatrixView<T> C11 = C.block(0, 0, m2, n2), C12 = C.block(0, n2, m2, n2);
+        const MatrixView<T> C21 = C.block(m2, 0, m2, n2), C22 = C.block(m2, n2, m2, n2);
+        const MatrixView<T> X = takeBlock(workspace, m2, k2);
+        const MatrixView<T> Y = takeBlock(workspace, k2, n2);
+        const MatrixView<T> Z = takeBlock(workspace, m2, n2);
+
+        combine(A11, A21, T(-1), X);
+        combine(B22, B12, T(-1), Y);
+        multiplyRecursive(X, Y, C21, cutoff, workspace); // P7
+        combine(A21, A22, T(1), X);
+        combine(B12, B11, T(-1), Y);
+        multiplyRecursive(X, Y, C22, cutoff, workspace); // P5
+        combine(X, A11, T(-1), X);
+        combine(B22, Y, T(-1), Y);
+        multiplyRecursive(X, Y, C12, cutoff, workspace); // P6
+        combine(A12, X, T(-1), X);                       // S4
+        multiplyRecursive(A11, B11, Z, cutoff, workspace); // P1
+        combine(C12, Z, T(1), C12);                        // P1 + P6
+        combine(C21, C12, T(1), C21);                      // P1 + P6 + P7
+        combine(C12, C22, T(1), C12);                      // P1 + P6 + P5
+        combine(C22, C21, T(1), C22);                      // C22
+        multiplyRecursive(A12, B21, C11, cutoff, workspace); // P2
+        combine(C11, Z, T(1), C11);                          // C11
+        multiplyRecursive(X, B22, Z, cutoff, workspace);     // P3
+        combine(C12, Z, T(1), C12);                          // C12
+        combine(Y, B21, T(-1), Y);                           // T4
+        multiplyRecursive(A22, Y, Z, cutoff, workspace);     // P4
+        combine(C21, Z, T(-1), C21);                         // C21
+
+        peel(A, B, C, 2 * m2, 2 * n2, 2 * k2);
+    }
+
+    /**
+     * Top level of the task runtime variant: the operand sums are formed first,
+     * then the 7 products run as tasks (P1 to P4 into the quadrants of C, P5 to
+     * P7 into temporaries) and are combined in one pass.
+     */
+    void multiplyParallel(const MatrixView<const T> &A,
+                          const MatrixView<const T> &B,
+                          const MatrixView<T> &C,
+                          size_t cutoff,
+                          T *workspace) const
+    {
+        TaskRuntime &runtime = TaskRuntime::instance();
+        const size_t threads = _threads.load(std::memory_order_relaxed);
+        const size_t m2 = C.rows / 2;
+        const size_t n2 = C.cols / 2;
+        const size_t k2 = A.cols / 2;
+        const MatrixView<const T> A11 = A.block(0, 0, m2, k2), A12 = A.block(0, k2, m2, k2);
+        const MatrixView<const T> A21 = A.block(m2, 0, m2, k2), A22 = A.block(m2, k2, m2, k2);
+        const MatrixView<const T> B11 = B.block(0, 0, k2, n2), B12 = B.block(0, n2, k2, n2);
+        const MatrixView<const T> B21 = B.block(k2, 0, k2, n2), B22 = B.block(k2, n2, k2, n2);
+        const MatrixView<T> C11 = C.block(0, 0, m2, n2), C12 = C.block(0, n2, m2, n2);
+        const MatrixView<T> C21 = C.block(m2, 0, m2, n2), C22 = C.block(m2, n2, m2, n2);
+        MatrixView<T> S[4];
+        MatrixView<T> U[4];
+        MatrixView<T> P[3];
+        for (MatrixView<T> &s : S) {
+            s = takeBlock(workspace, m2, k2);
+        }
+        for (MatrixView<T> &t : U) {
+            t = takeBlock(workspace, k2, n2);
+        }
+        for (MatrixView<T> &p : P) {
+            p = takeBlock(workspace, m2, n2);
+        }
+        const size_t productWorkspace = workspaceSize(m2, n2, k2, cutoff);
+
+        runtime.parallelFor(m2, runtime.grainFor(m2, 16, threads), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                for (size_t p = 0; p < k2; p++) {
+                    const T s1 = A21(i, p) + A22(i, p);
+                    const T s2 = s1 - A11(i, p);
+                    S[0](i, p) = s1;
+                    S[1](i, p) = s2;
+                    S[2](i, p) = A11(i, p) - A21(i, p);
+                    S[3](i, p) = A12(i, p) - s2;
+                }
+            }
+        });
+        runtime.parallelFor(k2, runtime.grainFor(k2, 16, threads), [&](size_t begin, size_t end) {
+            for (size_t p = begin; p < end; p++) {
+                for (size_t j = 0; j < n2; j++) {
+                    const T t1 = B12(p, j) - B11(p, j);
+                    const T t2 = B22(p, j) - t1;
+                    U[0](p, j) = t1;
+                    U[1](p, j) = t2;
+                    U[2](p, j) = B22(p, j) - B12(p, j);
+                    U[3](p, j) = t2 - B21(p, j);
+                }
+            }
+        });
+
+        const MatrixView<const T> left[7] = {A11, A12, S[3], A22, S[0], S[1], S[2]};
+        const MatrixView<const T> right[7] = {B11, B21, B22, U[3], U[0], U[1], U[2]};
+        const MatrixView<T> product[7] = {C11, C12, C21, C22, P[0], P[1], P[2]};
+        const size_t tasks = threads > 0 ? std::min<size_t>(threads, 7) : 7;
+        runtime.parallelFor(7, (7 + tasks - 1) / tasks, [&](size_t begin, size_t end) {
+            for (size_t index = begin; index < end; index++) {
+                multiplyRecursive(left[index],
+                                  right[index],
+                                  product[index],
+                                  cutoff,
+                                  workspace + index * productWorkspace);
+            }
+        });
+
+        runtime.parallelFor(m2, runtime.grainFor(m2, 16, threads), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                for (size_t j = 0; j < n2; j++) {
+                    const T p1 = C11(i, j);
+                    const T p5 = P[0](i, j);
+                    const T u2 = p1 + P[1](i, j);
+                    const T u3 = u2 + P[2](i, j);
+                    C11(i, j) = p1 + C12(i, j);
+                    C12(i, j) = u2 + p5 + C21(i, j);
+                    C21(i, j) = u3 - C22(i, j);
+                    C22(i, j) = u3 + p5;
+                }
+            }
+        });
+
+        peel(A, B, C, 2 * m2, 2 * n2, 2 * k2);
+    }
+
+    PackedGemm<T> _gemm;
+    size_t _cutoff;
+    // Set by ThreadBudget::rebalance() while other threads multiply.
+    std::atomic<size_t> _threads;
+};
+
+template<class T>
+bool registerStrassenBackends()
+{
+    MatrixBackendRegistry<T>::instance().add("strassen", 58, []() {
+        return std::make_unique<DynamicMatrixStrassenMultiplier<T>>();
+    });
+    MatrixBackendRegistry<T>::instance().add(
+        "strassen (task runtime)",
+        59,
+        []() { return std::make_unique<DynamicMatrixStrassenMultiplier<T>>(true); },
+        true);
+    return true;
+}
+
+inline const bool strassenBackendRegistered =
+    registerStrassenBackends<float>() && registerStrassenBackends<double>();
+
+/**
+ * Normwise error bound of a Strassen-Winograd product with the given levels
+ * over a classic product of inner size k / 2^levels (Higham, Accuracy and
+ * Stability of Numerical Algorithms, 23.2.2), in units of epsilon times
+ * max|A| max|B|.
+ */
+inline double strassenErrorBound(size_t k, size_t levels)
+{
+    const double base = std::ceil(double(k) / double(size_t(1) << levels));
+    return std::pow(18.0, double(levels)) * (base * base + 6 * base);
+}
+
+/**
+ * verifyDynamicMultiplier() and, for a DynamicMatrixStrassenMultiplier, the
+ * recursion: with the cutoff lowered to 8, so that products of the
+ * verification shapes recurse several levels and peel odd dimensions, every
+ * element checked must be within strassenErrorBound() of the reference.
+ * Strassen's error is only bounded normwise, so the elementwise check of
+ * verifyDynamicMultiplier() only holds above the cutoff. The cutoff is
+ * restored afterwards.
+ */
+template<class T>
+VerificationReport verifyStrassenMultiplier(DynamicMatrixMultiplier<T> &multiplier,
+                                            double toleranceFactor = 1.0)
+{
+    VerificationReport report = verifyDynamicMultiplier<T>(multiplier, toleranceFactor);
+    auto *strassen = dynamic_cast<DynamicMatrixStrassenMultiplier<T> *>(&multiplier);
+    if (strassen == nullptr) {
+        return report;
+    }
+    typedef typename VerificationTraits<T>::Accumulator Accumulator;
+    const size_t saved = strassen->cutoff();
+    strassen->setCutoff(8);
+    Philox4x32 rng(0x57a55e9ULL);
+    uint64_t stream = 0;
+    for (const MatrixShape &shape :
+         parseMatrixShapes("16x16x16 33x65x31 64x64x64 100x100x100 129x67x95 255x130x257")) {
+        for (VerificationFill fill : {VERIFY_RANDOM, VERIFY_IDENTITY, VERIFY_WIDE_RANGE}) {
+            DynamicMatrix<T> A(shape.m + 1, shape.k + 3);
+            DynamicMatrix<T> B(shape.k + 1, shape.n + 5);
+            DynamicMatrix<T> C(shape.m + 1, shape.n + 7);
+            MatrixView<T> a = A.view().block(1, 3, shape.m, shape.k);
+            MatrixView<T> b = B.view().block(1, 5, shape.k, shape.n);
+            MatrixView<T> c = C.view().block(1, 7, shape.m, shape.n);
+            fillVerificationOperand(a, fill, shape.k, rng, stream++);
+            fillVerificationOperand(
+                b, fill == VERIFY_IDENTITY ? VERIFY_RANDOM : fill, shape.k, rng, stream++);
+            for (size_t i = 0; i < c.rows; i++) {
+                std::fill(c.row(i), c.row(i) + c.cols, VerificationTraits<T>::poison());
+            }
+            double largestA = 0;
+            double largestB = 0;
+            for (size_t i = 0; i < a.rows; i++) {
+                for (size_t p = 0; p < a.cols; p++) {
+                    largestA = std::max(largestA, std::fabs(double(a(i, p))));
+                }
+            }
+            for (size_t p = 0; p < b.rows; p++) {
+                for (size_t j = 0; j < b.cols; j++) {
+                    largestB = std::max(largestB, std::fabs(double(b(p, j))));
+                }
+            }
+            const size_t levels = strassen->levels(shape.m, shape.n, shape.k);
+            const double tolerance = toleranceFactor * strassenErrorBound(shape.k, levels) *
+                                         VerificationTraits<T>::epsilon() * largestA * largestB +
+                                     VerificationTraits<T>::smallest();
+
+            report.cases++;
+            std::string failure;
+            if (!multiplier.multiply(a, b, c)) {
+                failure = "shape rejected";
+            }
+            for (size_t i = 0; i < shape.m && failure.empty(); i++) {
+                for (size_t j = 0; j < shape.n && failure.empty(); j++) {
+                    Accumulator expected = 0;
+                    for (size_t p = 0; p < shape.k; p++) {
+                        expected += Accumulator(a(i, p)) * Accumulator(b(p, j));
+                    }
+                    const double error = double(std::fabs(Accumulator(c(i, j)) - expected));
+                    if (error <= tolerance) {
+                        report.worstErrorRatio =
+                            std::max(report.worstErrorRatio, error / tolerance);
+                        continue;
+                    }
+                    std::ostringstream text;
+                    text << "C(" << i << ", " << j << ") = " << c(i, j) << ", expected "
+                         << double(expected);
+                    failure = text.str();
+                }
+            }
+            if (!failure.empty() && report.failedCases++ == 0) {
+                report.firstFailure = shape.describe() + " " + verificationFillName(fill) +
+                                      " with cutoff 8: " + failure;
+            }
+        }
+    }
+    strassen->setCutoff(saved);
+    return report;
+}
+
+/**
+ * Accuracy a Strassen product gives up against the classic product of the
+ * same gemm: both errors against a reference accumulated in
+ * VerificationTraits<T>::Accumulator, normwise in the Frobenius norm and as
+ * the largest elementwise error relative to the largest element.
+ */
+struct StrassenAccuracy
+{
+    MatrixShape shape;
+    size_t levels = 0;
+    double normwise = 0;
+    double maxRelative = 0;
+    double classicNormwise = 0;
+    double classicMaxRelative = 0;
+
+    /**
+     * How many times the classic normwise error Strassen makes.
+     */
+    double loss() const { return classicNormwise > 0 ? normwise / classicNormwise : 1.0; }
+
+    std::string describe() const
+    {
+        std::ostringstream text;
+        text << levels << " levels, error normwise " << normwise << " (classic "
+             << classicNormwise << ", " << loss() << "x), max " << maxRelative
+             << " of the largest element (classic " << classicMaxRelative << ")";
+        return text.str();
+    }
+};
+
+/**
+ * Measures StrassenAccuracy for multiplier on shape, with operands uniform in
+ * [-1, 1). The references cover the rows verificationRows() picks.
+ */
+template<class T>
+KPSR_PRECISE_MATH StrassenAccuracy strassenAccuracy(
+    DynamicMatrixStrassenMultiplier<T> &multiplier,
+    const MatrixShape &shape,
+    uint64_t seed = 0x5eed5eedULL)
+{
+    typedef typename VerificationTraits<T>::Accumulator Accumulator;
+    StrassenAccuracy accuracy;
+    accuracy.shape = shape;
+    accuracy.levels = multiplier.levels(shape.m, shape.n, shape.k);
+    Philox4x32 rng(seed);
+    DynamicMatrix<T> A(shape.m, shape.k);
+    DynamicMatrix<T> B(shape.k, shape.n);
+    DynamicMatrix<T> C(shape.m, shape.n);
+    DynamicMatrix<T> classic(shape.m, shape.n);
+    for (size_t i = 0; i < shape.m; i++) {
+        rng.fillUniform(&A(i, 0), shape.k, T(-1), T(1), i * Philox4x32::blocksFor<T>(shape.k), 0);
+    }
+    for (size_t p = 0; p < shape.k; p++) {
+        rng.fillUniform(&B(p, 0), shape.n, T(-1), T(1), p * Philox4x32::blocksFor<T>(shape.n), 1);
+    }
+    multiplier.multiply(A, B, C);
+    const size_t saved = multiplier.cutoff();
+    multiplier.setCutoff(std::numeric_limits<size_t>::max());
+    multiplier.multiply(A, B, classic);
+    multiplier.setCutoff(saved);
+
+    double largest = 0;
+    double norm = 0;
+    double squares = 0;
+    double classicSquares = 0;
+    double maxError = 0;
+    double classicMaxError = 0;
+    std::vector<Accumulator> reference(shape.n);
+    for (size_t i : verificationRows(shape.m, shape.n, shape.k)) {
+        std::fill(reference.begin(), reference.end(), Accumulator(0));
+        for (size_t p = 0; p < shape.k; p++) {
+            const Accumulator a = A(i, p);
+            for (size_t j = 0; j < shape.n; j++) {
+                reference[j] += a * Accumulator(B(p, j));
+            }
+        }
+        for (size_t j = 0; j < shape.n; j++) {
+            const double expected = double(reference[j]);
+            const double error = double(Accumulator(C(i, j)) - reference[j]);
+            const double classicError = double(Accumulator(classic(i, j)) - reference[j]);
+            largest = std::max(largest, std::fabs(expected));
+            norm += expected * expected;
+            squares += error * error;
+            classicSquares += classicError * classicError;
+            maxError = std::max(maxError, std::fabs(error));
+            classicMaxError = std::max(classicMaxError, std::fabs(classicError));
+        }
+    }
+    accuracy.normwise = norm > 0 ? std::sqrt(squares / norm) : 0;
+    accuracy.classicNormwise = norm > 0 ? std::sqrt(classicSquares / norm) : 0;
+    accuracy.maxRelative = largest > 0 ? maxError / largest : 0;
+    accuracy.classicMaxRelative = largest > 0 ? classicMaxError / largest : 0;
+    return accuracy;
+}
+
+#endif // MATRIX_STRASSEN_MULTIPLIER_H
@@ -0,0 +1,548 @@
+#ifndef MATRIX_VERIFICATION_H
+#define MATRIX_VERIFICATION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "dynamic_matrix_multiplier.h"
+#include "matrix_epilogue.h"
+#include "matrix_multiplier.h"
+#include "matrix_shape_sweep.h"
+#include "philox_random.h"
+#include "reduced_float.h"
+
+// Marks reference computations: they keep IEEE semantics even when the build
+// opts into -funsafe-math-optimizations (KPSR_FAST_MATH), which would
+// otherwise reassociate the wide sums they are checked against.
+#if defined(__GNUC__) && !defined(__clang__)
+#define KPSR_PRECISE_MATH __attribute__((optimize("no-unsafe-math-optimizations")))
+#else
+#define KPSR_PRECISE_MATH
+#endif
+
+/**
+ * Outcome of checking a backend against the reference product.
+ */
+struct VerificationReport
+{
+    size_t cases = 0;
+    size_t failedCases = 0;
+    // Largest |C - reference| / tolerance seen; <= 1 passes.
+    double worstErrorRatio = 0;
+    std::string firstFailure;
+
+    bool passed() const { return cases > 0 && failedCases == 0; }
+
+    std::string describe() const
+    {
+        std::ostringstream text;
+        if (passed()) {
+            text << "passed " << cases << " cases, worst error " << worstErrorRatio
+                 << " of the tolerance";
+        } else {
+            text << "failed " << failedCases << " of " << cases
+                 << " cases, first: " << firstFailure;
+        }
+        return text.str();
+    }
+};
+
+/**
+ * Operand contents of a verification case. WIDE_RANGE mixes signs and
+ * magnitudes over many binades so sums cancel, and for integers goes up to the
+ * largest values whose products cannot overflow.
+ */
+enum VerificationFill { VERIFY_RANDOM = 0, VERIFY_IDENTITY, VERIFY_WIDE_RANGE };
+
+inline const char *verificationFillName(VerificationFill fill)
+{
+    return fill == VERIFY_IDENTITY     ? "identity"
+           : fill == VERIFY_WIDE_RANGE ? "wide range"
+                                       : "random";
+}
+
+/**
+ * Element type properties used by the check: integer products must match
+ * exactly (saturated to the type for int8 and int16, which only the quantized
+ * backends handle), floating point ones within (k + 2) * epsilon *
+ * (|A| |B|)(i, j), the standard bound for any summation order (times the
+ * factor given to the verify functions, for reduced precision backends).
+ * Half and BFloat16 accumulate in float, so epsilon is float's, and rounding
+ * the result to storage adds their roundoff.
+ */
+template<class T>
+struct VerificationTraits
+{
+    static constexpr bool exact = std::is_integral<T>::value;
+
+    // Reference accumulator: float products are exact in double, double ones
+    // get the 11 extra bits of x87 extended precision or quad on aarch64.
+    // Plain wider sums rather than compensated ones, which unsafe math
+    // (KPSR_FAST_MATH) would reassociate away despite KPSR_PRECISE_MATH on
+    // compilers without per-function math options.
+    typedef typename std::conditional<(sizeof(T) > sizeof(float)), long double, double>::type
+        Accumulator;
+
+    // Narrow integers hold quantized values: products saturate instead of
+    // wrapping.
+    static constexpr bool saturating = exact && sizeof(T) < sizeof(int);
+
+    static double epsilon()
+    {
+        return exact                      ? 0.0
+               : IsReducedFloat<T>::value ? double(std::numeric_limits<float>::epsilon())
+                                          : double(std::numeric_limits<T>::epsilon());
+    }
+
+    static double roundoff()
+    {
+        return IsReducedFloat<T>::value ? double(std::numeric_limits<T>::epsilon()) / 2 : 0.0;
+    }
+
+    static double smallest() { return exact ? 0.0 : double(std::numeric_limits<T>::min()); }
+
+    // Value C is filled with before the product, so unwritten elements fail.
+    static T poison()
+    {
+        return exact ? T(0x5A5A5A5A) : T(std::numeric_limits<float>::quiet_NaN());
+    }
+};
+
+template<class T>
+void fillVerificationOperand(const MatrixView<T> &M,
+                             VerificationFill fill,
+                             size_t k,
+                             const Philox4x32 &rng,
+                             uint64_t stream)
+{
+    if (fill == VERIFY_IDENTITY) {
+        for (size_t i = 0; i < M.rows; i++) {
+            for (size_t j = 0; j < M.cols; j++) {
+                M(i, j) = T(i == j ? 1 : 0);
+            }
+        }
+        return;
+    }
+    std::vector<uint32_t> bits(M.rows * M.cols);
+    rng.fillUniform<uint32_t>(bits.data(), bits.size(), 0, 0xFFFFFFFFu, 0, stream);
+    for (size_t i = 0; i < M.rows; i++) {
+        for (size_t j = 0; j < M.cols; j++) {
+            uint32_t word = bits[i * M.cols + j];
+            double unit = (word >> 8) * 0x1p-24;
+            double sign = word & 1 ? -1.0 : 1.0;
+            if (VerificationTraits<T>::exact) {
+                // |a| * |b| * k stays below 2^30.
+                double limit = fill == VERIFY_WIDE_RANGE
+                                   ? std::floor(std::sqrt(double(1 << 30) / std::max<size_t>(k, 1)))
+                                   : 8.0;
+                limit = std::min(limit, double(std::numeric_limits<T>::max()));
+                M(i, j) = T(sign * std::floor(unit * (limit + 1)));
+            } else if (fill == VERIFY_WIDE_RANGE) {
+                // Binades -20 to 20, fewer where k sums of products could
+                // overflow the type (half).
+                int spread = std::min(
+                    20,
+                    int(std::floor((std::log2(double(std::numeric_limits<T>::max())) -
+                                    std::log2(double(k + 1)) - 2) /
+                                   2)));
+                int exponent = static_cast<int>((word >> 1) % (2 * spread + 1)) - spread;
+                M(i, j) = T(sign * (1.0 + unit) * std::ldexp(1.0, exponent));
+            } else {
+                M(i, j) = T(2.0 * unit - 1.0);
+            }
+        }
+    }
+}
+
+/**
+ * Checks rows of C = A * B (or epilogue(A * B)) against a reference
+ * accumulated in VerificationTraits<T>::Accumulator for floating point types
+ * and in 64-bit integers otherwise. The epilogue's scale, biases and their
+ * roundings widen the floating point tolerance to (k + 4) * epsilon * (|scale|
+ * (|A| |B|)(i, j) + |biases|). Returns a failure description, empty when
+ * every row matches.
+ */
+template<class T>
+KPSR_PRECISE_MATH std::string checkProductRows(const MatrixView<const T> &A,
+                             const MatrixView<const T> &B,
+                             const MatrixView<const T> &C,
+                             const std::vector<size_t> &rows,
+                             double toleranceFactor,
+                             double &worstErrorRatio,
+                             const GemmEpilogue<T> &epilogue = GemmEpilogue<T>())
+{
+    typedef typename VerificationTraits<T>::Accumulator Accumulator;
+    typedef typename GemmEpilogue<T>::Compute Compute;
+    const size_t k = A.cols;
+    const bool fused = !epilogue.empty();
+    const double scale = toleranceFactor *
+                         ((k + (fused ? 4 : 2)) * VerificationTraits<T>::epsilon() +
+                          (fused ? 2 : 1) * VerificationTraits<T>::roundoff());
+    Compute low, high;
+    epilogue.bounds(low, high);
+    std::vector<Accumulator> sum(C.cols);
+    std::vector<double> magnitude(C.cols);
+    std::vector<long long> exact(C.cols);
+    for (size_t i : rows) {
+        std::fill(sum.begin(), sum.end(), Accumulator(0));
+        std::fill(magnitude.begin(), magnitude.end(), 0.0);
+        std::fill(exact.begin(), exact.end(), 0);
+        for (size_t p = 0; p < k; p++) {
+            const Accumulator a = Accumulator(A(i, p));
+            for (size_t j = 0; j < C.cols; j++) {
+                if (VerificationTraits<T>::exact) {
+                    exact[j] += static_cast<long long>(A(i, p)) * static_cast<long long>(B(p, j));
+                    continue;
+                }
+                Accumulator product = a * Accumulator(B(p, j));
+                sum[j] += product;
+                magnitude[j] += std::fabs(double(product));
+            }
+        }
+        for (size_t j = 0; j < C.cols; j++) {
+            bool ok;
+            double ratio = 0;
+            Accumulator expected;
+            const Accumulator bias =
+                (epilogue.rowBias != nullptr ? Accumulator(epilogue.rowBias[i]) : 0) +
+                (epilogue.columnBias != nullptr ? Accumulator(epilogue.columnBias[j]) : 0);
+            if constexpr (VerificationTraits<T>::exact) {
+                auto saturate = [](long long value) {
+                    if (!VerificationTraits<T>::saturating) {
+                        return value;
+                    }
+                    return std::min<long long>(
+                        std::numeric_limits<T>::max(),
+                        std::max<long long>(std::numeric_limits<T>::min(), value));
+                };
+                exact[j] = saturate(exact[j]);
+                if (fused) {
+                    long long value = static_cast<long long>(epilogue.scale) * exact[j] +
+                                      static_cast<long long>(bias);
+                    value = std::max<long long>(value, static_cast<long long>(low));
+                    exact[j] = saturate(std::min<long long>(value, static_cast<long long>(high)));
+                    if (!VerificationTraits<T>::saturating) {
+                        exact[j] = static_cast<long long>(static_cast<T>(exact[j]));
+                    }
+                }
+                expected = Accumulator(exact[j]);
+                ok = static_cast<long long>(C(i, j)) == exact[j];
+                ratio = ok ? 0 : std::numeric_limits<double>::infinity();
+            } else {
+                expected = sum[j];
+                double bound = magnitude[j];
+                if (fused) {
+                    expected = Accumulator(epilogue.scale) * sum[j] + bias;
+                    expected = std::max(expected, Accumulator(low));
+                    expected = std::min(expected, Accumulator(high));
+                    bound = std::fabs(double(epilogue.scale)) * magnitude[j] +
+                            (epilogue.rowBias != nullptr ? std::fabs(double(epilogue.rowBias[i]))
+                                                         : 0.0) +
+                            (epilogue.columnBias != nullptr
+                                 ? std::fabs(double(epilogue.columnBias[j]))
+                                 : 0.0);
+                }
+                double tolerance = scale * bound + VerificationTraits<T>::smallest();
+                double error = double(std::fabs(Accumulator(C(i, j)) - expected));
+                ok = error <= tolerance;
+                ratio = ok ? error / tolerance : std::numeric_limits<double>::infinity();
+            }
+            worstErrorRatio = std::max(worstErrorRatio, ratio);
+            if (!ok) {
+                std::ostringstream failure;
+                failure << "C(" << i << ", " << j << ") = " << +C(i, j) << ", expected "
+                        << double(expected);
+                return failure.str();
+            }
+        }
+    }
+    return std::string();
+}
+
+/**
+ * All rows up to 2^24 multiply-adds, otherwise the first, last and 16 evenly
+ * spread rows (tile edges included) to keep large fixed sizes quick to check.
+ */
+inline std::vector<size_t> verificationRows(size_t m, size_t n, size_t k)
+{
+    std::vector<size_t> rows;
+    if (double(m) * n * k <= double(1 << 24) || m <= 32) {
+        for (size_t i = 0; i < m; i++) {
+            rows.push_back(i);
+        }
+        return rows;
+    }
+    for (size_t i = 0; i < 8; i++) {
+        rows.push_back(i);
+        rows.push_back(m - 1 - i);
+    }
+    for (size_t i = 1; i <= 16; i++) {
+        rows.push_back(i * m / 17);
+    }
+    return rows;
+}
+
+/**
+ * Shapes of the dynamic verification: degenerate vectors, primes that leave
+ * partial micro-tiles in every dimension, tall/skinny and long-k products, and
+ * an empty inner dimension (C must come out zero).
+ */
+inline std::vector<MatrixShape> verificationShapes()
+{
+    std::vector<MatrixShape> shapes = parseMatrixShapes("1x1x1 1x17x1 17x1x1 1x1x33 7x13x17 "
+                                                        "33x65x31 64x64x64 100x100x100 129x3x257 "
+                                                        "3x129x5 5x7x1000");
+    shapes.push_back({5, 7, 0});
+    return shapes;
+}
+
+/**
+ * Epilogues of the verification: each bias alone and both together, with
+ * ReLU, ReLU6, a clamp and none, most of them scaled. rowBias and columnBias
+ * hold one value per row and per column of C.
+ */
+template<class T>
+std::vector<GemmEpilogue<T>> verificationEpilogues(const T *rowBias, const T *columnBias)
+{
+    typedef typename GemmEpilogue<T>::Compute Compute;
+    const bool integral = std::is_integral<T>::value;
+    std::vector<GemmEpilogue<T>> epilogues(4);
+    epilogues[0].rowBias = rowBias;
+    epilogues[0].activation = EPILOGUE_RELU;
+    epilogues[1].columnBias = columnBias;
+    epilogues[1].scale = integral ? Compute(2) : Compute(0.5);
+    epilogues[1].activation = EPILOGUE_RELU6;
+    epilogues[2].rowBias = rowBias;
+    epilogues[2].columnBias = columnBias;
+    epilogues[2].scale = Compute(-1);
+    epilogues[2].activation = EPILOGUE_CLAMP;
+    epilogues[2].clampLow = integral ? Compute(-20) : Compute(-1);
+    epilogues[2].clampHigh = integral ? Compute(20) : Compute(1);
+    epilogues[3].scale = integral ? Compute(3) : Compute(0.25);
+    return epilogues;
+}
+
+/**
+ * Runs multiplier on every verification shape and fill, then with every
+ * verification epilogue on a few shapes, then with a prepacked B and on a
+ * batch. Operands are mostly blocks of larger matrices (row strides past the
+ * row length) and C starts out poisoned.
+ */
+template<class T>
+VerificationReport verifyDynamicMultiplier(DynamicMatrixMultiplier<T> &multiplier,
+                                           double toleranceFactor = 1.0)
+{
+    VerificationReport report;
+    Philox4x32 rng(0x5eed5eedULL);
+    uint64_t stream = 0;
+    auto runCase = [&](const MatrixShape &shape,
+                       VerificationFill fill,
+                       const GemmEpilogue<T> &epilogue,
+                       bool prepacked) {
+        DynamicMatrix<T> A(shape.m + 1, shape.k + 3);
+        DynamicMatrix<T> B(shape.k + 1, shape.n + 5);
+        DynamicMatrix<T> C(shape.m + 1, shape.n + 7);
+        MatrixView<T> a = A.view().block(1, 3, shape.m, shape.k);
+        MatrixView<T> b = B.view().block(1, 5, shape.k, shape.n);
+        MatrixView<T> c = C.view().block(1, 7, shape.m, shape.n);
+        fillVerificationOperand(a, fill, shape.k, rng, stream++);
+        // Identity A picks the rows of a random B.
+        fillVerificationOperand(
+            b, fill == VERIFY_IDENTITY ? VERIFY_RANDOM : fill, shape.k, rng, stream++);
+        for (size_t i = 0; i < c.rows; i++) {
+            std::fill(c.row(i), c.row(i) + c.cols, VerificationTraits<T>::poison());
+        }
+        report.cases++;
+        std::string failure;
+        // A prepacked B is used twice, as in a pipeline, and B itself is
+        // overwritten after prepack(): the handle must hold its own copy.
+        std::shared_ptr<const PackedMatrix<T>> packed;
+        if (prepacked) {
+            packed = multiplier.prepack(MatrixView<const T>(b));
+            fillVerificationOperand(b, VERIFY_RANDOM, shape.k, rng, stream++);
+            multiplier.multiply(a, *packed, c, epilogue);
+            for (size_t i = 0; i < c.rows; i++) {
+                std::fill(c.row(i), c.row(i) + c.cols, VerificationTraits<T>::poison());
+            }
+        }
+        const MatrixView<const T> reference = prepacked ? packed->plain().view() : b;
+        if (prepacked ? !multiplier.multiply(a, *packed, c, epilogue)
+                      : !multiplier.multiply(a, b, c, epilogue)) {
+            failure = "shape rejected";
+        } else {
+            failure = checkProductRows<T>(a,
+                                          reference,
+                                          c,
+                                          verificationRows(shape.m, shape.n, shape.k),
+                                          toleranceFactor,
+                                          report.worstErrorRatio,
+                                          epilogue);
+        }
+        if (!failure.empty() && report.failedCases++ == 0) {
+            report.firstFailure = shape.describe() + " " + verificationFillName(fill) +
+                                  (epilogue.empty() ? "" : ", " + epilogue.describe()) +
+                                  (prepacked ? ", prepacked B: " : ": ") + failure;
+        }
+    };
+    for (const MatrixShape &shape : verificationShapes()) {
+        for (VerificationFill fill : {VERIFY_RANDOM, VERIFY_IDENTITY, VERIFY_WIDE_RANGE}) {
+            runCase(shape, fill, GemmEpilogue<T>(), false);
+        }
+    }
+    std::vector<MatrixShape> epilogueShapes =
+        parseMatrixShapes("1x1x1 7x13x17 33x65x31 100x100x100");
+    epilogueShapes.push_back({5, 7, 0});
+    for (const MatrixShape &shape : epilogueShapes) {
+        DynamicMatrix<T> rowBias(1, shape.m);
+        DynamicMatrix<T> columnBias(1, shape.n);
+        fillVerificationOperand(rowBias.view(), VERIFY_RANDOM, 1, rng, stream++);
+        fillVerificationOperand(columnBias.view(), VERIFY_RANDOM, 1, rng, stream++);
+        for (const GemmEpilogue<T> &epilogue :
+             verificationEpilogues<T>(&rowBias(0, 0), &columnBias(0, 0))) {
+            runCase(shape, VERIFY_RANDOM, epilogue, false);
+        }
+    }
+    // Past the kc x nc blocking of the packed backends in both directions.
+    std::vector<MatrixShape> prepackedShapes =
+        parseMatrixShapes("1x1x1 33x65x31 100x100x100 7x300x520");
+    prepackedShapes.push_back({5, 7, 0});
+    for (const MatrixShape &shape : prepackedShapes) {
+        DynamicMatrix<T> columnBias(1, shape.n);
+        fillVerificationOperand(columnBias.view(), VERIFY_RANDOM, 1, rng, stream++);
+        GemmEpilogue<T> epilogue;
+        epilogue.columnBias = &columnBias(0, 0);
+        epilogue.activation = EPILOGUE_RELU;
+        runCase(shape, VERIFY_RANDOM, GemmEpilogue<T>(), true);
+        runCase(shape, VERIFY_RANDOM, epilogue, true);
+    }
+    // One batch through multiplyBatch(), its products of different shapes.
+    std::vector<MatrixShape> batchShapes = parseMatrixShapes("7x13x17 33x65x31 100x100x100");
+    batchShapes.push_back({5, 7, 0});
+    std::vector<DynamicMatrix<T>> batchA, batchB, batchC;
+    std::vector<MatrixView<const T>> leftViews, rightViews;
+    std::vector<MatrixView<T>> resultViews;
+    for (const MatrixShape &shape : batchShapes) {
+        batchA.emplace_back(shape.m, shape.k);
+        batchB.emplace_back(shape.k, shape.n);
+        batchC.emplace_back(shape.m, shape.n);
+    }
+    for (size_t i = 0; i < batchShapes.size(); i++) {
+        fillVerificationOperand(batchA[i].view(), VERIFY_RANDOM, batchShapes[i].k, rng, stream++);
+        fillVerificationOperand(batchB[i].view(), VERIFY_RANDOM, batchShapes[i].k, rng, stream++);
+        MatrixView<T> c = batchC[i].view();
+        for (size_t r = 0; r < c.rows; r++) {
+            std::fill(c.row(r), c.row(r) + c.cols, VerificationTraits<T>::poison());
+        }
+        leftViews.push_back(batchA[i].view());
+        rightViews.push_back(batchB[i].view());
+        resultViews.push_back(c);
+    }
+    const bool accepted = multiplier.multiplyBatch(
+        leftViews.data(), rightViews.data(), resultViews.data(), batchShapes.size());
+    for (size_t i = 0; i < batchShapes.size(); i++) {
+        const MatrixShape &shape = batchShapes[i];
+        report.cases++;
+        std::string failure = "shape rejected";
+        if (accepted) {
+            failure = checkProductRows<T>(leftViews[i],
+                                          rightViews[i],
+                                          resultViews[i],
+                                          verificationRows(shape.m, shape.n, shape.k),
+                                          toleranceFactor,
+                                          report.worstErrorRatio);
+        }
+        if (!failure.empty() && report.failedCases++ == 0) {
+            report.firstFailure = shape.describe() + " in a batch: " + failure;
+        }
+    }
+    return report;
+}
+
+/**
+ * Same check for a fixed-size backend, at its compile-time shape, through
+ * multiply(), multiplyBatch() and multiply() with each verification epilogue.
+ */
+template<class T, size_t colsLeft, size_t rowsLeft, size_t rowsRight>
+VerificationReport verifyMultiplier(MatrixMultiplier<T, colsLeft, rowsLeft, rowsRight> &multiplier,
+                                    double toleranceFactor = 1.0)
+{
+    typedef Matrix<T, colsLeft, rowsLeft> Left;
+    typedef Matrix<T, rowsLeft, rowsRight> Right;
+    typedef Matrix<T, colsLeft, rowsRight> Result;
+    const std::vector<size_t> rows = verificationRows(colsLeft, rowsRight, rowsLeft);
+    VerificationReport report;
+    Philox4x32 rng(0x5eed5eedULL);
+    uint64_t stream = 0;
+    std::unique_ptr<Left[]> A(new Left[2]);
+    std::unique_ptr<Right[]> B(new Right[2]);
+    std::unique_ptr<Result[]> C(new Result[2]);
+    for (VerificationFill fill : {VERIFY_RANDOM, VERIFY_IDENTITY, VERIFY_WIDE_RANGE}) {
+        for (bool batch : {false, true}) {
+            size_t count = batch ? 2 : 1;
+            for (size_t i = 0; i < count; i++) {
+                fillVerificationOperand(makeMatrixView(A[i]), fill, rowsLeft, rng, stream++);
+                fillVerificationOperand(makeMatrixView(B[i]),
+                                        fill == VERIFY_IDENTITY ? VERIFY_RANDOM : fill,
+                                        rowsLeft,
+                                        rng,
+                                        stream++);
+                for (size_t r = 0; r < colsLeft; r++) {
+                    std::fill(
+                        C[i].data[r], C[i].data[r] + rowsRight, VerificationTraits<T>::poison());
+                }
+            }
+            if (batch) {
+                multiplier.multiplyBatch(A.get(), B.get(), C.get(), count);
+            } else {
+                multiplier.multiply(A[0], B[0], C[0]);
+            }
+            for (size_t i = 0; i < count; i++) {
+                report.cases++;
+                std::string failure = checkProductRows<T>(makeMatrixView(A[i]),
+                                                          makeMatrixView(B[i]),
+                                                          makeMatrixView(C[i]),
+                                                          rows,
+                                                          toleranceFactor,
+                                                          report.worstErrorRatio);
+                if (!failure.empty() && report.failedCases++ == 0) {
+                    report.firstFailure = std::string(verificationFillName(fill)) +
+                                          (batch ? " batch: " : ": ") + failure;
+                }
+            }
+        }
+    }
+    DynamicMatrix<T> rowBias(1, colsLeft);
+    DynamicMatrix<T> columnBias(1, rowsRight);
+    fillVerificationOperand(rowBias.view(), VERIFY_RANDOM, 1, rng, stream++);
+    fillVerificationOperand(columnBias.view(), VERIFY_RANDOM, 1, rng, stream++);
+    for (const GemmEpilogue<T> &epilogue :
+         verificationEpilogues<T>(&rowBias(0, 0), &columnBias(0, 0))) {
+        fillVerificationOperand(makeMatrixView(A[0]), VERIFY_RANDOM, rowsLeft, rng, stream++);
+        fillVerificationOperand(makeMatrixView(B[0]), VERIFY_RANDOM, rowsLeft, rng, stream++);
+        for (size_t r = 0; r < colsLeft; r++) {
+            std::fill(C[0].data[r], C[0].data[r] + rowsRight, VerificationTraits<T>::poison());
+        }
+        multiplier.multiply(A[0], B[0], C[0], epilogue);
+        report.cases++;
+        std::string failure = checkProductRows<T>(makeMatrixView(A[0]),
+                                                  makeMatrixView(B[0]),
+                                                  makeMatrixView(C[0]),
+                                                  rows,
+                                                  toleranceFactor,
+                                                  report.worstErrorRatio,
+                                                  epilogue);
+        if (!failure.empty() && report.failedCases++ == 0) {
+            report.firstFailure = epilogue.describe() + ": " + failure;
+        }
+    }
+    return report;
+}
+
+#endif // MATRIX_VERIFICATION_H
@@ -0,0 +1,246 @@
+#ifndef MATRIX_WIDENED_MULTIPLIER_H
+#define MATRIX_WIDENED_MULTIPLIER_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "dynamic_matrix_multiplier.h"
+#include "matrix_backend_registry.h"
+#include "matrix_packed_gemm.h"
+#include "matrix_shape_sweep.h"
+#include "matrix_simd_kernels.h"
+#include "matrix_verification.h"
+#include "philox_random.h"
+#include "reduced_float.h"
+
+/**
+ * Multiplier for the 16-bit storage types (Half, BFloat16): A and B are
+ * widened to float at the edges, multiplied with the float SIMD kernels, which
+ * accumulate in float, and C is rounded back once. Matrices move through
+ * memory at half the size of float ones; the conversions are O(n^2) against
+ * the O(n^3) product.
+ */
+template<class T>
+class DynamicMatrixWidenedMultiplier : public DynamicMatrixMultiplier<T>
+{
+    static_assert(IsReducedFloat<T>::value, "widened products are for Half and BFloat16");
+
+public:
+    explicit DynamicMatrixWidenedMultiplier(bool parallel = false)
+        : _gemm(SimdMicroKernels<float>::select(activeSimdIsa()),
+                {96, 256, 256},
+                parallel ? &TaskRuntime::instance() : nullptr)
+    {}
+
+    virtual ~DynamicMatrixWidenedMultiplier() {}
+
+    // Only the task runtime variant runs a product on several threads.
+    bool setNumThreads(size_t threads) override
+    {
+        if (!_gemm.parallel()) {
+            return false;
+        }
+        _gemm.setThreads(threads);
+        return true;
+    }
+
+    bool setBlocking(size_t mc, size_t kc, size_t nc) override
+    {
+        _gemm.setBlocking({mc, kc, nc});
+        return true;
+    }
+
+protected:
+    void compute(const MatrixView<const T> &A,
+                 const MatrixView<const T> &B,
+                 const MatrixView<T> &C) override
+    {
+        const size_t m = C.rows;
+        const size_t n = C.cols;
+        const size_t k = A.cols;
+        // The calling thread's buffers; the runtime tasks only read them.
+        Buffer &a = buffer(0);
+        Buffer &b = buffer(1);
+        Buffer &c = buffer(2);
+        a.resize(std::max(a.size(), m * k));
+        b.resize(std::max(b.size(), k * n));
+        c.resize(std::max(c.size(), m * n));
+        for (size_t i = 0; i < m; i++) {
+            widenToFloat(A.row(i), a.data() + i * k, k);
+        }
+        for (size_t p = 0; p < k; p++) {
+            widenToFloat(B.row(p), b.data() + p * n, n);
+        }
+        _gemm.multiply(m, n, k, a.data(), k, b.data(), n, c.data(), n);
+        for (size_t i = 0; i < m; i++) {
+            narrowFromFloat(c.data() + i * n, C.row(i), n);
+        }
+    }
+
+    // B is widened and packed once, into float panels.
+    void packOperand(PackedMatrix<T> &B) override
+    {
+        const size_t k = B.rows();
+        const size_t n = B.cols();
+        Buffer &b = buffer(1);
+        b.resize(std::max(b.size(), k * n));
+        for (size_t p = 0; p < k; p++) {
+            widenToFloat(B.plain().view().row(p), b.data() + p * n, n);
+        }
+        B.setLayout(_gemm.prepackB(k, n, b.data(), n));
+    }
+
+    void computePrepacked(const MatrixView<const T> &A,
+                          const PackedMatrix<T> &B,
+                          const MatrixView<T> &C,
+                          const GemmEpilogue<T> &epilogue) override
+    {
+        const auto *packed = B.template layout<PackedGemm<float>::PackedB>();
+        if (packed == nullptr || !_gemm.accepts(*packed)) {
+            DynamicMatrixMultiplier<T>::computePrepacked(A, B, C, epilogue);
+            return;
+        }
+        const size_t m = C.rows;
+        const size_t n = C.cols;
+        const size_t k = A.cols;
+        Buffer &a = buffer(0);
+        Buffer &c = buffer(2);
+        a.resize(std::max(a.size(), m * k));
+        c.resize(std::max(c.size(), m * n));
+        for (size_t i = 0; i < m; i++) {
+            widenToFloat(A.row(i), a.data() + i * k, k);
+        }
+        _gemm.multiplyPrepacked(m, a.data(), k, *packed, c.data(), n);
+        for (size_t i = 0; i < m; i++) {
+            narrowFromFloat(c.data() + i * n, C.row(i), n);
+        }
+        if (!epilogue.empty()) {
+            epilogue.apply(C.data, C.stride, 0, 0, C.rows, C.cols);
+        }
+    }
+
+private:
+    typedef std::vector<float, AlignedAllocator<float>> Buffer;
+
+    static Buffer &buffer(int index)
+    {
+        static thread_local Buffer buffers[3];
+        return buffers[index];
+    }
+
+    PackedGemm<float> _gemm;
+};
+
+template<class T>
+bool registerWidenedBackends()
+{
+    MatrixBackendRegistry<T>::instance().add(
+        std::string("widened (") + simdIsaName(activeSimdIsa()) + ")", 55, []() {
+            return std::make_unique<DynamicMatrixWidenedMultiplier<T>>();
+        });
+    MatrixBackendRegistry<T>::instance().add(
+        "widened (task runtime)",
+        56,
+        []() { return std::make_unique<DynamicMatrixWidenedMultiplier<T>>(true); },
+        true);
+    return true;
+}
+
+// Half and BFloat16 only have the widened backends.
+inline const bool widenedBackendRegistered =
+    registerWidenedBackends<Half>() && registerWidenedBackends<BFloat16>();
+
+/**
+ * What storing a product's data as T costs against keeping it in float.
+ * Errors are of C against the fp32 product of the same operands, relative to
+ * the largest element (maxRelative) or normwise in the Frobenius norm.
+ * inputNormwise is the part due to rounding A and B alone: the exact product
+ * of the rounded operands against the fp32 one.
+ */
+struct ReducedPrecisionError
+{
+    MatrixShape shape;
+    double maxAbsolute = 0;
+    double maxRelative = 0;
+    double normwise = 0;
+    double inputNormwise = 0;
+
+    std::string describe() const
+    {
+        std::ostringstream text;
+        text << "error vs fp32: max " << maxAbsolute << " (" << maxRelative
+             << " of the largest element), normwise " << normwise << ", of which inputs "
+             << inputNormwise;
+        return text.str();
+    }
+};
+
+/**
+ * Measures ReducedPrecisionError for multiplier on shape, with fp32 operands
+ * uniform in [-1, 1) rounded to T. The references are accumulated in double.
+ */
+template<class T>
+KPSR_PRECISE_MATH ReducedPrecisionError reducedPrecisionError(
+    DynamicMatrixMultiplier<T> &multiplier, const MatrixShape &shape, uint64_t seed = 0x5eed5eedULL)
+{
+    ReducedPrecisionError error;
+    error.shape = shape;
+    Philox4x32 rng(seed);
+    DynamicMatrix<float> A32(shape.m, shape.k);
+    DynamicMatrix<float> B32(shape.k, shape.n);
+    DynamicMatrix<T> A(shape.m, shape.k);
+    DynamicMatrix<T> B(shape.k, shape.n);
+    DynamicMatrix<T> C(shape.m, shape.n);
+    for (size_t i = 0; i < shape.m; i++) {
+        rng.fillUniform(
+            &A32(i, 0), shape.k, -1.0f, 1.0f, i * Philox4x32::blocksFor<float>(shape.k), 0);
+        narrowFromFloat(&A32(i, 0), &A(i, 0), shape.k);
+    }
+    for (size_t p = 0; p < shape.k; p++) {
+        rng.fillUniform(
+            &B32(p, 0), shape.n, -1.0f, 1.0f, p * Philox4x32::blocksFor<float>(shape.n), 1);
+        narrowFromFloat(&B32(p, 0), &B(p, 0), shape.n);
+    }
+    if (!multiplier.multiply(A, B, C)) {
+        const double failed = std::numeric_limits<double>::quiet_NaN();
+        error.maxAbsolute = error.maxRelative = error.normwise = error.inputNormwise = failed;
+        return error;
+    }
+
+    double largest = 0;
+    double norm = 0;
+    double outputSquares = 0;
+    double inputSquares = 0;
+    std::vector<double> fp32(shape.n);
+    std::vector<double> rounded(shape.n);
+    for (size_t i = 0; i < shape.m; i++) {
+        std::fill(fp32.begin(), fp32.end(), 0.0);
+        std::fill(rounded.begin(), rounded.end(), 0.0);
+        for (size_t p = 0; p < shape.k; p++) {
+            const double a32 = A32(i, p);
+            const double a = float(A(i, p));
+            for (size_t j = 0; j < shape.n; j++) {
+                fp32[j] += a32 * B32(p, j);
+                rounded[j] += a * float(B(p, j));
+            }
+        }
+        for (size_t j = 0; j < shape.n; j++) {
+            double difference = double(float(C(i, j))) - fp32[j];
+            largest = std::max(largest, std::fabs(fp32[j]));
+            norm += fp32[j] * fp32[j];
+            outputSquares += difference * difference;
+            inputSquares += (rounded[j] - fp32[j]) * (rounded[j] - fp32[j]);
+            error.maxAbsolute = std::max(error.maxAbsolute, std::fabs(difference));
+        }
+    }
+    error.maxRelative = largest > 0 ? error.maxAbsolute / largest : 0;
+    error.normwise = norm > 0 ? std::sqrt(outputSquares / norm) : 0;
+    error.inputNormwise = norm > 0 ? std::sqrt(inputSquares / norm) : 0;
+    return error;
+}
+
+#endif // MATRIX_WIDENED_MULTIPLIER_H
@@ -1,7 +1,10 @@
 #ifndef MM4CONVKN_STREAM_ASSEMBLER_H
 #define MM4CONVKN_STREAM_ASSEMBLER_H
 
+#include <atomic>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <vector>
 
 #include <klepsydra/core/event_transform_forwarder.h>
@@ -10,143 +13,278 @@
 #include <klepsydra/performance_benchmark/scheduler_factory.h>
 #include <klepsydra/performance_benchmark/subscriber_factory.h>
 
-#include <klepsydra/matrix_mult_benchmark/matrix_multiplier.h>
-
-#include <klepsydra/matrix_mult_benchmark/matrix_operation_event.h>
+#include <klepsydra/matrix_mult_benchmark/dynamic_matrix_multiplier.h>
+#include <klepsydra/matrix_mult_benchmark/latency_histogram.h>
+#include <klepsydra/matrix_mult_benchmark/matrix_convolution.h>
+#include <klepsydra/matrix_mult_benchmark/matrix_pool.h>
+#include <klepsydra/matrix_mult_benchmark/thread_budget.h>
 
 namespace kpsr {
 namespace matrix_mult_benchmark {
 
-template<class T, size_t colsLeft, size_t rowsLeft, size_t rowsRight>
-class ConvolutionKNMockTransformForwarder
+/**
+ * Read-only, reference counted activation passed between convolution layers.
+ */
+template<class T>
+using ActivationHandle = std::shared_ptr<const DynamicMatrix<T>>;
+
+/**
+ * Chain stage: runs its convolution layer on the incoming activation into a
+ * slot of the pool and publishes the handle of the slot. latency gets the time
+ * spent in the layer.
+ */
+template<class T>
+class ConvolutionLayerTransformForwarder
 {
 public:
-    ConvolutionKNMockTransformForwarder(
-        MatrixOperationEvent<T, colsLeft, rowsRight> &matrixOperationEvent,
-        Subscriber<unsigned long> *previousSubscriber,
-        Publisher<unsigned long> *nextPublisher,
-        MatrixMultiplier<T, colsLeft, rowsLeft, rowsRight> *matrixMultiplier)
+    ConvolutionLayerTransformForwarder(Subscriber<ActivationHandle<T>> *previousSubscriber,
+                                       Publisher<ActivationHandle<T>> *nextPublisher,
+                                       std::unique_ptr<ConvolutionLayer<T>> layer,
+                                       DynamicMatrixPool<T> *pool,
+                                       LatencyHistogram *latency)
         : eventTranformForwarder(
-              [matrixMultiplier, this](const unsigned long preSeq, unsigned long &nextSeq) {
-                  Matrix<T, colsLeft, rowsRight> C;
-                  for (int i = 0; i < _matrixOperationEvent.repetitions; i++) {
-                      matrixMultiplier->multiply(*_matrixOperationEvent.left,
-                                                 *_matrixOperationEvent.right,
-                                                 C);
+              [this, pool, latency](const ActivationHandle<T> &input,
+                                    ActivationHandle<T> &output) {
+                  long long start = steadyClockNanos();
+                  std::shared_ptr<DynamicMatrix<T>> activation = pool->acquire();
+                  if (!_layer->forward(*input, *activation)) {
+                      _failures++;
                   }
-                  nextSeq = preSeq;
+                  latency->record(steadyClockNanos() - start);
+                  output = activation;
               },
               nextPublisher)
         , _previousSubscriber(previousSubscriber)
-        , _matrixOperationEvent(matrixOperationEvent)
+        , _layer(std::move(layer))
     {
-        previousSubscriber->registerListener("ConvolutionKNMockTransformForwarder",
+        previousSubscriber->registerListener("ConvolutionLayerTransformForwarder",
                                              eventTranformForwarder.forwarderListenerFunction);
     }
 
-    virtual ~ConvolutionKNMockTransformForwarder()
+    virtual ~ConvolutionLayerTransformForwarder()
     {
-        _previousSubscriber->removeListener("ConvolutionKNMockTransformForwarder");
+        _previousSubscriber->removeListener("ConvolutionLayerTransformForwarder");
     }
 
+    ConvolutionLayer<T> &layer() { return *_layer; }
+
+    // Events whose activation the layer rejected (forwarded unprocessed).
+    size_t failures() const { return _failures.load(); }
+
 private:
-    EventTransformForwarder<unsigned long, unsigned long> eventTranformForwarder;
-    Subscriber<unsigned long> *_previousSubscriber;
-    MatrixOperationEvent<T, colsLeft, rowsRight> &_matrixOperationEvent;
+    EventTransformForwarder<ActivationHandle<T>, ActivationHandle<T>> eventTranformForwarder;
+    Subscriber<ActivationHandle<T>> *_previousSubscriber;
+    std::unique_ptr<ConvolutionLayer<T>> _layer;
+    std::atomic<size_t> _failures{0};
 };
 
+/**
+ * Chain of convolution layers (batch size 1) in one activation layout, fed by
+ * a periodic producer. The producer publishes the input slots of a pool filled
+ * once with Philox uniform values, stamped with the steady clock; every layer
+ * writes its output activation into a slot of its own pool of poolSize
+ * matrices and publishes the handle, so activations flow from layer to layer
+ * without copies. Layers get random filters scaled to keep the activations in
+ * range and a random bias (replace them through the returned forwarder's
+ * layer()). Each layer counts as one stage of the ThreadBudget, which
+ * rebalances the product threads of the layers' multipliers as they are added.
+ *
+ * Every layer records the time it spent on an event and the end of the chain
+ * records the end to end latency, summarized at stop().
+ */
+template<class T>
 class MM4ConvKnStreamAssembler
 {
 public:
     MM4ConvKnStreamAssembler(const std::string &providerNamePrefix,
                              int period,
                              SchedulerFactory *schedulerFactory,
-                             SubscriberFactory<unsigned long> *subscriberFactory,
-                             PublisherFactory<unsigned long> *producerFactory)
+                             SubscriberFactory<ActivationHandle<T>> *subscriberFactory,
+                             PublisherFactory<ActivationHandle<T>> *producerFactory,
+                             ConvolutionLayout layout,
+                             size_t poolSize = DEFAULT_POOL_SIZE)
         : _period(period)
         , _schedulerFactory(schedulerFactory)
         , _subscriberFactory(subscriberFactory)
         , _producerFactory(producerFactory)
         , _providerNamePrefix(providerNamePrefix)
+        , _layout(layout)
+        , _poolSize(poolSize)
         , _counter(0)
+        , _sequence(0)
     {}
 
-    template<class T, size_t colsLeft, size_t rowsLeft, size_t rowsRight>
-    std::shared_ptr<ConvolutionKNMockTransformForwarder<T, colsLeft, rowsLeft, rowsRight>>
-    addConvLayer(MatrixOperationEvent<T, colsLeft, rowsRight> &event,
-                 MatrixMultiplier<T, colsLeft, rowsLeft, rowsRight> *matrixMultiplier)
+    /**
+     * Appends a layer taking the output of the previous one (the first layer
+     * sets the chain input). im2col layers run on multiplier, which must
+     * outlive the assembler. The layer gets a random bias and activation,
+     * both fused into its product. Returns nullptr, adding nothing, when
+     * shape does not take the previous layer's output or im2col has no
+     * multiplier.
+     */
+    std::shared_ptr<ConvolutionLayerTransformForwarder<T>> addConvLayer(
+        const ConvolutionShape &shape,
+        ConvolutionLowering lowering,
+        DynamicMatrixMultiplier<T> *multiplier = nullptr,
+        EpilogueActivation activation = EPILOGUE_IDENTITY)
     {
+        if (!shape.valid() || (lowering == CONV_IM2COL && multiplier == nullptr)) {
+            return nullptr;
+        }
+        if (!_shapes.empty()) {
+            const ConvolutionShape &previous = _shapes.back();
+            if (shape.channels != previous.filters || shape.height != previous.outputHeight() ||
+                shape.width != previous.outputWidth()) {
+                return nullptr;
+            }
+        }
+        std::unique_ptr<ConvolutionLayer<T>> layer(
+            new ConvolutionLayer<T>(shape, _layout, lowering, multiplier));
+        layer->setFilters(randomFilters<T>(shape, _counter + 1).data());
+        layer->setBias(randomBias<T>(shape, _counter + 1).data());
+        layer->setActivation(activation);
+        if (_shapes.empty()) {
+            fillInputs(layer->inputRows(), layer->inputCols());
+        }
+        _shapes.push_back(shape);
+
         std::string const previousProviderName = _providerNamePrefix + std::to_string(_counter);
         std::string const nextProviderName = _providerNamePrefix + std::to_string(_counter + 1);
-        std::shared_ptr<std::function<void()>> producerFunction =
-            std::make_shared<std::function<void()>>([previousProviderName, this]() {
-                unsigned long currentTimetamp =
-                    std::chrono::duration_cast<std::chrono::microseconds>(
-                        std::chrono::system_clock::now().time_since_epoch())
-                        .count();
-                _producerFactory->getPublisher(previousProviderName)->publish(currentTimetamp);
-            });
-
-        _producerFunctions.push_back((producerFunction));
-
-        kpsr::Subscriber<unsigned long> *previousSubscriber = _subscriberFactory->getSubscriber(
-            previousProviderName);
-        kpsr::Publisher<unsigned long> *nextPublisher = _producerFactory->getPublisher(
-            nextProviderName);
-        auto stream =
-            std::make_shared<ConvolutionKNMockTransformForwarder<T, colsLeft, rowsLeft, rowsRight>>(
-                event, previousSubscriber, nextPublisher, matrixMultiplier);
+        kpsr::Subscriber<ActivationHandle<T>> *previousSubscriber =
+            _subscriberFactory->getSubscriber(previousProviderName);
+        kpsr::Publisher<ActivationHandle<T>> *nextPublisher =
+            _producerFactory->getPublisher(nextProviderName);
+        _pools.emplace_back(
+            new DynamicMatrixPool<T>(_poolSize, layer->outputRows(), layer->outputCols()));
+        _layerLatency.emplace_back(new LatencyHistogram());
+        auto stream = std::make_shared<ConvolutionLayerTransformForwarder<T>>(
+            previousSubscriber,
+            nextPublisher,
+            std::move(layer),
+            _pools.back().get(),
+            _layerLatency.back().get());
 
         _counter++;
+        // Every layer is a stage of its own, the split changes with each one.
+        ThreadBudget &budget = ThreadBudget::instance();
+        budget.addStages(1);
+        if (multiplier != nullptr) {
+            budget.attach(this, multiplier);
+        }
+        budget.rebalance();
 
         return stream;
     }
 
     void start()
     {
+        if (_counter == 0) {
+            return;
+        }
         std::string const lastProviderName = _providerNamePrefix + std::to_string(_counter);
         _subscriberFactory->getSubscriber(lastProviderName)
-            ->registerListener("StreamAssembler", [&](const unsigned long &id) {
-                long long currentTimetamp = std::chrono::duration_cast<std::chrono::microseconds>(
-                                                std::chrono::system_clock::now().time_since_epoch())
-                                                .count();
-                totalProcessingTime = totalProcessingTime + (currentTimetamp - id);
+            ->registerListener("StreamAssembler", [&](const ActivationHandle<T> &activation) {
+                long long latency = steadyClockNanos() - activation->timestamp;
+                _endToEndLatency.record(latency);
+                totalProcessingTime += latency / 1000;
                 totalProcessedMatrices++;
             });
 
-        for (size_t i = 0; i < _producerFunctions.size(); i++) {
-            _schedulerFactory->getScheduler()->startScheduledTask(std::to_string(i),
-                                                                  _period * 1000,
-                                                                  true,
-                                                                  _producerFunctions[i]);
-        }
+        std::string const firstProviderName = _providerNamePrefix + "0";
+        _producerFunction = std::make_shared<std::function<void()>>([firstProviderName, this]() {
+            std::shared_ptr<DynamicMatrix<T>> input = _inputs->acquire();
+            input->sequence = _sequence++;
+            input->timestamp = steadyClockNanos();
+            _producerFactory->getPublisher(firstProviderName)->publish(input);
+        });
+        _schedulerFactory->getScheduler()->startScheduledTask("0",
+                                                              _period * 1000,
+                                                              true,
+                                                              _producerFunction);
     }
 
     void stop()
     {
-        for (size_t i = 0; i < _producerFunctions.size(); i++) {
-            _schedulerFactory->getScheduler()->stopScheduledTask(std::to_string(i));
+        if (_producerFunction) {
+            _schedulerFactory->getScheduler()->stopScheduledTask("0");
         }
+        _layerSummaries.clear();
+        for (const auto &latency : _layerLatency) {
+            _layerSummaries.push_back(latency->summarize());
+        }
+        _endToEndSummary = _endToEndLatency.summarize();
     }
 
     virtual ~MM4ConvKnStreamAssembler()
     {
-        std::string const lastProviderName = _providerNamePrefix + std::to_string(_counter);
-        _subscriberFactory->getSubscriber(lastProviderName)->removeListener("StreamAssembler");
-        _producerFunctions.clear();
+        if (_producerFunction) {
+            std::string const lastProviderName = _providerNamePrefix + std::to_string(_counter);
+            _subscriberFactory->getSubscriber(lastProviderName)->removeListener("StreamAssembler");
+        }
+        _producerFunction.reset();
+        ThreadBudget &budget = ThreadBudget::instance();
+        budget.detach(this);
+        budget.removeStages(static_cast<size_t>(_counter));
+        budget.rebalance();
+    }
+
+    const std::vector<ConvolutionShape> &layers() const { return _shapes; }
+
+    /**
+     * Time spent in every layer and end to end latency as of stop().
+     */
+    const std::vector<LatencySummary> &layerLatency() const { return _layerSummaries; }
+    const LatencySummary &endToEndLatency() const { return _endToEndSummary; }
+
+    /**
+     * Activations allocated on the heap because a pool (inputs included) had
+     * every slot in flight; non-zero means poolSize is too small.
+     */
+    size_t poolFallbacks() const
+    {
+        size_t fallbacks = _inputs ? _inputs->fallbacks() : 0;
+        for (const auto &pool : _pools) {
+            fallbacks += pool->fallbacks();
+        }
+        return fallbacks;
     }
 
-    long long totalProcessingTime = 0;
-    int totalProcessedMatrices = 0;
+    static constexpr size_t DEFAULT_POOL_SIZE = 16;
+
+    // Sum of the end to end latencies in microseconds.
+    std::atomic<long long> totalProcessingTime{0};
+    std::atomic<int> totalProcessedMatrices{0};
 
 private:
+    // Fills every input slot once; inputs taken from the heap when the pool
+    // runs dry are zero.
+    void fillInputs(size_t rows, size_t cols)
+    {
+        _inputs.reset(new DynamicMatrixPool<T>(_poolSize, rows, cols));
+        std::vector<std::shared_ptr<DynamicMatrix<T>>> slots;
+        for (size_t i = 0; i < _poolSize; i++) {
+            slots.push_back(_inputs->acquire());
+            fillActivation(*slots.back(), i);
+        }
+    }
+
     int _period;
     SchedulerFactory *_schedulerFactory;
-    SubscriberFactory<unsigned long> *_subscriberFactory;
-    PublisherFactory<unsigned long> *_producerFactory;
+    SubscriberFactory<ActivationHandle<T>> *_subscriberFactory;
+    PublisherFactory<ActivationHandle<T>> *_producerFactory;
     std::string _providerNamePrefix;
+    ConvolutionLayout _layout;
+    size_t _poolSize;
     int _counter;
-    std::vector<std::shared_ptr<std::function<void()>>> _producerFunctions;
+    std::atomic<int> _sequence;
+    std::vector<ConvolutionShape> _shapes;
+    std::unique_ptr<DynamicMatrixPool<T>> _inputs;
+    std::vector<std::unique_ptr<DynamicMatrixPool<T>>> _pools;
+    std::shared_ptr<std::function<void()>> _producerFunction;
+    std::vector<std::unique_ptr<LatencyHistogram>> _layerLatency;
+    LatencyHistogram _endToEndLatency;
+    std::vector<LatencySummary> _layerSummaries;
+    LatencySummary _endToEndSummary;
 };
 } // namespace matrix_mult_benchmark
 } // namespace kpsr
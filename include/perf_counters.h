@@ -0,0 +1,301 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+enum PerfCounter {
+    PERF_CYCLES = 0,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_PAGE_FAULTS,
+    PERF_CONTEXT_SWITCHES,
+    PERF_CPU_MIGRATIONS,
+    PERF_COUNTER_COUNT
+};
+
+inline const char *perfCounterName(PerfCounter counter)
+{
+    switch (counter) {
+    case PERF_CYCLES:
+        return "cycles";
+    case PERF_INSTRUCTIONS:
+        return "instructions";
+    case PERF_L1D_MISSES:
+        return "L1D misses";
+    case PERF_LLC_MISSES:
+        return "LLC misses";
+    case PERF_DTLB_MISSES:
+        return "dTLB misses";
+    case PERF_PAGE_FAULTS:
+        return "page faults";
+    case PERF_CONTEXT_SWITCHES:
+        return "context switches";
+    default:
+        return "migrations";
+    }
+}
+
+/**
+ * Counter totals; valid[c] is false when counter c could not be opened.
+ */
+struct PerfCounterValues
+{
+    uint64_t values[PERF_COUNTER_COUNT] = {};
+    bool valid[PERF_COUNTER_COUNT] = {};
+
+    PerfCounterValues &operator+=(const PerfCounterValues &other)
+    {
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+            values[c] += other.values[c];
+            valid[c] = valid[c] || other.valid[c];
+        }
+        return *this;
+    }
+
+    bool any() const
+    {
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+            if (valid[c]) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * "cycles 1200, instructions 3400 (IPC 2.83), L1D misses n/a, ...".
+     */
+    std::string describe() const
+    {
+        std::ostringstream text;
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+            text << (c > 0 ? ", " : "") << perfCounterName(PerfCounter(c)) << " ";
+            if (valid[c]) {
+                text << values[c];
+            } else {
+                text << "n/a";
+            }
+            if (c == PERF_INSTRUCTIONS && valid[PERF_CYCLES] && valid[PERF_INSTRUCTIONS] &&
+                values[PERF_CYCLES] > 0) {
+                text << " (IPC " << double(values[PERF_INSTRUCTIONS]) / values[PERF_CYCLES] << ")";
+            }
+        }
+        return text.str();
+    }
+};
+
+/**
+ * Hardware and scheduler counters of the calling thread through Linux
+ * perf_event_open. Every counter is opened on its own, so a core lacking one
+ * event (or a kernel refusing kernel-side counting) still gets the others;
+ * counts are scaled when the kernel multiplexed them. Work handed to other
+ * threads (OpenMP team, task runtime workers) is not counted.
+ *
+ * Where perf_event_open is unavailable (other systems, seccomp, a too strict
+ * perf_event_paranoid) or KPSR_PERF_COUNTERS=off, available() is false and
+ * start()/stop() do nothing.
+ */
+class PerfCounters
+{
+public:
+    PerfCounters()
+    {
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+            _fds[c] = -1;
+            _enabledAtStart[c] = 0;
+            _runningAtStart[c] = 0;
+        }
+        if (disabledByEnvironment()) {
+            return;
+        }
+#ifdef __linux__
+        const uint32_t types[PERF_COUNTER_COUNT] = {PERF_TYPE_HARDWARE,
+                                                    PERF_TYPE_HARDWARE,
+                                                    PERF_TYPE_HW_CACHE,
+                                                    PERF_TYPE_HARDWARE,
+                                                    PERF_TYPE_HW_CACHE,
+                                                    PERF_TYPE_SOFTWARE,
+                                                    PERF_TYPE_SOFTWARE,
+                                                    PERF_TYPE_SOFTWARE};
+        const uint64_t configs[PERF_COUNTER_COUNT] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            PERF_COUNT_SW_PAGE_FAULTS,
+            PERF_COUNT_SW_CONTEXT_SWITCHES,
+            PERF_COUNT_SW_CPU_MIGRATIONS};
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+            // Kernel-side counting first, user space only if that is refused.
+            _fds[c] = openCounter(types[c], configs[c], false);
+            if (_fds[c] < 0) {
+                _fds[c] = openCounter(types[c], configs[c], true);
+            }
+            _totals.valid[c] = _fds[c] >= 0;
+        }
+#endif
+    }
+
+    ~PerfCounters()
+    {
+#ifdef __linux__
+        for (int fd : _fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+#endif
+    }
+
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    bool available() const
+    {
+        for (int fd : _fds) {
+            if (fd >= 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void start()
+    {
+#ifdef __linux__
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+            if (_fds[c] < 0) {
+                continue;
+            }
+            // The reset only zeroes the count: the enabled and running times
+            // keep growing across windows, so stop() scales by their deltas.
+            ioctl(_fds[c], PERF_EVENT_IOC_RESET, 0);
+            uint64_t reading[3];
+            const bool timed = read(_fds[c], reading, sizeof(reading)) == sizeof(reading);
+            _enabledAtStart[c] = timed ? reading[1] : 0;
+            _runningAtStart[c] = timed ? reading[2] : 0;
+            ioctl(_fds[c], PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    /**
+     * Adds the counts since start() to totals().
+     */
+    void stop()
+    {
+#ifdef __linux__
+        for (int fd : _fds) {
+            if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            }
+        }
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+            // value, time enabled, time running
+            uint64_t reading[3];
+            if (_fds[c] < 0 || read(_fds[c], reading, sizeof(reading)) != sizeof(reading)) {
+                continue;
+            }
+            uint64_t value = reading[0];
+            const uint64_t enabled = reading[1] - _enabledAtStart[c];
+            const uint64_t running = reading[2] - _runningAtStart[c];
+            if (running > 0 && running < enabled) {
+                value = static_cast<uint64_t>(double(value) * enabled / running);
+            }
+            _totals.values[c] += value;
+        }
+#endif
+    }
+
+    const PerfCounterValues &totals() const { return _totals; }
+
+    /**
+     * Names of the counters that could be opened, comma separated.
+     */
+    std::string describe() const
+    {
+        std::string names;
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+            if (_fds[c] >= 0) {
+                names += (names.empty() ? "" : ", ") + std::string(perfCounterName(PerfCounter(c)));
+            }
+        }
+        return names;
+    }
+
+    void reset()
+    {
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+            _totals.values[c] = 0;
+        }
+    }
+
+    /**
+     * Why no counter could be opened, for the report.
+     */
+    static std::string unavailableReason()
+    {
+        if (disabledByEnvironment()) {
+            return "disabled by KPSR_PERF_COUNTERS";
+        }
+#ifdef __linux__
+        std::ifstream paranoid("/proc/sys/kernel/perf_event_paranoid");
+        int level;
+        if (paranoid >> level) {
+            return "perf_event_open refused (perf_event_paranoid = " + std::to_string(level) + ")";
+        }
+        return "perf_event_open refused";
+#else
+        return "perf_event_open is Linux only";
+#endif
+    }
+
+private:
+    static bool disabledByEnvironment()
+    {
+        const char *setting = std::getenv("KPSR_PERF_COUNTERS");
+        return setting != nullptr &&
+               (std::strcmp(setting, "off") == 0 || std::strcmp(setting, "0") == 0);
+    }
+
+#ifdef __linux__
+    static int openCounter(uint32_t type, uint64_t config, bool userOnly)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = userOnly ? 1 : 0;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+#endif
+
+    int _fds[PERF_COUNTER_COUNT];
+    // Enabled and running times of each counter at the last start().
+    uint64_t _enabledAtStart[PERF_COUNTER_COUNT];
+    uint64_t _runningAtStart[PERF_COUNTER_COUNT];
+    PerfCounterValues _totals;
+};
+
+#endif // PERF_COUNTERS_H
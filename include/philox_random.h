@@ -0,0 +1,136 @@
+#ifndef PHILOX_RANDOM_H
+#define PHILOX_RANDOM_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+/**
+ * Philox4x32-10 counter-based generator (Salmon et al., "Parallel random
+ * numbers: as easy as 1, 2, 3"). Block number `counter` of stream `stream` is a
+ * pure function of (key, counter, stream), so any part of a buffer can be
+ * filled independently, in any order and from any thread, and the fill loop
+ * runs many counters side by side in vector registers.
+ */
+class Philox4x32
+{
+public:
+    static constexpr size_t BLOCK_WORDS = 4;
+
+    explicit Philox4x32(uint64_t seed)
+        : _key0(static_cast<uint32_t>(seed))
+        , _key1(static_cast<uint32_t>(seed >> 32))
+    {}
+
+    /**
+     * Writes the 4 words of blocks counter .. counter + count - 1, block i at
+     * out[4 * i].
+     */
+    void generate(uint64_t counter, uint64_t stream, size_t count, uint32_t *out) const
+    {
+        while (count > 0) {
+            size_t lanes = std::min(count, LANES);
+            uint32_t c0[LANES], c1[LANES], c2[LANES], c3[LANES];
+            for (size_t l = 0; l < LANES; l++) {
+                c0[l] = static_cast<uint32_t>(counter + l);
+                c1[l] = static_cast<uint32_t>((counter + l) >> 32);
+                c2[l] = static_cast<uint32_t>(stream);
+                c3[l] = static_cast<uint32_t>(stream >> 32);
+            }
+            uint32_t k0 = _key0;
+            uint32_t k1 = _key1;
+            for (int round = 0; round < ROUNDS; round++) {
+                for (size_t l = 0; l < LANES; l++) {
+                    uint64_t p0 = static_cast<uint64_t>(M0) * c0[l];
+                    uint64_t p1 = static_cast<uint64_t>(M1) * c2[l];
+                    uint32_t n0 = static_cast<uint32_t>(p1 >> 32) ^ c1[l] ^ k0;
+                    uint32_t n2 = static_cast<uint32_t>(p0 >> 32) ^ c3[l] ^ k1;
+                    c1[l] = static_cast<uint32_t>(p1);
+                    c3[l] = static_cast<uint32_t>(p0);
+                    c0[l] = n0;
+                    c2[l] = n2;
+                }
+                k0 += W0;
+                k1 += W1;
+            }
+            for (size_t l = 0; l < lanes; l++) {
+                out[4 * l] = c0[l];
+                out[4 * l + 1] = c1[l];
+                out[4 * l + 2] = c2[l];
+                out[4 * l + 3] = c3[l];
+            }
+            out += 4 * lanes;
+            counter += lanes;
+            count -= lanes;
+        }
+    }
+
+    /**
+     * Number of blocks fillUniform() consumes for n values of type T.
+     */
+    template<class T>
+    static uint64_t blocksFor(size_t n)
+    {
+        return (n * wordsPerValue<T>() + BLOCK_WORDS - 1) / BLOCK_WORDS;
+    }
+
+    /**
+     * Fills out[0, n) with uniform values from blocks counter onwards of stream:
+     * [low, high) for floating point types, [low, high] for integers (with a
+     * bias below 2^-32 for ranges that are not powers of two). Other element
+     * types are drawn as float and converted.
+     */
+    template<class T>
+    void fillUniform(T *out, size_t n, T low, T high, uint64_t counter, uint64_t stream = 0) const
+    {
+        constexpr size_t words = wordsPerValue<T>();
+        constexpr size_t chunkValues = LANES * BLOCK_WORDS / words;
+        uint32_t buffer[LANES * BLOCK_WORDS];
+        for (size_t done = 0; done < n; done += chunkValues) {
+            size_t values = std::min(n - done, chunkValues);
+            generate(counter, stream, (values * words + BLOCK_WORDS - 1) / BLOCK_WORDS, buffer);
+            counter += LANES;
+            for (size_t v = 0; v < values; v++) {
+                out[done + v] = convert(buffer + v * words, low, high);
+            }
+        }
+    }
+
+private:
+    static constexpr size_t LANES = 16;
+    static constexpr int ROUNDS = 10;
+    static constexpr uint32_t M0 = 0xD2511F53;
+    static constexpr uint32_t M1 = 0xCD9E8D57;
+    static constexpr uint32_t W0 = 0x9E3779B9;
+    static constexpr uint32_t W1 = 0xBB67AE85;
+
+    template<class T>
+    static constexpr size_t wordsPerValue()
+    {
+        return std::is_floating_point<T>::value && sizeof(T) > 4 ? 2 : 1;
+    }
+
+    template<class T>
+    static T convert(const uint32_t *words, T low, T high)
+    {
+        if constexpr (std::is_floating_point<T>::value && sizeof(T) > 4) {
+            double unit = ((words[0] >> 5) * 67108864.0 + (words[1] >> 6)) * 0x1p-53;
+            return low + static_cast<T>((high - low) * unit);
+        } else if constexpr (std::is_floating_point<T>::value) {
+            float unit = (words[0] >> 8) * 0x1p-24f;
+            return low + (high - low) * unit;
+        } else if constexpr (std::is_integral<T>::value) {
+            uint64_t range = static_cast<uint64_t>(high - low) + 1;
+            return low + static_cast<T>((static_cast<uint64_t>(words[0]) * range) >> 32);
+        } else {
+            float unit = (words[0] >> 8) * 0x1p-24f;
+            return T(float(low) + (float(high) - float(low)) * unit);
+        }
+    }
+
+    uint32_t _key0;
+    uint32_t _key1;
+};
+
+#endif // PHILOX_RANDOM_H
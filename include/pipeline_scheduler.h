@@ -0,0 +1,342 @@
+#ifndef PIPELINE_SCHEDULER_H
+#define PIPELINE_SCHEDULER_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace kpsr {
+namespace matrix_mult_benchmark {
+
+/**
+ * What the producer does when the pipeline is full:
+ * - BACKPRESSURE_BLOCK: waits until an event leaves the pipeline.
+ * - BACKPRESSURE_DROP_OLDEST: discards the oldest event still waiting in a
+ *   queue to make room, the tick is skipped when every event is being worked on.
+ * - BACKPRESSURE_SKIP_TICK: skips the tick without generating an input.
+ */
+enum BackpressureMode { BACKPRESSURE_BLOCK = 0, BACKPRESSURE_DROP_OLDEST, BACKPRESSURE_SKIP_TICK };
+
+inline const char *backpressureModeName(BackpressureMode mode)
+{
+    switch (mode) {
+    case BACKPRESSURE_DROP_OLDEST:
+        return "drop_oldest";
+    case BACKPRESSURE_SKIP_TICK:
+        return "skip_tick";
+    default:
+        return "block";
+    }
+}
+
+/**
+ * Parses block, drop_oldest or skip_tick; anything else gives fallback.
+ */
+inline BackpressureMode parseBackpressureMode(const std::string &name,
+                                              BackpressureMode fallback = BACKPRESSURE_BLOCK)
+{
+    for (BackpressureMode mode :
+         {BACKPRESSURE_BLOCK, BACKPRESSURE_DROP_OLDEST, BACKPRESSURE_SKIP_TICK}) {
+        if (name == backpressureModeName(mode)) {
+            return mode;
+        }
+    }
+    return fallback;
+}
+
+struct PipelineLimits
+{
+    // Events waiting in front of each stage.
+    size_t queueCapacity = 2;
+    // Events admitted and not yet completed or dropped, 0 for one per stage.
+    size_t maxInFlight = 0;
+    BackpressureMode backpressure = BACKPRESSURE_BLOCK;
+};
+
+/**
+ * Occupancy of the queue in front of one stage. meanDepth is the depth an
+ * arriving event found; stalls counts the arrivals that found the queue full.
+ */
+struct StageOccupancy
+{
+    size_t capacity;
+    size_t arrivals;
+    double meanDepth;
+    size_t maxDepth;
+    size_t stalls;
+};
+
+/**
+ * Runs a chain of stages on one thread each, connected by bounded FIFO queues,
+ * with at most maxInFlight events between submit() and the sink. When the
+ * pipeline is full the producer gets the configured backpressure instead of
+ * the queues growing, and a stage whose next queue is full waits for it.
+ *
+ * submit() is meant for a single producer thread.
+ */
+template<class Event>
+class PipelineScheduler
+{
+public:
+    typedef std::function<Event(const Event &)> Stage;
+    typedef std::function<void(const Event &)> Sink;
+
+    /**
+     * Starts one thread per stage; onStageStart(i) runs first on the thread
+     * of stage i (e.g. to pin it).
+     */
+    PipelineScheduler(std::vector<Stage> stages,
+                      Sink sink,
+                      const PipelineLimits &limits,
+                      std::function<void(size_t)> onStageStart = nullptr)
+        : _stages(std::move(stages))
+        , _sink(std::move(sink))
+        , _limits(limits)
+        , _queues(_stages.size())
+        , _stats(_stages.size())
+        , _finished(_stages.size(), false)
+        , _wakeStage(_stages.size())
+    {
+        _limits.queueCapacity = std::max<size_t>(_limits.queueCapacity, 1);
+        if (_limits.maxInFlight == 0) {
+            _limits.maxInFlight = std::max<size_t>(_stages.size(), 1);
+        }
+        for (size_t stage = 0; stage < _stages.size(); stage++) {
+            _threads.emplace_back([this, stage, onStageStart]() {
+                if (onStageStart) {
+                    onStageStart(stage);
+                }
+                runStage(stage);
+            });
+        }
+    }
+
+    ~PipelineScheduler() { stop(); }
+
+    /**
+     * Admits the event made by produce, which only runs once there is room.
+     * Returns false when the tick was skipped (full pipeline or stopped).
+     */
+    bool submit(const std::function<Event()> &produce)
+    {
+        if (_stages.empty()) {
+            _sink(produce());
+            std::lock_guard<std::mutex> lock(_mutex);
+            _admitted++;
+            _completed++;
+            return true;
+        }
+        std::unique_lock<std::mutex> lock(_mutex);
+        Event dropped;
+        if (!admissible() && _queues[0].size() >= _limits.queueCapacity) {
+            _stats[0].stalls++;
+        }
+        while (!_stopping && !admissible()) {
+            if (_limits.backpressure == BACKPRESSURE_BLOCK) {
+                _roomFreed.wait(lock);
+            } else if (_limits.backpressure != BACKPRESSURE_DROP_OLDEST ||
+                       !dropOldest(dropped)) {
+                _skipped++;
+                return false;
+            }
+        }
+        if (_stopping) {
+            _skipped++;
+            return false;
+        }
+        _inFlight++;
+        _admitted++;
+        _peakInFlight = std::max(_peakInFlight, _inFlight);
+        lock.unlock();
+        Event event = produce();
+        lock.lock();
+        enqueue(0, std::move(event));
+        return true;
+    }
+
+    /**
+     * Stops admitting events, lets the queued ones drain through every stage
+     * and joins the stage threads.
+     */
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _roomFreed.notify_all();
+        for (auto &wake : _wakeStage) {
+            wake.notify_all();
+        }
+        for (auto &thread : _threads) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+    }
+
+    std::vector<StageOccupancy> occupancy() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::vector<StageOccupancy> occupancy;
+        for (const QueueStats &stats : _stats) {
+            occupancy.push_back({_limits.queueCapacity,
+                                 stats.arrivals,
+                                 stats.arrivals > 0 ? double(stats.depthSum) / stats.arrivals
+                                                    : 0.0,
+                                 stats.maxDepth,
+                                 stats.stalls});
+        }
+        return occupancy;
+    }
+
+    const PipelineLimits &limits() const { return _limits; }
+
+    size_t admitted() const { return counter(_admitted); }
+    size_t completed() const { return counter(_completed); }
+    size_t dropped() const { return counter(_dropped); }
+    size_t skipped() const { return counter(_skipped); }
+    size_t peakInFlight() const { return counter(_peakInFlight); }
+
+private:
+    struct QueueStats
+    {
+        size_t arrivals = 0;
+        size_t depthSum = 0;
+        size_t maxDepth = 0;
+        size_t stalls = 0;
+    };
+
+    bool admissible() const
+    {
+        return _inFlight < _limits.maxInFlight && _queues[0].size() < _limits.queueCapacity;
+    }
+
+    /**
+     * Takes the oldest waiting event out: the head of the first queue when that
+     * one is full, otherwise the head of the deepest non-empty queue.
+     */
+    bool dropOldest(Event &dropped)
+    {
+        size_t stage = _queues.size();
+        if (_queues[0].size() >= _limits.queueCapacity) {
+            stage = 0;
+        } else {
+            for (size_t i = _queues.size(); i-- > 0;) {
+                if (!_queues[i].empty()) {
+                    stage = i;
+                    break;
+                }
+            }
+        }
+        if (stage == _queues.size()) {
+            return false;
+        }
+        dropped = std::move(_queues[stage].front());
+        _queues[stage].pop_front();
+        _inFlight--;
+        _dropped++;
+        _roomFreed.notify_all();
+        return true;
+    }
+
+    // Called with _mutex held; waits while the queue of stage is full.
+    void enqueue(size_t stage, Event event, std::unique_lock<std::mutex> &lock)
+    {
+        std::deque<Event> &queue = _queues[stage];
+        QueueStats &stats = _stats[stage];
+        if (queue.size() >= _limits.queueCapacity) {
+            stats.stalls++;
+            _roomFreed.wait(lock, [&]() { return queue.size() < _limits.queueCapacity; });
+        }
+        stats.arrivals++;
+        stats.depthSum += queue.size();
+        queue.push_back(std::move(event));
+        stats.maxDepth = std::max(stats.maxDepth, queue.size());
+        _wakeStage[stage].notify_one();
+    }
+
+    // Producer side: room in the first queue was reserved by admissible().
+    void enqueue(size_t stage, Event event)
+    {
+        QueueStats &stats = _stats[stage];
+        stats.arrivals++;
+        stats.depthSum += _queues[stage].size();
+        _queues[stage].push_back(std::move(event));
+        stats.maxDepth = std::max(stats.maxDepth, _queues[stage].size());
+        _wakeStage[stage].notify_one();
+    }
+
+    void runStage(size_t stage)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        std::deque<Event> &queue = _queues[stage];
+        while (true) {
+            // A stage finishes once stop() was called (or its upstream stage
+            // finished) and its queue is drained.
+            _wakeStage[stage].wait(lock, [&]() { return !queue.empty() || upstreamDone(stage); });
+            if (queue.empty()) {
+                break;
+            }
+            Event input = std::move(queue.front());
+            queue.pop_front();
+            _roomFreed.notify_all();
+            lock.unlock();
+            Event output = _stages[stage](input);
+            input = Event();
+            if (stage + 1 == _stages.size()) {
+                _sink(output);
+                output = Event();
+                lock.lock();
+                _inFlight--;
+                _completed++;
+                _roomFreed.notify_all();
+            } else {
+                lock.lock();
+                enqueue(stage + 1, std::move(output), lock);
+            }
+        }
+        _finished[stage] = true;
+        if (stage + 1 < _stages.size()) {
+            _wakeStage[stage + 1].notify_all();
+        }
+    }
+
+    bool upstreamDone(size_t stage) const
+    {
+        return stage == 0 ? _stopping : _finished[stage - 1];
+    }
+
+    size_t counter(const size_t &value) const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return value;
+    }
+
+    std::vector<Stage> _stages;
+    Sink _sink;
+    PipelineLimits _limits;
+    std::vector<std::deque<Event>> _queues;
+    std::vector<QueueStats> _stats;
+    std::vector<bool> _finished;
+    std::vector<std::condition_variable> _wakeStage;
+    std::condition_variable _roomFreed;
+    mutable std::mutex _mutex;
+    bool _stopping = false;
+    size_t _inFlight = 0;
+    size_t _peakInFlight = 0;
+    size_t _admitted = 0;
+    size_t _completed = 0;
+    size_t _dropped = 0;
+    size_t _skipped = 0;
+    std::vector<std::thread> _threads;
+};
+} // namespace matrix_mult_benchmark
+} // namespace kpsr
+
+#endif // PIPELINE_SCHEDULER_H
@@ -0,0 +1,334 @@
+#ifndef REDUCED_FLOAT_H
+#define REDUCED_FLOAT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#include "matrix_simd_kernels.h"
+
+/**
+ * IEEE binary16 bits from a float, rounded to nearest even; overflow goes to
+ * infinity, NaN stays a quiet NaN.
+ */
+inline uint16_t floatToHalfBits(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const uint32_t exponent = (bits >> 23) & 0xFF;
+    uint32_t mantissa = bits & 0x7FFFFF;
+    if (exponent == 0xFF) {
+        return uint16_t(sign | 0x7C00 | (mantissa != 0 ? 0x200 | (mantissa >> 13) : 0));
+    }
+    const int32_t halfExponent = int32_t(exponent) - 127 + 15;
+    if (halfExponent >= 31) {
+        return uint16_t(sign | 0x7C00);
+    }
+    if (halfExponent <= 0) {
+        // Subnormal half (or zero): the implicit bit joins the mantissa.
+        if (halfExponent < -10) {
+            return uint16_t(sign);
+        }
+        mantissa |= 0x800000;
+        const uint32_t shift = uint32_t(14 - halfExponent);
+        uint32_t half = mantissa >> shift;
+        const uint32_t remainder = mantissa & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1))) {
+            half++;
+        }
+        return uint16_t(sign | half);
+    }
+    uint32_t half = (uint32_t(halfExponent) << 10) | (mantissa >> 13);
+    const uint32_t remainder = mantissa & 0x1FFF;
+    // A carry out of the mantissa correctly bumps the exponent (up to infinity).
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+        half++;
+    }
+    return uint16_t(sign | half);
+}
+
+inline float halfBitsToFloat(uint16_t half)
+{
+    const uint32_t sign = uint32_t(half & 0x8000) << 16;
+    const uint32_t exponent = (half >> 10) & 0x1F;
+    uint32_t mantissa = half & 0x3FF;
+    uint32_t bits;
+    if (exponent == 0x1F) {
+        bits = sign | 0x7F800000 | (mantissa << 13);
+    } else if (exponent != 0) {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else if (mantissa == 0) {
+        bits = sign;
+    } else {
+        // Subnormal half: normalise into a float exponent.
+        uint32_t shifts = 0;
+        while ((mantissa & 0x400) == 0) {
+            mantissa <<= 1;
+            shifts++;
+        }
+        bits = sign | ((113 - shifts) << 23) | ((mantissa & 0x3FF) << 13);
+    }
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/**
+ * bfloat16 bits (the top half of a float) from a float, rounded to nearest
+ * even; NaN stays a quiet NaN.
+ */
+inline uint16_t floatToBFloat16Bits(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    if ((bits & 0x7FFFFFFF) > 0x7F800000) {
+        return uint16_t((bits >> 16) | 0x40);
+    }
+    bits += 0x7FFF + ((bits >> 16) & 1);
+    return uint16_t(bits >> 16);
+}
+
+inline float bfloat16BitsToFloat(uint16_t bfloat)
+{
+    uint32_t bits = uint32_t(bfloat) << 16;
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/**
+ * IEEE half precision storage type: 16 bits in memory, float in arithmetic.
+ * Converts implicitly both ways, so it can be the T of Matrix, the data
+ * factory and the stream assembler; backends for it widen to float and
+ * accumulate there (DynamicMatrixWidenedMultiplier).
+ */
+struct Half
+{
+    uint16_t bits;
+
+    Half() = default;
+    Half(float value)
+        : bits(floatToHalfBits(value))
+    {}
+    Half(double value)
+        : Half(float(value))
+    {}
+    Half(int value)
+        : Half(float(value))
+    {}
+
+    operator float() const { return halfBitsToFloat(bits); }
+
+    static Half fromBits(uint16_t bits)
+    {
+        Half half;
+        half.bits = bits;
+        return half;
+    }
+};
+
+/**
+ * bfloat16 storage type: float's exponent range with 8 bits of precision, the
+ * format of ML accelerators and ARMv8.6/AVX512-BF16. Used like Half.
+ */
+struct BFloat16
+{
+    uint16_t bits;
+
+    BFloat16() = default;
+    BFloat16(float value)
+        : bits(floatToBFloat16Bits(value))
+    {}
+    BFloat16(double value)
+        : BFloat16(float(value))
+    {}
+    BFloat16(int value)
+        : BFloat16(float(value))
+    {}
+
+    operator float() const { return bfloat16BitsToFloat(bits); }
+
+    static BFloat16 fromBits(uint16_t bits)
+    {
+        BFloat16 bfloat;
+        bfloat.bits = bits;
+        return bfloat;
+    }
+};
+
+/**
+ * Storage types computed in float (Half, BFloat16).
+ */
+template<class T>
+struct IsReducedFloat : std::false_type
+{};
+
+template<>
+struct IsReducedFloat<Half> : std::true_type
+{};
+
+template<>
+struct IsReducedFloat<BFloat16> : std::true_type
+{};
+
+namespace std {
+
+template<>
+class numeric_limits<Half>
+{
+public:
+    static constexpr bool is_specialized = true;
+    static constexpr bool is_signed = true;
+    static constexpr bool is_integer = false;
+    static constexpr bool has_infinity = true;
+    static constexpr bool has_quiet_NaN = true;
+    static constexpr int digits = 11;
+    static Half min() { return Half::fromBits(0x0400); }
+    static Half max() { return Half::fromBits(0x7BFF); }
+    static Half lowest() { return Half::fromBits(0xFBFF); }
+    static Half epsilon() { return Half::fromBits(0x1400); }
+    static Half infinity() { return Half::fromBits(0x7C00); }
+    static Half quiet_NaN() { return Half::fromBits(0x7E00); }
+};
+
+template<>
+class numeric_limits<BFloat16>
+{
+public:
+    static constexpr bool is_specialized = true;
+    static constexpr bool is_signed = true;
+    static constexpr bool is_integer = false;
+    static constexpr bool has_infinity = true;
+    static constexpr bool has_quiet_NaN = true;
+    static constexpr int digits = 8;
+    static BFloat16 min() { return BFloat16::fromBits(0x0080); }
+    static BFloat16 max() { return BFloat16::fromBits(0x7F7F); }
+    static BFloat16 lowest() { return BFloat16::fromBits(0xFF7F); }
+    static BFloat16 epsilon() { return BFloat16::fromBits(0x3C00); }
+    static BFloat16 infinity() { return BFloat16::fromBits(0x7F80); }
+    static BFloat16 quiet_NaN() { return BFloat16::fromBits(0x7FC0); }
+};
+
+} // namespace std
+
+#if defined(MATRIX_SIMD_X86)
+
+__attribute__((target("avx,f16c"))) inline void f16cWiden(const Half *in, float *out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i half = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(half));
+    }
+    for (; i < n; i++) {
+        out[i] = in[i];
+    }
+}
+
+__attribute__((target("avx,f16c"))) inline void f16cNarrow(const float *in, Half *out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), half);
+    }
+    for (; i < n; i++) {
+        out[i] = in[i];
+    }
+}
+
+#if defined(__clang__) || __GNUC__ >= 10
+#define MATRIX_AVX512_BF16
+// vcvtneps2bf16 rounds like floatToBFloat16Bits but flushes float subnormals
+// to zero.
+__attribute__((target("avx512f,avx512bf16"))) inline void avx512Bf16Narrow(const float *in,
+                                                                          BFloat16 *out,
+                                                                          size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256bh bfloat = _mm512_cvtneps_pbh(_mm512_loadu_ps(in + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), (__m256i)bfloat);
+    }
+    for (; i < n; i++) {
+        out[i] = in[i];
+    }
+}
+#endif
+
+#endif // MATRIX_SIMD_X86
+
+/**
+ * Bulk conversions between a reduced storage type and float, with the host's
+ * conversion instructions when it has them: F16C for half on x86 and fcvt on
+ * aarch64, AVX512-BF16 for narrowing to bfloat16. Widening bfloat16 is a
+ * shift, and the portable loops vectorise.
+ */
+inline void widenToFloat(const Half *in, float *out, size_t n)
+{
+#if defined(MATRIX_SIMD_X86)
+    static const bool f16c = __builtin_cpu_supports("f16c") && __builtin_cpu_supports("avx");
+    if (f16c) {
+        f16cWiden(in, out, n);
+        return;
+    }
+#elif defined(__aarch64__)
+    for (size_t i = 0; i < n; i++) {
+        __fp16 half;
+        std::memcpy(&half, &in[i].bits, sizeof(half));
+        out[i] = float(half);
+    }
+    return;
+#endif
+    for (size_t i = 0; i < n; i++) {
+        out[i] = in[i];
+    }
+}
+
+inline void narrowFromFloat(const float *in, Half *out, size_t n)
+{
+#if defined(MATRIX_SIMD_X86)
+    static const bool f16c = __builtin_cpu_supports("f16c") && __builtin_cpu_supports("avx");
+    if (f16c) {
+        f16cNarrow(in, out, n);
+        return;
+    }
+#elif defined(__aarch64__)
+    for (size_t i = 0; i < n; i++) {
+        __fp16 half = __fp16(in[i]);
+        std::memcpy(&out[i].bits, &half, sizeof(half));
+    }
+    return;
+#endif
+    for (size_t i = 0; i < n; i++) {
+        out[i] = in[i];
+    }
+}
+
+inline void widenToFloat(const BFloat16 *in, float *out, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        uint32_t bits = uint32_t(in[i].bits) << 16;
+        std::memcpy(&out[i], &bits, sizeof(bits));
+    }
+}
+
+inline void narrowFromFloat(const float *in, BFloat16 *out, size_t n)
+{
+#if defined(MATRIX_AVX512_BF16)
+    static const bool bf16 = __builtin_cpu_supports("avx512bf16");
+    if (bf16) {
+        avx512Bf16Narrow(in, out, n);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < n; i++) {
+        out[i] = in[i];
+    }
+}
+
+#endif // REDUCED_FLOAT_H
@@ -1,7 +1,11 @@
 #ifndef STREAM_ASSEMBLER_H
 #define STREAM_ASSEMBLER_H
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <sstream>
+#include <thread>
 
 #include <klepsydra/core/event_transform_forwarder.h>
 
@@ -9,31 +13,51 @@
 #include <klepsydra/performance_benchmark/scheduler_factory.h>
 #include <klepsydra/performance_benchmark/subscriber_factory.h>
 
+#include <klepsydra/matrix_mult_benchmark/latency_histogram.h>
+#include <klepsydra/matrix_mult_benchmark/matrix_chain_executor.h>
 #include <klepsydra/matrix_mult_benchmark/matrix_data_factory.h>
 #include <klepsydra/matrix_mult_benchmark/matrix_multiplier.h>
+#include <klepsydra/matrix_mult_benchmark/matrix_pool.h>
+#include <klepsydra/matrix_mult_benchmark/pipeline_scheduler.h>
+#include <klepsydra/matrix_mult_benchmark/thread_budget.h>
+#include <klepsydra/matrix_mult_benchmark/thread_placement.h>
 
 namespace kpsr {
 namespace matrix_mult_benchmark {
 
+/**
+ * Pipeline stage: squares the incoming matrix into a slot of the pool and
+ * publishes the handle of the slot. latency gets the time from the previous
+ * stage boundary to this one, waiting in the topic included.
+ */
 template<class T, size_t rows>
 class MatrixMultiplierTransformForwarder
 {
 public:
-    MatrixMultiplierTransformForwarder(Subscriber<Matrix<T, rows, rows>> *previousSubscriber,
-                                       Publisher<Matrix<T, rows, rows>> *nextPublisher,
+    MatrixMultiplierTransformForwarder(Subscriber<MatrixHandle<T, rows>> *previousSubscriber,
+                                       Publisher<MatrixHandle<T, rows>> *nextPublisher,
                                        MatrixMultiplier<T, rows, rows, rows> *matrixMultiplier,
-                                       bool debug)
+                                       MatrixPool<T, rows, rows> *pool,
+                                       LatencyHistogram *latency,
+                                       bool debug,
+                                       std::function<void()> pinStage)
         : eventTranformForwarder(
-              [matrixMultiplier, debug](const Matrix<T, rows, rows> &A, Matrix<T, rows, rows> &C) {
-                  matrixMultiplier->multiply(A, A, C);
+              [matrixMultiplier, pool, latency, debug, pinStage](const MatrixHandle<T, rows> &A,
+                                                                 MatrixHandle<T, rows> &C) {
+                  pinStage();
+                  std::shared_ptr<Matrix<T, rows, rows>> output = pool->acquire();
+                  matrixMultiplier->multiply(*A, *A, *output);
+                  output->stageTimestamp = steadyClockNanos();
+                  latency->record(output->stageTimestamp - A->stageTimestamp);
                   if (debug) {
                       for (size_t i = 0; i < rows; i++) {
                           for (size_t j = 0; j < rows; j++) {
-                              std::cout << C.data[i][j] << "\t";
+                              std::cout << output->data[i][j] << "\t";
                           }
                           std::cout << std::endl;
                       }
                   }
+                  C = output;
               },
               nextPublisher)
         , _previousSubscriber(previousSubscriber)
@@ -48,10 +72,44 @@ public:
     }
 
 private:
-    EventTransformForwarder<Matrix<T, rows, rows>, Matrix<T, rows, rows>> eventTranformForwarder;
-    Subscriber<Matrix<T, rows, rows>> *_previousSubscriber;
+    EventTransformForwarder<MatrixHandle<T, rows>, MatrixHandle<T, rows>> eventTranformForwarder;
+    Subscriber<MatrixHandle<T, rows>> *_previousSubscriber;
 };
 
+/**
+ * How StreamAssembler runs its chain:
+ * - STREAM_PIPELINED: one stage per topic, the matrix hops between them.
+ * - STREAM_SEQUENTIAL: one listener runs every step on pooled buffers.
+ * - STREAM_FUSED_CHAIN: one listener runs the steps on a MatrixChainExecutor
+ *   whose buffers stay in cache, the lower bound of the chain latency.
+ * - STREAM_BOUNDED_PIPELINE: one thread per stage fed by a PipelineScheduler,
+ *   with bounded queues, an in-flight limit and backpressure on the producer.
+ */
+enum StreamMode {
+    STREAM_PIPELINED = 0,
+    STREAM_SEQUENTIAL,
+    STREAM_FUSED_CHAIN,
+    STREAM_BOUNDED_PIPELINE
+};
+
+/**
+ * Chain of topicCount - 1 squaring stages fed by a periodic producer. Matrices
+ * travel as MatrixHandle: the producer publishes the immutable input slots of
+ * its MatrixDataFactory, every stage writes into a slot of a MatrixPool of
+ * poolSize matrices (size it like the event pool) and only the handles are
+ * copied between stages. limits only applies to STREAM_BOUNDED_PIPELINE; size
+ * the pool for its in-flight limit plus one output per stage. The pool's
+ * slots live in a MatrixArena on the given pages and are first touched by the
+ * stage that takes them.
+ *
+ * Latencies are recorded on the steady clock into one histogram per stage
+ * (previous stage boundary to this one; not in STREAM_FUSED_CHAIN mode) and
+ * one end to end (input produced to chain done), summarized at stop().
+ *
+ * The stages that run concurrently (one in the single-thread modes) are
+ * registered with the ThreadBudget for the assembler's lifetime, and every
+ * multiplier gets the product threads of the resulting split.
+ */
 template<class T, size_t rows>
 class StreamAssembler
 {
@@ -60,46 +118,116 @@ public:
                     const int topicCount,
                     int period,
                     SchedulerFactory *schedulerFactory,
-                    SubscriberFactory<Matrix<T, rows, rows>> *subscriberFactory,
-                    PublisherFactory<Matrix<T, rows, rows>> *producerFactory,
+                    SubscriberFactory<MatrixHandle<T, rows>> *subscriberFactory,
+                    PublisherFactory<MatrixHandle<T, rows>> *producerFactory,
                     std::vector<MatrixMultiplier<T, rows, rows, rows> *> matrixMultiplier,
                     MatrixDataFactory<T, rows, rows> *matrixDataFactory,
                     bool debug,
-                    bool sequential)
+                    StreamMode mode,
+                    const ThreadPlacement &placement = ThreadPlacement(),
+                    size_t poolSize = DEFAULT_POOL_SIZE,
+                    const PipelineLimits &limits = PipelineLimits(),
+                    PagePolicy pages = PAGES_DEFAULT)
         : _period(period)
         , _streams(topicCount)
         , _schedulerFactory(schedulerFactory)
         , _subscriberFactory(subscriberFactory)
         , _providerNamePrefix(providerNamePrefix)
         , _topicCount(topicCount)
+        , _mode(mode)
+        , _placement(placement)
+        , _stageCpus(topicCount)
+        , _producerThread(std::thread::id())
+        , _pool(poolSize, pages)
+        , _stageLatency(std::max(topicCount - 1, 0))
     {
+        for (auto &cpu : _stageCpus) {
+            cpu.store(STAGE_NOT_STARTED);
+        }
         _matrixProducer = std::make_shared<std::function<void()>>(
-            [producerFactory, providerNamePrefix, matrixDataFactory]() {
+            [this, producerFactory, providerNamePrefix, matrixDataFactory]() {
+                pinStage(0);
+                if (_scheduler) {
+                    _scheduler->submit(
+                        [matrixDataFactory]() -> MatrixHandle<T, rows> {
+                            return matrixDataFactory->generateMatrix();
+                        });
+                    return;
+                }
                 std::string const previousProviderName = providerNamePrefix + "0";
                 producerFactory->getPublisher(previousProviderName)
                     ->publish(matrixDataFactory->generateMatrix());
             });
 
-        if (sequential) {
+        if (mode == STREAM_BOUNDED_PIPELINE) {
+            std::vector<typename PipelineScheduler<MatrixHandle<T, rows>>::Stage> stages;
+            for (int i = 0; i < (topicCount - 1); i++) {
+                auto multiplier = matrixMultiplier.size() == 1 ? matrixMultiplier[0]
+                                                               : matrixMultiplier[i];
+                stages.push_back([this, multiplier, i](const MatrixHandle<T, rows> &A) {
+                    std::shared_ptr<Matrix<T, rows, rows>> output = _pool.acquire();
+                    multiplier->multiply(*A, *A, *output);
+                    recordStage(i, *A, *output);
+                    return MatrixHandle<T, rows>(output);
+                });
+            }
+            _scheduler.reset(new PipelineScheduler<MatrixHandle<T, rows>>(
+                stages,
+                [this, debug](const MatrixHandle<T, rows> &matrix) {
+                    if (debug) {
+                        for (size_t i = 0; i < rows; i++) {
+                            for (size_t j = 0; j < rows; j++) {
+                                std::cout << matrix->data[i][j] << "\t";
+                            }
+                            std::cout << std::endl;
+                        }
+                    }
+                    recordProcessed(*matrix);
+                },
+                limits,
+                [this](size_t stage) { pinStage(stage + 1); }));
+        } else if (mode == STREAM_FUSED_CHAIN) {
+            std::string const previousProviderName = providerNamePrefix + "0";
+            _fusedChain.reset(new MatrixChainExecutor<T, rows>(matrixMultiplier[0], topicCount - 1));
+            _subscriberFactory->getSubscriber(previousProviderName)
+                ->registerListener("Multiplications", [&, debug](const MatrixHandle<T, rows> &matrix) {
+                    const Matrix<T, rows, rows> &output = _fusedChain->run(*matrix);
+                    if (debug) {
+                        for (size_t i = 0; i < rows; i++) {
+                            for (size_t j = 0; j < rows; j++) {
+                                std::cout << output.data[i][j] << "\t";
+                            }
+                            std::cout << std::endl;
+                        }
+                    }
+                    recordProcessed(output);
+                });
+        } else if (mode == STREAM_SEQUENTIAL) {
             std::string const previousProviderName = providerNamePrefix + "0";
             auto multiplier = matrixMultiplier[0];
             _subscriberFactory->getSubscriber(previousProviderName)
                 ->registerListener("Multiplications",
-                                   [&, multiplier, debug](const Matrix<T, rows, rows> &matrix) {
-                                       Matrix<T, rows, rows> input = matrix;
-                                       Matrix<T, rows, rows> output;
+                                   [&, multiplier, debug](const MatrixHandle<T, rows> &matrix) {
+                                       // Ping-pong between two pool slots, the
+                                       // first stage reads the event in place.
+                                       std::shared_ptr<Matrix<T, rows, rows>> buffers[2] =
+                                           {_pool.acquire(), _pool.acquire()};
+                                       const Matrix<T, rows, rows> *input = matrix.get();
                                        for (int i = 0; i < (_topicCount - 1); i++) {
-                                           multiplier->multiply(input, input, output);
+                                           Matrix<T, rows, rows> *output = buffers[i % 2].get();
+                                           multiplier->multiply(*input, *input, *output);
+                                           recordStage(i, *input, *output);
                                            input = output;
                                        }
                                        if (debug) {
                                            for (size_t i = 0; i < rows; i++) {
                                                for (size_t j = 0; j < rows; j++) {
-                                                   std::cout << output.data[i][j] << "\t";
+                                                   std::cout << input->data[i][j] << "\t";
                                                }
                                                std::cout << std::endl;
                                            }
                                        }
+                                       recordProcessed(*input);
                                    });
 
         } else {
@@ -108,27 +236,38 @@ public:
                                                                : matrixMultiplier[i];
                 std::string const previousProviderName = providerNamePrefix + std::to_string(i);
                 std::string const nextProviderName = providerNamePrefix + std::to_string(i + 1);
-                kpsr::Subscriber<Matrix<T, rows, rows>> *previousSubscriber =
+                kpsr::Subscriber<MatrixHandle<T, rows>> *previousSubscriber =
                     subscriberFactory->getSubscriber(previousProviderName);
-                kpsr::Publisher<Matrix<T, rows, rows>> *nextPublisher =
+                kpsr::Publisher<MatrixHandle<T, rows>> *nextPublisher =
                     producerFactory->getPublisher(nextProviderName);
                 auto stream = std::make_shared<MatrixMultiplierTransformForwarder<T, rows>>(
-                    previousSubscriber, nextPublisher, multiplier, debug);
+                    previousSubscriber,
+                    nextPublisher,
+                    multiplier,
+                    &_pool,
+                    &_stageLatency[i],
+                    debug,
+                    [this, i]() { pinStage(i + 1); });
                 _streams[i] = stream;
             }
             std::string const previousProviderName = providerNamePrefix +
                                                      std::to_string(topicCount - 1);
             subscriberFactory->getSubscriber(previousProviderName)
-                ->registerListener("StreamAssembler", [&](const Matrix<T, rows, rows> &matrix) {
-                    long long currentTimetamp =
-                        std::chrono::duration_cast<std::chrono::microseconds>(
-                            std::chrono::system_clock::now().time_since_epoch())
-                            .count();
-                    totalProcessingTime = totalProcessingTime +
-                                          (currentTimetamp - matrix.timestamp);
-                    totalProcessedMatrices++;
+                ->registerListener("StreamAssembler", [&](const MatrixHandle<T, rows> &matrix) {
+                    recordProcessed(*matrix);
                 });
         }
+
+        // The stages share the cores with every other chain of the process.
+        _budgetStages = (mode == STREAM_PIPELINED || mode == STREAM_BOUNDED_PIPELINE)
+                            ? static_cast<size_t>(std::max(topicCount - 1, 1))
+                            : 1;
+        ThreadBudget &budget = ThreadBudget::instance();
+        budget.addStages(_budgetStages);
+        for (auto multiplier : matrixMultiplier) {
+            budget.attach(this, multiplier);
+        }
+        budget.rebalance();
     }
 
     void start()
@@ -139,27 +278,168 @@ public:
                                                               _matrixProducer);
     }
 
-    void stop() { _schedulerFactory->getScheduler()->stopScheduledTask("StreamAssembler"); }
+    /**
+     * Stops the producer and summarizes the latency histograms; in
+     * STREAM_BOUNDED_PIPELINE mode the matrices still in flight are drained
+     * first.
+     */
+    void stop()
+    {
+        _schedulerFactory->getScheduler()->stopScheduledTask("StreamAssembler");
+        if (_scheduler) {
+            _scheduler->stop();
+        }
+        _stageSummaries.clear();
+        for (const LatencyHistogram &latency : _stageLatency) {
+            if (_mode != STREAM_FUSED_CHAIN) {
+                _stageSummaries.push_back(latency.summarize());
+            }
+        }
+        _endToEndSummary = _endToEndLatency.summarize();
+    }
 
     ~StreamAssembler()
     {
-        std::string const previousProviderName = _providerNamePrefix +
-                                                 std::to_string(_topicCount - 1);
-        _subscriberFactory->getSubscriber(previousProviderName)->removeListener("StreamAssembler");
+        if (_scheduler) {
+            _scheduler.reset();
+        } else if (_mode == STREAM_PIPELINED) {
+            std::string const previousProviderName = _providerNamePrefix +
+                                                     std::to_string(_topicCount - 1);
+            _subscriberFactory->getSubscriber(previousProviderName)
+                ->removeListener("StreamAssembler");
+        } else {
+            _subscriberFactory->getSubscriber(_providerNamePrefix + "0")
+                ->removeListener("Multiplications");
+        }
         _streams.clear();
+        ThreadBudget &budget = ThreadBudget::instance();
+        budget.detach(this);
+        budget.removeStages(_budgetStages);
+        budget.rebalance();
     }
 
-    long long totalProcessingTime = 0;
-    int totalProcessedMatrices = 0;
+    /**
+     * Where the producer (slot 0) and every stage (slot i) actually ran.
+     */
+    std::string placementReport() const
+    {
+        std::ostringstream report;
+        report << _placement.policyName();
+        for (size_t slot = 0; slot < _stageCpus.size(); slot++) {
+            if (slot == 0) {
+                report << ": producer";
+            } else {
+                report << ", stage " << slot;
+            }
+            int cpu = _stageCpus[slot].load();
+            if (cpu >= 0) {
+                report << " -> cpu " << cpu;
+            } else if (cpu == STAGE_ON_PRODUCER) {
+                report << " -> producer thread";
+            } else if (cpu == STAGE_NOT_STARTED) {
+                report << " -> not run";
+            } else {
+                report << " -> unpinned";
+            }
+        }
+        return report.str();
+    }
+
+    const MatrixPool<T, rows, rows> &pool() const { return _pool; }
+
+    /**
+     * Executor of STREAM_FUSED_CHAIN mode, nullptr in the other modes. Configure
+     * it (e.g. setPower()) before start().
+     */
+    MatrixChainExecutor<T, rows> *fusedChain() { return _fusedChain.get(); }
+
+    /**
+     * Scheduler of STREAM_BOUNDED_PIPELINE mode with its queue occupancy and
+     * backpressure counters, nullptr in the other modes.
+     */
+    const PipelineScheduler<MatrixHandle<T, rows>> *pipelineScheduler() const
+    {
+        return _scheduler.get();
+    }
+
+    /**
+     * Latency of every stage and of the whole chain as of stop(). There are
+     * no stage summaries in STREAM_FUSED_CHAIN mode.
+     */
+    const std::vector<LatencySummary> &stageLatency() const { return _stageSummaries; }
+    const LatencySummary &endToEndLatency() const { return _endToEndSummary; }
+
+    static constexpr size_t DEFAULT_POOL_SIZE = 64;
+
+    // Sum of the end to end latencies in microseconds.
+    std::atomic<long long> totalProcessingTime{0};
+    std::atomic<int> totalProcessedMatrices{0};
 
 private:
+    static constexpr int STAGE_NOT_STARTED = -1;
+    static constexpr int STAGE_UNPINNED = -2;
+    static constexpr int STAGE_ON_PRODUCER = -3;
+
+    void recordStage(size_t stage,
+                     const Matrix<T, rows, rows> &input,
+                     Matrix<T, rows, rows> &output)
+    {
+        output.stageTimestamp = steadyClockNanos();
+        _stageLatency[stage].record(output.stageTimestamp - input.stageTimestamp);
+    }
+
+    void recordProcessed(const Matrix<T, rows, rows> &matrix)
+    {
+        long long latency = steadyClockNanos() - matrix.timestamp;
+        _endToEndLatency.record(latency);
+        totalProcessingTime += latency / 1000;
+        totalProcessedMatrices++;
+    }
+
+    /**
+     * Pins the calling thread to the placement slot the first time the slot
+     * runs. Stages running on the producer thread (event emitters) are left
+     * alone so the producer is not moved around; bounded pipeline stages have
+     * threads of their own.
+     */
+    void pinStage(size_t slot)
+    {
+        if (_stageCpus[slot].load(std::memory_order_relaxed) != STAGE_NOT_STARTED) {
+            return;
+        }
+        int cpu = STAGE_UNPINNED;
+        if (slot == 0) {
+            _producerThread.store(std::this_thread::get_id());
+        }
+        if (slot != 0 && _mode != STREAM_BOUNDED_PIPELINE &&
+            std::this_thread::get_id() == _producerThread.load()) {
+            cpu = STAGE_ON_PRODUCER;
+        } else if (_placement.pinCurrentThread(slot)) {
+            cpu = _placement.cpuFor(slot);
+        }
+        _stageCpus[slot].store(cpu);
+    }
+
     int _period;
     std::vector<std::shared_ptr<MatrixMultiplierTransformForwarder<T, rows>>> _streams;
     SchedulerFactory *_schedulerFactory;
-    SubscriberFactory<Matrix<T, rows, rows>> *_subscriberFactory;
+    SubscriberFactory<MatrixHandle<T, rows>> *_subscriberFactory;
     std::shared_ptr<std::function<void()>> _matrixProducer;
     std::string _providerNamePrefix;
     int _topicCount;
+    StreamMode _mode;
+    ThreadPlacement _placement;
+    std::vector<std::atomic<int>> _stageCpus;
+    // Set by the slot 0 stage, read by the others on their own threads.
+    std::atomic<std::thread::id> _producerThread;
+    MatrixPool<T, rows, rows> _pool;
+    std::unique_ptr<MatrixChainExecutor<T, rows>> _fusedChain;
+    std::unique_ptr<PipelineScheduler<MatrixHandle<T, rows>>> _scheduler;
+    std::vector<LatencyHistogram> _stageLatency;
+    LatencyHistogram _endToEndLatency;
+    std::vector<LatencySummary> _stageSummaries;
+    LatencySummary _endToEndSummary;
+    size_t _budgetStages;
 };
 } // namespace matrix_mult_benchmark
 } // namespace kpsr
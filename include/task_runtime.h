@@ -0,0 +1,239 @@
+#ifndef TASK_RUNTIME_H
+#define TASK_RUNTIME_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Process-wide work-stealing runtime shared by the parallel multipliers.
+ *
+ * Each worker owns a deque: it pops its own tasks LIFO and steals FIFO from the
+ * others when it runs dry. A parallelFor() caller splits its range into tasks,
+ * spreads them over the deques and works on them too until its group is done,
+ * so the runtime only adds hardware_concurrency() - 1 threads however many
+ * threads call into it. Calls made from inside a task (nested parallelism)
+ * run inline on the calling thread.
+ */
+class TaskRuntime
+{
+public:
+    typedef std::function<void(size_t, size_t)> RangeFunction;
+
+    explicit TaskRuntime(size_t workers)
+        : _queues(workers)
+        , _queued(0)
+        , _nextQueue(0)
+        , _stopping(false)
+    {
+        for (size_t i = 0; i < workers; i++) {
+            _queues[i].reset(new WorkQueue());
+        }
+        for (size_t i = 0; i < workers; i++) {
+            _workers.emplace_back(&TaskRuntime::workerLoop, this, i);
+        }
+    }
+
+    ~TaskRuntime()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_sleepMutex);
+            _stopping = true;
+        }
+        _sleepCondition.notify_all();
+        for (auto &worker : _workers) {
+            worker.join();
+        }
+    }
+
+    static TaskRuntime &instance()
+    {
+        static TaskRuntime runtime(std::max(1u, std::thread::hardware_concurrency()) - 1);
+        return runtime;
+    }
+
+    /**
+     * Threads that can execute tasks of one parallelFor(): the workers plus the
+     * caller.
+     */
+    size_t concurrency() const { return _workers.size() + 1; }
+
+    /**
+     * Chunk size splitting count elements evenly over concurrency(), or over
+     * at most threads when that is set, never below minimum.
+     */
+    size_t grainFor(size_t count, size_t minimum, size_t threads = 0) const
+    {
+        size_t parts = threads > 0 ? std::min(threads, concurrency()) : concurrency();
+        return std::max(minimum, (count + parts - 1) / parts);
+    }
+
+    /**
+     * Calls fn(begin, end) over [0, count) in chunks of at most grain elements
+     * and returns once every chunk has run.
+     */
+    void parallelFor(size_t count, size_t grain, const RangeFunction &fn)
+    {
+        if (count == 0) {
+            return;
+        }
+        grain = std::max<size_t>(1, grain);
+        if (_workers.empty() || count <= grain || insideTask()) {
+            TaskScope scope;
+            fn(0, count);
+            return;
+        }
+
+        TaskGroup group(fn, (count + grain - 1) / grain);
+        size_t queue = _nextQueue.fetch_add(1, std::memory_order_relaxed);
+        for (size_t begin = 0; begin < count; begin += grain, queue++) {
+            push(queue % _queues.size(), {&group, begin, std::min(count, begin + grain)});
+        }
+
+        while (group.pending.load(std::memory_order_acquire) > 0) {
+            Task task;
+            if (steal(queue, task)) {
+                run(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(group.mutex);
+            group.done.wait(lock, [&group]() {
+                return group.pending.load(std::memory_order_acquire) == 0;
+            });
+        }
+        std::lock_guard<std::mutex> lock(group.mutex);
+    }
+
+    /**
+     * True on runtime workers and on any thread currently running a task.
+     */
+    static bool insideTask() { return taskDepth() > 0; }
+
+private:
+    struct TaskGroup
+    {
+        TaskGroup(const RangeFunction &function, size_t tasks)
+            : function(function)
+            , pending(tasks)
+        {}
+
+        const RangeFunction &function;
+        std::atomic<size_t> pending;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+
+    struct Task
+    {
+        TaskGroup *group;
+        size_t begin;
+        size_t end;
+    };
+
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    struct TaskScope
+    {
+        TaskScope() { taskDepth()++; }
+        ~TaskScope() { taskDepth()--; }
+    };
+
+    static int &taskDepth()
+    {
+        static thread_local int depth = 0;
+        return depth;
+    }
+
+    void push(size_t index, const Task &task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_queues[index]->mutex);
+            _queues[index]->tasks.push_back(task);
+        }
+        _queued.fetch_add(1, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(_sleepMutex);
+        }
+        _sleepCondition.notify_one();
+    }
+
+    bool pop(size_t index, Task &task)
+    {
+        std::lock_guard<std::mutex> lock(_queues[index]->mutex);
+        if (_queues[index]->tasks.empty()) {
+            return false;
+        }
+        task = _queues[index]->tasks.back();
+        _queues[index]->tasks.pop_back();
+        _queued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool steal(size_t start, Task &task)
+    {
+        for (size_t i = 0; i < _queues.size(); i++) {
+            WorkQueue &victim = *_queues[(start + i) % _queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                _queued.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(const Task &task)
+    {
+        {
+            TaskScope scope;
+            task.group->function(task.begin, task.end);
+        }
+        // Decrement under the lock: once the caller has seen zero and taken the
+        // lock itself, no worker touches the group again.
+        std::lock_guard<std::mutex> lock(task.group->mutex);
+        if (task.group->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            task.group->done.notify_all();
+        }
+    }
+
+    void workerLoop(size_t index)
+    {
+        TaskScope workerScope;
+        while (true) {
+            Task task;
+            if (pop(index, task) || steal(index + 1, task)) {
+                run(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(_sleepMutex);
+            _sleepCondition.wait(lock, [this]() {
+                return _stopping || _queued.load(std::memory_order_acquire) > 0;
+            });
+            if (_stopping) {
+                return;
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<WorkQueue>> _queues;
+    std::vector<std::thread> _workers;
+    std::atomic<size_t> _queued;
+    std::atomic<size_t> _nextQueue;
+    std::mutex _sleepMutex;
+    std::condition_variable _sleepCondition;
+    bool _stopping;
+};
+
+#endif // TASK_RUNTIME_H
@@ -0,0 +1,203 @@
+#ifndef THREAD_BUDGET_H
+#define THREAD_BUDGET_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef openmp_enabled
+#include <omp.h>
+#endif
+#ifdef openblas_enabled
+#include <cblas.h>
+#endif
+#ifdef eigen_enabled
+#include <Eigen/Core>
+#endif
+
+/**
+ * Process-wide split of the cores between pipeline stages and the threads of
+ * each product, so the stages and the libraries under them do not each size
+ * themselves to the whole board.
+ *
+ * Every chain registers the stages that may run concurrently (addStages())
+ * and the multipliers they run on (attach()); each product then gets
+ * cores() / stages() threads. rebalance() pushes that count to the attached
+ * multipliers (setNumThreads()) and to the libraries' own knobs: OpenBLAS,
+ * Eigen and the OpenMP team size of the calling thread. Stages already
+ * running pick the new count up with their next product.
+ *
+ * The core count is hardware_concurrency(), or KPSR_CORES when set.
+ */
+class ThreadBudget
+{
+public:
+    static ThreadBudget &instance()
+    {
+        static ThreadBudget budget;
+        return budget;
+    }
+
+    size_t cores() const { return _cores; }
+
+    size_t stages() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _stages;
+    }
+
+    /**
+     * Threads each product may use: the cores shared out between the
+     * registered stages, at least one.
+     */
+    size_t gemmThreads() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return gemmThreadsLocked();
+    }
+
+    void addStages(size_t stages)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stages += stages;
+    }
+
+    void removeStages(size_t stages)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stages -= std::min(stages, _stages);
+    }
+
+    /**
+     * Gives multiplier the product threads of the budget on every rebalance()
+     * until owner is detached; attaching it again is a no-op. M is any
+     * multiplier with setNumThreads().
+     */
+    template<class M>
+    void attach(const void *owner, M *multiplier)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (const Attached &attached : _multipliers) {
+            if (attached.owner == owner && attached.multiplier == multiplier) {
+                return;
+            }
+        }
+        _multipliers.push_back({owner, multiplier, [multiplier](size_t threads) {
+                                    return multiplier->setNumThreads(threads);
+                                }});
+    }
+
+    void detach(const void *owner)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _multipliers.erase(std::remove_if(_multipliers.begin(),
+                                          _multipliers.end(),
+                                          [owner](const Attached &attached) {
+                                              return attached.owner == owner;
+                                          }),
+                           _multipliers.end());
+    }
+
+    /**
+     * Applies gemmThreads() to the libraries and the attached multipliers.
+     * Returns the number of multipliers that took it; the others (sequential
+     * backends) run on one thread anyway.
+     */
+    size_t rebalance()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        const size_t threads = gemmThreadsLocked();
+#ifdef openmp_enabled
+        // Only the calling thread's team size; the OpenMP multipliers of other
+        // threads take theirs through setNumThreads().
+        omp_set_num_threads(static_cast<int>(threads));
+#endif
+#ifdef openblas_enabled
+        openblas_set_num_threads(static_cast<int>(threads));
+#endif
+#ifdef eigen_enabled
+        Eigen::setNbThreads(static_cast<int>(threads));
+#endif
+        _configured = 0;
+        for (const Attached &attached : _multipliers) {
+            if (attached.setNumThreads(threads)) {
+                _configured++;
+            }
+        }
+        return _configured;
+    }
+
+    /**
+     * "4 cores: 3 stages x 1 GEMM thread (OpenMP, OpenBLAS, Eigen), 2 of 3
+     * multipliers configured", as of the last rebalance().
+     */
+    std::string describe() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        const size_t stages = std::max<size_t>(_stages, 1);
+        const size_t threads = gemmThreadsLocked();
+        std::ostringstream text;
+        text << _cores << (_cores == 1 ? " core: " : " cores: ") << stages
+             << (stages == 1 ? " stage x " : " stages x ") << threads
+             << (threads == 1 ? " GEMM thread" : " GEMM threads");
+        const char *separator = " (";
+#ifdef openmp_enabled
+        text << separator << "OpenMP";
+        separator = ", ";
+#endif
+#ifdef openblas_enabled
+        text << separator << "OpenBLAS";
+        separator = ", ";
+#endif
+#ifdef eigen_enabled
+        text << separator << "Eigen";
+        separator = ", ";
+#endif
+        if (separator[0] == ',') {
+            text << ")";
+        }
+        text << ", " << _configured << " of " << _multipliers.size()
+             << " multipliers configured";
+        return text.str();
+    }
+
+    ThreadBudget(const ThreadBudget &) = delete;
+    ThreadBudget &operator=(const ThreadBudget &) = delete;
+
+private:
+    struct Attached
+    {
+        const void *owner;
+        const void *multiplier;
+        std::function<bool(size_t)> setNumThreads;
+    };
+
+    ThreadBudget()
+        : _cores(std::max(1u, std::thread::hardware_concurrency()))
+        , _stages(0)
+        , _configured(0)
+    {
+        const char *cores = std::getenv("KPSR_CORES");
+        if (cores != nullptr && std::atoi(cores) > 0) {
+            _cores = static_cast<size_t>(std::atoi(cores));
+        }
+    }
+
+    size_t gemmThreadsLocked() const
+    {
+        return std::max<size_t>(1, _cores / std::max<size_t>(_stages, 1));
+    }
+
+    size_t _cores;
+    size_t _stages;
+    size_t _configured;
+    std::vector<Attached> _multipliers;
+    mutable std::mutex _mutex;
+};
+
+#endif // THREAD_BUDGET_H
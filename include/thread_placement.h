@@ -0,0 +1,256 @@
+#ifndef THREAD_PLACEMENT_H
+#define THREAD_PLACEMENT_H
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+enum PlacementPolicy { PLACEMENT_FREE = 0, PLACEMENT_EXPLICIT, PLACEMENT_COMPACT, PLACEMENT_SCATTER };
+
+/**
+ * Maps logical thread slots (benchmark thread i, pipeline stage i) to CPUs.
+ *
+ * - free: threads are left to the scheduler.
+ * - compact: consecutive slots fill one core/package before the next.
+ * - scatter: consecutive slots go to different packages and physical cores,
+ *   SMT siblings are used last.
+ * - explicit: a CPU list such as "0,2,3" or "1-3", one CPU per slot.
+ *
+ * Slots past the end of the CPU list wrap around.
+ */
+class ThreadPlacement
+{
+public:
+    ThreadPlacement()
+        : _policy(PLACEMENT_FREE)
+    {}
+
+    ThreadPlacement(PlacementPolicy policy, const std::vector<int> &cpus)
+        : _policy(policy)
+        , _cpus(cpus)
+    {}
+
+    /**
+     * Parses "free", "compact", "scatter" or an explicit CPU list. Anything
+     * unparseable, CPU ids a cpu_set_t cannot hold included, or a host
+     * without affinity support, gives free placement.
+     */
+    static ThreadPlacement parse(const std::string &spec)
+    {
+        if (spec == "compact") {
+            return ThreadPlacement(PLACEMENT_COMPACT, orderedCpus(false));
+        }
+        if (spec == "scatter") {
+            return ThreadPlacement(PLACEMENT_SCATTER, orderedCpus(true));
+        }
+        std::vector<int> cpus = parseCpuList(spec);
+        if (cpus.empty()) {
+            return ThreadPlacement();
+        }
+        return ThreadPlacement(PLACEMENT_EXPLICIT, cpus);
+    }
+
+    PlacementPolicy policy() const { return _policy; }
+
+    /**
+     * CPU for a slot, -1 when the slot is not pinned.
+     */
+    int cpuFor(size_t slot) const
+    {
+        if (_policy == PLACEMENT_FREE || _cpus.empty()) {
+            return -1;
+        }
+        return _cpus[slot % _cpus.size()];
+    }
+
+    bool pin(std::thread &thread, size_t slot) const
+    {
+        return pinHandle(thread.native_handle(), slot);
+    }
+
+    bool pinCurrentThread(size_t slot) const
+    {
+#ifdef __linux__
+        return pinHandle(pthread_self(), slot);
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * Human readable placement of the first slots, e.g. "compact [0, 1, 2, 3]".
+     */
+    std::string describe(size_t slots) const
+    {
+        std::ostringstream out;
+        out << policyName();
+        if (_policy != PLACEMENT_FREE) {
+            out << " [";
+            for (size_t i = 0; i < slots; i++) {
+                out << (i == 0 ? "" : ", ") << cpuFor(i);
+            }
+            out << "]";
+        }
+        return out.str();
+    }
+
+    const char *policyName() const
+    {
+        switch (_policy) {
+        case PLACEMENT_EXPLICIT:
+            return "explicit";
+        case PLACEMENT_COMPACT:
+            return "compact";
+        case PLACEMENT_SCATTER:
+            return "scatter";
+        default:
+            return "free";
+        }
+    }
+
+private:
+    bool pinHandle(std::thread::native_handle_type handle, size_t slot) const
+    {
+        int cpu = cpuFor(slot);
+        if (cpu < 0) {
+            return false;
+        }
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(handle, sizeof(set), &set) == 0;
+#else
+        (void) handle;
+        return false;
+#endif
+    }
+
+    // CPU ids a cpu_set_t can hold.
+#ifdef __linux__
+    static constexpr int MAX_CPUS = CPU_SETSIZE;
+#else
+    static constexpr int MAX_CPUS = 1024;
+#endif
+
+    /**
+     * CPUs of a "0,2,4-7" list, empty when an item is not a CPU id or range
+     * in [0, MAX_CPUS).
+     */
+    static std::vector<int> parseCpuList(const std::string &spec)
+    {
+        std::vector<int> cpus;
+        std::stringstream stream(spec);
+        std::string item;
+        while (std::getline(stream, item, ',')) {
+            size_t dash = item.find('-');
+            try {
+                if (dash == std::string::npos) {
+                    int cpu = std::stoi(item);
+                    if (cpu < 0 || cpu >= MAX_CPUS) {
+                        return std::vector<int>();
+                    }
+                    cpus.push_back(cpu);
+                } else {
+                    int first = std::stoi(item.substr(0, dash));
+                    int last = std::stoi(item.substr(dash + 1));
+                    if (first < 0 || last >= MAX_CPUS) {
+                        return std::vector<int>();
+                    }
+                    for (int cpu = first; cpu <= last; cpu++) {
+                        cpus.push_back(cpu);
+                    }
+                }
+            } catch (const std::exception &) {
+                return std::vector<int>();
+            }
+        }
+        return cpus;
+    }
+
+    static int readTopology(int cpu, const char *entry)
+    {
+        std::ifstream file("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/" +
+                           entry);
+        int value = 0;
+        file >> value;
+        return value;
+    }
+
+    /**
+     * CPUs this process may run on, in compact or scatter order.
+     */
+    static std::vector<int> orderedCpus(bool scatter)
+    {
+        struct Cpu
+        {
+            int cpu;
+            int package;
+            int core;
+            int sibling;
+            int coreRank;
+        };
+        std::vector<Cpu> cpus;
+#ifdef __linux__
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            return std::vector<int>();
+        }
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                cpus.push_back(
+                    {cpu, readTopology(cpu, "physical_package_id"), readTopology(cpu, "core_id"), 0, 0});
+            }
+        }
+#endif
+        // sibling: index of the hardware thread inside its core,
+        // coreRank: index of the core inside its package.
+        for (Cpu &cpu : cpus) {
+            std::vector<int> packageCores;
+            for (const Cpu &other : cpus) {
+                if (other.package != cpu.package) {
+                    continue;
+                }
+                if (other.core == cpu.core && other.cpu < cpu.cpu) {
+                    cpu.sibling++;
+                }
+                if (std::find(packageCores.begin(), packageCores.end(), other.core) ==
+                    packageCores.end()) {
+                    packageCores.push_back(other.core);
+                }
+            }
+            std::sort(packageCores.begin(), packageCores.end());
+            cpu.coreRank = static_cast<int>(
+                std::find(packageCores.begin(), packageCores.end(), cpu.core) - packageCores.begin());
+        }
+        std::sort(cpus.begin(), cpus.end(), [scatter](const Cpu &a, const Cpu &b) {
+            if (scatter) {
+                return std::tie(a.sibling, a.coreRank, a.package, a.cpu) <
+                       std::tie(b.sibling, b.coreRank, b.package, b.cpu);
+            }
+            return std::tie(a.package, a.coreRank, a.sibling, a.cpu) <
+                   std::tie(b.package, b.coreRank, b.sibling, b.cpu);
+        });
+        std::vector<int> order;
+        for (const Cpu &cpu : cpus) {
+            order.push_back(cpu.cpu);
+        }
+        return order;
+    }
+
+    PlacementPolicy _policy;
+    std::vector<int> _cpus;
+};
+
+#endif // THREAD_PLACEMENT_H
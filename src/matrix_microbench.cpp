@@ -0,0 +1,468 @@
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "matrix_autotuner.h"
+#include "matrix_backends.h"
+#include "matrix_convolution.h"
+#include "matrix_microbenchmark.h"
+
+// Sweeps every compiled-in backend over element types, shapes and numbers of
+// concurrent caller threads. Arguments are key=value options:
+//   backends=simd,packed    backends by name, or every one whose name contains
+//                           an entry that is not a name
+//   types=float,double,int  element types (default these three; int8 and int16
+//                           run the quantized backends, half and bfloat16 the
+//                           widened ones, reporting their error against fp32;
+//                           the Strassen backends report theirs against the
+//                           classic product)
+//   sizes=32,64,128x256x64  shapes, MxNxK or a square size
+//   convs=3x64x64,16:3:1:1  convolution chain (input CxHxW, then one
+//                           filters:kernel:stride:padding entry per layer),
+//                           run in both layouts with im2col on every backend
+//                           and with the implicit gemm, bias and ReLU fused
+//                           (float, double, int)
+//   prepacked=1             also time every backend with B prepacked once
+//                           (prepack()), as for weights reused across calls
+//   threads=1,2,4           concurrent caller threads (default 1 and all cores)
+//   placement=compact       thread placement (free, compact, scatter, CPU list)
+//   warmup_ms=50 max_ms=2000 min_reps=10 max_reps=1000 target_error=0.01
+//   json=results.json csv=results.csv
+//   mode=verify             only check the backends against the reference
+//   mode=list               print the backends compiled in
+//   mode=tune               tune every type, shape and thread count and store
+//                           the winners in the tuning cache (KPSR_TUNING_CACHE)
+// Backends failing the correctness check are reported and never timed.
+// backends=auto times the tuned dispatch (MatrixAutoMultiplier).
+namespace {
+
+std::vector<std::string> splitList(const std::string &list)
+{
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+/**
+ * Times layer.forward() like runMicrobenchmark() times a product, on one
+ * thread.
+ */
+template<class T>
+MicrobenchmarkStatistics timeConvolution(ConvolutionLayer<T> &layer,
+                                         const MicrobenchmarkSettings &settings)
+{
+    DynamicMatrix<T> input(layer.inputRows(), layer.inputCols());
+    DynamicMatrix<T> output(layer.outputRows(), layer.outputCols());
+    fillActivation(input, layer.shape().depth());
+    auto round = [&](size_t layers) -> std::chrono::nanoseconds {
+        auto begin = std::chrono::steady_clock::now();
+        for (size_t l = 0; l < layers; l++) {
+            layer.forward(input, output);
+        }
+        return std::chrono::steady_clock::now() - begin;
+    };
+    std::chrono::nanoseconds warm(0);
+    size_t warmRounds = 0;
+    while (warmRounds == 0 || warm < settings.warmup) {
+        warm += round(1);
+        warmRounds++;
+    }
+    double roundNanos = std::max(1.0, double(warm.count()) / warmRounds);
+    size_t layersPerSample = std::max<size_t>(
+        1, static_cast<size_t>(std::ceil(settings.minSample.count() / roundNanos)));
+    std::vector<double> samples;
+    auto begin = std::chrono::steady_clock::now();
+    while (samples.size() < settings.maxRepetitions) {
+        samples.push_back(double(round(layersPerSample).count()) / layersPerSample);
+        if (samples.size() >= settings.minRepetitions &&
+            (summarizeSamples(samples, layersPerSample, settings.targetError).stable ||
+             std::chrono::steady_clock::now() - begin >= settings.maxTime)) {
+            break;
+        }
+    }
+    return summarizeSamples(samples, layersPerSample, settings.targetError);
+}
+
+/**
+ * Verifies the convolution lowerings on every backend, then times every layer
+ * of chain in both layouts: im2col on each backend, and the implicit gemm.
+ * Timed layers add a bias and apply ReLU, as in a network.
+ */
+template<class T>
+void runConvolutions(NamedDynamicMultipliers<T> &backends,
+                     const std::vector<ConvolutionShape> &chain,
+                     const MicrobenchmarkSettings &settings,
+                     bool verifyOnly,
+                     std::vector<RejectedBackend> &rejected)
+{
+    std::vector<DynamicMatrixMultiplier<T> *> passed;
+    for (auto &backend : backends) {
+        VerificationReport report;
+        {
+            MatrixTuningPause<T> pause(*backend.second);
+            report = verifyConvolutionLayers<T>(*backend.second);
+        }
+        if (verifyOnly || !report.passed()) {
+            std::cout << std::left << std::setw(24) << backend.first << std::setw(10)
+                      << matrixTypeName<T>() << std::right
+                      << (report.passed() ? "conv " : "FAILED conv verification: ")
+                      << report.describe() << std::endl;
+        }
+        if (report.passed()) {
+            passed.push_back(backend.second.get());
+        } else {
+            rejected.push_back({backend.first + " (conv)", matrixTypeName<T>(),
+                                report.firstFailure});
+        }
+    }
+    if (verifyOnly || passed.empty()) {
+        return;
+    }
+    std::cout << "Times per layer in ns (then GFLOP/s and reps)" << std::endl;
+    for (const ConvolutionShape &shape : chain) {
+        const std::vector<T> bias = randomBias<T>(shape, 1);
+        for (ConvolutionLayout layout : {CONV_NCHW, CONV_NHWC}) {
+            for (size_t b = 0; b <= backends.size(); b++) {
+                const bool implicit = b == backends.size();
+                if (!implicit && std::find(passed.begin(), passed.end(),
+                                           backends[b].second.get()) == passed.end()) {
+                    continue;
+                }
+                ConvolutionLayer<T> layer(shape,
+                                          layout,
+                                          implicit ? CONV_IMPLICIT_GEMM : CONV_IM2COL,
+                                          implicit ? nullptr : backends[b].second.get());
+                layer.setBias(bias.data());
+                layer.setActivation(EPILOGUE_RELU);
+                MicrobenchmarkStatistics time = timeConvolution(layer, settings);
+                std::cout << std::left << std::setw(24)
+                          << (implicit ? std::string("implicit gemm") : backends[b].first)
+                          << std::setw(10) << matrixTypeName<T>() << std::setw(36)
+                          << shape.describe() << std::setw(6) << convolutionLayoutName(layout)
+                          << std::right << std::fixed << std::setprecision(0) << std::setw(14)
+                          << time.median << std::setprecision(2) << std::setw(10)
+                          << shape.flops() / time.median << std::setw(6) << time.repetitions
+                          << (time.stable ? "" : " unstable") << std::endl;
+            }
+        }
+    }
+}
+
+template<class T>
+void runType(const std::vector<std::string> &backendFilters,
+             const std::vector<MatrixShape> &shapes,
+             const std::vector<ConvolutionShape> &chain,
+             const std::vector<size_t> &threadCounts,
+             const ThreadPlacement &placement,
+             const MicrobenchmarkSettings &settings,
+             bool verifyOnly,
+             std::vector<MicrobenchmarkResult> &results,
+             std::vector<RejectedBackend> &rejected)
+{
+    NamedDynamicMultipliers<T> backends;
+    for (auto &backend : dynamicMultipliers<T>(backendFilters)) {
+        VerificationReport report = verifyBackend<T>(*backend.second);
+        if (verifyOnly || !report.passed()) {
+            std::cout << std::left << std::setw(24) << backend.first << std::setw(10)
+                      << matrixTypeName<T>() << std::right
+                      << (report.passed() ? "" : "FAILED verification: ") << report.describe()
+                      << std::endl;
+        }
+        if (report.passed()) {
+            backends.push_back(std::move(backend));
+        } else {
+            rejected.push_back({backend.first, matrixTypeName<T>(), report.firstFailure});
+        }
+    }
+    if constexpr (IsReducedFloat<T>::value) {
+        for (auto &backend : backends) {
+            for (const MatrixShape &shape : shapes) {
+                std::cout << std::left << std::setw(24) << backend.first << std::setw(10)
+                          << matrixTypeName<T>() << std::setw(14) << shape.describe()
+                          << std::right
+                          << reducedPrecisionError<T>(*backend.second, shape).describe()
+                          << std::endl;
+            }
+        }
+    }
+    if constexpr (std::is_floating_point<T>::value) {
+        for (auto &backend : backends) {
+            auto *strassen =
+                dynamic_cast<DynamicMatrixStrassenMultiplier<T> *>(backend.second.get());
+            for (const MatrixShape &shape : shapes) {
+                if (strassen == nullptr) {
+                    break;
+                }
+                std::cout << std::left << std::setw(24) << backend.first << std::setw(10)
+                          << matrixTypeName<T>() << std::setw(14) << shape.describe()
+                          << std::right << " " << strassenAccuracy<T>(*strassen, shape).describe()
+                          << std::endl;
+            }
+        }
+    }
+    if constexpr (std::is_floating_point<T>::value || std::is_same<T, int>::value) {
+        if (!chain.empty()) {
+            runConvolutions<T>(backends, chain, settings, verifyOnly, rejected);
+        }
+    }
+    if (verifyOnly) {
+        return;
+    }
+    for (const MatrixShape &shape : shapes) {
+        for (size_t threads : threadCounts) {
+            // settings.prepacked adds a prepacked run of every backend.
+            for (size_t run = 0; run < backends.size() * (settings.prepacked ? 2 : 1); run++) {
+                auto &backend = backends[run % backends.size()];
+                MicrobenchmarkSettings runSettings = settings;
+                runSettings.prepacked = run >= backends.size();
+                const std::string name =
+                    backend.first + (runSettings.prepacked ? " prepacked" : "");
+                setExpectedCallers<T>(*backend.second, threads);
+                MicrobenchmarkResult result = runMicrobenchmark<T>(
+                    *backend.second, name, shape, threads, placement, runSettings);
+                std::cout << std::left << std::setw(32) << result.backend << std::setw(10)
+                          << result.type << std::setw(14) << shape.describe() << std::right
+                          << std::setw(4) << threads << std::fixed << std::setprecision(0)
+                          << std::setw(14) << result.time.median << std::setw(14)
+                          << result.time.min << std::setw(12) << result.time.stddev
+                          << std::setprecision(2) << std::setw(10) << result.gflops()
+                          << std::setw(10) << result.gflopsPerThread() << std::setw(6)
+                          << result.time.repetitions << (result.time.stable ? "" : " unstable")
+                          << std::endl;
+                results.push_back(result);
+            }
+        }
+    }
+}
+
+template<class T>
+void tuneType(const std::vector<std::string> &backendFilters,
+              const std::vector<MatrixShape> &shapes,
+              const std::vector<size_t> &threadCounts)
+{
+    MatrixAutotuner<T> tuner(MatrixTuningCache::instance(), backendFilters);
+    for (const MatrixShape &shape : shapes) {
+        for (size_t threads : threadCounts) {
+            std::vector<MatrixTuning> candidates;
+            MatrixTuning best = tuner.retune(shape, threads, &candidates);
+            std::cout << std::left << std::setw(10) << matrixTypeName<T>() << std::setw(14)
+                      << shape.describe() << std::right << std::setw(4) << threads << "  "
+                      << std::left << std::setw(56) << best.describe() << std::right
+                      << std::fixed << std::setprecision(0) << std::setw(12)
+                      << best.medianNanos << " ns  of " << candidates.size() << " candidates"
+                      << std::endl;
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> backendFilters;
+    std::vector<std::string> types = {"float", "double", "int"};
+    std::vector<MatrixShape> shapes = parseMatrixShapes("16,32,64,100,128,256");
+    std::vector<ConvolutionShape> chain;
+    std::vector<size_t> threadCounts = {1};
+    size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    if (cores > 1) {
+        threadCounts.push_back(cores);
+    }
+    std::string placementSpec = "free";
+    std::string jsonPath;
+    std::string csvPath;
+    MicrobenchmarkSettings settings;
+    bool verifyOnly = false;
+    bool tuneOnly = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        size_t equals = arg.find('=');
+        std::string key = arg.substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : arg.substr(equals + 1);
+        if (key == "backends") {
+            backendFilters = parseBackendList(value);
+        } else if (key == "types") {
+            types = splitList(value);
+        } else if (key == "sizes") {
+            shapes = parseMatrixShapes(value);
+        } else if (key == "convs") {
+            chain = parseConvolutionChain(value);
+            if (chain.empty()) {
+                std::cout << "Ignoring malformed convolution chain " << value << std::endl;
+            }
+        } else if (key == "threads") {
+            threadCounts.clear();
+            for (const std::string &count : splitList(value)) {
+                threadCounts.push_back(std::max(1, std::atoi(count.c_str())));
+            }
+        } else if (key == "prepacked") {
+            settings.prepacked = value == "1";
+        } else if (key == "placement") {
+            placementSpec = value;
+        } else if (key == "warmup_ms") {
+            settings.warmup = std::chrono::milliseconds(std::atoi(value.c_str()));
+        } else if (key == "max_ms") {
+            settings.maxTime = std::chrono::milliseconds(std::atoi(value.c_str()));
+        } else if (key == "min_reps") {
+            settings.minRepetitions = std::max(2, std::atoi(value.c_str()));
+        } else if (key == "max_reps") {
+            settings.maxRepetitions = std::max(2, std::atoi(value.c_str()));
+        } else if (key == "target_error") {
+            settings.targetError = std::atof(value.c_str());
+        } else if (key == "json") {
+            jsonPath = value;
+        } else if (key == "csv") {
+            csvPath = value;
+        } else if (key == "mode" && value == "list") {
+            for (const std::string &name : MatrixBackendRegistry<float>::instance().names()) {
+                std::cout << name << std::endl;
+            }
+            return 0;
+        } else if (key == "mode") {
+            verifyOnly = value == "verify";
+            tuneOnly = value == "tune";
+        } else {
+            std::cout << "Ignoring unknown option " << arg << std::endl;
+        }
+    }
+    settings.maxRepetitions = std::max(settings.maxRepetitions, settings.minRepetitions);
+    if (tuneOnly) {
+        std::cout << "Tuning for " << MatrixTuningCache::instance().cpu() << " into "
+                  << MatrixTuningCache::instance().path() << std::endl;
+        for (const std::string &type : types) {
+            if (type == "float") {
+                tuneType<float>(backendFilters, shapes, threadCounts);
+            } else if (type == "double") {
+                tuneType<double>(backendFilters, shapes, threadCounts);
+            } else if (type == "int") {
+                tuneType<int>(backendFilters, shapes, threadCounts);
+            } else if (type == "int8") {
+                tuneType<int8_t>(backendFilters, shapes, threadCounts);
+            } else if (type == "int16") {
+                tuneType<int16_t>(backendFilters, shapes, threadCounts);
+            } else if (type == "half") {
+                tuneType<Half>(backendFilters, shapes, threadCounts);
+            } else if (type == "bfloat16") {
+                tuneType<BFloat16>(backendFilters, shapes, threadCounts);
+            } else {
+                std::cout << "Ignoring unknown type " << type << std::endl;
+            }
+        }
+        return 0;
+    }
+    const ThreadPlacement placement = ThreadPlacement::parse(placementSpec);
+    size_t maxThreads = *std::max_element(threadCounts.begin(), threadCounts.end());
+    if (!verifyOnly) {
+        std::cout << "Thread placement : " << placement.describe(maxThreads) << std::endl;
+        std::cout << "Times per product (per round with several threads) in ns" << std::endl;
+        std::cout << std::left << std::setw(32) << "backend" << std::setw(10) << "type"
+                  << std::setw(14) << "shape" << std::right << std::setw(4) << "thr"
+                  << std::setw(14) << "median" << std::setw(14) << "min" << std::setw(12)
+                  << "stddev" << std::setw(10) << "GFLOP/s" << std::setw(10) << "/thread"
+                  << std::setw(6) << "reps" << std::endl;
+    }
+
+    std::vector<MicrobenchmarkResult> results;
+    std::vector<RejectedBackend> rejected;
+    for (const std::string &type : types) {
+        if (type == "float") {
+            runType<float>(backendFilters,
+                           shapes,
+                           chain,
+                           threadCounts,
+                           placement,
+                           settings,
+                           verifyOnly,
+                           results,
+                           rejected);
+        } else if (type == "double") {
+            runType<double>(backendFilters,
+                            shapes,
+                            chain,
+                            threadCounts,
+                            placement,
+                            settings,
+                            verifyOnly,
+                            results,
+                            rejected);
+        } else if (type == "int") {
+            runType<int>(backendFilters,
+                         shapes,
+                         chain,
+                         threadCounts,
+                         placement,
+                         settings,
+                         verifyOnly,
+                         results,
+                         rejected);
+        } else if (type == "int8") {
+            runType<int8_t>(backendFilters,
+                            shapes,
+                            chain,
+                            threadCounts,
+                            placement,
+                            settings,
+                            verifyOnly,
+                            results,
+                            rejected);
+        } else if (type == "int16") {
+            runType<int16_t>(backendFilters,
+                             shapes,
+                             chain,
+                             threadCounts,
+                             placement,
+                             settings,
+                             verifyOnly,
+                             results,
+                             rejected);
+        } else if (type == "half") {
+            runType<Half>(backendFilters,
+                          shapes,
+                          chain,
+                          threadCounts,
+                          placement,
+                          settings,
+                          verifyOnly,
+                          results,
+                          rejected);
+        } else if (type == "bfloat16") {
+            runType<BFloat16>(backendFilters,
+                              shapes,
+                              chain,
+                              threadCounts,
+                              placement,
+                              settings,
+                              verifyOnly,
+                              results,
+                              rejected);
+        } else {
+            std::cout << "Ignoring unknown type " << type << std::endl;
+        }
+    }
+    if (verifyOnly) {
+        return rejected.empty() ? 0 : 1;
+    }
+
+    if (!jsonPath.empty()) {
+        std::ofstream json(jsonPath);
+        writeMicrobenchmarkJson(json, results, rejected);
+        std::cout << "Wrote " << results.size() << " results to " << jsonPath << std::endl;
+    }
+    if (!csvPath.empty()) {
+        std::ofstream csv(csvPath);
+        writeMicrobenchmarkCsv(csv, results);
+        std::cout << "Wrote " << results.size() << " results to " << csvPath << std::endl;
+    }
+    return 0;
+}
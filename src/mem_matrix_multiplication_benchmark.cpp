@@ -1,4 +1,6 @@
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <random>
 #include <string>
 #include <thread>
@@ -14,20 +16,15 @@
 #include <klepsydra/performance_benchmark/configuration_data.h>
 #include <klepsydra/performance_benchmark/file_admin_statistics_factory.h>
 
-#include <klepsydra/matrix_mult_benchmark/matrix_seq_multiplier.h>
+#include <klepsydra/matrix_mult_benchmark/matrix_arena.h>
+#include <klepsydra/matrix_mult_benchmark/matrix_backends.h>
+#include <klepsydra/matrix_mult_benchmark/matrix_convolution.h>
+#include <klepsydra/matrix_mult_benchmark/matrix_shape_sweep.h>
+#include <klepsydra/matrix_mult_benchmark/matrix_verification.h>
+#include <klepsydra/matrix_mult_benchmark/mm4convkn_stream_assembler.h>
 #include <klepsydra/matrix_mult_benchmark/stream_assembler.h>
-#ifdef openmp_enabled
-#include <klepsydra/matrix_mult_benchmark/matrix_openmp_multiplier.h>
-#endif
-#ifdef blas_enabled
-#include <klepsydra/matrix_mult_benchmark/matrix_blas_multipler.h>
-#endif
-#ifdef eigen_enabled
-#include <klepsydra/matrix_mult_benchmark/matrix_eigen_multiplier.h>
-#endif
-#ifdef ruy_enabled
-#include <klepsydra/matrix_mult_benchmark/matrix_ruy_multiplier.h>
-#endif
+#include <klepsydra/matrix_mult_benchmark/thread_budget.h>
+#include <klepsydra/matrix_mult_benchmark/thread_placement.h>
 
 #include <klepsydra/mem_performance_benchmark/event_emitter_factory.h>
 #include <klepsydra/mem_performance_benchmark/multi_event_loop_factory.h>
@@ -35,106 +32,224 @@
 const int EVENT_LOOP_SIZE(256);
 const int MATRIX_ROWS(100);
 
+std::string getOptionalProperty(kpsr::Environment *environment,
+                                const std::string &key,
+                                const std::string &defaultValue)
+{
+    std::string value = defaultValue;
+    try {
+        environment->getPropertyString(key, value);
+    } catch (...) {
+        value = defaultValue;
+    }
+    return value;
+}
+
+/**
+ * Backends picked by the backends key, e.g. "simd,blas" (names, or substrings
+ * of names, see MatrixBackendRegistry::select), each run in turn under the same
+ * configuration. Without that key the legacy msgToSave number picks one.
+ */
 template<class T>
-void matrixMutiplicationTest(kpsr::Environment *environment,
-                             kpsr::performance_benchmark::ConfigurationData &configurationData,
-                             std::function<T()> randomGenerator)
+std::vector<std::string> selectedBackends(
+    kpsr::Environment *environment,
+    const kpsr::performance_benchmark::ConfigurationData &configurationData)
 {
-    spdlog::set_pattern("[%c] [%H:%M:%S %f] [%n] [%l] [%t] %v");
-    spdlog::set_level(configurationData.toStdOut
-                          ? spdlog::level::debug
-                          : spdlog::level::info); // Set global log level to info
+    const std::vector<std::string> legacyNames = {"normal",
+                                                  "openmp",
+                                                  "blas",
+                                                  "eigen",
+                                                  "ruy",
+                                                  "packed",
+                                                  std::string("simd (") +
+                                                      simdIsaName(activeSimdIsa()) + ")"};
+    std::string legacyName = configurationData.msgToSave >= 0 &&
+                                     configurationData.msgToSave < int(legacyNames.size())
+                                 ? legacyNames[configurationData.msgToSave]
+                                 : std::string("backend ") +
+                                       std::to_string(configurationData.msgToSave);
+    std::string list = getOptionalProperty(environment, "backends", legacyName);
+    std::vector<std::string> backends = MatrixBackendRegistry<T>::instance().select(
+        parseBackendList(list));
+    if (backends.empty()) {
+        std::string available;
+        for (const std::string &name : MatrixBackendRegistry<T>::instance().names()) {
+            available += (available.empty() ? "" : ", ") + name;
+        }
+        spdlog::error("No compiled-in backend matches {}, available: {}", list, available);
+    }
+    return backends;
+}
 
-    if (configurationData.logToFile) {
-        auto kpsrLogger = spdlog::basic_logger_mt("mem_matrix_multiplication_benchmark",
-                                                  configurationData.logFilename);
-        spdlog::set_default_logger(kpsrLogger);
-    } else {
-        auto kpsrLogger = spdlog::stdout_color_mt("mem_matrix_multiplication_benchmark");
-        spdlog::set_default_logger(kpsrLogger);
+/**
+ * dataProcType "shape_sweep": times the selected backends on every shape of the
+ * matrix_shapes key (e.g. "32,64,128x256x64"), splitting testDuration between
+ * them, instead of running the event pipeline.
+ */
+template<class T>
+void shapeSweepTest(kpsr::Environment *environment,
+                    kpsr::performance_benchmark::ConfigurationData &configurationData,
+                    std::function<T()> randomGenerator)
+{
+    std::vector<MatrixShape> shapes = parseMatrixShapes(
+        getOptionalProperty(environment, "matrix_shapes", std::to_string(MATRIX_ROWS)));
+    if (shapes.empty()) {
+        spdlog::error("No valid matrix_shapes");
+        return;
     }
+    std::vector<std::string> backends = selectedBackends<T>(environment, configurationData);
 
-    if (configurationData.dataProcType == "kpsr_event_loop") {
-        kpsr::Threadpool::getCriticalThreadPool(std::thread::hardware_concurrency() * 2 + 2);
-        kpsr::Threadpool::getNonCriticalThreadPool(2);
-    } else {
-        kpsr::Threadpool::getCriticalThreadPool(1);
-        kpsr::Threadpool::getNonCriticalThreadPool(2);
+    std::chrono::microseconds shapeDuration = std::chrono::seconds(configurationData.testDuration);
+    shapeDuration /= shapes.size() * std::max<size_t>(backends.size(), 1);
+    for (const std::string &backend : backends) {
+        std::unique_ptr<DynamicMatrixMultiplier<T>> multiplier =
+            MatrixBackendRegistry<T>::instance().create(backend);
+        VerificationReport verification = verifyBackend<T>(*multiplier);
+        if (!verification.passed()) {
+            spdlog::error("Backend {} FAILED verification, not timed: {}",
+                          backend,
+                          verification.describe());
+            continue;
+        }
+        spdlog::info("Shape sweep of backend {} over {} shapes, verification {}....",
+                     backend,
+                     shapes.size(),
+                     verification.describe());
+        for (const MatrixShape &shape : shapes) {
+            ShapeSweepResult result =
+                timeMatrixShape<T>(*multiplier, shape, 1, shapeDuration, randomGenerator);
+            spdlog::info("{} shape {}: {} products, {} us per product, {} GFLOP/s",
+                         backend,
+                         shape.describe(),
+                         result.iterations,
+                         result.averageMicros,
+                         result.gflops());
+        }
     }
+    spdlog::info("finished....");
+}
 
+/**
+ * Quantized stages (int8 and int16 backends) get C scales that keep their
+ * products in range: the first stage multiplies data factory matrices (values
+ * up to maxInput), the later ones full range outputs of the stage before.
+ */
+template<class T>
+void configureQuantizedStages(
+    const std::vector<MatrixMultiplier<T, MATRIX_ROWS, MATRIX_ROWS, MATRIX_ROWS> *> &stages,
+    double maxInput)
+{
+    if constexpr (VerificationTraits<T>::saturating) {
+        for (size_t stage = 0; stage < stages.size(); stage++) {
+            auto *registered =
+                dynamic_cast<RegisteredMatrixMultiplier<T, MATRIX_ROWS, MATRIX_ROWS, MATRIX_ROWS> *>(
+                    stages[stage]);
+            auto *quantized = registered != nullptr
+                                  ? dynamic_cast<DynamicMatrixQuantizedMultiplier<T> *>(
+                                        &registered->backend())
+                                  : nullptr;
+            if (quantized != nullptr) {
+                double range = stage == 0 ? maxInput : double(std::numeric_limits<T>::max());
+                quantized->setParams(rangeQuantizedParams<T>(MATRIX_ROWS, range, range));
+            }
+        }
+    }
+}
+
+/**
+ * One event pipeline run of testDuration with backend in every stage.
+ */
+template<class T>
+void pipelineTest(kpsr::Environment *environment,
+                  kpsr::performance_benchmark::ConfigurationData &configurationData,
+                  const std::string &backend)
+{
     kpsr::performance_benchmark::FileAdminStatisticsFactory statisticsFactory(environment,
                                                                               configurationData);
     kpsr::Container *container = statisticsFactory.getContainer();
 
     kpsr::performance_benchmark::MultiEventLoopFactory<
         EVENT_LOOP_SIZE,
-        kpsr::matrix_mult_benchmark::Matrix<T, MATRIX_ROWS, MATRIX_ROWS>> *eventLoopFactory = nullptr;
+        kpsr::matrix_mult_benchmark::MatrixHandle<T, MATRIX_ROWS>> *eventLoopFactory = nullptr;
     kpsr::performance_benchmark::EventEmitterFactory<
-        kpsr::matrix_mult_benchmark::Matrix<T, MATRIX_ROWS, MATRIX_ROWS>> *eventEmitterFactory =
+        kpsr::matrix_mult_benchmark::MatrixHandle<T, MATRIX_ROWS>> *eventEmitterFactory =
         nullptr;
 
+    // stage_placement: free, compact, scatter or a CPU list (producer first, then stages).
+    ThreadPlacement stagePlacement = ThreadPlacement::parse(
+        getOptionalProperty(environment, "stage_placement", "free"));
+    spdlog::info("Stage placement: {}", stagePlacement.describe(configurationData.topicCount));
+
+    // matrix_pages: default, transparent or explicit (huge) pages under the
+    // matrix pool and the input ring.
+    PagePolicy matrixPages = PAGES_DEFAULT;
+    if (!parsePagePolicy(getOptionalProperty(environment, "matrix_pages", "default"),
+                         matrixPages)) {
+        spdlog::error("Invalid matrix_pages, expected default, transparent or explicit");
+        return;
+    }
+
+    // Matrices travel between stages as pooled handles, one slot per event in flight.
+    size_t matrixPoolSize = configurationData.eventPoolSize > 0
+                                ? static_cast<size_t>(configurationData.eventPoolSize)
+                                : kpsr::matrix_mult_benchmark::StreamAssembler<T, MATRIX_ROWS>::
+                                      DEFAULT_POOL_SIZE;
+
     spdlog::info("Creating streams....");
     kpsr::matrix_mult_benchmark::StreamAssembler<T, MATRIX_ROWS> *streamAssembler;
-    std::vector<
-        kpsr::matrix_mult_benchmark::MatrixMultiplier<T, MATRIX_ROWS, MATRIX_ROWS, MATRIX_ROWS> *>
-        matrixMultiplier;
+    std::vector<MatrixMultiplier<T, MATRIX_ROWS, MATRIX_ROWS, MATRIX_ROWS> *> matrixMultiplier;
+    // input_ring_size: distinct input matrices generated up front,
+    // input_refill: regenerate released RANDOM inputs in the background.
+    size_t inputRingSize = std::stoul(getOptionalProperty(
+        environment,
+        "input_ring_size",
+        std::to_string(kpsr::matrix_mult_benchmark::MatrixDataFactory<T, MATRIX_ROWS, MATRIX_ROWS>::
+                           DEFAULT_RING_SIZE)));
+    bool inputRefill = getOptionalProperty(environment, "input_refill", "false") == "true";
     kpsr::matrix_mult_benchmark::MatrixDataFactory<T, MATRIX_ROWS, MATRIX_ROWS>
         matrixDataFactory((kpsr::matrix_mult_benchmark::MatrixType) configurationData.payloadSize,
                           10.0,
-                          randomGenerator);
-
-    if (configurationData.msgToSave == 0) {
-        spdlog::info("MatrixSeqMultiplier....");
-        matrixMultiplier.emplace_back(
-            new kpsr::matrix_mult_benchmark::
-                MatrixSeqMultiplier<T, MATRIX_ROWS, MATRIX_ROWS, MATRIX_ROWS>());
-    } else if (configurationData.msgToSave == 1) {
-#ifdef openmp_enabled
-        spdlog::info("MatrixOmpMultiplier....");
-        matrixMultiplier.emplace_back(
-            new kpsr::matrix_mult_benchmark::
-                MatrixOmpMultiplier<T, MATRIX_ROWS, MATRIX_ROWS, MATRIX_ROWS>());
-#else
-        spdlog::error("MatrixOmpMultiplier is disabled");
-        return;
-#endif
-    } else if (configurationData.msgToSave == 2) {
-#ifdef blas_enabled
-        spdlog::info("MatrixBlasMultiplier....");
-        matrixMultiplier.emplace_back(
-            new kpsr::matrix_mult_benchmark::
-                MatrixBlasMultiplier<T, MATRIX_ROWS, MATRIX_ROWS, MATRIX_ROWS>());
-#else
-        spdlog::error("MatrixBlasMultiplier is disabled");
-        return;
-#endif
-    } else if (configurationData.msgToSave == 3) {
-#ifdef eigen_enabled
-        spdlog::info("MatrixTemplatedEigenMultiplier....");
-        matrixMultiplier.emplace_back(
-            new kpsr::matrix_mult_benchmark::
-                MatrixTemplatedEigenMultiplier<T, MATRIX_ROWS, MATRIX_ROWS, MATRIX_ROWS>());
-#else
-        spdlog::error("MatrixTemplatedEigenMultiplier is disabled");
+                          T(0),
+                          T(10),
+                          inputRingSize,
+                          inputRefill,
+                          matrixPages);
+
+    // One multiplier per stage, so no backend instance is shared between threads.
+    std::vector<std::unique_ptr<MatrixMultiplier<T, MATRIX_ROWS, MATRIX_ROWS, MATRIX_ROWS>>>
+        stageMultipliers;
+    for (int i = 0; i < std::max(configurationData.topicCount, 1); i++) {
+        stageMultipliers.push_back(
+            createRegisteredMultiplier<T, MATRIX_ROWS, MATRIX_ROWS, MATRIX_ROWS>(backend));
+        matrixMultiplier.push_back(stageMultipliers.back().get());
+    }
+    // Only a backend matching the reference product gets benchmarked.
+    VerificationReport verification = verifyMultiplier(*matrixMultiplier.front());
+    if (!verification.passed()) {
+        spdlog::error("Backend {} FAILED verification, not benchmarked: {}",
+                      backend,
+                      verification.describe());
         return;
-#endif
-    } else if (configurationData.msgToSave == 4) {
-#ifdef ruy_enabled
-        spdlog::info("MatrixRuyMultiplier.....");
-        for (int i = 0; i < configurationData.topicCount; i++) {
-            matrixMultiplier.emplace_back(
-                new kpsr::matrix_mult_benchmark::
-                    MatrixRuyMultiplier<T, MATRIX_ROWS, MATRIX_ROWS, MATRIX_ROWS>());
+    }
+    spdlog::info("Verification {}", verification.describe());
+    configureQuantizedStages<T>(matrixMultiplier, 10.0);
+    if constexpr (IsReducedFloat<T>::value) {
+        // What 16-bit storage costs each stage, to weigh against its bandwidth saving.
+        auto *registered =
+            dynamic_cast<RegisteredMatrixMultiplier<T, MATRIX_ROWS, MATRIX_ROWS, MATRIX_ROWS> *>(
+                matrixMultiplier.front());
+        if (registered != nullptr) {
+            spdlog::info("Per stage {}",
+                         reducedPrecisionError<T>(registered->backend(),
+                                                  {MATRIX_ROWS, MATRIX_ROWS, MATRIX_ROWS})
+                             .describe());
         }
-#else
-        spdlog::error("MatrixRuyMultiplier is disabled");
-        return;
-#endif
     }
+
     if (configurationData.dataProcType == "kpsr_event_loop") {
         eventLoopFactory = new kpsr::performance_benchmark::MultiEventLoopFactory<
             EVENT_LOOP_SIZE,
-            kpsr::matrix_mult_benchmark::Matrix<T, MATRIX_ROWS, MATRIX_ROWS>>(
+            kpsr::matrix_mult_benchmark::MatrixHandle<T, MATRIX_ROWS>>(
             configurationData.topicCount,
             configurationData.eventPoolSize,
             configurationData.topicPrefix,
@@ -149,11 +264,44 @@ void matrixMutiplicationTest(kpsr::Environment *environment,
             matrixMultiplier,
             &matrixDataFactory,
             configurationData.toStdOut,
-            false);
+            kpsr::matrix_mult_benchmark::STREAM_PIPELINED,
+            stagePlacement,
+            matrixPoolSize,
+            kpsr::matrix_mult_benchmark::PipelineLimits(),
+            matrixPages);
     } else {
-        bool sequential = (configurationData.dataProcType != "kpsr_event_emitter");
+        // kpsr_event_emitter pipelines the stages, kpsr_bounded_pipeline runs them
+        // on their own threads behind bounded queues, kpsr_fused_chain runs the
+        // whole chain in cache on one thread, anything else runs it sequentially.
+        kpsr::matrix_mult_benchmark::StreamMode mode =
+            configurationData.dataProcType == "kpsr_event_emitter"
+                ? kpsr::matrix_mult_benchmark::STREAM_PIPELINED
+            : configurationData.dataProcType == "kpsr_bounded_pipeline"
+                ? kpsr::matrix_mult_benchmark::STREAM_BOUNDED_PIPELINE
+            : configurationData.dataProcType == "kpsr_fused_chain"
+                ? kpsr::matrix_mult_benchmark::STREAM_FUSED_CHAIN
+                : kpsr::matrix_mult_benchmark::STREAM_SEQUENTIAL;
+        // pipeline_queue_capacity: matrices waiting in front of each stage,
+        // pipeline_in_flight: matrices in the pipeline (0: one per stage),
+        // pipeline_backpressure: block, drop_oldest or skip_tick.
+        kpsr::matrix_mult_benchmark::PipelineLimits pipelineLimits;
+        pipelineLimits.queueCapacity = std::stoul(
+            getOptionalProperty(environment,
+                                "pipeline_queue_capacity",
+                                std::to_string(pipelineLimits.queueCapacity)));
+        pipelineLimits.maxInFlight = std::stoul(
+            getOptionalProperty(environment, "pipeline_in_flight", "0"));
+        pipelineLimits.backpressure = kpsr::matrix_mult_benchmark::parseBackpressureMode(
+            getOptionalProperty(environment, "pipeline_backpressure", "block"));
+        if (mode == kpsr::matrix_mult_benchmark::STREAM_BOUNDED_PIPELINE) {
+            spdlog::info("Bounded pipeline: queue capacity {}, {} in flight, {} backpressure",
+                         pipelineLimits.queueCapacity,
+                         pipelineLimits.maxInFlight,
+                         kpsr::matrix_mult_benchmark::backpressureModeName(
+                             pipelineLimits.backpressure));
+        }
         eventEmitterFactory = new kpsr::performance_benchmark::EventEmitterFactory<
-            kpsr::matrix_mult_benchmark::Matrix<T, MATRIX_ROWS, MATRIX_ROWS>>(
+            kpsr::matrix_mult_benchmark::MatrixHandle<T, MATRIX_ROWS>>(
             configurationData.topicCount,
             configurationData.eventPoolSize,
             configurationData.topicPrefix,
@@ -168,8 +316,22 @@ void matrixMutiplicationTest(kpsr::Environment *environment,
             matrixMultiplier,
             &matrixDataFactory,
             configurationData.toStdOut,
-            sequential);
+            mode,
+            stagePlacement,
+            matrixPoolSize,
+            pipelineLimits,
+            matrixPages);
+        if (mode == kpsr::matrix_mult_benchmark::STREAM_FUSED_CHAIN) {
+            // chain_power: compute input^p by squaring instead of the squaring chain.
+            unsigned chainPower = std::stoul(getOptionalProperty(environment, "chain_power", "0"));
+            streamAssembler->fusedChain()->setPower(chainPower);
+            if (chainPower > 0) {
+                spdlog::info("Fused chain computes input^{} by squaring", chainPower);
+            }
+        }
     }
+    // The stages are registered with the budget, which has sized their products.
+    spdlog::info("Thread budget: {}", ThreadBudget::instance().describe());
 
     spdlog::info("starting....");
     std::this_thread::sleep_for(std::chrono::milliseconds(configurationData.testDelayInMs));
@@ -184,6 +346,7 @@ void matrixMutiplicationTest(kpsr::Environment *environment,
 
     std::this_thread::sleep_for(std::chrono::milliseconds(configurationData.testDelayInMs));
 
+    PageFaults faultsBefore = PageFaults::process();
     streamAssembler->start();
 
     spdlog::info("running....");
@@ -191,11 +354,55 @@ void matrixMutiplicationTest(kpsr::Environment *environment,
 
     spdlog::info("stopping....");
     streamAssembler->stop();
+    PageFaults faults = PageFaults::process() - faultsBefore;
 
     statisticsFactory.stop();
 
-    spdlog::info("Total processed matrices: {}", streamAssembler->totalProcessedMatrices);
-    spdlog::info("Total processing time: {}", streamAssembler->totalProcessingTime);
+    spdlog::info("Total processed matrices: {}", streamAssembler->totalProcessedMatrices.load());
+    spdlog::info("Total processing time: {}", streamAssembler->totalProcessingTime.load());
+    spdlog::info("End to end latency: {}", streamAssembler->endToEndLatency().describe());
+    for (size_t stage = 0; stage < streamAssembler->stageLatency().size(); stage++) {
+        spdlog::info("Stage {} latency: {}",
+                     stage + 1,
+                     streamAssembler->stageLatency()[stage].describe());
+    }
+    spdlog::info("Placement: {}", streamAssembler->placementReport());
+    if (streamAssembler->fusedChain() != nullptr) {
+        spdlog::info("Fused chain ran {} multiplications",
+                     streamAssembler->fusedChain()->multiplications());
+    }
+    if (streamAssembler->pipelineScheduler() != nullptr) {
+        auto scheduler = streamAssembler->pipelineScheduler();
+        spdlog::info("Pipeline: {} admitted, {} completed, {} dropped, {} skipped ticks, "
+                     "peak {} of {} in flight",
+                     scheduler->admitted(),
+                     scheduler->completed(),
+                     scheduler->dropped(),
+                     scheduler->skipped(),
+                     scheduler->peakInFlight(),
+                     scheduler->limits().maxInFlight);
+        auto occupancy = scheduler->occupancy();
+        for (size_t stage = 0; stage < occupancy.size(); stage++) {
+            spdlog::info("Stage {} queue: {} arrivals, mean depth {:.2f}, max {} of {}, "
+                         "{} arrivals found it full",
+                         stage + 1,
+                         occupancy[stage].arrivals,
+                         occupancy[stage].meanDepth,
+                         occupancy[stage].maxDepth,
+                         occupancy[stage].capacity,
+                         occupancy[stage].stalls);
+        }
+    }
+    spdlog::info("Input ring: {} matrices, {} misses, {} background refills",
+                 matrixDataFactory.ringSize(),
+                 matrixDataFactory.misses(),
+                 matrixDataFactory.refills());
+    spdlog::info("Matrix pool: {} slots, {} heap fallbacks",
+                 streamAssembler->pool().size(),
+                 streamAssembler->pool().fallbacks());
+    spdlog::info("Matrix pool arena: {}", streamAssembler->pool().arena().describe());
+    spdlog::info("Input ring arena: {}", matrixDataFactory.arena().describe());
+    spdlog::info("Page faults while running: {} minor, {} major", faults.minor, faults.major);
 
     if (eventLoopFactory != nullptr) {
         eventLoopFactory->stop();
@@ -209,17 +416,173 @@ void matrixMutiplicationTest(kpsr::Environment *environment,
     if (eventEmitterFactory) {
         delete eventEmitterFactory;
     }
+}
+
+/**
+ * dataProcType "conv_chain": runs the convolution chain of the conv_chain key
+ * (input CxHxW, then filters:kernel:stride:padding per layer, e.g.
+ * "3x64x64,16:3:1:1,32:3:2:1") for testDuration, one event per image, in the
+ * conv_layout (nchw or nhwc) and conv_lowering (im2col on backend, or
+ * implicit) of the configuration. Every layer adds a bias and applies the
+ * conv_activation (none, relu, relu6) fused into its product. Float, double
+ * and int only.
+ */
+template<class T>
+void convChainTest(kpsr::Environment *environment,
+                   kpsr::performance_benchmark::ConfigurationData &configurationData,
+                   const std::string &backend)
+{
+    using kpsr::matrix_mult_benchmark::ActivationHandle;
+    using kpsr::matrix_mult_benchmark::MM4ConvKnStreamAssembler;
+    std::string chainSpec =
+        getOptionalProperty(environment, "conv_chain", "3x64x64,16:3:1:1,32:3:2:1,64:3:2:1");
+    std::vector<ConvolutionShape> chain = parseConvolutionChain(chainSpec);
+    ConvolutionLayout layout;
+    ConvolutionLowering lowering;
+    EpilogueActivation activation;
+    if (chain.empty() ||
+        !parseConvolutionLayout(getOptionalProperty(environment, "conv_layout", "nchw"),
+                                layout) ||
+        !parseConvolutionLowering(getOptionalProperty(environment, "conv_lowering", "im2col"),
+                                  lowering) ||
+        !parseEpilogueActivation(getOptionalProperty(environment, "conv_activation", "relu"),
+                                 activation)) {
+        spdlog::error("Invalid conv_chain {}, conv_layout, conv_lowering or conv_activation",
+                      chainSpec);
+        return;
+    }
+    std::unique_ptr<DynamicMatrixMultiplier<T>> multiplier =
+        MatrixBackendRegistry<T>::instance().create(backend);
+    VerificationReport verification;
+    {
+        MatrixTuningPause<T> pause(*multiplier);
+        verification = verifyConvolutionLayers<T>(*multiplier);
+    }
+    if (!verification.passed()) {
+        spdlog::error("Backend {} FAILED convolution verification, not benchmarked: {}",
+                      backend,
+                      verification.describe());
+        return;
+    }
+    spdlog::info("Convolution verification {}", verification.describe());
+
+    kpsr::performance_benchmark::FileAdminStatisticsFactory statisticsFactory(environment,
+                                                                              configurationData);
+    kpsr::performance_benchmark::EventEmitterFactory<ActivationHandle<T>> eventEmitterFactory(
+        int(chain.size()) + 1,
+        configurationData.eventPoolSize,
+        configurationData.topicPrefix,
+        statisticsFactory.getContainer());
+    size_t poolSize = configurationData.eventPoolSize > 0
+                          ? static_cast<size_t>(configurationData.eventPoolSize)
+                          : MM4ConvKnStreamAssembler<T>::DEFAULT_POOL_SIZE;
+    MM4ConvKnStreamAssembler<T> streamAssembler(configurationData.topicPrefix,
+                                                configurationData.publishingRate,
+                                                &eventEmitterFactory,
+                                                &eventEmitterFactory,
+                                                &eventEmitterFactory,
+                                                layout,
+                                                poolSize);
+    // One multiplier per layer, so no backend instance is shared between threads.
+    std::vector<std::unique_ptr<DynamicMatrixMultiplier<T>>> layerMultipliers;
+    std::vector<std::shared_ptr<kpsr::matrix_mult_benchmark::ConvolutionLayerTransformForwarder<T>>>
+        layers;
+    double flops = 0;
+    for (const ConvolutionShape &shape : chain) {
+        layerMultipliers.push_back(MatrixBackendRegistry<T>::instance().create(backend));
+        layers.push_back(
+            streamAssembler.addConvLayer(
+                shape, lowering, layerMultipliers.back().get(), activation));
+        flops += shape.flops();
+        spdlog::info("Layer {}: {}, {} {}, bias and {}, GEMM {}",
+                     layers.size(),
+                     shape.describe(),
+                     convolutionLayoutName(layout),
+                     convolutionLoweringName(lowering),
+                     epilogueActivationName(activation),
+                     shape.gemmShape(layout).describe());
+    }
+    spdlog::info("Thread budget: {}", ThreadBudget::instance().describe());
+
+    spdlog::info("starting....");
+    statisticsFactory.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(configurationData.testDelayInMs));
+    streamAssembler.start();
+
+    spdlog::info("running....");
+    std::this_thread::sleep_for(std::chrono::seconds(configurationData.testDuration));
+
+    spdlog::info("stopping....");
+    streamAssembler.stop();
+    statisticsFactory.stop();
+
+    spdlog::info("Total processed images: {}", streamAssembler.totalProcessedMatrices.load());
+    spdlog::info("End to end latency: {}", streamAssembler.endToEndLatency().describe());
+    for (size_t layer = 0; layer < streamAssembler.layerLatency().size(); layer++) {
+        const auto &latency = streamAssembler.layerLatency()[layer];
+        spdlog::info("Layer {} latency: {}, {} GFLOP/s at the median",
+                     layer + 1,
+                     latency.describe(),
+                     latency.p50 > 0 ? chain[layer].flops() / latency.p50 : 0.0);
+    }
+    spdlog::info("Chain: {} GFLOP per image, {} activation pool heap fallbacks",
+                 flops * 1e-9,
+                 streamAssembler.poolFallbacks());
+}
+
+template<class T>
+void matrixMutiplicationTest(kpsr::Environment *environment,
+                             kpsr::performance_benchmark::ConfigurationData &configurationData,
+                             std::function<T()> randomGenerator)
+{
+    spdlog::set_pattern("[%c] [%H:%M:%S %f] [%n] [%l] [%t] %v");
+    spdlog::set_level(configurationData.toStdOut
+                          ? spdlog::level::debug
+                          : spdlog::level::info); // Set global log level to info
+
+    if (configurationData.logToFile) {
+        auto kpsrLogger = spdlog::basic_logger_mt("mem_matrix_multiplication_benchmark",
+                                                  configurationData.logFilename);
+        spdlog::set_default_logger(kpsrLogger);
+    } else {
+        auto kpsrLogger = spdlog::stdout_color_mt("mem_matrix_multiplication_benchmark");
+        spdlog::set_default_logger(kpsrLogger);
+    }
 
-#ifdef eigen_enabled
-    if (configurationData.msgToSave == 3) {
-        spdlog::info(
-            "MatrixTemplatedEigenMultiplier performed {} multiplications",
-            static_cast<kpsr::matrix_mult_benchmark::
-                            MatrixTemplatedEigenMultiplier<T, MATRIX_ROWS, MATRIX_ROWS, MATRIX_ROWS>
-                                *>(matrixMultiplier[0])
-                ->numberOfMultiplications);
+    if (configurationData.dataProcType == "shape_sweep") {
+        shapeSweepTest<T>(environment, configurationData, randomGenerator);
+        return;
+    }
+
+    if (configurationData.dataProcType == "conv_chain") {
+        if constexpr (std::is_floating_point<T>::value || std::is_same<T, int>::value) {
+            kpsr::Threadpool::getCriticalThreadPool(1);
+            kpsr::Threadpool::getNonCriticalThreadPool(2);
+            for (const std::string &backend : selectedBackends<T>(environment, configurationData)) {
+                spdlog::info("Backend {}....", backend);
+                convChainTest<T>(environment, configurationData, backend);
+            }
+        } else {
+            spdlog::error("conv_chain runs on float, double and integer data only");
+        }
+        spdlog::info("finished....");
+        return;
+    }
+
+    if (configurationData.dataProcType == "kpsr_event_loop") {
+        // One thread per event loop plus two; the cores themselves are shared
+        // out by ThreadBudget, not by the size of this pool.
+        kpsr::Threadpool::getCriticalThreadPool(std::max(configurationData.topicCount, 1) + 2);
+        kpsr::Threadpool::getNonCriticalThreadPool(2);
+    } else {
+        kpsr::Threadpool::getCriticalThreadPool(1);
+        kpsr::Threadpool::getNonCriticalThreadPool(2);
+    }
+
+    for (const std::string &backend : selectedBackends<T>(environment, configurationData)) {
+        spdlog::info("Backend {}....", backend);
+        pipelineTest<T>(environment, configurationData, backend);
     }
-#endif
     spdlog::info("finished....");
 }
 
@@ -253,4 +616,42 @@ int main(int argc, char **argv)
         matrixMutiplicationTest<int>(&environment, configurationData, [&]() { return dist(gen); });
         return 0;
     }
+    // 16-bit storage with float accumulation, see DynamicMatrixWidenedMultiplier.
+    if (configurationData.jsonDir == "half") {
+        std::random_device rd;
+        std::mt19937 gen(rd());
+        std::uniform_real_distribution<float> dist(0.0, 10.0);
+        matrixMutiplicationTest<Half>(&environment, configurationData, [&]() {
+            return Half(dist(gen));
+        });
+        return 0;
+    }
+    if (configurationData.jsonDir == "bfloat16") {
+        std::random_device rd;
+        std::mt19937 gen(rd());
+        std::uniform_real_distribution<float> dist(0.0, 10.0);
+        matrixMutiplicationTest<BFloat16>(&environment, configurationData, [&]() {
+            return BFloat16(dist(gen));
+        });
+        return 0;
+    }
+    // Quantized products with int32 accumulation, see DynamicMatrixQuantizedMultiplier.
+    if (configurationData.jsonDir == "int8") {
+        std::random_device rd;
+        std::mt19937 gen(rd());
+        std::uniform_int_distribution<> dist(0, 10);
+        matrixMutiplicationTest<int8_t>(&environment, configurationData, [&]() {
+            return int8_t(dist(gen));
+        });
+        return 0;
+    }
+    if (configurationData.jsonDir == "int16") {
+        std::random_device rd;
+        std::mt19937 gen(rd());
+        std::uniform_int_distribution<> dist(0, 10);
+        matrixMutiplicationTest<int16_t>(&environment, configurationData, [&]() {
+            return int16_t(dist(gen));
+        });
+        return 0;
+    }
 }
@@ -11,15 +11,16 @@
 #include <iostream>
 
 #include "matrix.h"
+#include "matrix_arena.h"
+#include "matrix_backends.h"
 #include "matrix_multiplier.h"
-#include "matrix_seq_multiplier.h"
-#include "matrix_openmp_multiplier.h"
-#include "matrix_eigen_multiplier.h"
+#include "matrix_shape_sweep.h"
+#include "matrix_verification.h"
+#include "perf_counters.h"
+#include "thread_placement.h"
 
 constexpr int MATRIX_ROWS = 100;
 
-using T = float;
-
 template <class TimeUnit>
 class TimingInfos {
 public:
@@ -37,52 +38,130 @@ public:
     typename TimeUnit::rep timeDiff;
 };
 
-int main() {
+constexpr int NUM_CORES = 4;
 
+// Operand values: [-1, 1] for floating point types, [-8, 8] for integers.
+template<class T>
+std::function<T()> operandGenerator(std::mt19937 &rng) {
+    if constexpr (std::is_integral<T>::value) {
+        return std::bind(std::uniform_int_distribution<int>(-8, 8), std::ref(rng));
+    } else if constexpr (IsReducedFloat<T>::value) {
+        return std::bind(std::uniform_real_distribution<float>(-1, 1), std::ref(rng));
+    } else {
+        return std::bind(std::uniform_real_distribution<T>(-1, 1), std::ref(rng));
+    }
+}
+
+template<class T>
+void runTests(const ThreadPlacement &placement,
+              const std::vector<std::string> &backendFilters,
+              const std::string &shapesSpec,
+              size_t sweepIterations,
+              PagePolicy pages,
+              bool countersAvailable) {
     using Mat = Matrix<T, MATRIX_ROWS, MATRIX_ROWS>;
     using MatMul = MatrixMultiplier<T, MATRIX_ROWS, MATRIX_ROWS, MATRIX_ROWS>;
+    using RegisteredMatMul = RegisteredMatrixMultiplier<T, MATRIX_ROWS, MATRIX_ROWS, MATRIX_ROWS>;
     std::unique_ptr<MatMul> matrixMultiplier;
-    
-    constexpr int numCores = 4;
+
+    constexpr int numCores = NUM_CORES;
     constexpr int numIterations = 20;
     using TimeUnit = std::chrono::milliseconds;
     using TimingType = TimingInfos<TimeUnit>;
 
-    auto runBenchmarks = [numCores, numIterations](MatMul *matrixMultiplier) {
-        // fill input matrices
-        std::vector<Mat>  inputMatrices;
-        std::vector<Mat>  outputMatrices;
+    if (!shapesSpec.empty()) {
+        std::vector<MatrixShape> shapes = parseMatrixShapes(shapesSpec);
+        // Only backends matching the reference product get timed.
+        NamedDynamicMultipliers<T> backends;
+        for (auto &backend : dynamicMultipliers<T>(backendFilters)) {
+            VerificationReport report = verifyBackend<T>(*backend.second);
+            if (report.passed()) {
+                backends.push_back(std::move(backend));
+            } else {
+                std::cout << backend.first << " FAILED verification, not timed : " << report.describe() << std::endl;
+            }
+        }
+
+        std::random_device random_device;
+        auto rng = std::mt19937(random_device());
+        std::function<T()> generator = operandGenerator<T>(rng);
+
+        placement.pinCurrentThread(0);
+        PerfCounters sweepCounters;
+        std::cout << "Shape sweep over " << shapes.size() << " shapes, at least " << sweepIterations << " products each " << std::endl;
+        for (const MatrixShape &shape : shapes) {
+            for (auto &backend : backends) {
+                ShapeSweepResult result = timeMatrixShape<T>(
+                    *backend.second, shape, sweepIterations, std::chrono::milliseconds(200), generator,
+                    countersAvailable ? &sweepCounters : nullptr);
+                std::cout << "Shape " << shape.describe() << " " << backend.first << " : "
+                          << result.averageMicros << " us " << result.gflops() << " GFLOP/s" << std::endl;
+                if (countersAvailable) {
+                    std::cout << "    " << result.iterations << " products : " << result.counters.describe() << std::endl;
+                }
+            }
+        }
+        return;
+    }
+
+    auto runBenchmarks = [numCores, numIterations, &placement, pages, countersAvailable](MatMul *matrixMultiplier) {
+        VerificationReport report = verifyMultiplier(*matrixMultiplier);
+        if (!report.passed()) {
+            std::cout << "FAILED verification, not timed : " << report.describe() << std::endl;
+            return;
+        }
+        std::cout << "Verification " << report.describe() << std::endl;
+
+        // fill input matrices, allocated on the pages asked for
+        MatrixArena arena(pages, 2 * numCores * sizeof(Mat));
+        Mat *inputMatrices = arena.create<Mat>(numCores);
+        Mat *outputMatrices = arena.create<Mat>(numCores);
 
     
         std::random_device random_device;
         auto rng = std::mt19937(random_device());
-        auto f32rng = std::bind(std::uniform_real_distribution<float>(-1.0f, +1.0f), std::ref(rng));
+        std::function<T()> valueRng = operandGenerator<T>(rng);
 
         for (int i = 0; i < numCores; i++) {
-            inputMatrices.push_back(Mat(i));
-            outputMatrices.push_back(Mat(i));
-            auto &mat = inputMatrices.back();
-            std::generate(&mat.data[0][0], &mat.data[MATRIX_ROWS-1][MATRIX_ROWS-1], std::ref(f32rng));
+            inputMatrices[i] = Mat(i);
+            outputMatrices[i] = Mat(i);
+            auto &mat = inputMatrices[i];
+            for (int row = 0; row < MATRIX_ROWS; row++) {
+                std::generate(mat.data[row], mat.data[row] + MATRIX_ROWS, std::ref(valueRng));
+            }
         }
+        std::cout << "Matrix pages : " << arena.describe() << std::endl;
 
-        std::vector<TimingType> timings(inputMatrices.size());
-        auto matMulFunction = [&inputMatrices, &outputMatrices, &timings, numIterations](int i, MatMul *matrixMultiplier) {
+        std::vector<TimingType> timings(numCores);
+        std::vector<PerfCounterValues> threadCounters(numCores);
+        auto matMulFunction = [inputMatrices, outputMatrices, &timings, &threadCounters, &placement, numIterations](int i, MatMul *matrixMultiplier) {
+            placement.pinCurrentThread(i);
+            PerfCounters counters;
+            counters.start();
             for (int k = 0; k < numIterations; k++) {
                 timings[i].start();
                 matrixMultiplier->multiply(inputMatrices[i], inputMatrices[i], outputMatrices[i]);
                 timings[i].stop();
             }
+            counters.stop();
+            threadCounters[i] = counters.totals();
         };
 
         TimingType singleTime;
-        auto singleCall = [&inputMatrices, &outputMatrices, &singleTime, numIterations](MatMul *matrixMultiplier){
+        PerfCounterValues singleCounters;
+        auto singleCall = [inputMatrices, outputMatrices, &singleTime, &singleCounters, &placement, numCores, numIterations](MatMul *matrixMultiplier){
+            placement.pinCurrentThread(0);
+            PerfCounters counters;
+            counters.start();
             singleTime.start();
             for (int k = 0; k < numIterations; k++) {
-                for (int i = 0; i < inputMatrices.size(); i++) {
+                for (int i = 0; i < numCores; i++) {
                     matrixMultiplier->multiply(inputMatrices[i], inputMatrices[i], outputMatrices[i]);
                 }
             }
             singleTime.stop();
+            counters.stop();
+            singleCounters = counters.totals();
         };
         std::vector<std::thread> parallelThreads;
         TimingType threadedTime;
@@ -97,34 +176,120 @@ int main() {
         threadedTime.stop();
 
         singleCall(matrixMultiplier);
+
+        TimingType batchTime;
+        PerfCounters batchCounters;
+        batchCounters.start();
+        batchTime.start();
+        for (int k = 0; k < numIterations; k++) {
+            matrixMultiplier->multiplyBatch(inputMatrices, inputMatrices, outputMatrices, numCores);
+        }
+        batchTime.stop();
+        batchCounters.stop();
+
         decltype(TimingType::timeDiff) separateThreadTimes = 0;
+        PerfCounterValues separateThreadCounters;
         std::cout << "Running each layers for " << numIterations << " iterations " << std::endl;
         for (size_t  i = 0; i < numCores; i++) {
             separateThreadTimes += timings[i].timeDiff;
+            separateThreadCounters += threadCounters[i];
             // std::cout << "Matrix mult " << i << " executed in " << timings[i].timeDiff << " us " << std::endl;
         }
 
         std::cout << "Separate thread timings : " << separateThreadTimes << std::endl;
+        if (countersAvailable) {
+            std::cout << "    counters (sum over threads) : " << separateThreadCounters.describe() << std::endl;
+        }
         std::cout << "Separate thread  total time : " << threadedTime.timeDiff << std::endl;
         std::cout <<"Sequential Thread timings : " << singleTime.timeDiff << std::endl;
+        if (countersAvailable) {
+            std::cout << "    counters : " << singleCounters.describe() << std::endl;
+        }
+        std::cout << "Batched timings : " << batchTime.timeDiff << std::endl;
+        if (countersAvailable) {
+            std::cout << "    counters : " << batchCounters.totals().describe() << std::endl;
+        }
     };
 
-    matrixMultiplier.reset(nullptr);
-#ifdef openmp_enabled
-    matrixMultiplier.reset(nullptr);
-    std::cout << "Tests run with openmp_enabled " << std::endl;
-    matrixMultiplier = std::make_unique<MatrixOmpMultiplier<T, MATRIX_ROWS, MATRIX_ROWS, MATRIX_ROWS>>();
-    runBenchmarks(matrixMultiplier.get());
-#endif
-#if eigen_enabled
-    matrixMultiplier.reset(nullptr);
-    std::cout << "Tests run with eigen_enabled " << std::endl;
-    matrixMultiplier = std::make_unique<MatrixTemplatedEigenMultiplier<T, MATRIX_ROWS, MATRIX_ROWS, MATRIX_ROWS>>();
-    runBenchmarks(matrixMultiplier.get());    
-#endif
-    std::cout << "Tests run with normal mode " << std::endl;
-    matrixMultiplier.reset(nullptr);
-    matrixMultiplier = std::make_unique<MatrixSeqMultiplier<T, MATRIX_ROWS, MATRIX_ROWS, MATRIX_ROWS>>();
-    runBenchmarks(matrixMultiplier.get());    
+    for (const std::string &name : MatrixBackendRegistry<T>::instance().select(backendFilters)) {
+        std::cout << "Tests run with " << name << std::endl;
+        matrixMultiplier = createRegisteredMultiplier<T, MATRIX_ROWS, MATRIX_ROWS, MATRIX_ROWS>(name);
+        // The threaded run multiplies on numCores threads at once.
+        auto &registered = static_cast<RegisteredMatMul &>(*matrixMultiplier);
+        setExpectedCallers<T>(registered.backend(), numCores);
+        runBenchmarks(matrixMultiplier.get());
+    }
+}
+
+int main(int argc, char **argv) {
 
+    // Arguments: an optional placement (free, compact, scatter or an explicit
+    // CPU list), then key=value options:
+    //   backends=simd,packed     backends to run (see MatrixBackendRegistry::select)
+    //   shapes=32,64,128x256x64  run the shape sweep instead (MxNxK or square size)
+    //   iterations=N             minimum products per shape in the sweep
+    //   type=float               element type: float, double, int, int8 and
+    //                            int16 (quantized backends), half and bfloat16
+    //                            (widened backends)
+    //   pages=transparent        pages under the timed matrices: default,
+    //                            transparent or explicit huge pages
+    std::string placementSpec = "free";
+    std::string type = "float";
+    std::vector<std::string> backendFilters;
+    std::string shapesSpec;
+    size_t sweepIterations = 3;
+    PagePolicy pages = PAGES_DEFAULT;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        size_t equals = arg.find('=');
+        if (equals == std::string::npos) {
+            placementSpec = arg;
+        } else if (arg.substr(0, equals) == "backends") {
+            backendFilters = parseBackendList(arg.substr(equals + 1));
+        } else if (arg.substr(0, equals) == "shapes") {
+            shapesSpec = arg.substr(equals + 1);
+        } else if (arg.substr(0, equals) == "type") {
+            type = arg.substr(equals + 1);
+        } else if (arg.substr(0, equals) == "iterations") {
+            sweepIterations = std::max(1, std::atoi(arg.c_str() + equals + 1));
+        } else if (arg.substr(0, equals) == "pages") {
+            if (!parsePagePolicy(arg.substr(equals + 1), pages)) {
+                std::cout << "Unknown pages " << arg.substr(equals + 1) << std::endl;
+                return 1;
+            }
+        } else {
+            std::cout << "Ignoring unknown option " << arg << std::endl;
+        }
+    }
+    const ThreadPlacement placement = ThreadPlacement::parse(placementSpec);
+    std::cout << "Thread placement : " << placement.describe(NUM_CORES) << std::endl;
+
+    // Counters are opened per measuring thread and only printed when at least one opens.
+    PerfCounters counterProbe;
+    const bool countersAvailable = counterProbe.available();
+    if (countersAvailable) {
+        std::cout << "Hardware counters : " << counterProbe.describe() << std::endl;
+    } else {
+        std::cout << "Hardware counters : unavailable, " << PerfCounters::unavailableReason() << std::endl;
+    }
+
+    if (type == "float") {
+        runTests<float>(placement, backendFilters, shapesSpec, sweepIterations, pages, countersAvailable);
+    } else if (type == "double") {
+        runTests<double>(placement, backendFilters, shapesSpec, sweepIterations, pages, countersAvailable);
+    } else if (type == "int") {
+        runTests<int>(placement, backendFilters, shapesSpec, sweepIterations, pages, countersAvailable);
+    } else if (type == "int8") {
+        runTests<int8_t>(placement, backendFilters, shapesSpec, sweepIterations, pages, countersAvailable);
+    } else if (type == "int16") {
+        runTests<int16_t>(placement, backendFilters, shapesSpec, sweepIterations, pages, countersAvailable);
+    } else if (type == "half") {
+        runTests<Half>(placement, backendFilters, shapesSpec, sweepIterations, pages, countersAvailable);
+    } else if (type == "bfloat16") {
+        runTests<BFloat16>(placement, backendFilters, shapesSpec, sweepIterations, pages, countersAvailable);
+    } else {
+        std::cout << "Unknown type " << type << std::endl;
+        return 1;
+    }
+    return 0;
 }